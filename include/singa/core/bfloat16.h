@@ -0,0 +1,69 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+#ifndef SINGA_CORE_BFLOAT16_H_
+#define SINGA_CORE_BFLOAT16_H_
+
+#include <cstdint>
+#include <cstring>
+
+namespace singa {
+
+/// The brain floating point format, i.e., the 16 high bits of a float32: 1
+/// sign bit, 8 exponent bits and 7 mantissa bits. It has the range of
+/// float32 with less precision. There is no bfloat16 arithmetic; values are
+/// converted to float for computation, and float values are rounded to the
+/// nearest even bfloat16.
+class bfloat16 {
+ public:
+  bfloat16() = default;
+  bfloat16(float x) : bits_(FromFloat(x)) {}
+  operator float() const { return ToFloat(bits_); }
+
+  /// the raw bits of the value
+  uint16_t bits() const { return bits_; }
+  static bfloat16 FromBits(uint16_t bits) {
+    bfloat16 x;
+    x.bits_ = bits;
+    return x;
+  }
+
+  static uint16_t FromFloat(float x) {
+    uint32_t u;
+    memcpy(&u, &x, sizeof(u));
+    // keep NaN a (quiet) NaN, which rounding could turn into infinity
+    if ((u & 0x7fffffffu) > 0x7f800000u)
+      return static_cast<uint16_t>((u >> 16) | 0x40u);
+    return static_cast<uint16_t>((u + 0x7fffu + ((u >> 16) & 1u)) >> 16);
+  }
+  static float ToFloat(uint16_t bits) {
+    const uint32_t u = static_cast<uint32_t>(bits) << 16;
+    float x;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+  }
+
+ private:
+  uint16_t bits_;
+};
+
+}  // namespace singa
+
+#endif  // SINGA_CORE_BFLOAT16_H_
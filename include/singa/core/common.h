@@ -20,8 +20,11 @@
 #define SINGA_CORE_COMMON_H_
 #include <atomic>
 #include <chrono>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <random>
+#include <vector>
 
 #include "singa/singa_config.h"
 #include "singa/utils/logging.h"
@@ -60,6 +63,13 @@ typedef struct _Opencl {
 }  // namespace lang
 
 class Device;
+/// Base class of the data derived from a Block by kernels (see
+/// Block::cache()).
+class BlockCache {
+ public:
+  virtual ~BlockCache() = default;
+};
+
 /// Block represent a chunk of memory (on device or host).
 class Block {
  public:
@@ -67,12 +77,33 @@ class Block {
       : data_(ptr), size_(size), offset_(offset), device_(device) {
     ref_count_ = 1;  // std::make_shared<std::atomic<int>>(1);
   }
+  /// A view of 'size' bytes at 'offset' of the parent block, which shares
+  /// the memory of the parent until either of them is written. The first
+  /// write (mutable_data()) to the view copies the range into memory owned
+  /// by the view, and so does the first write to the parent before changing
+  /// it; free_data() makes the view share the parent again.
+  Block(Block* parent, size_t size, size_t offset);
+  /// Wrap 'size' initialized bytes at 'ptr' that the block does not own,
+  /// e.g., an mmap'ed file region, a numpy buffer or memory of the user.
+  /// free_data() and the graph leave the memory alone; it is released by
+  /// calling 'deleter' (if any) when the block is deleted.
+  Block(void* ptr, size_t size, Device* device,
+        std::function<void(void*)> deleter);
+  ~Block();
   // Disabled as it is not used currently.
   // Block(void* ptr, size_t size, size_t offset, std::shared_ptr<atomic<int>>
   //  ref) : data_(ptr), size_(size), offset_(offset), ref_count_(ref) {}
   void* mutable_data();
   const void* data() const;
   void free_data();
+  /// Like free_data() for views, but the view is not copied before later
+  /// writes to the parent, which then show through it until free_data() is
+  /// called, e.g., for views that are not read any more.
+  void release_view();
+  /// Use memory owned by others, e.g., the arena of a graph memory plan,
+  /// until free_data() is called, which then drops the pointer instead of
+  /// freeing it. Nothing is done if the block already holds memory.
+  void use_external_data(void* ptr);
 
   size_t size() const { return size_; }
   size_t offset() const { return offset_; }
@@ -82,22 +113,74 @@ class Block {
   int DecRefCount() { return --ref_count_; }
   int ref_count() const { return ref_count_.load(); }
 
-  bool initialized() const { return initialized_; }
+  bool initialized() const {
+    return shares_parent() ? parent_->initialized() : initialized_;
+  }
+  bool external_data() const { return external_data_; }
+  /// true if the block wraps memory it does not own, see the constructor
+  bool borrowed() const { return borrowed_; }
+  /// the block viewed by this block, nullptr if it is not a view
+  Block* parent() const { return parent_; }
+  /// true if this block is a view reading the memory of its parent
+  bool shares_parent() const { return parent_ != nullptr && data_ == nullptr; }
+
+  /// Mark the data as not changing, e.g., the weights of a model used for
+  /// inference, which lets kernels cache forms derived from it.
+  void set_constant(bool constant);
+  bool constant() const { return constant_; }
+  /// The data a kernel derived from a constant block, e.g., the packed matrix
+  /// of GEMM, or nullptr. It is dropped when the block is written or freed.
+  std::shared_ptr<BlockCache> cache() const;
+  void set_cache(std::shared_ptr<BlockCache> cache);
 
  private:
   Block() {}
+  void AddView(Block* view);
+  void RemoveView(Block* view);
+  // let the views sharing this block copy their ranges before it is written
+  void DetachViews();
   void* data_ = nullptr;
   size_t size_ = 0;
   size_t offset_ = 0;
   bool initialized_ = false;
+  bool external_data_ = false;
+  bool borrowed_ = false;
+  std::function<void(void*)> deleter_;
   Device* device_ = nullptr;
+  // offset_ is the offset into the parent for views
+  Block* parent_ = nullptr;
+  bool constant_ = false;
+  // set and read atomically by the kernels sharing a constant block
+  std::shared_ptr<BlockCache> cache_;
+  // the views sharing the memory of this block; num_views_ is their number,
+  // which is read without locking views_mutex_ by every write
+  std::vector<Block*> views_;
+  std::atomic<size_t> num_views_{0};
+  std::mutex views_mutex_;
   // Disabled as it is not used currently.
   // std::shared_ptr<std::atomic<int>> ref_count_ = nullptr;
   std::atomic<int> ref_count_;
 };
 
+/// Accuracy of the transcendental functions (exp, log, tanh, sigmoid, ...)
+/// implemented for lang::Cpp.
+enum MathAccuracy {
+  kMathPrecise = 0,  ///< libm, one element at a time
+  kMathHigh,         ///< vectorized polynomials, within a few ulp of libm
+  kMathLow           ///< vectorized lower-degree polynomials, ~1e-4 rel. error
+};
+
 typedef struct _Context {
   std::mt19937 random_generator;
+  /// Key of the counter-based generator (Philox4x32) of the cpp random
+  /// kernels, and the number of streams drawn; every call draws one stream,
+  /// so its result does not depend on num_threads.
+  uint64_t random_seed = 0;
+  uint64_t random_stream = 0;
+  /// Max number of threads used by the cpp kernels (lang::Cpp).
+  int num_threads = 1;
+  /// Accuracy of the cpp kernels of transcendental functions.
+  MathAccuracy math_accuracy = kMathHigh;
 #ifdef USE_CUDA
   cublasHandle_t cublas_handle;
   cudaStream_t stream;
@@ -71,7 +71,7 @@ class Device {
   static void EnableLazyAlloc(bool enbale) { lazy_alloc_ = enbale; }
 
   /// Called by Tensor.
-  Block* NewBlock(int size);
+  Block* NewBlock(size_t size);
 
   /// Called by Tensor.
   void FreeBlock(Block* block);
@@ -82,8 +82,16 @@ class Device {
 
   /// Copy data within or across devices.
   virtual void CopyDataToFrom(Block* dst, Block* src, size_t nBytes,
-                              CopyDirection direction, int dst_offset,
-                              int src_offset, Context* ctx);
+                              CopyDirection direction, size_t dst_offset,
+                              size_t src_offset, Context* ctx);
+
+  /// Copy 'height' rows of 'width' bytes, where consecutive rows start
+  /// 'dst_pitch' ('src_pitch') bytes apart in dst (src), e.g., a range of
+  /// columns of a matrix.
+  void CopyDataToFrom2D(Block* dst, Block* src, size_t width, size_t height,
+                        size_t dst_pitch, size_t src_pitch,
+                        CopyDirection direction, size_t dst_offset,
+                        size_t src_offset, Context* ctx);
 
   void CopyDataFromHostPtr(Block* dst, const void* src, size_t nBytes,
                            size_t dst_offset = 0, Context* ctx = nullptr);
@@ -91,12 +99,21 @@ class Device {
   /// delay it depending on the scheduler.
   void Exec(function<void(Context*)>&& fn, const vector<Block*> read_blocks,
             const vector<Block*> write_blocks, string op_name = "no_name",
-            bool use_rand_generator = false);
+            bool use_rand_generator = false, EltwiseOpPtr eltwise = nullptr);
 
   void RunGraph(bool serial = false);
 
   void ResetGraph() { graph_->Reset(); }
 
+  /// Run the graph with the memory plan of Graph::EnableMemoryPlan().
+  void EnableMemoryPlan(bool enable) { graph_->EnableMemoryPlan(enable); }
+  /// Return the size (bytes) of the arena of the memory plan, i.e., the
+  /// planned peak memory of the blocks freed within each iteration.
+  size_t GetPlannedPeakMem() const { return graph_->planned_peak(); }
+  /// Fuse chains of elementwise operations in the graph, see
+  /// Graph::EnableFusion().
+  void EnableFusion(bool enable) { graph_->EnableFusion(enable); }
+
   // Wait for one event.
   // void WaitFor();
 
@@ -111,6 +128,7 @@ class Device {
   Context* context(int k) { return &ctx_; }
 
   bool graph_enabled() const { return graph_enabled_; }
+  const Graph* graph() const { return graph_; }
 
   /// Verbosity of the time profiling function:
   /// verbosity == 0 (default) -> no logging
@@ -138,8 +156,14 @@ class Device {
   virtual void CopyToFrom(void* dst, const void* src, size_t nBytes,
                           CopyDirection direction, Context* ctx) = 0;
 
+  /// Strided copy, see CopyDataToFrom2D(); calls CopyToFrom() per row by
+  /// default.
+  virtual void CopyToFrom2D(void* dst, size_t dst_pitch, const void* src,
+                            size_t src_pitch, size_t width, size_t height,
+                            CopyDirection direction, Context* ctx);
+
   /// Allocate device memory.
-  virtual void* Malloc(int size) = 0;
+  virtual void* Malloc(size_t size) = 0;
 
   /// Free device memory.
   virtual void Free(void* ptr) = 0;
@@ -181,12 +205,33 @@ extern std::shared_ptr<Device> defaultDevice;
 class CppCPU : public Device {
  public:
   ~CppCPU();
+  /// Allocate memory from a CppMemPool whose cache is capped at
+  /// CppMemPool::DefaultMaxCacheSize(). New blocks are zeroed.
   CppCPU();
+  /// Allocate memory from the given pool, e.g., a CppMemPool with another
+  /// cache cap or one that does not zero new blocks.
+  CppCPU(std::shared_ptr<DeviceMemPool> pool);
 
   std::shared_ptr<Device> host() const override { return defaultDevice; }
   void SetRandSeed(unsigned seed) override;
+  /// Set the max number of threads used by the kernels run on this device.
+  /// It defaults to the number of hardware threads.
+  void SetNumThreads(int num);
+  int num_threads() const { return ctx_.num_threads; }
+  /// Trade accuracy of exp, log, tanh, etc. for speed; see MathAccuracy.
+  void SetMathAccuracy(MathAccuracy accuracy) {
+    ctx_.math_accuracy = accuracy;
+  }
+  MathAccuracy math_accuracy() const { return ctx_.math_accuracy; }
+
+  size_t GetAllocatedMem() override;
+  std::shared_ptr<DeviceMemPool> pool() const { return pool_; }
+  /// Return the blocks cached by a CppMemPool to the system.
+  void ReleaseCache();
 
  protected:
+  /// 'executor' > 0 runs fn on the context of that executor, e.g., one of
+  /// the workers of Graph::RunConcurrently().
   void DoExec(function<void(Context*)>&& fn, int executor) override;
   void TimeProfilingDoExec(function<void(Context*)>&& fn, int executor,
                            Node* node) override;
@@ -194,12 +239,25 @@ class CppCPU : public Device {
 
   void CopyToFrom(void* dst, const void* src, size_t nBytes,
                   CopyDirection direction, Context* ctx) override;
+  void CopyToFrom2D(void* dst, size_t dst_pitch, const void* src,
+                    size_t src_pitch, size_t width, size_t height,
+                    CopyDirection direction, Context* ctx) override;
 
   /// Allocate cpu memory.
-  void* Malloc(int size) override;
+  void* Malloc(size_t size) override;
 
   /// Free cpu memory.
   void Free(void* ptr) override;
+
+ private:
+  void Setup();
+  void CreateExecutors();
+  Context* ExecutorContext(int executor);
+
+  shared_ptr<DeviceMemPool> pool_;
+  // the contexts of executors 1 to num_threads - 1, which follow the
+  // settings of ctx_ but have their own streams
+  vector<std::unique_ptr<Context>> executor_ctx_;
 };
 
 // Implement Device using OpenCL libs.
@@ -229,9 +287,12 @@ class CudaGPU : public Device {
 
   void CopyToFrom(void* dst, const void* src, size_t nBytes,
                   CopyDirection direction, Context* ctx) override;
+  void CopyToFrom2D(void* dst, size_t dst_pitch, const void* src,
+                    size_t src_pitch, size_t width, size_t height,
+                    CopyDirection direction, Context* ctx) override;
 
   /// Allocate cpu memory.
-  void* Malloc(int size) override;
+  void* Malloc(size_t size) override;
 
   /// Free cpu memory.
   void Free(void* ptr) override;
@@ -262,8 +323,8 @@ class OpenclDevice : public singa::Device {
   void SetRandSeed(unsigned seed) override;
 
   virtual void CopyDataToFrom(Block* dst, Block* src, size_t nBytes,
-                              CopyDirection direction, int dst_offset = 0,
-                              int src_offset = 0,
+                              CopyDirection direction, size_t dst_offset = 0,
+                              size_t src_offset = 0,
                               Context* ctx = nullptr) override;
 
  protected:
@@ -290,7 +351,7 @@ class OpenclDevice : public singa::Device {
   /// Allocates memory on this OpenCL device
   /// by creating and returning an empty cl::Buffer object.
   /// with the indicated size.
-  void* Malloc(int size) override;
+  void* Malloc(size_t size) override;
 
   /// Converts the void pointer into a Buffer object, then deletes the object.
   /// This has the effect of freeing up device memory.
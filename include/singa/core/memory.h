@@ -21,6 +21,8 @@
 
 #include <atomic>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "singa/proto/core.pb.h"
 #include "singa/singa_config.h"
@@ -53,6 +55,61 @@ class DeviceMemPool {
   //  size_t init_size_ = 0, max_size_ = 0;
 };
 
+/// Caching allocator for host memory, used by CppCPU.
+/// Freed blocks are kept in free lists, one per size class, and handed out
+/// again for later requests of the same class. Size classes are multiples of
+/// 64 bytes with 4 classes per power of two, i.e., at most 25% overhead.
+/// Blocks are 64-byte aligned and, unlike malloc + memset, are not zeroed
+/// unless zero_memory is set. With huge_pages, blocks of 2MB or more are
+/// 2MB-aligned and advised to be backed by transparent huge pages (Linux).
+class CppMemPool : public DeviceMemPool {
+ public:
+  /// max_cache_size: the max bytes kept in the free lists; 0 for unlimited.
+  CppMemPool(bool zero_memory = false, bool huge_pages = false,
+             size_t max_cache_size = 0);
+  ~CppMemPool();
+
+  void Malloc(void** ptr, const size_t size) override;
+  void Free(void* ptr) override;
+
+  /// Return the bytes cached in the free lists and the total bytes held by
+  /// the pool, i.e., in use plus cached.
+  std::pair<size_t, size_t> GetMemUsage() override;
+
+  /// Return all cached blocks to the system.
+  void ReleaseCache();
+  /// Cap the bytes kept in the free lists (0 for unlimited), returning the
+  /// cached blocks above the cap to the system.
+  void SetMaxCacheSize(size_t size);
+  size_t max_cache_size();
+
+  /// The default cap of the cache, i.e., 1/8 of the physical memory.
+  static size_t DefaultMaxCacheSize();
+
+  /// The max bytes in use since the creation of the pool.
+  size_t peak_usage();
+  /// The number of Malloc() calls, and those served from the free lists.
+  size_t num_mallocs();
+  size_t num_hits();
+
+  /// The bytes reserved for a request of 'size' bytes.
+  static size_t SizeClass(size_t size);
+
+ protected:
+  void* SystemMalloc(size_t size);
+
+ private:
+  bool zero_memory_, huge_pages_;
+  size_t max_cache_size_;
+  size_t in_use_ = 0, cached_ = 0, peak_ = 0;
+  size_t num_mallocs_ = 0, num_hits_ = 0;
+  // size class => free blocks
+  std::unordered_map<size_t, std::vector<void*>> free_lists_;
+  // blocks in use => size class
+  std::unordered_map<void*, size_t> allocated_;
+  std::mutex mtx_;
+};
+
 #ifdef USE_CUDA
 class CnMemPool : public DeviceMemPool {
  public:
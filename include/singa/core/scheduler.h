@@ -21,6 +21,7 @@
 
 #include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -43,6 +44,7 @@ class Edge;
 class Graph;
 class Device;
 class BlkInfo;
+class Tensor;
 
 typedef std::vector<Node *> NodeVec;
 typedef std::vector<Edge *> EdgeVec;
@@ -51,9 +53,24 @@ typedef std::unordered_set<Block *> BlockSet;
 typedef std::function<void(Context *)> OpFunc;
 typedef std::unordered_map<Block *, BlkInfo *> Blk2InfoMap;
 typedef std::chrono::high_resolution_clock::time_point TimePoint;
+typedef std::function<void(const std::vector<Tensor> &, Tensor *, Context *)>
+    EltwiseKernel;
 
 enum BlockType { kUnknow, kInput, kParam, kInter, kEnd };
 
+/// A float32 elementwise operation over dense blocks of the same number of
+/// elements, which lets the graph fuse chains of such operations into one
+/// pass over memory. kernel(in, out, ctx) runs the operation on tensors over
+/// any range of the blocks, e.g., the tiles of the fused loop.
+struct EltwiseOp {
+  BlockVec inputs;
+  Block *output = nullptr;
+  size_t size = 0;  ///< the number of elements of each block
+  std::shared_ptr<Device> device;
+  EltwiseKernel kernel;
+};
+typedef std::shared_ptr<EltwiseOp> EltwiseOpPtr;
+
 class Node {
  public:
   Node(int id, OpFunc &&op, string op_name)
@@ -68,6 +85,10 @@ class Node {
   const EdgeVec &in_edges() const { return in_edges_; }
   const EdgeVec &out_edges() const { return out_edges_; }
   float time_elapsed() const { return time_elapsed_; }
+  bool use_rand_generator() const { return use_rand_generator_; }
+  const EltwiseOpPtr &eltwise() const { return eltwise_; }
+  size_t read_bytes() const { return read_bytes_; }
+  size_t write_bytes() const { return write_bytes_; }
 
   // time profiling
   void time_elapsed_inc(float time) { time_elapsed_ += time; }
@@ -82,6 +103,12 @@ class Node {
 
   string op_name_;
   float time_elapsed_ = 0;
+  bool use_rand_generator_ = false;
+  size_t read_bytes_ = 0;
+  size_t write_bytes_ = 0;
+  EltwiseOpPtr eltwise_;
+  // replaces op_ if the node is fused, see Graph::fusions()
+  OpFunc fused_op_;
 
 #ifdef USE_CUDA
   cudaEvent_t start_;
@@ -136,6 +163,8 @@ class BlkInfo {
   BlockType type_;
   int graph_ref_;
   Edge *write_edge_;    // the edge of last node that writes data into blk
+  EdgeVec read_edges_;  // the edges of the nodes reading blk before the first
+                        // write, which have no source node
   NodeVec used_nodes_;  // the nodes that use this block(in order of execution)
 };
 
@@ -156,8 +185,25 @@ class Graph {
   void RunGraph();
   void RunInSerial();
   void PrintTimeProfiling();
+  /// Operations using the random generator of the device context are run
+  /// one at a time in the order they are added. Operations with an eltwise
+  /// description may be fused with each other (see EnableFusion()).
   void AddOperation(OpFunc &&op, const BlockVec &read_blocks,
-                    const BlockVec &write_blocks, string op_name = "no_name");
+                    const BlockVec &write_blocks, string op_name = "no_name",
+                    bool use_rand_generator = false,
+                    EltwiseOpPtr eltwise = nullptr);
+  /// Place the blocks freed within each iteration (see free_blocks_) at
+  /// offsets of one arena allocated from the device, so that running the
+  /// graph does not allocate memory for them. Blocks live at the same time
+  /// in the execution order get disjoint ranges (larger blocks are placed
+  /// first at the lowest free offset), so a planned graph runs one node at
+  /// a time.
+  void EnableMemoryPlan(bool enable);
+  /// Fuse chains of elementwise operations (enabled by default). The output
+  /// of each fused operation but the last is read only by the next one and
+  /// is never materialized; the last node computes all of them one tile at a
+  /// time and the others do nothing.
+  void EnableFusion(bool enable);
 
   // getters of Graph
   const NodeVec &nodes() const { return nodes_; }
@@ -171,6 +217,17 @@ class Graph {
   const std::vector<NodeVec> &next_nodes() const { return next_nodes_; }
   const std::vector<BlockVec> &free_blocks() const { return free_blocks_; }
   int iteration() const { return iteration_; }
+  bool memory_plan_enabled() const { return plan_memory_; }
+  bool fusion_enabled() const { return fusion_; }
+  /// the groups of fused nodes, each in program order ending with the node
+  /// running the fused kernel
+  const std::vector<NodeVec> &fusions() const { return fusions_; }
+  /// the arena size (bytes) of the memory plan, 0 if there is no plan
+  size_t planned_peak() const { return planned_peak_; }
+  /// the arena offset of each planned block
+  const std::unordered_map<Block *, size_t> &planned_offsets() const {
+    return planned_offsets_;
+  }
 
   Node *node(const size_t idx) const;
   Edge *edge(const size_t idx) const;
@@ -185,7 +242,13 @@ class Graph {
   void FreeLoop();
   void AnalyzeNodes();
   void AnalyzeEdges();
-  void TimeProfilingDoExec(Node *curNode);
+  void FuseEltwise();
+  void AnalyzeDependency();
+  void PlanMemory();
+  void UsePlannedMemory();
+  void FreeArena();
+  void RunConcurrently(size_t max_threads);
+  void TimeProfilingDoExec(Node *curNode, int executor = 0);
   void AddSyncOp(function<void(Context *)> &&op, string op_name = "no_name");
 
   void step() { iteration_++; }
@@ -214,6 +277,33 @@ class Graph {
   std::vector<NodeVec> next_nodes_;
   std::vector<BlockVec> free_blocks_;
 
+  // Fusion: the node executing each node (itself unless it is fused into
+  // a later node), and the fused outputs that are never materialized
+  bool fusion_ = true;
+  std::vector<NodeVec> fusions_;
+  std::vector<int> fused_into_;
+  BlockSet fused_blocks_;
+
+  // Concurrent execution: the number of edges from other nodes to each
+  // node, plus one for the previous node using the random generator
+  std::vector<int> node_deps_;
+  // the next node using the random generator, -1 for none; these nodes run
+  // on the calling thread, i.e., with the random state of executor 0
+  std::vector<int> next_rand_node_;
+  // the blocks in free_blocks_ used by each node, and the number of their
+  // users; a block is freed after all of them finish
+  std::vector<BlockVec> used_free_blocks_;
+  std::unordered_map<Block *, int> free_block_users_;
+
+  // Memory plan: the execution order the plan is made for, the arena offset
+  // of each block in free_blocks_ and the arena
+  bool plan_memory_ = false;
+  bool analyzed_serial_ = false;
+  std::unordered_map<Block *, size_t> planned_offsets_;
+  size_t planned_peak_ = 0;
+  size_t arena_size_ = 0;
+  void *arena_ = nullptr;
+
   // Time Profiling
   int iteration_ = 0;
   float time_elapsed_ = 0;
@@ -0,0 +1,98 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SINGA_CORE_SPARSE_TENSOR_H_
+#define SINGA_CORE_SPARSE_TENSOR_H_
+
+#include <memory>
+
+#include "singa/core/tensor.h"
+
+namespace singa {
+
+/// The storage formats of SparseTensor.
+enum SparseFormat {
+  /// Compressed sparse row: 'rows' has one offset per row plus the end, i.e.,
+  /// the entries of row r are [rows[r], rows[r + 1]) of 'cols' and 'values',
+  /// with the columns of a row in increasing order.
+  kCSR = 0,
+  /// Coordinate: 'rows' and 'cols' hold the row and column of each entry,
+  /// in any order; duplicated entries are summed.
+  kCOO = 1
+};
+
+/// A sparse float32 matrix, whose values and (kInt) indices are stored in
+/// Tensors, i.e., on Blocks of the device. Copies share the Blocks.
+///
+/// Only CppCPU implements the operations below.
+class SparseTensor {
+ public:
+  SparseTensor() {}
+  /// Build from the values and indices of 'format'; see SparseFormat. The
+  /// indices are checked on the host, hence the graph must be disabled.
+  SparseTensor(const Shape &shape, SparseFormat format, const Tensor &values,
+               const Tensor &rows, const Tensor &cols);
+
+  /// The non-zero entries of the 2-d 'dense' tensor.
+  static SparseTensor FromDense(const Tensor &dense,
+                                SparseFormat format = kCSR);
+  Tensor ToDense() const;
+
+  /// The same matrix in the other format; no copy if it is already in
+  /// 'format'.
+  SparseTensor ToFormat(SparseFormat format) const;
+  SparseTensor ToCSR() const { return ToFormat(kCSR); }
+  SparseTensor ToCOO() const { return ToFormat(kCOO); }
+
+  /// The transposed matrix (a new copy) in the same format.
+  SparseTensor Transpose() const;
+
+  const Shape &shape() const { return shape_; }
+  size_t shape(size_t idx) const { return shape_.at(idx); }
+  SparseFormat format() const { return format_; }
+  /// The number of stored entries.
+  size_t nnz() const { return values_.Size(); }
+  std::shared_ptr<Device> device() const { return values_.device(); }
+
+  const Tensor &values() const { return values_; }
+  const Tensor &rows() const { return rows_; }
+  const Tensor &cols() const { return cols_; }
+
+ private:
+  friend SparseTensor EltwiseMult(const SparseTensor &A, const Tensor &B);
+  /// Build from indices known to be valid, e.g., computed from those of
+  /// another SparseTensor, without checking them.
+  static SparseTensor Unchecked(const Shape &shape, SparseFormat format,
+                                const Tensor &values, const Tensor &rows,
+                                const Tensor &cols);
+
+  Shape shape_{0, 0};
+  SparseFormat format_ = kCSR;
+  Tensor values_, rows_, cols_;
+};
+
+/// C = A * B for the sparse matrix A and the dense matrix (or vector) B,
+/// i.e., SpMM (or SpMV). The rows of C are computed in parallel.
+Tensor Mult(const SparseTensor &A, const Tensor &B);
+/// The element-wise product of A and the dense B of the same shape, which
+/// keeps the entries (the sparsity) of A.
+SparseTensor EltwiseMult(const SparseTensor &A, const Tensor &B);
+
+}  // namespace singa
+
+#endif  // SINGA_CORE_SPARSE_TENSOR_H_
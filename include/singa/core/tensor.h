@@ -18,11 +18,14 @@
 
 #ifndef SINGA_CORE_TENSOR_H_
 #define SINGA_CORE_TENSOR_H_
+#include <functional>
 #include <memory>
+#include <string>
 #include <tuple>
 #include <vector>
 
 #include "half.hpp"
+#include "singa/core/bfloat16.h"
 #include "singa/core/common.h"
 #include "singa/core/device.h"
 #include "singa/proto/core.pb.h"
@@ -36,7 +39,8 @@ typedef vector<size_t> Shape;
 /// hardcode the width of types defined in DataType
 const size_t kDataWidth[] = {sizeof(float),  sizeof(float) / 2,
                              sizeof(int),    sizeof(char),
-                             sizeof(double), sizeof(unsigned char)};
+                             sizeof(double), sizeof(unsigned char),
+                             sizeof(bfloat16)};
 inline size_t SizeOf(DataType t) {
   static_assert(kNumDataType == sizeof(kDataWidth) / sizeof(size_t),
                 "Num of data types not match num of data width");
@@ -133,6 +137,16 @@ class Tensor {
     return block_ != nullptr && block_->initialized();
   }
 
+  /// Mark the data as constant (e.g., the weights of a model used only for
+  /// inference) or not. Kernels may then cache forms derived from the data on
+  /// its block, e.g., GEMM on CppCPU keeps the packed copy of a constant B.
+  /// The cache is dropped whenever the data is written.
+  void SetConstant(bool constant = true) const {
+    CHECK(block_ != nullptr) << "The tensor has no memory";
+    block_->set_constant(constant);
+  }
+  bool constant() const { return block_ != nullptr && block_->constant(); }
+
   /// Return number of total elements
   size_t Size() const { return size(); }
 
@@ -207,6 +221,31 @@ class Tensor {
 
   void Clone(Tensor *&other, std::shared_ptr<Device> device = nullptr) const;
 
+  /// Return a tensor of the given shape over the elements [offset, offset +
+  /// Product(shape)) of this contiguous tensor without copying them. The
+  /// elements are copied by the first write to either tensor (see Block), so
+  /// the view behaves like a copy; it keeps its copy from then on, also
+  /// across runs of a graph.
+  Tensor View(const Shape &shape, size_t offset = 0) const;
+
+  /// Return a tensor over the Product(shape) elements at 'ptr', which is
+  /// memory of 'device' (the default host device if nullptr), e.g., a numpy
+  /// buffer, without copying them. The tensor does not own the memory;
+  /// 'deleter' (if any) is called on 'ptr' once the tensor and its copies are
+  /// gone.
+  static Tensor FromExternal(void *ptr, const Shape &shape,
+                             DataType dtype = kFloat32,
+                             std::function<void(void *)> deleter = nullptr,
+                             std::shared_ptr<Device> device = nullptr);
+
+  /// Map the Product(shape) elements at byte 'offset' of the file 'path'
+  /// into a host tensor without reading them. The pages are loaded on
+  /// demand and shared with other processes mapping the file through the
+  /// page cache. Writes to the tensor are private (copy-on-write), i.e.,
+  /// the file is never changed.
+  static Tensor FromMmap(const std::string &path, size_t offset,
+                         const Shape &shape, DataType dtype = kFloat32);
+
   // --------------------------------------------------------------------------
   // ---Following methods change the tensor and return itself
   // --------------------------------------------------------------------------
@@ -291,11 +330,12 @@ class Tensor {
       return;
     }
 
-    size_t dim = Size();
+    // from the last dimension, as dividing the size fails for empty tensors
+    stride_.resize(shape_.size());
     int cumulative_product = 1;
-    for (size_t n = 0; n < shape_.size(); ++n) {
+    for (size_t n = shape_.size(); n-- > 0;) {
+      stride_[n] = cumulative_product;
       cumulative_product = cumulative_product * shape_[n];
-      stride_.push_back(dim / cumulative_product);
     }
   }
 
@@ -358,6 +398,14 @@ Tensor Transpose(const Tensor &in, const vector<size_t> &axes);
 void CopyDataToFrom(Tensor *dst, const Tensor &src, const size_t num,
                     const size_t dst_offset = 0, const size_t src_offset = 0);
 
+/// Copy 'height' rows of 'width' elements of src to dst in one operation.
+/// Row i starts at element dst_offset + i * dst_pitch of dst, and at
+/// src_offset + i * src_pitch of src.
+void CopyDataToFrom2D(Tensor *dst, const Tensor &src, const size_t width,
+                      const size_t height, const size_t dst_pitch,
+                      const size_t src_pitch, const size_t dst_offset = 0,
+                      const size_t src_offset = 0);
+
 void RepeatDataToFrom(bool broadcast_flag, const vector<size_t> &repeats,
                       int axis, Tensor *dst, const Tensor &in,
                       const size_t num);
@@ -528,10 +576,7 @@ template <typename SType = float>
 SType Sum(const Tensor &in);
 
 // ============Matrix (row/column) operations==================================
-/// Average elements in the Tensor, currently only support vector and matrix.
-/// if 'axis' is 0, average all rows into a single row
-/// if 'axis' is 1, average all columns into a single column
-/// TODO(wangwei) support arbitrary Tensor like numpy.average
+/// Average elements in the Tensor along 'axis', see Sum(in, axis).
 Tensor Average(const Tensor &in, const int axis);
 
 /// Add column 'v' with each column of matrix M
@@ -557,11 +602,17 @@ void MultRow(const Tensor &v, Tensor *M);
 Tensor SoftMax(const Tensor &in);
 Tensor SoftMax(const Tensor &in, int axis);
 Tensor SoftMaxBackward(const Tensor &in, int axis, const Tensor &fdout);
+/// log(SoftMax(in)), computed in one pass over each row, so it stays finite
+/// where the softmax underflows.
+Tensor LogSoftMax(const Tensor &in);
+Tensor LogSoftMax(const Tensor &in, int axis);
 
 Tensor RowMax(const Tensor &in);
 /// Do softmax for each row. 'in' could be a 1-d or 2-d Tensor.
 void SoftMax(const Tensor &in, Tensor *out);
 void SoftMax(const Tensor &in, Tensor *out, int axis);
+void LogSoftMax(const Tensor &in, Tensor *out);
+void LogSoftMax(const Tensor &in, Tensor *out, int axis);
 /// Sub column 'v' by each column of matrix M
 void SubColumn(const Tensor &v, Tensor *M);
 /// Sub row 'v' by each row of matrix M; write results into 'out'
@@ -571,13 +622,33 @@ void SumColumns(const Tensor &M, Tensor *out);
 /// Sum all rows of matrix M into a single row as 'out'
 void SumRows(const Tensor &M, Tensor *out);
 
-/// Sum elements in the Tensor, currently only support vector and matrix.
-/// if 'axis' is 0, sum all rows into a single row
-/// if 'axis' is 1, sum all columns into a single column
-/// TODO(wangwei) support arbitrary Tensor like numpy.sum
+/// Sum elements in the Tensor along 'axis', which is removed from the shape;
+/// for matrices, if 'axis' is 0, sum all rows into a single row, and if
+/// 'axis' is 1, sum all columns into a single column.
+/// Only vectors and matrices are supported by devices other than CppCPU.
 Tensor Sum(const Tensor &in, const int axis);
+/// Sum all elements into a tensor of shape {1}.
 Tensor SumAll(const Tensor &in);
 
+// ================Reductions=================================================
+/// Reduce 'axes' of 'in' (all axes if 'axes' is empty; negative axes count
+/// from the last one), like numpy.sum, etc. 'in' may be transposed or
+/// broadcasted. The reduced axes are kept with size 1 if 'keepdims' is true,
+/// otherwise they are removed; reducing all axes then gives shape {1}.
+/// Sums are accumulated pairwise and with Kahan summation.
+/// Only CppCPU implements them, for kFloat32, kFloat16, kBFloat16 and kInt.
+Tensor ReduceSum(const Tensor &in, const vector<int> &axes = {},
+                 bool keepdims = false);
+Tensor ReduceMean(const Tensor &in, const vector<int> &axes = {},
+                  bool keepdims = false);
+Tensor ReduceMax(const Tensor &in, const vector<int> &axes = {},
+                 bool keepdims = false);
+Tensor ReduceMin(const Tensor &in, const vector<int> &axes = {},
+                 bool keepdims = false);
+/// The index (kInt) of the first max (min) element along 'axis'.
+Tensor ArgMax(const Tensor &in, int axis, bool keepdims = false);
+Tensor ArgMin(const Tensor &in, int axis, bool keepdims = false);
+
 // ================Random operations==========================================
 /// For each element x set x = 1 if random() < p; otherwise x = 1.
 template <typename SType>
@@ -630,6 +701,28 @@ void ComputeCrossEntropy(const Tensor &p, const Tensor &t, Tensor *loss);
 
 void SoftmaxCrossEntropyBwd(const Tensor &t, Tensor *p);
 
+/// Fused SoftMax and cross entropy loss of the logits 'x', without
+/// materializing the probabilities. 'x' and 't' are as 'p' and 't' of
+/// ComputeCrossEntropy(); 't' is int or float32. With label smoothing the
+/// target weights of each instance are (1 - smoothing) * t[i] / sum(t[i]) +
+/// smoothing / dim. The loss of each instance is written into 'loss' and,
+/// in the same pass, the log-sum-exp of each row into 'lse' and the gradient
+/// w.r.t. 'x' into 'grad' if they are not nullptr. The backward pass needs
+/// only 'lse' (see SoftmaxCrossEntropyBwd() below).
+void SoftmaxCrossEntropyFwd(const Tensor &x, const Tensor &t, Tensor *loss,
+                            Tensor *lse, Tensor *grad = nullptr,
+                            float smoothing = 0.f);
+/// Return the loss; 'lse' is reset to a new tensor of the log-sum-exp.
+Tensor SoftmaxCrossEntropyFwd(const Tensor &x, const Tensor &t, Tensor *lse,
+                              float smoothing = 0.f);
+/// The gradient w.r.t. the logits 'x', given the 'lse' computed by
+/// SoftmaxCrossEntropyFwd() with the same 't' and 'smoothing'.
+void SoftmaxCrossEntropyBwd(const Tensor &x, const Tensor &t,
+                            const Tensor &lse, Tensor *grad,
+                            float smoothing = 0.f);
+Tensor SoftmaxCrossEntropyBwd(const Tensor &x, const Tensor &t,
+                              const Tensor &lse, float smoothing = 0.f);
+
 /// To be called by pysinga autograd operations;
 /// swig ignores the const qualifier
 /// http://www.swig.org/Doc3.0/SWIGPlus.html#SWIGPlus_const
@@ -639,9 +732,12 @@ Tensor SoftmaxCrossEntropyBwd(const Tensor &p, const Tensor &t);
 /// Return a tensor consisting of rows ([start, end)) from 'in'. It copies the
 /// values from 'in'. 'in' ia a 2D Tensor.
 Tensor CopyRows(const Tensor &in, const size_t start, const size_t end);
-/// Alias of CopyRows
+/// Like CopyRows but returns a view of 'in' (see Tensor::View()) without
+/// copying if 'in' is contiguous. 'in' may have any number of dimensions.
 Tensor SliceRows(const Tensor &in, const size_t start, const size_t end);
-/// Slice the input tensor along the give axis to generate a new tensor
+/// Slice the input tensor along the give axis to generate a new tensor,
+/// which is a view of 'in' if the slice is contiguous, i.e., if all
+/// dimensions before 'axis' are 1.
 Tensor SliceOn(const Tensor &in, const size_t start, const size_t end,
                int axis);
 /// Return a tensor consisting of columns ([start, end)) from 'in'. It copies
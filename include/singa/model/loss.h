@@ -105,7 +105,8 @@ class SoftmaxCrossEntropy : public Loss {
 
  private:
   // to buffer intermediate data, i.e., probability for each category and
-  // the target (ground truth)
+  // the target (ground truth); for int targets on CppCPU, the prediction,
+  // the log-sum-exp of each instance and the target of the fused kernels
   std::stack<Tensor> buf_;
 };
 
@@ -0,0 +1,94 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+
+#ifndef SINGA_UTILS_THREAD_POOL_H_
+#define SINGA_UTILS_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace singa {
+
+/**
+ * A fixed set of worker threads shared by all CPU kernels.
+ *
+ * Tasks are plain closures consumed in FIFO order. ParallelFor() splits an
+ * index range into chunks, hands all but the first chunk to the workers and
+ * runs the first chunk on the calling thread. A ParallelFor() issued from a
+ * worker thread runs serially, so kernels may nest freely without
+ * dead-locking the pool.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t num_workers = 0);
+  ~ThreadPool();
+
+  /// Return the process-wide pool used by the CPU device.
+  static ThreadPool* Global();
+  /// Return true if the calling thread is one of the pool workers.
+  static bool InWorker();
+  /// Number of hardware threads, at least 1.
+  static size_t HardwareConcurrency();
+
+  /// Number of worker threads (not counting the caller of ParallelFor).
+  size_t size();
+  /// Spawn more workers so that there are at least 'num_workers' of them.
+  void Reserve(size_t num_workers);
+  /// Queue a task. It is executed by one of the workers.
+  void Submit(std::function<void()>&& task);
+
+  /**
+   * Call fn(begin_i, end_i) over disjoint sub-ranges covering [begin, end).
+   *
+   * @param grain the minimum number of indices per chunk; ranges smaller
+   * than 2 * grain are not split.
+   * @param max_threads the maximum number of threads (including the caller)
+   * working on this range.
+   * Return after all chunks are done.
+   */
+  void ParallelFor(size_t begin, size_t end, size_t grain, size_t max_threads,
+                   const std::function<void(size_t, size_t)>& fn);
+
+ private:
+  void WorkerLoop();
+
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stop_ = false;
+};
+
+/// Run fn over [begin, end) using the global pool; see
+/// ThreadPool::ParallelFor.
+inline void ParallelFor(size_t begin, size_t end, size_t grain,
+                        size_t max_threads,
+                        const std::function<void(size_t, size_t)>& fn) {
+  ThreadPool::Global()->ParallelFor(begin, end, grain, max_threads, fn);
+}
+
+}  // namespace singa
+
+#endif  // SINGA_UTILS_THREAD_POOL_H_
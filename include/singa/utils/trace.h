@@ -0,0 +1,107 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+
+#ifndef SINGA_UTILS_TRACE_H_
+#define SINGA_UTILS_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace singa {
+
+/// An executed operation, written as a complete ("X") trace event.
+struct TraceEvent {
+  std::string name;
+  const char* category = "";  ///< "graph" or "eager"
+  int64_t start = 0;          ///< ns since TraceRecorder::Start()
+  int64_t end = 0;
+  int tid = 0;  ///< small id of the executing thread, set by Record()
+  int device = 0;
+  int iteration = -1;  ///< the graph iteration, -1 for eager operations
+  int node = -1;       ///< the graph node id, -1 for eager operations
+  size_t read_bytes = 0;
+  size_t write_bytes = 0;
+};
+
+/**
+ * Records the operations executed by the devices, both the graph nodes and
+ * the eager Device::Exec() calls, as a timeline in the Chrome trace-event
+ * JSON format, which chrome://tracing and ui.perfetto.dev open.
+ *
+ * Each thread appends to its own buffer, so recording costs two clock reads
+ * and an uncontended lock per operation; when stopped it costs one relaxed
+ * atomic load. The times of asynchronous devices (e.g., cuda) are those of
+ * submitting the operations.
+ */
+class TraceRecorder {
+ public:
+  /// Return the process-wide recorder used by the devices.
+  static TraceRecorder* Global();
+
+  /// Drop the recorded events and start recording; events beyond
+  /// max_events are counted by num_dropped() but not kept.
+  void Start(size_t max_events = 1 << 20);
+  void Stop();
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  /// Return the time (ns) since Start().
+  int64_t Now() const;
+  void Record(TraceEvent&& event);
+
+  /// Return the number of events kept and dropped since Start().
+  size_t num_events() const;
+  size_t num_dropped() const;
+  /// Return the events of all threads ordered by start time.
+  std::vector<TraceEvent> events();
+
+  /// Write the events as Chrome trace-event JSON.
+  void Dump(std::ostream& os);
+  /// Write the events to a file; return false if it cannot be written.
+  bool Dump(const std::string& path);
+
+ private:
+  TraceRecorder() {}
+  struct ThreadBuffer {
+    int tid;
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+  };
+  ThreadBuffer* LocalBuffer();
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<size_t> num_events_{0};
+  // set by Start() while other threads may be recording
+  std::atomic<size_t> max_events_{0};
+  // the steady clock (ns) at Start()
+  std::atomic<int64_t> start_{0};
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+};
+
+}  // namespace singa
+
+#endif  // SINGA_UTILS_TRACE_H_
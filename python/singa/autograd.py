@@ -1305,30 +1305,47 @@ def ranking_loss(pos, neg, M=0.2):
 
 class SoftMaxCrossEntropy(Operator):
 
-    def __init__(self, t):
+    def __init__(self, t, smoothing=0.0):
         super(SoftMaxCrossEntropy, self).__init__()
         self.t = t.data
+        self.smoothing = smoothing
 
     def forward(self, x):
-        self.p = singa.SoftMax(x)
-        ret = singa.CrossEntropyFwd(self.p, self.t)
+        # on cpu the fused kernels never form the probabilities; only the
+        # log-sum-exp of each row is kept for the backward pass
+        self.fused = x.device().lang() == singa.kCpp
+        if self.fused:
+            self.x = x
+            self.lse = singa.Tensor()
+            ret = singa.SoftmaxCrossEntropyFwd(x, self.t, self.lse,
+                                               self.smoothing)
+        else:
+            assert self.smoothing == 0, \
+                "label smoothing is only supported on cpu"
+            self.p = singa.SoftMax(x)
+            ret = singa.CrossEntropyFwd(self.p, self.t)
         loss = singa.SumAll(ret)
         loss /= x.shape()[0]
         return loss
 
     def backward(self, dy=1.0):
-        dx = singa.SoftmaxCrossEntropyBwd(self.p, self.t)
-        dx /= float(self.p.shape()[0])
+        if self.fused:
+            dx = singa.SoftmaxCrossEntropyBwd(self.x, self.t, self.lse,
+                                              self.smoothing)
+        else:
+            dx = singa.SoftmaxCrossEntropyBwd(self.p, self.t)
+        dx /= float(dx.shape()[0])
         return dx
 
 
-def softmax_cross_entropy(x, t):
+def softmax_cross_entropy(x, t, smoothing=0.0):
     assert x.ndim() == 2, "1st arg required 2d tensor. got shape: " + str(
         x.shape)
     assert t.ndim() <= 2, "2nd arg required <=2d tensor. got shape: " + str(
         t.shape)
-    # x is the logits and t is the ground truth.
-    return SoftMaxCrossEntropy(t)(x)[0]
+    # x is the logits and t is the ground truth; with label smoothing the
+    # target is (1 - smoothing) * t + smoothing / x.shape[1]
+    return SoftMaxCrossEntropy(t, smoothing)(x)[0]
 
 
 class MeanSquareError(Operator):
@@ -4205,6 +4222,10 @@ class Slice(Operator):
             if end > x_shape[axis]:
                 end = x_shape[axis]
             self.cache.append((axis, x_shape[axis], start, end, step))
+            if step == 1 and 0 <= start < end:
+                # a view of x if the slice is contiguous (see SliceOn)
+                x = singa.SliceOn(x, start, end, axis)
+                continue
             xs = []
             for step_idx in range(x_shape[axis])[start:end:step]:
                 xs.append(singa.SliceOn(x, step_idx, step_idx + 1, axis))
@@ -4826,25 +4847,34 @@ class _RNN(Operator):
             #  batch_first=True,
             use_mask=False,
             seq_lengths=None):
-        assert singa.USE_CUDA, "Not able to run without CUDA"
         super(_RNN, self).__init__()
         self.handle = handle
+        if isinstance(handle, singa.CpuRNNHandle):
+            self.prefix = 'Cpu'
+        else:
+            assert singa.USE_CUDA, "Not able to run without CUDA"
+            self.prefix = 'Gpu'
         self.return_sequences = return_sequences
         self.use_mask = use_mask
         if use_mask:
             assert type(seq_lengths) == Tensor, "wrong type for seq_lengths"
         self.seq_lengths = seq_lengths
 
+    def _op(self, name):
+        # the Cpu* and Gpu* functions share the same signatures
+        return getattr(singa, self.prefix + name)
+
     def forward(self, x, hx, cx, w):
         if training:
             if self.use_mask:
                 (y, hy,
-                 cy) = singa.GpuRNNForwardTrainingEx(x, hx, cx, w,
-                                                     self.seq_lengths.data,
-                                                     self.handle)
+                 cy) = self._op('RNNForwardTrainingEx')(x, hx, cx, w,
+                                                        self.seq_lengths.data,
+                                                        self.handle)
             else:
                 (y, hy,
-                 cy) = singa.GpuRNNForwardTraining(x, hx, cx, w, self.handle)
+                 cy) = self._op('RNNForwardTraining')(x, hx, cx, w,
+                                                      self.handle)
             self.inputs = {
                 'x': x,
                 'hx': hx,
@@ -4857,12 +4887,13 @@ class _RNN(Operator):
         else:
             if self.use_mask:
                 (y, hy,
-                 cy) = singa.GpuRNNForwardInferenceEx(x, hx, cx, w,
-                                                      self.seq_lengths.data,
-                                                      self.handle)
+                 cy) = self._op('RNNForwardInferenceEx')(x, hx, cx, w,
+                                                         self.seq_lengths.data,
+                                                         self.handle)
             else:
                 (y, hy,
-                 cy) = singa.GpuRNNForwardInference(x, hx, cx, w, self.handle)
+                 cy) = self._op('RNNForwardInference')(x, hx, cx, w,
+                                                       self.handle)
 
         if self.return_sequences:
             # (seq, bs, data)
@@ -4911,20 +4942,21 @@ class _RNN(Operator):
 
         if self.use_mask:
             (dx, dhx,
-             dcx) = singa.GpuRNNBackwardxEx(self.inputs['y'], dy, dhy, dcy,
-                                            self.inputs['w'], self.inputs['hx'],
-                                            self.inputs['cx'],
+             dcx) = self._op('RNNBackwardxEx')(
+                 self.inputs['y'], dy, dhy, dcy, self.inputs['w'],
+                 self.inputs['hx'], self.inputs['cx'], self.seq_lengths.data,
+                 self.handle)
+            dW = self._op('RNNBackwardWEx')(self.inputs['x'], self.inputs['hx'],
+                                            self.inputs['y'],
                                             self.seq_lengths.data, self.handle)
-            dW = singa.GpuRNNBackwardWEx(self.inputs['x'], self.inputs['hx'],
-                                         self.inputs['y'],
-                                         self.seq_lengths.data, self.handle)
         else:
             (dx, dhx,
-             dcx) = singa.GpuRNNBackwardx(self.inputs['y'], dy, dhy, dcy,
-                                          self.inputs['w'], self.inputs['hx'],
-                                          self.inputs['cx'], self.handle)
-            dW = singa.GpuRNNBackwardW(self.inputs['x'], self.inputs['hx'],
-                                       self.inputs['y'], self.handle)
+             dcx) = self._op('RNNBackwardx')(self.inputs['y'], dy, dhy, dcy,
+                                             self.inputs['w'],
+                                             self.inputs['hx'],
+                                             self.inputs['cx'], self.handle)
+            dW = self._op('RNNBackwardW')(self.inputs['x'], self.inputs['hx'],
+                                          self.inputs['y'], self.handle)
 
         return dx, dhx, dcx, dW
 
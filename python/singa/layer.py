@@ -665,7 +665,7 @@ class Conv2d(Layer):
             _x.set_value(0.0)
 
         if _x.device.id() == -1:
-            if self.group != 1:
+            if self.group != 1 and singa.USE_DNNL:
                 raise ValueError("Not implemented yet")
             else:
                 if not hasattr(self, "handle"):
@@ -1549,7 +1549,7 @@ class Reshape(Layer):
 
 class CudnnRNN(Layer):
     """ `CudnnRNN` class implements with c++ backend and run the operation
-          directly on cuDNN
+          directly on cuDNN, or on the native cpp kernels for CPU devices
         While `RNN` class implements with high level singa API
     """
 
@@ -1569,7 +1569,6 @@ class CudnnRNN(Layer):
                 hidden_size: hidden feature dim
                 rnn_mode: accepted value: "vanilla", "tanh", "relu",  "lstm", "gru"
         """
-        assert singa.USE_CUDA, "Not able to run without CUDA"
         assert num_layers > 0, "num layers should be > 0"
         assert 0 <= dropout < 1, "dropout shouldbe >=0 and <1"
         super(CudnnRNN, self).__init__()
@@ -1599,13 +1598,18 @@ class CudnnRNN(Layer):
             x = x.transpose((1, 0, 2))
         self.input_size = x.shape[1]
 
-        # GPU handle
-        self.handle = singa.CudnnRNNHandle(x.data,
-                                           self.hidden_size,
-                                           mode=self.cudnn_rnn_mode,
-                                           num_layers=self.num_layers,
-                                           dropout=self.dropout,
-                                           bidirectional=self.bidirectional)
+        if x.device.id() == -1:
+            assert self.dropout == 0, "dropout is not supported on CPU"
+            handle_cls = singa.CpuRNNHandle
+        else:
+            assert singa.USE_CUDA, "Not able to run without CUDA"
+            handle_cls = singa.CudnnRNNHandle
+        self.handle = handle_cls(x.data,
+                                 self.hidden_size,
+                                 mode=self.cudnn_rnn_mode,
+                                 num_layers=self.num_layers,
+                                 dropout=self.dropout,
+                                 bidirectional=self.bidirectional)
 
         self.W = Tensor(shape=(self.handle.weights_size,),
                         requires_grad=True,
@@ -0,0 +1,107 @@
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+# =============================================================================
+'''Post-training int8 quantization on CppCPU.
+
+Example usage::
+
+    from singa import quantization
+
+    observers = quantization.calibrate(m, batches)
+    params = observers['linear1'].Params()
+    qx = quantization.quantize(x, params)
+    x_ = quantization.dequantize(qx)
+'''
+
+from collections import OrderedDict
+
+from . import layer
+from . import tensor
+from . import singa_wrap as singa
+
+
+def quantize(x, params):
+    '''Quantize a float32 tensor into int8.
+
+    Args:
+        x (Tensor): a float32 tensor on CppCPU
+        params (singa.QuantParams): e.g., from singa.ChooseQuantParams() or
+            RangeObserver.Params()
+
+    Returns:
+        a singa.QuantizedTensor, i.e., the int8 data and the params
+    '''
+    return singa.Quantize(x.data, params)
+
+
+def dequantize(qx):
+    '''The float32 values of the singa.QuantizedTensor qx.
+
+    Returns:
+        a new Tensor
+    '''
+    return tensor.from_raw_tensor(singa.Dequantize(qx))
+
+
+def calibrate(model, batches, layer_types=(layer.Linear, layer.Conv2d)):
+    '''Observe the range of the inputs of the layers to be quantized over
+    the sample batches, running the model in evaluation mode.
+
+    Args:
+        model (Model): the model, whose forward() takes one batch
+        batches: an iterable of input Tensors
+        layer_types (tuple): the classes of the layers to observe
+
+    Returns:
+        an OrderedDict from the layer names, in the order of their first
+        call, to singa.RangeObserver instances, whose Params() gives the
+        quantization parameters of the input of the layer
+    '''
+    observers = OrderedDict()
+    observed = []
+
+    def observe(l, name):
+        forward = l.forward
+
+        def wrapper(x, *args, **kwargs):
+            if name not in observers:
+                observers[name] = singa.RangeObserver()
+            observers[name].Observe(x.data)
+            return forward(x, *args, **kwargs)
+
+        # an instance attribute overrides the forward() of the class
+        l.forward = wrapper
+        observed.append(l)
+
+    def walk(l, prefix):
+        for name, sublayer in l._layers.items():
+            name = sublayer.name if sublayer.name else prefix + name
+            if isinstance(sublayer, layer_types):
+                observe(sublayer, name)
+            walk(sublayer, name + layer.Layer.sep)
+
+    walk(model, '')
+    training = model.training
+    model.eval()
+    try:
+        for x in batches:
+            model.forward(x)
+    finally:
+        for l in observed:
+            del l.forward
+        model.train(training)
+    return observers
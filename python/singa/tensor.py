@@ -67,6 +67,7 @@ from .device import get_default_device
 int32 = 2  #core.proto.kInt32
 float16 = 1  #core.proto.kFloat16
 float32 = 0  #core.proto.kFloat32
+bfloat16 = 6  #core.proto.kBFloat16
 CTensor = singa.Tensor
 
 
@@ -262,7 +263,8 @@ class Tensor(object):
         '''Change the data type.
 
         Args:
-            dtype: accepts 'int', 'float', 'singa.kFloat32', 'singa.kInt'
+            dtype: accepts 'int', 'float', 'singa.kFloat32', 'singa.kFloat16',
+                'singa.kBFloat16', 'singa.kInt'
 
         Returns:
             new tensor with new type
@@ -271,6 +273,8 @@ class Tensor(object):
             pass
         elif dtype == singa.kFloat16:
             pass
+        elif dtype == singa.kBFloat16:
+            pass
         elif dtype == singa.kFloat32:
             pass
         elif dtype == 'int':
@@ -287,7 +291,8 @@ class Tensor(object):
         '''Change the data type inplace.
 
         Args:
-            dtype: accepts 'int', 'float', 'singa.kFloat32', 'singa.kInt'
+            dtype: accepts 'int', 'float', 'singa.kFloat32', 'singa.kFloat16',
+                'singa.kBFloat16', 'singa.kInt'
 
         Returns:
             new tensor with new type
@@ -299,6 +304,8 @@ class Tensor(object):
             pass
         elif dtype == singa.kFloat16:
             pass
+        elif dtype == singa.kBFloat16:
+            pass
         elif dtype == 'int':
             dtype = singa.kInt
         elif dtype == 'float':
@@ -777,6 +784,7 @@ class Tensor(object):
 
     dtype_name = {
         float16: "float16",
+        bfloat16: "bfloat16",
         float32: "float32",
         int32: "int32",
     }
@@ -885,6 +893,9 @@ def from_numpy(np_array, dev=None):
     '''Create a Tensor instance with the shape, dtype and values from the numpy
     array.
 
+    numpy has no bfloat16 type; the bfloat16 arrays of extensions such as
+    ml_dtypes are converted into bfloat16 tensors through float32.
+
     Args:
         np_array: the numpy array.
 
@@ -892,6 +903,13 @@ def from_numpy(np_array, dev=None):
         A Tensor instance allocated on the default CppCPU device.
     '''
     assert type(np_array) is np.ndarray, 'Must input numpy array'
+    if np_array.dtype.name == 'bfloat16':
+        ret = from_numpy(np_array.astype(np.float32))
+        ret.to_type(bfloat16)
+        if dev:
+            ret.to_device(dev)
+        return ret
+
     # convert to float32 array
     if np_array.dtype == np.float64 or np_array.dtype == np.float:
         np_array = np_array.astype(np.float32)
@@ -914,6 +932,27 @@ def from_numpy(np_array, dev=None):
     return ret
 
 
+def from_mmap(path, offset, shape, dtype=float32):
+    '''Create a host Tensor over the elements at byte 'offset' of the file
+    'path' without reading them, e.g., the large read-only weights of a
+    pretrained model. The file is memory-mapped, so the pages are loaded on
+    demand and shared with other processes through the page cache; writes to
+    the tensor never change the file.
+
+    Args:
+        path (str): the file path
+        offset (int): the byte offset of the first element in the file
+        shape (tuple<int>): the tensor shape
+        dtype: the data type of the elements
+
+    Returns:
+        A Tensor instance on the default CppCPU device.
+    '''
+    t = CTensor.FromMmap(path, offset, list(shape), dtype)
+    # wrap t without allocating a new tensor as from_raw_tensor() does
+    return Tensor(device=t.device(), data=t)
+
+
 def to_host(t):
     '''Copy the data to a host tensor.
 
@@ -929,7 +968,8 @@ def to_host(t):
 
 
 def to_numpy(t):
-    '''Copy the tensor into a numpy array.
+    '''Copy the tensor into a numpy array. A bfloat16 tensor gives a float32
+    array, as numpy has no bfloat16 type.
 
     Args:
         t (Tensor): a Tensor
@@ -938,6 +978,8 @@ def to_numpy(t):
         a numpy array
     '''
     th = to_host(t)
+    if th.dtype == bfloat16:
+        th = th.as_type(float32)
     if th.dtype == float32:
         np_array = th.data.GetFloatValue(int(th.size()))
     elif th.dtype == float16:
@@ -1846,3 +1888,86 @@ def ones(shape, device=get_default_device()):
     ret = Tensor(shape, device=device)
     ret.set_value(1.0)
     return ret
+
+
+class SparseTensor(object):
+    '''Python SparseTensor, which wraps a swig converted SparseTensor, i.e., a
+    float32 matrix in the CSR or COO format. Only the CppCPU device supports
+    sparse tensors.
+
+    Args:
+        data: a swig SparseTensor.
+    '''
+
+    def __init__(self, data):
+        self.data = data
+        self.shape = tuple(data.shape())
+        self.device = data.device()
+
+    @classmethod
+    def from_csr(cls, shape, values, indptr, indices, device=None):
+        '''Create a CSR tensor from numpy arrays, e.g., those of a
+        scipy.sparse.csr_matrix.
+
+        Args:
+            shape (tuple<int>): (rows, columns)
+            values: the values of the entries
+            indptr: the offsets of the rows, i.e., rows + 1 of them
+            indices: the columns of the entries
+        '''
+        return cls._create(shape, singa.kCSR, values, indptr, indices, device)
+
+    @classmethod
+    def from_coo(cls, shape, values, rows, cols, device=None):
+        '''Create a COO tensor from numpy arrays of the values and the row and
+        column of every entry; duplicated entries are summed.
+        '''
+        return cls._create(shape, singa.kCOO, values, rows, cols, device)
+
+    @classmethod
+    def _create(cls, shape, fmt, values, rows, cols, device):
+        values = from_numpy(np.asarray(values, dtype=np.float32), device)
+        rows = from_numpy(np.asarray(rows, dtype=np.int32), device)
+        cols = from_numpy(np.asarray(cols, dtype=np.int32), device)
+        return cls(
+            singa.SparseTensor(list(shape), fmt, values.data, rows.data,
+                               cols.data))
+
+    @classmethod
+    def from_dense(cls, t, fmt=singa.kCSR):
+        '''Create a sparse tensor from the non-zero entries of the 2-d
+        Tensor t.
+        '''
+        return cls(singa.SparseTensor.FromDense(t.data, fmt))
+
+    def to_dense(self):
+        return _call_singa_func(self.data.ToDense)
+
+    def to_csr(self):
+        return SparseTensor(self.data.ToCSR())
+
+    def to_coo(self):
+        return SparseTensor(self.data.ToCOO())
+
+    def transpose(self):
+        return SparseTensor(self.data.Transpose())
+
+    @property
+    def T(self):
+        return self.transpose()
+
+    def nnz(self):
+        return self.data.nnz()
+
+    def matmul(self, rhs):
+        '''Return self * rhs for the dense Tensor (matrix or vector) rhs.'''
+        return _call_singa_func(singa.SparseMult, self.data, rhs.data)
+
+    def __matmul__(self, rhs):
+        return self.matmul(rhs)
+
+    def mult(self, rhs):
+        '''Return the element-wise product with the dense Tensor rhs, which
+        keeps the sparsity of self.
+        '''
+        return SparseTensor(singa.SparseEltwiseMult(self.data, rhs.data))
@@ -29,6 +29,7 @@
 
 %{
 #include "singa/core/device.h"
+#include "singa/utils/trace.h"
 %}
 
 /* smart pointer to avoid memory leak */
@@ -43,23 +44,43 @@ namespace std{
 
 namespace singa{
 
+enum LangType { kCpp, kCuda, kOpencl };
+
 class Device {
  public:
   virtual void SetRandSeed(unsigned seed) = 0;
   std::shared_ptr<Device> host();
   void Reset();
   int id() const;
+  LangType lang() const;
   virtual void Sync();
   void ResetGraph();
   void RunGraph(bool serial = false);
   bool graph_enabled() const;
   void EnableGraph(bool enable);
+  void EnableMemoryPlan(bool enable);
+  size_t GetPlannedPeakMem() const;
+  void EnableFusion(bool enable);
   void PrintTimeProfiling();
   void SetVerbosity(int verbosity);
   void SetSkipIteration(int skip_iteration);
   static void EnableLazyAlloc(bool enbale);
 };
 
+class TraceRecorder {
+ public:
+  static TraceRecorder* Global();
+  void Start(size_t max_events = 1 << 20);
+  void Stop();
+  bool enabled() const;
+  size_t num_events() const;
+  size_t num_dropped() const;
+  bool Dump(const std::string& path);
+
+ private:
+  TraceRecorder();
+};
+
 class Platform {
  public:
 #if USE_CUDA
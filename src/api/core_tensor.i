@@ -30,6 +30,7 @@
 %{
 #define SWIG_FILE_WITH_INIT
 #include "singa/core/tensor.h"
+#include "singa/core/sparse_tensor.h"
 #include "singa/core/device.h"
 #include "singa/proto/core.pb.h"
 // #include "singa/proto/model.pb.h"
@@ -84,7 +85,7 @@ namespace std {
 namespace singa{
 
   enum DataType {
-    kFloat32, kFloat16, kInt, kChar, kDouble
+    kFloat32, kFloat16, kInt, kChar, kDouble, kUChar, kBFloat16
   };
 
   inline size_t Product(const std::vector<size_t> &shape,
@@ -122,6 +123,8 @@ namespace singa{
     size_t nDim() const;
 
     bool initialized() const;
+    void SetConstant(bool constant = true) const;
+    bool constant() const;
     size_t Size() const;
     size_t MemSize() const;
 
@@ -144,6 +147,9 @@ namespace singa{
     void RepeatData(std::vector<size_t> repeats, int axis, int total_repeats, const Tensor &src);
 
     Tensor Clone() const;
+    static Tensor FromMmap(const std::string &path, size_t offset,
+                           const std::vector<size_t> &shape,
+                           DataType dtype = kFloat32);
     Tensor Repeat(std::vector<size_t> repeats, int axis);
 
 
@@ -182,6 +188,10 @@ namespace singa{
   void CopyDataToFrom(Tensor *dst, const Tensor &src, size_t num,
                       size_t src_offset = 0, size_t dst_offset = 0);
 
+  void CopyDataToFrom2D(Tensor *dst, const Tensor &src, size_t width,
+                        size_t height, size_t dst_pitch, size_t src_pitch,
+                        size_t dst_offset = 0, size_t src_offset = 0);
+
   void RepeatDataToFrom(bool broadcast_flag, std::vector<size_t> repeats, int axis,
                         Tensor *dst, const Tensor &src, const size_t num);
 
@@ -225,10 +235,23 @@ namespace singa{
   %template(SumAsFloat) Sum<float>;
   Tensor SumAll(const Tensor &t);
 
+  Tensor ReduceSum(const Tensor &in, const std::vector<int> &axes,
+                   bool keepdims = false);
+  Tensor ReduceMean(const Tensor &in, const std::vector<int> &axes,
+                    bool keepdims = false);
+  Tensor ReduceMax(const Tensor &in, const std::vector<int> &axes,
+                   bool keepdims = false);
+  Tensor ReduceMin(const Tensor &in, const std::vector<int> &axes,
+                   bool keepdims = false);
+  Tensor ArgMax(const Tensor &in, int axis, bool keepdims = false);
+  Tensor ArgMin(const Tensor &in, int axis, bool keepdims = false);
+
   Tensor Average(const Tensor &t, int axis);
   Tensor SoftMax(const Tensor &t);
   Tensor SoftMax(const Tensor &t, int axis);
   Tensor SoftMaxBackward(const Tensor &t, int axis, const Tensor &fdout);
+  Tensor LogSoftMax(const Tensor &t);
+  Tensor LogSoftMax(const Tensor &t, int axis);
 
   Tensor Pow(const Tensor &base, const Tensor &exp);
 
@@ -383,9 +406,48 @@ namespace singa{
   void SoftMax(const Tensor &in, Tensor *out);
   Tensor SoftMax(const Tensor &in, int axis);
   void SoftMax(const Tensor &in, Tensor *out, int axis);
+  void LogSoftMax(const Tensor &in, Tensor *out);
+  void LogSoftMax(const Tensor &in, Tensor *out, int axis);
 
   Tensor CrossEntropyFwd(const Tensor& p, const Tensor& t);
   Tensor SoftmaxCrossEntropyBwd(const Tensor& p, const Tensor& t);
+  Tensor SoftmaxCrossEntropyFwd(const Tensor& x, const Tensor& t,
+                                Tensor* lse, float smoothing = 0.f);
+  Tensor SoftmaxCrossEntropyBwd(const Tensor& x, const Tensor& t,
+                                const Tensor& lse, float smoothing = 0.f);
+
+  /* =========== Sparse tensors ==========*/
+
+  enum SparseFormat { kCSR = 0, kCOO = 1 };
+
+  class SparseTensor {
+   public:
+    SparseTensor();
+    SparseTensor(const std::vector<size_t> &shape, SparseFormat format,
+                 const Tensor &values, const Tensor &rows,
+                 const Tensor &cols);
+    static SparseTensor FromDense(const Tensor &dense,
+                                  SparseFormat format = kCSR);
+    Tensor ToDense() const;
+    SparseTensor ToFormat(SparseFormat format) const;
+    SparseTensor ToCSR() const;
+    SparseTensor ToCOO() const;
+    SparseTensor Transpose() const;
+
+    const std::vector<size_t> &shape() const;
+    SparseFormat format() const;
+    size_t nnz() const;
+    std::shared_ptr<singa::Device> device() const;
+    const Tensor &values() const;
+    const Tensor &rows() const;
+    const Tensor &cols() const;
+  };
+
+  %rename(SparseMult) Mult(const SparseTensor &A, const Tensor &B);
+  Tensor Mult(const SparseTensor &A, const Tensor &B);
+  %rename(SparseEltwiseMult) EltwiseMult(const SparseTensor &A,
+                                         const Tensor &B);
+  SparseTensor EltwiseMult(const SparseTensor &A, const Tensor &B);
 
   void InitLogging(const char* argv);
 }
@@ -29,9 +29,12 @@
 #include "../src/model/operation/batchnorm.h"
 #include "../src/model/operation/pooling.h"
 #include "../src/model/operation/rnn.h"
+#include "../src/model/operation/quantization.h"
 
 %}
 
+%template(VecFloat) std::vector<float>;
+
 namespace singa {
 
 class ConvHandle {
@@ -70,7 +73,6 @@ class BatchNormHandle{
     float factor;
 };
 
-#if USE_DNNL
 Tensor CpuBatchNormForwardInference(const BatchNormHandle &bnh,
                                     const Tensor &x,
                                     const Tensor &bnScale,
@@ -90,7 +92,6 @@ const std::vector<Tensor> CpuBatchNormBackwardx(const BatchNormHandle &bnh,
                                                 const Tensor &x,
                                                 const Tensor &bnScale, const Tensor &bnBias,
                                                 const Tensor &mean, const Tensor &var);
-#endif //USE_DNNL
 
 
 class PoolingHandle {
@@ -111,11 +112,76 @@ class PoolingHandle {
   bool is_max_pooling;
 };
 
-#if USE_DNNL
 Tensor CpuPoolingForward(const PoolingHandle &ph, const Tensor &x);
 Tensor CpuPoolingBackward(const PoolingHandle &ph, const Tensor &dy,
                               const Tensor& x, const Tensor& y);
-#endif //USE_DNNL
+
+class CpuRNNHandle {
+ public:
+  CpuRNNHandle(const Tensor &x,
+               const int hidden_size, const int mode = 0,
+               const int num_layers = 1, const int bias = 1,
+               const float dropout = 0.0f, const int bidirectional = 0);
+  int bias;
+  int mode;
+  float dropout;
+  int bidirectional;
+  size_t feature_size;
+  size_t hidden_size;
+  size_t weights_size;
+  size_t num_layers;
+  size_t batch_size;
+  size_t seq_length;
+  Tensor workspace;
+  Tensor reserve_space;
+};
+
+std::vector<Tensor> CpuRNNForwardTraining(const Tensor &x, const Tensor &hx, const Tensor &cx, const Tensor &W, CpuRNNHandle &h);
+std::vector<Tensor> CpuRNNForwardInference(const Tensor &x, const Tensor &hx, const Tensor &cx, const Tensor &W, CpuRNNHandle &h);
+std::vector<Tensor> CpuRNNBackwardx(const Tensor &y, const Tensor &dy, const Tensor &dhy, const Tensor &dcy, const Tensor &W, const Tensor &hx, const Tensor &cx, CpuRNNHandle &h);
+Tensor CpuRNNBackwardW(const Tensor &x, const Tensor &hx, const Tensor &y, CpuRNNHandle &h);
+
+void CpuRNNSetParam(int linLayerID, int pseudoLayer, Tensor &weights, Tensor &paramValues, bool is_bias, CpuRNNHandle &h);
+Tensor CpuRNNGetParamCopy(int linLayerID, int pseudoLayer, Tensor &weights, bool is_bias, CpuRNNHandle &h);
+
+std::vector<Tensor> CpuRNNForwardTrainingEx(const Tensor &x, const Tensor &hx, const Tensor &cx, const Tensor &W, const Tensor &seq_lengths, CpuRNNHandle &h);
+std::vector<Tensor> CpuRNNForwardInferenceEx(const Tensor &x, const Tensor &hx, const Tensor &cx, const Tensor &W, const Tensor &seq_lengths, CpuRNNHandle &h);
+std::vector<Tensor> CpuRNNBackwardxEx(const Tensor &y, const Tensor &dy, const Tensor &dhy, const Tensor &dcy, const Tensor &W, const Tensor &hx, const Tensor &cx, const Tensor &seq_lengths, CpuRNNHandle &h);
+Tensor CpuRNNBackwardWEx(const Tensor &x, const Tensor &hx, const Tensor &y, const Tensor &seq_lengths, CpuRNNHandle &h);
+
+
+struct QuantParams {
+  std::vector<float> scale;
+  std::vector<int> zero_point;
+  int axis;
+};
+
+QuantParams ChooseQuantParams(float min, float max, bool symmetric = false);
+QuantParams ChooseQuantParams(const std::vector<float> &min,
+                              const std::vector<float> &max, int axis,
+                              bool symmetric = true);
+
+struct QuantizedTensor {
+  Tensor data;
+  QuantParams params;
+};
+
+QuantizedTensor Quantize(const Tensor &in, const QuantParams &params);
+Tensor Dequantize(const QuantizedTensor &in);
+Tensor MultInt8(const Tensor &A, const Tensor &B);
+Tensor QuantizedDense(const QuantizedTensor &x, const QuantizedTensor &W,
+                      const Tensor &b);
+Tensor QuantizedConvForward(const QuantizedTensor &x,
+                            const QuantizedTensor &W, const Tensor &b,
+                            const ConvHandle &ch);
+
+class RangeObserver {
+ public:
+  void Observe(const Tensor &t);
+  float min() const;
+  float max() const;
+  QuantParams Params(bool symmetric = false) const;
+};
 
 
 #if USE_CUDNN
@@ -18,28 +18,126 @@
 
 #include "singa/core/common.h"
 
+#include <algorithm>
+
 #include "singa/core/device.h"
 
 namespace singa {
 
+Block::Block(Block* parent, size_t size, size_t offset)
+    : size_(size), offset_(offset), device_(parent->device_), parent_(parent) {
+  CHECK_LE(offset + size, parent->size()) << "The view is out of range";
+  ref_count_ = 1;
+  parent_->IncRefCount();
+  parent_->AddView(this);
+}
+
+Block::Block(void* ptr, size_t size, Device* device,
+             std::function<void(void*)> deleter)
+    : data_(ptr),
+      size_(size),
+      initialized_(true),
+      borrowed_(true),
+      deleter_(std::move(deleter)),
+      device_(device) {
+  ref_count_ = 1;
+}
+
+Block::~Block() {
+  if (borrowed_ && deleter_) deleter_(data_);
+  if (parent_ != nullptr) parent_->RemoveView(this);
+}
+
 void* Block::mutable_data() {
+  if (constant_) set_cache(nullptr);
+  if (num_views_.load() > 0) DetachViews();
   if (data_ == nullptr && size_ > 0) {
-    data_ = device_->Malloc((int)size_);
+    data_ = device_->Malloc(size_);
+    // copy on write
+    if (parent_ != nullptr) {
+      if (parent_->initialized()) {
+        auto direct = device_->lang() == kCpp ? kHostToHost : kDeviceToDevice;
+        device_->CopyDataToFrom(this, parent_, size_, direct, 0, offset_,
+                                device_->context(0));
+      }
+      parent_->RemoveView(this);
+    }
   }
   initialized_ = true;
+  if (parent_ != nullptr) return data_;
   return static_cast<char*>(data_) + offset_;
 }
 
 const void* Block::data() const {
+  if (shares_parent())
+    return static_cast<const char*>(parent_->data()) + offset_;
   CHECK(initialized_) << "Must initialize data before reading it";
+  if (parent_ != nullptr) return data_;
   return static_cast<char*>(data_) + offset_;
 }
 
 void Block::free_data() {
+  if (constant_) set_cache(nullptr);
+  // borrowed memory lives as long as the block
+  if (borrowed_) return;
   if (data_) {
-    device_->Free(data_);
+    if (!external_data_) device_->Free(data_);
     data_ = nullptr;
     initialized_ = false;
+    external_data_ = false;
+  }
+  if (parent_ != nullptr) parent_->AddView(this);
+}
+
+void Block::release_view() {
+  free_data();
+  if (parent_ != nullptr) parent_->RemoveView(this);
+}
+
+void Block::AddView(Block* view) {
+  std::lock_guard<std::mutex> lock(views_mutex_);
+  if (std::find(views_.begin(), views_.end(), view) == views_.end())
+    views_.push_back(view);
+  num_views_ = views_.size();
+}
+
+void Block::RemoveView(Block* view) {
+  std::lock_guard<std::mutex> lock(views_mutex_);
+  auto it = std::find(views_.begin(), views_.end(), view);
+  if (it != views_.end()) views_.erase(it);
+  num_views_ = views_.size();
+}
+
+void Block::DetachViews() {
+  // views of uninitialized memory have nothing to keep
+  if (!initialized()) return;
+  std::vector<Block*> views;
+  {
+    std::lock_guard<std::mutex> lock(views_mutex_);
+    views.swap(views_);
+    num_views_ = 0;
+  }
+  // the first write to a view copies its range from this block
+  for (auto view : views) view->mutable_data();
+}
+
+void Block::set_constant(bool constant) {
+  constant_ = constant;
+  if (!constant) set_cache(nullptr);
+}
+
+std::shared_ptr<BlockCache> Block::cache() const {
+  return std::atomic_load(&cache_);
+}
+
+void Block::set_cache(std::shared_ptr<BlockCache> cache) {
+  std::atomic_store(&cache_, std::move(cache));
+}
+
+void Block::use_external_data(void* ptr) {
+  if (data_ == nullptr) {
+    data_ = ptr;
+    external_data_ = true;
   }
 }
 
@@ -16,36 +16,85 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cstring>
+
 #include "singa/core/device.h"
+#include "singa/utils/thread_pool.h"
 
 namespace singa {
 
 std::shared_ptr<Device> defaultDevice = std::make_shared<CppCPU>();
 
 CppCPU::CppCPU() : Device(-1, 1) {
+  pool_ = std::make_shared<CppMemPool>(true, false,
+                                       CppMemPool::DefaultMaxCacheSize());
+  Setup();
+}
+
+CppCPU::CppCPU(std::shared_ptr<DeviceMemPool> pool) : Device(-1, 1) {
+  CHECK(pool != nullptr);
+  pool_ = pool;
+  Setup();
+}
+
+void CppCPU::Setup() {
   lang_ = kCpp;
+  ctx_.num_threads = ThreadPool::HardwareConcurrency();
 #ifdef USE_DNNL
   ctx_.dnnl_engine = dnnl::engine(dnnl::engine::kind::cpu, 0);
   ctx_.dnnl_stream = dnnl::stream(ctx_.dnnl_engine);
 #endif  // USE_DNNL
+  CreateExecutors();
   // host_ = nullptr;
 }
 
-CppCPU::~CppCPU(){};
+CppCPU::~CppCPU() {
+  // the graph frees its memory via Free(), which is gone in ~Device()
+  ResetGraph();
+}
+
+void CppCPU::SetRandSeed(unsigned seed) {
+  ctx_.random_generator.seed(seed);
+  ctx_.random_seed = seed;
+  ctx_.random_stream = 0;
+}
+
+void CppCPU::SetNumThreads(int num) {
+  CHECK_GT(num, 0);
+  ctx_.num_threads = num;
+  CreateExecutors();
+  ThreadPool::Global()->Reserve(num - 1);
+}
+
+void CppCPU::CreateExecutors() {
+  while (executor_ctx_.size() + 1 < static_cast<size_t>(ctx_.num_threads)) {
+    executor_ctx_.emplace_back(new Context(ctx_));
+#ifdef USE_DNNL
+    executor_ctx_.back()->dnnl_stream = dnnl::stream(ctx_.dnnl_engine);
+#endif  // USE_DNNL
+  }
+}
 
-void CppCPU::SetRandSeed(unsigned seed) { ctx_.random_generator.seed(seed); }
+Context* CppCPU::ExecutorContext(int executor) {
+  if (executor == 0) return &ctx_;
+  CHECK(executor > 0 && static_cast<size_t>(executor) <= executor_ctx_.size())
+      << "No context for executor " << executor;
+  Context* ctx = executor_ctx_[executor - 1].get();
+  ctx->num_threads = ctx_.num_threads;
+  ctx->math_accuracy = ctx_.math_accuracy;
+  return ctx;
+}
 
 void CppCPU::DoExec(function<void(Context*)>&& fn, int executor) {
-  CHECK_EQ(executor, 0);
-  fn(&ctx_);
+  fn(ExecutorContext(executor));
 }
 
 void CppCPU::TimeProfilingDoExec(function<void(Context*)>&& fn, int executor,
                                  Node* node) {
-  CHECK_EQ(executor, 0);
-
+  Context* ctx = ExecutorContext(executor);
   auto t_start = std::chrono::high_resolution_clock::now();
-  fn(&ctx_);
+  fn(ctx);
   std::chrono::duration<float> duration =
       std::chrono::high_resolution_clock::now() - t_start;
   node->time_elapsed_inc(duration.count());
@@ -53,18 +102,24 @@ void CppCPU::TimeProfilingDoExec(function<void(Context*)>&& fn, int executor,
 
 void CppCPU::EvaluateTimeElapsed(Node* node) {}
 
-void* CppCPU::Malloc(int size) {
-  if (size > 0) {
-    void* ptr = malloc(size);
-    memset(ptr, 0, size);
-    return ptr;
-  } else {
-    return nullptr;
-  }
+size_t CppCPU::GetAllocatedMem() {
+  auto ret = pool_->GetMemUsage();
+  return ret.second - ret.first;
+}
+
+void CppCPU::ReleaseCache() {
+  auto pool = std::dynamic_pointer_cast<CppMemPool>(pool_);
+  if (pool != nullptr) pool->ReleaseCache();
+}
+
+void* CppCPU::Malloc(size_t size) {
+  void* ptr = nullptr;
+  if (size > 0) pool_->Malloc(&ptr, size);
+  return ptr;
 }
 
 void CppCPU::Free(void* ptr) {
-  if (ptr != nullptr) free(ptr);
+  if (ptr != nullptr) pool_->Free(ptr);
 }
 
 void CppCPU::CopyToFrom(void* dst, const void* src, size_t nBytes,
@@ -72,4 +127,18 @@ void CppCPU::CopyToFrom(void* dst, const void* src, size_t nBytes,
   memcpy(dst, src, nBytes);
 }
 
+void CppCPU::CopyToFrom2D(void* dst, size_t dst_pitch, const void* src,
+                          size_t src_pitch, size_t width, size_t height,
+                          CopyDirection direction, Context* ctx) {
+  // at least 64KB per thread
+  size_t grain = std::max<size_t>(1, (1 << 16) / std::max<size_t>(width, 1));
+  ParallelFor(0, height, grain, ctx ? ctx->num_threads : 1,
+              [=](size_t begin, size_t end) {
+                for (size_t row = begin; row < end; row++)
+                  memcpy(static_cast<char*>(dst) + row * dst_pitch,
+                         static_cast<const char*>(src) + row * src_pitch,
+                         width);
+              });
+}
+
 }  // namespace singa
@@ -34,6 +34,8 @@ const cudaMemcpyKind copyKind[] = {cudaMemcpyHostToHost, cudaMemcpyHostToDevice,
                                    cudaMemcpyDeviceToDevice};
 
 CudaGPU::~CudaGPU() {
+  // the graph frees its memory via Free(), which is gone in ~Device()
+  ResetGraph();
   if (ctx_.cublas_handle) CUBLAS_CHECK(cublasDestroy(ctx_.cublas_handle));
   if (ctx_.curand_generator)
     CURAND_CHECK(curandDestroyGenerator(ctx_.curand_generator));
@@ -174,6 +176,13 @@ void CudaGPU::CopyToFrom(void* dst, const void* src, size_t nBytes,
   cudaMemcpyAsync(dst, src, nBytes, copyKind[direction], ctx_.stream);
 }
 
+void CudaGPU::CopyToFrom2D(void* dst, size_t dst_pitch, const void* src,
+                           size_t src_pitch, size_t width, size_t height,
+                           CopyDirection direction, Context* ctx) {
+  cudaMemcpy2DAsync(dst, dst_pitch, src, src_pitch, width, height,
+                    copyKind[direction], ctx_.stream);
+}
+
 size_t CudaGPU::GetAllocatedMem() {
   if (pool_ != nullptr) {
     auto ret = pool_->GetMemUsage();
@@ -184,7 +193,7 @@ size_t CudaGPU::GetAllocatedMem() {
 }
 
 /// Allocate gpu memory.
-void* CudaGPU::Malloc(int size) {
+void* CudaGPU::Malloc(size_t size) {
   void* ptr = nullptr;
   if (size > 0) {
     CUDA_CHECK(cudaSetDevice(id_));
@@ -18,6 +18,8 @@
 
 #include "singa/core/device.h"
 
+#include "singa/utils/trace.h"
+
 namespace singa {
 
 bool Device::lazy_alloc_ = true;
@@ -55,12 +57,27 @@ void Device::Reset() {
 void Device::Exec(function<void(Context*)>&& fn,
                   const vector<Block*> read_blocks,
                   const vector<Block*> write_blocks, string op_name,
-                  bool use_rand_generator) {
+                  bool use_rand_generator, EltwiseOpPtr eltwise) {
   if (graph_enabled_ == true) {
-    graph_->AddOperation(std::move(fn), read_blocks, write_blocks, op_name);
-  } else {
+    graph_->AddOperation(std::move(fn), read_blocks, write_blocks, op_name,
+                         use_rand_generator, std::move(eltwise));
+  } else if (!TraceRecorder::Global()->enabled()) {
     // printf("immediately ops\n");
     DoExec(std::move(fn), 0);
+  } else {
+    TraceRecorder* trace = TraceRecorder::Global();
+    TraceEvent event;
+    event.start = trace->Now();
+    DoExec(std::move(fn), 0);
+    event.end = trace->Now();
+    event.name = op_name;
+    event.category = "eager";
+    event.device = id_;
+    for (auto blk : read_blocks)
+      if (blk) event.read_bytes += blk->size();
+    for (auto blk : write_blocks)
+      if (blk) event.write_bytes += blk->size();
+    trace->Record(std::move(event));
   }
 }
 
@@ -84,10 +101,7 @@ void Device::RunGraph(bool serial) {
 void Device::PrintTimeProfiling() { graph_->PrintTimeProfiling(); }
 
 // Todo(Wangwei) Get Block From The Memory manager
-Block* Device::NewBlock(int size) {
-  CHECK_GE(size, 0)
-      << "size is negative, could be caused by the type cast "
-      << "from size_t to int. In that case, the size is too large.";
+Block* Device::NewBlock(size_t size) {
   if (size > 0) {
     void* ptr = nullptr;
     if (!lazy_alloc_) {
@@ -103,19 +117,46 @@ Block* Device::NewBlock(int size) {
 // TODO(wangwei) return Block to the memory manager
 void Device::FreeBlock(Block* block) {
   if (block != nullptr) {
-    Free(block->mutable_data());
+    Block* parent = block->parent();
+    block->free_data();
     delete block;
+    if (parent != nullptr && parent->DecRefCount() == 0) FreeBlock(parent);
   }
 }
 
 void Device::CopyDataToFrom(Block* dst, Block* src, size_t nBytes,
-                            CopyDirection direct, int dst_offset,
-                            int src_offset, Context* ctx) {
+                            CopyDirection direct, size_t dst_offset,
+                            size_t src_offset, Context* ctx) {
   this->CopyToFrom(reinterpret_cast<char*>(dst->mutable_data()) + dst_offset,
                    reinterpret_cast<const char*>(src->data()) + src_offset,
                    nBytes, direct, ctx);
 }
 
+void Device::CopyDataToFrom2D(Block* dst, Block* src, size_t width,
+                              size_t height, size_t dst_pitch,
+                              size_t src_pitch, CopyDirection direct,
+                              size_t dst_offset, size_t src_offset,
+                              Context* ctx) {
+  if (height == 0 || width == 0) return;
+  CHECK_LE(width, dst_pitch);
+  CHECK_LE(width, src_pitch);
+  CHECK_LE(dst_offset + (height - 1) * dst_pitch + width, dst->size());
+  CHECK_LE(src_offset + (height - 1) * src_pitch + width, src->size());
+  this->CopyToFrom2D(reinterpret_cast<char*>(dst->mutable_data()) + dst_offset,
+                     dst_pitch,
+                     reinterpret_cast<const char*>(src->data()) + src_offset,
+                     src_pitch, width, height, direct, ctx);
+}
+
+void Device::CopyToFrom2D(void* dst, size_t dst_pitch, const void* src,
+                          size_t src_pitch, size_t width, size_t height,
+                          CopyDirection direction, Context* ctx) {
+  for (size_t row = 0; row < height; row++)
+    CopyToFrom(static_cast<char*>(dst) + row * dst_pitch,
+               static_cast<const char*>(src) + row * src_pitch, width,
+               direction, ctx);
+}
+
 void Device::CopyDataFromHostPtr(Block* dst, const void* src, size_t nBytes,
                                  size_t dst_offset, Context* ctx) {
   auto direct = lang_ == kCpp ? kHostToHost : kHostToDevice;
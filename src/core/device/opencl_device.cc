@@ -58,8 +58,8 @@ OpenclDevice::~OpenclDevice() {
 void OpenclDevice::SetRandSeed(unsigned seed) { seed = seed; }
 
 void OpenclDevice::CopyDataToFrom(Block* dst, Block* src, size_t nBytes,
-                                  CopyDirection direction, int dst_offset,
-                                  int src_offset, Context* ctx) {
+                                  CopyDirection direction, size_t dst_offset,
+                                  size_t src_offset, Context* ctx) {
   // Pointers must be valid.
   if (!dst || !src) return;
 
@@ -133,7 +133,7 @@ void OpenclDevice::CopyToFrom(void* dst, const void* src, size_t nBytes,
   }
 }
 
-void* OpenclDevice::Malloc(int size) {
+void* OpenclDevice::Malloc(size_t size) {
   cl_mem buffer = memory_create(ocl::current_context(), size, nullptr);
 
   return static_cast<void*>(buffer);
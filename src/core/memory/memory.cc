@@ -19,11 +19,158 @@
 
 #include "singa/core/memory.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 #include "singa/proto/core.pb.h"
 #include "singa/utils/logging.h"
 
+#ifdef __linux__
+#include <sys/mman.h>
+#endif  // __linux__
+#ifndef _WIN32
+#include <unistd.h>
+#endif  // _WIN32
+
+namespace singa {
+namespace {
+const size_t kAlignment = 64;
+const size_t kHugePageSize = 2u << 20;
+}  // namespace
+
+CppMemPool::CppMemPool(bool zero_memory, bool huge_pages,
+                       size_t max_cache_size)
+    : zero_memory_(zero_memory),
+      huge_pages_(huge_pages),
+      max_cache_size_(max_cache_size) {}
+
+CppMemPool::~CppMemPool() { ReleaseCache(); }
+
+size_t CppMemPool::SizeClass(size_t size) {
+  if (size <= kAlignment) return kAlignment;
+  // step is a quarter of the largest power of two below size
+  size_t step = 1;
+  while (step * 2 < size) step *= 2;
+  step = std::max(step / 4, kAlignment);
+  return (size + step - 1) / step * step;
+}
+
+void* CppMemPool::SystemMalloc(size_t size) {
+  void* ptr = nullptr;
+  size_t alignment = kAlignment;
+  if (huge_pages_ && size >= kHugePageSize) alignment = kHugePageSize;
+  int status = posix_memalign(&ptr, alignment, size);
+  CHECK_EQ(status, 0) << "Failed to allocate " << size << " bytes";
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (alignment == kHugePageSize) madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+  return ptr;
+}
+
+void CppMemPool::Malloc(void** ptr, const size_t size) {
+  *ptr = nullptr;
+  if (size == 0) return;
+  size_t cls = SizeClass(size);
+  if (huge_pages_ && cls >= kHugePageSize)
+    cls = (cls + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    num_mallocs_++;
+    auto it = free_lists_.find(cls);
+    if (it != free_lists_.end() && !it->second.empty()) {
+      *ptr = it->second.back();
+      it->second.pop_back();
+      cached_ -= cls;
+      num_hits_++;
+    }
+  }
+  // allocate outside of the lock
+  if (*ptr == nullptr) *ptr = SystemMalloc(cls);
+  if (zero_memory_) memset(*ptr, 0, size);
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  allocated_[*ptr] = cls;
+  in_use_ += cls;
+  peak_ = std::max(peak_, in_use_);
+}
+
+void CppMemPool::Free(void* ptr) {
+  if (ptr == nullptr) return;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = allocated_.find(ptr);
+    CHECK(it != allocated_.end()) << "The memory is not from this pool";
+    size_t cls = it->second;
+    allocated_.erase(it);
+    in_use_ -= cls;
+    if (max_cache_size_ == 0 || cached_ + cls <= max_cache_size_) {
+      free_lists_[cls].push_back(ptr);
+      cached_ += cls;
+      return;
+    }
+  }
+  free(ptr);
+}
+
+std::pair<size_t, size_t> CppMemPool::GetMemUsage() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return std::make_pair(cached_, cached_ + in_use_);
+}
+
+void CppMemPool::ReleaseCache() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  for (auto& list : free_lists_)
+    for (void* ptr : list.second) free(ptr);
+  free_lists_.clear();
+  cached_ = 0;
+}
+
+void CppMemPool::SetMaxCacheSize(size_t size) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  max_cache_size_ = size;
+  if (size == 0) return;
+  for (auto& list : free_lists_) {
+    while (cached_ > size && !list.second.empty()) {
+      free(list.second.back());
+      list.second.pop_back();
+      cached_ -= list.first;
+    }
+  }
+}
+
+size_t CppMemPool::max_cache_size() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return max_cache_size_;
+}
+
+size_t CppMemPool::DefaultMaxCacheSize() {
+  size_t total = 0;
+#ifdef _SC_PHYS_PAGES
+  const long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGE_SIZE);
+  if (pages > 0 && page > 0)
+    total = static_cast<size_t>(pages) * static_cast<size_t>(page);
+#endif  // _SC_PHYS_PAGES
+  return total > 0 ? total / 8 : size_t(1) << 30;
+}
+
+size_t CppMemPool::peak_usage() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return peak_;
+}
+
+size_t CppMemPool::num_mallocs() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return num_mallocs_;
+}
+
+size_t CppMemPool::num_hits() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return num_hits_;
+}
+}  // namespace singa
+
 #ifdef USE_CUDA
 
 namespace singa {
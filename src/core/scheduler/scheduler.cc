@@ -19,16 +19,120 @@
 #include "singa/core/scheduler.h"
 
 #include <algorithm>
+#include <deque>
 #include <functional>
 #include <iomanip>
 #include <sstream>
 #include <thread>
 
 #include "singa/core/device.h"
+#include "singa/core/tensor.h"
 #include "singa/utils/safe_queue.h"
+#include "singa/utils/thread_pool.h"
+#include "singa/utils/trace.h"
 
 namespace singa {
 
+namespace {
+// elements computed at a time by each stage of a fused node; the tiles of the
+// intermediate outputs stay in cache
+const size_t kFusionTile = 2048;
+
+// a tensor of n floats without memory, which SetTile() points at a tile
+Tensor TileTensor(size_t n, const std::shared_ptr<Device> &dev) {
+  Tensor t(Shape{n}, dev);
+  t.block()->free_data();  // allocated unless the device allocates lazily
+  return t;
+}
+
+// point the block of a TileTensor() at the floats at ptr
+void SetTile(Tensor *t, const float *ptr) {
+  Block *blk = t->block();
+  blk->free_data();
+  blk->use_external_data(const_cast<float *>(ptr));
+  blk->mutable_data();  // mark it initialized
+}
+
+// free the data of a block after its last use in a run; views share their
+// parents again, until the "View" node of the next run (see Tensor::View)
+void Release(Block *blk) {
+  if (blk->parent() != nullptr)
+    blk->release_view();
+  else
+    blk->free_data();
+}
+
+// run the eltwise ops of the nodes (in program order) one tile at a time;
+// only the output of the last one is written to its block
+OpFunc FusedEltwiseOp(const NodeVec &nodes) {
+  struct Stage {
+    EltwiseOpPtr op;
+    std::vector<int> src;  // the stage producing each input, -1 for none
+  };
+  std::vector<Stage> stages;
+  for (auto node : nodes) {
+    Stage stage = {node->eltwise(), {}};
+    for (auto blk : stage.op->inputs) {
+      int src = -1;
+      for (size_t j = 0; j < stages.size(); ++j)
+        if (stages[j].op->output == blk) src = j;
+      stage.src.push_back(src);
+    }
+    stages.push_back(stage);
+  }
+
+  return [stages](Context *ctx) {
+    const EltwiseOpPtr &last = stages.back().op;
+    // read the input blocks before writing the output, which may be one of
+    // them
+    std::vector<std::vector<const float *> > ptrs(stages.size());
+    for (size_t i = 0; i < stages.size(); ++i)
+      for (size_t k = 0; k < stages[i].src.size(); ++k)
+        ptrs[i].push_back(
+            stages[i].src[k] < 0
+                ? static_cast<const float *>(stages[i].op->inputs[k]->data())
+                : nullptr);
+    float *out = static_cast<float *>(last->output->mutable_data());
+
+    size_t ntiles = (last->size + kFusionTile - 1) / kFusionTile;
+    ParallelFor(0, ntiles, 1, ctx->num_threads, [&](size_t begin, size_t end) {
+      // the tiles are split among the threads already
+      Context local(*ctx);
+      local.num_threads = 1;
+      std::vector<std::vector<float> > tiles(stages.size() - 1,
+                                             std::vector<float>(kFusionTile));
+      // the tensors of the stages are built once per thread (and once more
+      // for the shorter last tile) and pointed at every tile
+      std::vector<std::vector<Tensor> > in(stages.size());
+      std::vector<Tensor> ret(stages.size());
+      size_t len = 0;
+      for (size_t t = begin; t < end; ++t) {
+        size_t offset = t * kFusionTile;
+        size_t n = std::min(kFusionTile, last->size - offset);
+        if (n != len) {
+          for (size_t i = 0; i < stages.size(); ++i) {
+            in[i].assign(stages[i].src.size(), Tensor());
+            for (auto &x : in[i]) x = TileTensor(n, last->device);
+            ret[i] = TileTensor(n, last->device);
+          }
+          len = n;
+        }
+        for (size_t i = 0; i < stages.size(); ++i) {
+          for (size_t k = 0; k < stages[i].src.size(); ++k) {
+            int src = stages[i].src[k];
+            SetTile(&in[i][k],
+                    src < 0 ? ptrs[i][k] + offset : tiles[src].data());
+          }
+          SetTile(&ret[i],
+                  i + 1 < stages.size() ? tiles[i].data() : out + offset);
+          stages[i].op->kernel(in[i], &ret[i], &local);
+        }
+      }
+    });
+  };
+}
+}  // namespace
+
 void Node::AddInEdge(Edge *in_edge) { in_edges_.push_back(in_edge); }
 
 void Node::AddOutEdge(Edge *out_edge) { out_edges_.push_back(out_edge); }
@@ -104,6 +208,14 @@ void Graph::Reset() {
   dirty_ = false;
 
   in_serial_ = false;
+
+  fusions_.clear();
+  fused_into_.clear();
+  fused_blocks_.clear();
+
+  planned_offsets_.clear();
+  planned_peak_ = 0;
+  FreeArena();
 }
 
 void Graph::Debug() {
@@ -186,6 +298,12 @@ void Graph::Debug() {
     ss << "]" << std::endl;
   }
 
+  for (auto &group : fusions_) {
+    ss << "Fused OPs:[";
+    for (auto node : group) ss << node->id_ << " ";
+    ss << "]" << std::endl;
+  }
+
   size_t max_used_num = 0;
   std::vector<BlkInfo *> blkInfos;
   blkInfos.resize(blocks_.size());
@@ -294,12 +412,30 @@ void Graph::PrintTimeProfiling() {
   printf("%s", ss.str().c_str());
 }
 
-void Graph::TimeProfilingDoExec(Node *curNode) {
+void Graph::TimeProfilingDoExec(Node *curNode, int executor) {
+  TraceRecorder *trace = TraceRecorder::Global();
+  int64_t start = trace->enabled() ? trace->Now() : 0;
+
+  OpFunc &op = curNode->fused_op_ ? curNode->fused_op_ : curNode->op_;
   if ((device_->verbosity() > 0) && (curNode->op_name_ != "Waiting") &&
       (iteration_ >= device_->skip_iteration()))
-    device_->TimeProfilingDoExec(std::move(curNode->op_), 0, curNode);
+    device_->TimeProfilingDoExec(std::move(op), executor, curNode);
   else
-    device_->DoExec(std::move(curNode->op_), 0);
+    device_->DoExec(std::move(op), executor);
+
+  if (trace->enabled()) {
+    TraceEvent event;
+    event.name = curNode->op_name_;
+    event.category = "graph";
+    event.start = start;
+    event.end = trace->Now();
+    event.device = device_->id();
+    event.iteration = iteration_;
+    event.node = curNode->id_;
+    event.read_bytes = curNode->read_bytes_;
+    event.write_bytes = curNode->write_bytes_;
+    trace->Record(std::move(event));
+  }
 }
 
 void Graph::EvaluateTimeElapsed(const TimePoint &start) {
@@ -326,7 +462,23 @@ void Graph::TakeStartTime(TimePoint &start) {
 
 void Graph::RunGraph() {
   in_serial_ = false;
-  if (dirty_) Analyze();
+  if (dirty_ || (plan_memory_ && analyzed_serial_ && nodes_.size()))
+    Analyze();
+  if (plan_memory_) UsePlannedMemory();
+
+  // independent nodes of cpp devices run on the thread pool
+  size_t max_threads = 1;
+  if (device_->lang() == kCpp && !ThreadPool::InWorker() && !plan_memory_)
+    max_threads = std::min<size_t>(device_->context(0)->num_threads,
+                                   ThreadPool::Global()->size() + 1);
+  if (max_threads > 1) {
+    TimePoint start;
+    TakeStartTime(start);
+    RunConcurrently(max_threads);
+    step();
+    EvaluateTimeElapsed(start);
+    return;
+  }
 
   TimePoint start;
   SafeQueue<Node *> node_queue;
@@ -350,7 +502,7 @@ void Graph::RunGraph() {
 
     // step 3: release some blocks' data that won't be used later
     for (auto it : free_blocks_[curIndex]) {
-      it->free_data();
+      Release(it);
     }
 
     /*
@@ -372,9 +524,88 @@ void Graph::RunGraph() {
   EvaluateTimeElapsed(start);
 }
 
+void Graph::RunConcurrently(size_t max_threads) {
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::vector<int> deps(node_deps_);
+  std::unordered_map<Block *, int> users(free_block_users_);
+  std::deque<Node *> ready;
+  size_t done = 0, running = 0;
+  // every worker runs its node on the context of a free executor
+  std::vector<int> executors;
+  for (size_t i = max_threads - 1; i > 0; i--)
+    executors.push_back(static_cast<int>(i));
+
+  for (auto node : nodes_)
+    if (deps[node->id_] == 0) ready.push_back(node);
+
+  // called with mtx locked after node is executed
+  auto release = [&](Node *node) {
+    done++;
+    for (auto edge : node->out_edges_) {
+      Node *next = edge->dst_node_;
+      if (next && --deps[next->id_] == 0) ready.push_back(next);
+    }
+    int rand_node = next_rand_node_[node->id_];
+    if (rand_node >= 0 && --deps[rand_node] == 0)
+      ready.push_back(nodes_[rand_node]);
+    // next_nodes_ and free_blocks_ assume one node at a time; here a block
+    // is freed after all nodes using it finish
+    for (auto blk : used_free_blocks_[node->id_])
+      if (--users[blk] == 0) Release(blk);
+  };
+
+  std::unique_lock<std::mutex> lock(mtx);
+  while (done < nodes_.size()) {
+    if (ready.empty()) {
+      cv.wait(lock);
+      continue;
+    }
+    // the calling thread takes the node using the random generator if any
+    auto rand_it = std::find_if(ready.begin(), ready.end(), [](Node *node) {
+      return node->use_rand_generator_;
+    });
+    if (rand_it == ready.end()) rand_it = ready.begin();
+    Node *curNode = *rand_it;
+    ready.erase(rand_it);
+
+    // hand the other ready nodes to the workers; nested ParallelFor calls in
+    // the workers run serially, so the threads are not oversubscribed
+    auto it = ready.begin();
+    while (it != ready.end() && running + 1 < max_threads) {
+      Node *node = *it;
+      if (node->use_rand_generator_) {
+        ++it;
+        continue;
+      }
+      it = ready.erase(it);
+      int executor = executors.back();
+      executors.pop_back();
+      running++;
+      ThreadPool::Global()->Submit([this, node, executor, &mtx, &cv,
+                                    &running, &executors, &release]() {
+        TimeProfilingDoExec(node, executor);
+        std::lock_guard<std::mutex> guard(mtx);
+        running--;
+        executors.push_back(executor);
+        release(node);
+        cv.notify_one();
+      });
+    }
+
+    // the calling thread keeps the intra-op parallelism of its node
+    lock.unlock();
+    TimeProfilingDoExec(curNode);
+    lock.lock();
+    release(curNode);
+  }
+}
+
 void Graph::RunInSerial() {
   in_serial_ = true;
-  if (dirty_) Analyze();
+  if (dirty_ || (plan_memory_ && !analyzed_serial_ && nodes_.size()))
+    Analyze();
+  if (plan_memory_) UsePlannedMemory();
 
   TimePoint start;
   TakeStartTime(start);
@@ -387,7 +618,7 @@ void Graph::RunInSerial() {
 
     // step 2: release some blocks' data that won't be used later
     for (auto it : free_blocks_[i]) {
-      it->free_data();
+      Release(it);
     }
 
     /*
@@ -404,7 +635,8 @@ void Graph::RunInSerial() {
 }
 
 void Graph::AddOperation(OpFunc &&op, const BlockVec &read_blocks,
-                         const BlockVec &write_blocks, string op_name) {
+                         const BlockVec &write_blocks, string op_name,
+                         bool use_rand_generator, EltwiseOpPtr eltwise) {
   dirty_ = true;
 
   // if the size of both read_blocks and write_blocks is zero,
@@ -414,8 +646,32 @@ void Graph::AddOperation(OpFunc &&op, const BlockVec &read_blocks,
     return;
   }
 
+  // an operation on a view (see Block) reads the parent of the view, also
+  // when it writes the view as the first write copies the parent
+  BlockVec parents;
+  for (auto blks : {&read_blocks, &write_blocks})
+    for (auto blk : *blks)
+      for (Block *p = blk ? blk->parent() : nullptr; p; p = p->parent())
+        if (std::find(read_blocks.begin(), read_blocks.end(), p) ==
+                read_blocks.end() &&
+            std::find(parents.begin(), parents.end(), p) == parents.end())
+          parents.push_back(p);
+  if (!parents.empty()) {
+    BlockVec blocks(read_blocks);
+    blocks.insert(blocks.end(), parents.begin(), parents.end());
+    AddOperation(std::move(op), blocks, write_blocks, op_name,
+                 use_rand_generator, std::move(eltwise));
+    return;
+  }
+
   // create new node
   Node *node = new Node(nodes_.size(), std::move(op), op_name);
+  node->use_rand_generator_ = use_rand_generator;
+  node->eltwise_ = std::move(eltwise);
+  for (auto blk : read_blocks)
+    if (blk) node->read_bytes_ += blk->size();
+  for (auto blk : write_blocks)
+    if (blk) node->write_bytes_ += blk->size();
 
   // create edges for read_blocks
   for (size_t i = 0; i < read_blocks.size(); ++i) {
@@ -464,6 +720,7 @@ void Graph::AddOperation(OpFunc &&op, const BlockVec &read_blocks,
 
     node->AddInEdge(edge);
     edges_.push_back(edge);
+    if (!src_node) blkInfo->read_edges_.push_back(edge);
   }
 
   // update last node for write_blocks
@@ -485,7 +742,21 @@ void Graph::AddOperation(OpFunc &&op, const BlockVec &read_blocks,
       }
 
       Edge *write_edge = blkInfo->write_edge_;
-      if (write_edge) {
+      if (!write_edge) {
+        // the first write of an input (e.g., a parameter) waits for all the
+        // nodes reading it before, one edge per node
+        Node *last = node;
+        for (auto readEdge : blkInfo->read_edges_) {
+          Node *reader = readEdge->dst_node_;
+          if (reader == node || reader == last) continue;
+          Edge *edge = new Edge(edges_.size(), blk, reader, node);
+          reader->AddOutEdge(edge);
+          node->AddInEdge(edge);
+          edges_.push_back(edge);
+          last = reader;
+        }
+        blkInfo->read_edges_.clear();
+      } else {
         if (!write_edge->dst_node_) {
           write_edge->dst_node_ = node;
           node->AddInEdge(write_edge);
@@ -498,6 +769,7 @@ void Graph::AddOperation(OpFunc &&op, const BlockVec &read_blocks,
                   new Edge(edges_.size(), blk, outEdge->dst_node_, node);
               outEdge->dst_node_->AddOutEdge(edge);
               node->AddInEdge(edge);
+              edges_.push_back(edge);
             }
           }
         }
@@ -571,6 +843,13 @@ void Graph::Analyze() {
 
   AnalyzeEdges();
 
+  FuseEltwise();
+
+  AnalyzeDependency();
+
+  analyzed_serial_ = in_serial_;
+  if (plan_memory_) PlanMemory();
+
   dirty_ = false;
 
   // Debug();
@@ -678,15 +957,231 @@ void Graph::AnalyzeEdges() {
       BlockType type = blkInfo->type_;
 
       // if the block belongs to a inter tensor
-      // and isn't refered on the Python Side
-      if ((type == BlockType::kInter || type == BlockType::kEnd) &&
-          blkInfo->graph_ref_ >= blk->ref_count()) {
+      // and isn't refered on the Python Side;
+      // borrowed memory is never freed (nor planned) by the graph;
+      // views are inputs of the graph as they share their parents, and
+      // those only used in the graph share them again after being freed
+      if ((type == BlockType::kInter || type == BlockType::kEnd ||
+           blk->parent() != nullptr) &&
+          blkInfo->graph_ref_ >= blk->ref_count() && !blk->borrowed()) {
         free_blocks_[node_id].push_back(blk);
       }
     }
   }
 }
 
+void Graph::AnalyzeDependency() {
+  node_deps_.assign(nodes_.size(), 0);
+  next_rand_node_.assign(nodes_.size(), -1);
+  used_free_blocks_.clear();
+  used_free_blocks_.resize(nodes_.size());
+  free_block_users_.clear();
+
+  for (auto node : nodes_)
+    for (auto edge : node->in_edges_)
+      if (edge->src_node_) node_deps_[node->id_]++;
+
+  Node *last_rand_node = nullptr;
+  for (auto node : nodes_) {
+    if (!node->use_rand_generator_) continue;
+    if (last_rand_node) {
+      next_rand_node_[last_rand_node->id_] = node->id_;
+      node_deps_[node->id_]++;
+    }
+    last_rand_node = node;
+  }
+
+  for (auto &blks : free_blocks_)
+    for (auto blk : blks) {
+      BlkInfo *blkInfo = blocks_[blk];
+      free_block_users_[blk] = blkInfo->used_nodes_.size();
+      for (auto node : blkInfo->used_nodes_)
+        used_free_blocks_[fused_into_[node->id_]].push_back(blk);
+    }
+}
+
+void Graph::FuseEltwise() {
+  fusions_.clear();
+  fused_blocks_.clear();
+  fused_into_.resize(nodes_.size());
+  for (auto node : nodes_) {
+    fused_into_[node->id_] = node->id_;
+    node->fused_op_ = nullptr;
+  }
+  if (!fusion_) return;
+
+  BlockSet freed;
+  for (auto &blks : free_blocks_) freed.insert(blks.begin(), blks.end());
+  // the nodes writing each block; edges from a node are for the blocks it
+  // writes, except the ones added for writes after reads, which are not in
+  // edges_
+  std::unordered_map<Block *, std::vector<int> > writers;
+  for (auto edge : edges_)
+    if (edge->src_node_) writers[edge->blk_].push_back(edge->src_node_->id_);
+
+  // groups[i] is the group ending at node i, in program order
+  std::vector<NodeVec> groups(nodes_.size());
+  for (auto node : nodes_) {
+    if (!node->eltwise_) continue;
+    NodeVec &group = groups[node->id_];
+    for (auto blk : node->eltwise_->inputs) {
+      // the producer must be eltwise, and the block written by it and read
+      // by this node only, not in place and not referenced elsewhere
+      BlkInfo *blkInfo = blocks_[blk];
+      if (!freed.count(blk) || blkInfo->used_nodes_.size() != 2) continue;
+      Node *src = blkInfo->used_nodes_[0] == node ? blkInfo->used_nodes_[1]
+                                                  : blkInfo->used_nodes_[0];
+      if (src == node || !src->eltwise_ || src->eltwise_->output != blk ||
+          src->eltwise_->size != node->eltwise_->size ||
+          fused_into_[src->id_] != src->id_)
+        continue;
+      auto &in = src->eltwise_->inputs;
+      if (std::find(in.begin(), in.end(), blk) != in.end()) continue;
+
+      NodeVec merged = groups[src->id_].empty() ? NodeVec{src}
+                                                : groups[src->id_];
+      merged.insert(merged.end(), group.begin(), group.end());
+      std::sort(merged.begin(), merged.end(),
+                [](Node *a, Node *b) { return a->id_ < b->id_; });
+
+      // the fused node reads the inputs of the others later than they would;
+      // no node but itself may write them in between or after
+      BlockSet outputs;
+      for (auto it : merged) outputs.insert(it->eltwise_->output);
+      bool safe = true;
+      for (auto it : merged)
+        for (auto in_blk : it->eltwise_->inputs) {
+          if (outputs.count(in_blk)) continue;
+          for (int w : writers[in_blk])
+            if (w > it->id_ && w != node->id_) safe = false;
+        }
+      if (!safe) continue;
+
+      for (auto it : merged) fused_into_[it->id_] = node->id_;
+      groups[src->id_].clear();
+      group = merged;
+      fused_blocks_.insert(blk);
+    }
+    if (group.size() && group.back() != node) group.push_back(node);
+  }
+
+  for (auto &group : groups) {
+    if (group.size() < 2) continue;
+    Node *last = group.back();
+    last->fused_op_ = FusedEltwiseOp(group);
+    for (size_t i = 0; i + 1 < group.size(); ++i) {
+      group[i]->fused_op_ = [](Context *ctx) {};
+      // the inputs are read by the last node now
+      auto &blks = free_blocks_[group[i]->id_];
+      free_blocks_[last->id_].insert(free_blocks_[last->id_].end(),
+                                     blks.begin(), blks.end());
+      blks.clear();
+    }
+    fusions_.push_back(group);
+  }
+}
+
+void Graph::EnableFusion(bool enable) {
+  fusion_ = enable;
+  if (nodes_.size()) dirty_ = true;
+}
+
+void Graph::EnableMemoryPlan(bool enable) {
+  plan_memory_ = enable;
+  if (enable) {
+    if (nodes_.size()) dirty_ = true;
+  } else {
+    planned_offsets_.clear();
+    planned_peak_ = 0;
+    FreeArena();
+  }
+}
+
+void Graph::PlanMemory() {
+  // position of each node in the execution order, which follows next_nodes_
+  std::vector<int> pos(nodes_.size(), 0);
+  std::deque<Node *> queue(begin_nodes_.begin(), begin_nodes_.end());
+  for (int k = 0; !queue.empty(); ++k) {
+    Node *node = queue.front();
+    queue.pop_front();
+    pos[node->id_] = k;
+    for (auto next : next_nodes_[node->id_]) queue.push_back(next);
+  }
+
+  // a block is live from the first to the last node using it; blocks used
+  // by the same node are live at the same time
+  struct Interval {
+    Block *blk;
+    int id, first, last;
+    size_t size, offset;
+  };
+  const size_t kAlign = 64;
+  std::vector<Interval> intervals;
+  for (auto &blks : free_blocks_)
+    for (auto blk : blks) {
+      // fused outputs are never materialized, views share their parents
+      if (fused_blocks_.count(blk) || blk->parent()) continue;
+      BlkInfo *blkInfo = blocks_[blk];
+      Interval it = {blk, blkInfo->id_, static_cast<int>(nodes_.size()), -1,
+                     (blk->size() + kAlign - 1) / kAlign * kAlign, 0};
+      for (auto node : blkInfo->used_nodes_) {
+        int p = pos[fused_into_[node->id_]];
+        it.first = std::min(it.first, p);
+        it.last = std::max(it.last, p);
+      }
+      intervals.push_back(it);
+    }
+
+  // place larger blocks first, each at the lowest offset not overlapping the
+  // placed blocks that are live at the same time
+  std::sort(intervals.begin(), intervals.end(),
+            [](const Interval &a, const Interval &b) {
+              if (a.size != b.size) return a.size > b.size;
+              return a.id < b.id;
+            });
+  planned_offsets_.clear();
+  planned_peak_ = 0;
+  std::vector<const Interval *> live;
+  for (size_t i = 0; i < intervals.size(); ++i) {
+    Interval &cur = intervals[i];
+    live.clear();
+    for (size_t j = 0; j < i; ++j)
+      if (intervals[j].first <= cur.last && cur.first <= intervals[j].last)
+        live.push_back(&intervals[j]);
+    std::sort(live.begin(), live.end(),
+              [](const Interval *a, const Interval *b) {
+                return a->offset < b->offset;
+              });
+    for (auto it : live) {
+      if (cur.offset + cur.size <= it->offset) break;
+      cur.offset = std::max(cur.offset, it->offset + it->size);
+    }
+    planned_offsets_[cur.blk] = cur.offset;
+    planned_peak_ = std::max(planned_peak_, cur.offset + cur.size);
+  }
+
+  // the planned blocks have been freed by the previous iteration, so the
+  // arena is not in use
+  if (planned_peak_ > arena_size_) {
+    FreeArena();
+    arena_ = device_->Malloc(planned_peak_);
+    arena_size_ = planned_peak_;
+  }
+}
+
+void Graph::UsePlannedMemory() {
+  // blocks still holding their own memory (e.g., written before the graph
+  // was built) keep it until they are freed in this iteration
+  for (auto &it : planned_offsets_)
+    it.first->use_external_data(static_cast<char *>(arena_) + it.second);
+}
+
+void Graph::FreeArena() {
+  if (arena_) device_->Free(arena_);
+  arena_ = nullptr;
+  arena_size_ = 0;
+}
+
 void Graph::FreeLoop() {
   int id = 0;
   for (;;) {
@@ -695,7 +1190,7 @@ void Graph::FreeLoop() {
       break;
     } else {
       for (auto it : free_blocks_[id]) {
-        it->free_data();
+        Release(it);
       }
     }
   }
@@ -0,0 +1,814 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+#include "./math_kernel_cpp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "half.hpp"
+#include "singa/core/bfloat16.h"
+#include "singa/singa_config.h"
+#ifdef USE_CBLAS
+#include <cblas.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SINGA_SIMD_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define SINGA_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace singa {
+
+namespace cpp {
+
+// Every instruction set defines the same primitives in its own namespace,
+// and math_kernel_cpp_simd.h builds the kernels on top of them. The x86
+// kernels are compiled with function level target attributes, so that the
+// rest of the library does not require AVX.
+
+// ===================== Scalar =============================================
+namespace scalar {
+#define SIMD_TARGET
+typedef float V;
+typedef bool M;
+const size_t kWidth = 1;
+
+static inline V load(const float *p) { return *p; }
+static inline void store(float *p, V v) { *p = v; }
+static inline V set1(float x) { return x; }
+static inline V add(V a, V b) { return a + b; }
+static inline V sub(V a, V b) { return a - b; }
+static inline V mul(V a, V b) { return a * b; }
+static inline V div(V a, V b) { return a / b; }
+static inline V fmadd(V a, V b, V c) { return a * b + c; }
+static inline V vabs(V a) { return std::fabs(a); }
+static inline V vsqrt(V a) { return std::sqrt(a); }
+static inline V vround(V a) { return std::nearbyint(a); }
+static inline M cmp_lt(V a, V b) { return a < b; }
+static inline M cmp_le(V a, V b) { return a <= b; }
+static inline M cmp_gt(V a, V b) { return a > b; }
+static inline M cmp_ge(V a, V b) { return a >= b; }
+static inline M cmp_eq(V a, V b) { return a == b; }
+static inline M is_nan(V a) { return a != a; }
+static inline V select(M m, V a, V b) { return m ? a : b; }
+static inline M mask_and(M a, M b) { return a && b; }
+static inline bool all(M m) { return m; }
+static inline bool any(M m) { return m; }
+// 2^n for integral n in [-126, 127]
+static inline V pow2n(V n) {
+  int bits = (static_cast<int>(n) + 127) << 23;
+  float y;
+  memcpy(&y, &bits, sizeof(y));
+  return y;
+}
+// x = m * 2^e with m in [0.5, 1), for positive normal x
+static inline void vfrexp(V x, V *m, V *e) {
+  int bits;
+  memcpy(&bits, &x, sizeof(bits));
+  *e = static_cast<float>((bits >> 23) - 126);
+  bits = (bits & 0x007fffff) | 0x3f000000;
+  memcpy(m, &bits, sizeof(bits));
+}
+
+#include "./math_kernel_cpp_simd.h"
+#undef SIMD_TARGET
+}  // namespace scalar
+
+#ifdef SINGA_SIMD_X86
+// ===================== AVX2 + FMA =========================================
+namespace avx2 {
+#define SIMD_TARGET __attribute__((target("avx2,fma")))
+typedef __m256 V;
+typedef __m256 M;
+const size_t kWidth = 8;
+
+SIMD_TARGET static inline V load(const float *p) { return _mm256_loadu_ps(p); }
+SIMD_TARGET static inline void store(float *p, V v) { _mm256_storeu_ps(p, v); }
+SIMD_TARGET static inline V set1(float x) { return _mm256_set1_ps(x); }
+SIMD_TARGET static inline V add(V a, V b) { return _mm256_add_ps(a, b); }
+SIMD_TARGET static inline V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+SIMD_TARGET static inline V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+SIMD_TARGET static inline V div(V a, V b) { return _mm256_div_ps(a, b); }
+SIMD_TARGET static inline V fmadd(V a, V b, V c) {
+  return _mm256_fmadd_ps(a, b, c);
+}
+SIMD_TARGET static inline V vabs(V a) {
+  return _mm256_and_ps(a, _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)));
+}
+SIMD_TARGET static inline V vsqrt(V a) { return _mm256_sqrt_ps(a); }
+SIMD_TARGET static inline V vround(V a) {
+  return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+SIMD_TARGET static inline M cmp_lt(V a, V b) {
+  return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+}
+SIMD_TARGET static inline M cmp_le(V a, V b) {
+  return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+}
+SIMD_TARGET static inline M cmp_gt(V a, V b) {
+  return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+}
+SIMD_TARGET static inline M cmp_ge(V a, V b) {
+  return _mm256_cmp_ps(a, b, _CMP_GE_OQ);
+}
+SIMD_TARGET static inline M cmp_eq(V a, V b) {
+  return _mm256_cmp_ps(a, b, _CMP_EQ_OQ);
+}
+SIMD_TARGET static inline M is_nan(V a) {
+  return _mm256_cmp_ps(a, a, _CMP_UNORD_Q);
+}
+SIMD_TARGET static inline V select(M m, V a, V b) {
+  return _mm256_blendv_ps(b, a, m);
+}
+SIMD_TARGET static inline M mask_and(M a, M b) { return _mm256_and_ps(a, b); }
+SIMD_TARGET static inline bool all(M m) {
+  return _mm256_movemask_ps(m) == 0xff;
+}
+SIMD_TARGET static inline bool any(M m) { return _mm256_movemask_ps(m) != 0; }
+SIMD_TARGET static inline V pow2n(V n) {
+  __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+}
+SIMD_TARGET static inline void vfrexp(V x, V *m, V *e) {
+  __m256i bits = _mm256_castps_si256(x);
+  *e = _mm256_cvtepi32_ps(
+      _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+  bits = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+                         _mm256_set1_epi32(0x3f000000));
+  *m = _mm256_castsi256_ps(bits);
+}
+
+#include "./math_kernel_cpp_simd.h"
+#undef SIMD_TARGET
+}  // namespace avx2
+
+// ===================== AVX-512 ============================================
+namespace avx512 {
+#define SIMD_TARGET __attribute__((target("avx512f")))
+typedef __m512 V;
+typedef __mmask16 M;
+const size_t kWidth = 16;
+// The unmasked forms of some AVX-512 intrinsics start from
+// _mm512_undefined_*(), which GCC reports as uninitialized once inlined;
+// their zero-masked forms with all lanes set are the same instructions.
+const M kAll = 0xffff;
+
+SIMD_TARGET static inline V load(const float *p) { return _mm512_loadu_ps(p); }
+SIMD_TARGET static inline void store(float *p, V v) { _mm512_storeu_ps(p, v); }
+SIMD_TARGET static inline V set1(float x) { return _mm512_set1_ps(x); }
+SIMD_TARGET static inline V add(V a, V b) { return _mm512_add_ps(a, b); }
+SIMD_TARGET static inline V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+SIMD_TARGET static inline V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+SIMD_TARGET static inline V div(V a, V b) { return _mm512_div_ps(a, b); }
+SIMD_TARGET static inline V fmadd(V a, V b, V c) {
+  return _mm512_fmadd_ps(a, b, c);
+}
+SIMD_TARGET static inline V vabs(V a) {
+  return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a),
+                                              _mm512_set1_epi32(0x7fffffff)));
+}
+SIMD_TARGET static inline V vsqrt(V a) { return _mm512_maskz_sqrt_ps(kAll, a); }
+SIMD_TARGET static inline V vround(V a) {
+  return _mm512_maskz_roundscale_ps(
+      kAll, a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+SIMD_TARGET static inline M cmp_lt(V a, V b) {
+  return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ);
+}
+SIMD_TARGET static inline M cmp_le(V a, V b) {
+  return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ);
+}
+SIMD_TARGET static inline M cmp_gt(V a, V b) {
+  return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ);
+}
+SIMD_TARGET static inline M cmp_ge(V a, V b) {
+  return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ);
+}
+SIMD_TARGET static inline M cmp_eq(V a, V b) {
+  return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ);
+}
+SIMD_TARGET static inline M is_nan(V a) {
+  return _mm512_cmp_ps_mask(a, a, _CMP_UNORD_Q);
+}
+SIMD_TARGET static inline V select(M m, V a, V b) {
+  return _mm512_mask_blend_ps(m, b, a);
+}
+SIMD_TARGET static inline M mask_and(M a, M b) { return a & b; }
+SIMD_TARGET static inline bool all(M m) { return m == 0xffff; }
+SIMD_TARGET static inline bool any(M m) { return m != 0; }
+SIMD_TARGET static inline V pow2n(V n) {
+  __m512i e = _mm512_add_epi32(_mm512_maskz_cvtps_epi32(kAll, n),
+                               _mm512_set1_epi32(127));
+  return _mm512_castsi512_ps(_mm512_maskz_slli_epi32(kAll, e, 23));
+}
+SIMD_TARGET static inline void vfrexp(V x, V *m, V *e) {
+  __m512i bits = _mm512_castps_si512(x);
+  *e = _mm512_maskz_cvtepi32_ps(
+      kAll, _mm512_sub_epi32(_mm512_maskz_srli_epi32(kAll, bits, 23),
+                             _mm512_set1_epi32(126)));
+  bits = _mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x007fffff)),
+                         _mm512_set1_epi32(0x3f000000));
+  *m = _mm512_castsi512_ps(bits);
+}
+
+#include "./math_kernel_cpp_simd.h"
+#undef SIMD_TARGET
+}  // namespace avx512
+#endif  // SINGA_SIMD_X86
+
+#ifdef SINGA_SIMD_NEON
+// ===================== NEON (AArch64) =====================================
+namespace neon {
+#define SIMD_TARGET
+typedef float32x4_t V;
+typedef uint32x4_t M;
+const size_t kWidth = 4;
+
+static inline V load(const float *p) { return vld1q_f32(p); }
+static inline void store(float *p, V v) { vst1q_f32(p, v); }
+static inline V set1(float x) { return vdupq_n_f32(x); }
+static inline V add(V a, V b) { return vaddq_f32(a, b); }
+static inline V sub(V a, V b) { return vsubq_f32(a, b); }
+static inline V mul(V a, V b) { return vmulq_f32(a, b); }
+static inline V div(V a, V b) { return vdivq_f32(a, b); }
+static inline V fmadd(V a, V b, V c) { return vfmaq_f32(c, a, b); }
+static inline V vabs(V a) { return vabsq_f32(a); }
+static inline V vsqrt(V a) { return vsqrtq_f32(a); }
+static inline V vround(V a) { return vrndnq_f32(a); }
+static inline M cmp_lt(V a, V b) { return vcltq_f32(a, b); }
+static inline M cmp_le(V a, V b) { return vcleq_f32(a, b); }
+static inline M cmp_gt(V a, V b) { return vcgtq_f32(a, b); }
+static inline M cmp_ge(V a, V b) { return vcgeq_f32(a, b); }
+static inline M cmp_eq(V a, V b) { return vceqq_f32(a, b); }
+static inline M is_nan(V a) { return vmvnq_u32(vceqq_f32(a, a)); }
+static inline V select(M m, V a, V b) { return vbslq_f32(m, a, b); }
+static inline M mask_and(M a, M b) { return vandq_u32(a, b); }
+static inline bool all(M m) { return vminvq_u32(m) != 0; }
+static inline bool any(M m) { return vmaxvq_u32(m) != 0; }
+static inline V pow2n(V n) {
+  int32x4_t e = vaddq_s32(vcvtnq_s32_f32(n), vdupq_n_s32(127));
+  return vreinterpretq_f32_s32(vshlq_n_s32(e, 23));
+}
+static inline void vfrexp(V x, V *m, V *e) {
+  uint32x4_t bits = vreinterpretq_u32_f32(x);
+  *e = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)),
+                               vdupq_n_s32(126)));
+  bits = vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x007fffff)),
+                   vdupq_n_u32(0x3f000000));
+  *m = vreinterpretq_f32_u32(bits);
+}
+
+#include "./math_kernel_cpp_simd.h"
+#undef SIMD_TARGET
+}  // namespace neon
+#endif  // SINGA_SIMD_NEON
+
+// ===================== Dispatch ===========================================
+
+SimdLevel SupportedSimdLevel() {
+#if defined(SINGA_SIMD_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return kAVX512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return kAVX2;
+  return kScalar;
+#elif defined(SINGA_SIMD_NEON)
+  return kNeon;
+#else
+  return kScalar;
+#endif
+}
+
+static SimdLevel &simd_level() {
+  static SimdLevel level = SupportedSimdLevel();
+  return level;
+}
+
+SimdLevel GetSimdLevel() { return simd_level(); }
+
+void SetSimdLevel(SimdLevel level) {
+  SimdLevel supported = SupportedSimdLevel();
+#if defined(SINGA_SIMD_X86)
+  // AVX-512 machines support AVX2 as well
+  if (level == kNeon) level = kScalar;
+#endif
+  simd_level() = level > supported ? supported : level;
+}
+
+#if defined(SINGA_SIMD_X86)
+#define SIMD_DISPATCH(fn, ...)        \
+  switch (simd_level()) {             \
+    case kAVX512:                     \
+      return avx512::fn(__VA_ARGS__); \
+    case kAVX2:                       \
+      return avx2::fn(__VA_ARGS__);   \
+    default:                          \
+      return scalar::fn(__VA_ARGS__); \
+  }
+#elif defined(SINGA_SIMD_NEON)
+#define SIMD_DISPATCH(fn, ...)                             \
+  if (simd_level() == kNeon) return neon::fn(__VA_ARGS__); \
+  return scalar::fn(__VA_ARGS__);
+#else
+#define SIMD_DISPATCH(fn, ...) return scalar::fn(__VA_ARGS__);
+#endif
+
+void abs(const size_t n, const float *in, float *out) {
+  SIMD_DISPATCH(abs, n, in, out);
+}
+void sign(const size_t n, const float *in, float *out) {
+  SIMD_DISPATCH(sign, n, in, out);
+}
+void relu(const size_t n, const float *in, float *out) {
+  SIMD_DISPATCH(relu, n, in, out);
+}
+void exp(const size_t n, const float *in, float *out, bool fast) {
+  SIMD_DISPATCH(exp, n, in, out, fast);
+}
+bool log(const size_t n, const float *in, float *out) {
+  SIMD_DISPATCH(log, n, in, out);
+}
+bool sqrt(const size_t n, const float *in, float *out) {
+  SIMD_DISPATCH(sqrt, n, in, out);
+}
+void tanh(const size_t n, const float *in, float *out, bool fast) {
+  SIMD_DISPATCH(tanh, n, in, out, fast);
+}
+void sigmoid(const size_t n, const float *in, float *out, bool fast) {
+  SIMD_DISPATCH(sigmoid, n, in, out, fast);
+}
+void softplus(const size_t n, const float *in, float *out, bool fast) {
+  SIMD_DISPATCH(softplus, n, in, out, fast);
+}
+void softsign(const size_t n, const float *in, float *out) {
+  SIMD_DISPATCH(softsign, n, in, out);
+}
+void clamp(const size_t n, const float low, const float high, const float *in,
+           float *out) {
+  SIMD_DISPATCH(clamp, n, low, high, in, out);
+}
+
+void add(const size_t n, const float *in, const float x, float *out) {
+  SIMD_DISPATCH(add, n, in, x, out);
+}
+void mult(const size_t n, const float *in, const float x, float *out) {
+  SIMD_DISPATCH(mult, n, in, x, out);
+}
+bool div(const size_t n, const float x, const float *in, float *out) {
+  SIMD_DISPATCH(div, n, x, in, out);
+}
+void pow(const size_t n, const float *in, const float x, float *out) {
+  SIMD_DISPATCH(pow, n, in, x, out);
+}
+void ge(const size_t n, const float *in, const float x, float *out) {
+  SIMD_DISPATCH(ge, n, in, x, out);
+}
+void gt(const size_t n, const float *in, const float x, float *out) {
+  SIMD_DISPATCH(gt, n, in, x, out);
+}
+void le(const size_t n, const float *in, const float x, float *out) {
+  SIMD_DISPATCH(le, n, in, x, out);
+}
+void lt(const size_t n, const float *in, const float x, float *out) {
+  SIMD_DISPATCH(lt, n, in, x, out);
+}
+void eq(const size_t n, const float *in, const float x, float *out) {
+  SIMD_DISPATCH(eq, n, in, x, out);
+}
+
+void add(const size_t n, const float *in1, const float *in2, float *out) {
+  SIMD_DISPATCH(add, n, in1, in2, out);
+}
+void sub(const size_t n, const float *in1, const float *in2, float *out) {
+  SIMD_DISPATCH(sub, n, in1, in2, out);
+}
+void mult(const size_t n, const float *in1, const float *in2, float *out) {
+  SIMD_DISPATCH(mult, n, in1, in2, out);
+}
+bool div(const size_t n, const float *in1, const float *in2, float *out) {
+  SIMD_DISPATCH(div, n, in1, in2, out);
+}
+void pow(const size_t n, const float *in1, const float *in2, float *out) {
+  SIMD_DISPATCH(pow, n, in1, in2, out);
+}
+void relu_backward(const size_t n, const float *in1, const float *in2,
+                   float *out) {
+  SIMD_DISPATCH(relu_backward, n, in1, in2, out);
+}
+void ge(const size_t n, const float *in1, const float *in2, float *out) {
+  SIMD_DISPATCH(ge, n, in1, in2, out);
+}
+void gt(const size_t n, const float *in1, const float *in2, float *out) {
+  SIMD_DISPATCH(gt, n, in1, in2, out);
+}
+void le(const size_t n, const float *in1, const float *in2, float *out) {
+  SIMD_DISPATCH(le, n, in1, in2, out);
+}
+void lt(const size_t n, const float *in1, const float *in2, float *out) {
+  SIMD_DISPATCH(lt, n, in1, in2, out);
+}
+void eq(const size_t n, const float *in1, const float *in2, float *out) {
+  SIMD_DISPATCH(eq, n, in1, in2, out);
+}
+
+// ===================== 16-bit conversions ================================
+
+// The conversions use dedicated instructions, which are not among the
+// primitives of math_kernel_cpp_simd.h. A tail shorter than a vector goes
+// through a zero padded vector unless the scalar code rounds identically, so
+// that the result of an element does not depend on its position. The scalar
+// half conversions are those of half_float::half on the raw bits.
+static void half_to_float_scalar(const size_t n, const uint16_t *in,
+                                 float *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = half_float::detail::half2float<float>(in[i]);
+}
+
+static void float_to_half_scalar(const size_t n, const float *in,
+                                 uint16_t *out) {
+  const std::float_round_style kRound =
+      std::numeric_limits<half_float::half>::round_style;
+  for (size_t i = 0; i < n; i++)
+    out[i] = static_cast<uint16_t>(
+        half_float::detail::float2half<kRound>(in[i]));
+}
+
+#ifdef SINGA_SIMD_X86
+__attribute__((target("avx,f16c"))) static void half_to_float_f16c(
+    const size_t n, const uint16_t *in, float *out) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(
+                                  reinterpret_cast<const __m128i *>(in + i))));
+  if (i < n) {
+    uint16_t x[8] = {0};
+    float y[8];
+    memcpy(x, in + i, (n - i) * sizeof(uint16_t));
+    _mm256_storeu_ps(
+        y, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<__m128i *>(x))));
+    memcpy(out + i, y, (n - i) * sizeof(float));
+  }
+}
+
+__attribute__((target("avx,f16c"))) static void float_to_half_f16c(
+    const size_t n, const float *in, uint16_t *out) {
+  const int kRound = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm256_cvtps_ph(_mm256_loadu_ps(in + i), kRound));
+  if (i < n) {
+    float x[8] = {0};
+    uint16_t y[8];
+    memcpy(x, in + i, (n - i) * sizeof(float));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y),
+                     _mm256_cvtps_ph(_mm256_loadu_ps(x), kRound));
+    memcpy(out + i, y, (n - i) * sizeof(uint16_t));
+  }
+}
+
+__attribute__((target("avx2"))) static void bfloat16_to_float_avx2(
+    const size_t n, const uint16_t *in, float *out) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)));
+    _mm256_storeu_ps(out + i, _mm256_castsi256_ps(_mm256_slli_epi32(x, 16)));
+  }
+  for (; i < n; i++) out[i] = bfloat16::ToFloat(in[i]);
+}
+
+// rounds as bfloat16::FromFloat()
+__attribute__((target("avx2"))) static void float_to_bfloat16_avx2(
+    const size_t n, const float *in, uint16_t *out) {
+  const __m256i one = _mm256_set1_epi32(1), bias = _mm256_set1_epi32(0x7fff);
+  const __m256i quiet = _mm256_set1_epi32(0x40);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 x = _mm256_loadu_ps(in + i);
+    const __m256i u = _mm256_castps_si256(x);
+    const __m256i hi = _mm256_srli_epi32(u, 16);
+    __m256i r = _mm256_add_epi32(_mm256_add_epi32(u, bias),
+                                 _mm256_and_si256(hi, one));
+    r = _mm256_srli_epi32(r, 16);
+    const __m256 nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+    r = _mm256_castps_si256(
+        _mm256_blendv_ps(_mm256_castsi256_ps(r),
+                         _mm256_castsi256_ps(_mm256_or_si256(hi, quiet)), nan));
+    // the 16 bits words of r are in lanes [0, 4) and [8, 12) after packing
+    r = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm256_castsi256_si128(r));
+  }
+  for (; i < n; i++) out[i] = bfloat16::FromFloat(in[i]);
+}
+
+static bool cpu_supports_f16c() {
+  static const bool f16c = __builtin_cpu_supports("f16c");
+  return f16c;
+}
+
+// avx512bf16 is known to GCC 10 and clang 9 onwards
+#if (defined(__clang__) && __clang_major__ >= 9) || \
+    (!defined(__clang__) && __GNUC__ >= 10)
+#define SINGA_AVX512BF16
+#endif
+
+#ifdef SINGA_AVX512BF16
+__attribute__((target("avx512f,avx512bf16"))) static void
+float_to_bfloat16_avx512bf16(const size_t n, const float *in, uint16_t *out) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                        (__m256i)_mm512_cvtneps_pbh(_mm512_loadu_ps(in + i)));
+  if (i < n) {
+    float x[16] = {0};
+    uint16_t y[16];
+    memcpy(x, in + i, (n - i) * sizeof(float));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(y),
+                        (__m256i)_mm512_cvtneps_pbh(_mm512_loadu_ps(x)));
+    memcpy(out + i, y, (n - i) * sizeof(uint16_t));
+  }
+}
+
+static bool cpu_supports_avx512bf16() {
+  static const bool bf16 = __builtin_cpu_supports("avx512bf16");
+  return bf16;
+}
+#endif  // SINGA_AVX512BF16
+#endif  // SINGA_SIMD_X86
+
+void half_to_float(const size_t n, const uint16_t *in, float *out) {
+#ifdef SINGA_SIMD_X86
+  if (simd_level() >= kAVX2 && cpu_supports_f16c())
+    return half_to_float_f16c(n, in, out);
+#endif
+  half_to_float_scalar(n, in, out);
+}
+
+void float_to_half(const size_t n, const float *in, uint16_t *out) {
+#ifdef SINGA_SIMD_X86
+  if (simd_level() >= kAVX2 && cpu_supports_f16c())
+    return float_to_half_f16c(n, in, out);
+#endif
+  float_to_half_scalar(n, in, out);
+}
+
+void bfloat16_to_float(const size_t n, const uint16_t *in, float *out) {
+#ifdef SINGA_SIMD_X86
+  if (simd_level() >= kAVX2) return bfloat16_to_float_avx2(n, in, out);
+#endif
+  for (size_t i = 0; i < n; i++) out[i] = bfloat16::ToFloat(in[i]);
+}
+
+void float_to_bfloat16(const size_t n, const float *in, uint16_t *out) {
+#ifdef SINGA_SIMD_X86
+#ifdef SINGA_AVX512BF16
+  if (simd_level() == kAVX512 && cpu_supports_avx512bf16())
+    return float_to_bfloat16_avx512bf16(n, in, out);
+#endif
+  if (simd_level() >= kAVX2) return float_to_bfloat16_avx2(n, in, out);
+#endif
+  for (size_t i = 0; i < n; i++) out[i] = bfloat16::FromFloat(in[i]);
+}
+
+// ===================== int8 ===============================================
+
+// q = x / scale is clamped to +-384 before rounding, which keeps it in the
+// int32 range, and saturates anyway once the zero point in [-128, 127] is
+// added. The comparisons follow _mm512_min_ps/_mm512_max_ps, so that NaN
+// gives the same result on all paths.
+const float kQuantizeBound = 384.f;
+
+static void quantize_scalar(const size_t n, const float *in, const float scale,
+                            const int zero_point, int8_t *out) {
+  const float inv = 1.f / scale;
+  for (size_t i = 0; i < n; i++) {
+    float q = in[i] * inv;
+    q = q < kQuantizeBound ? q : kQuantizeBound;
+    q = q > -kQuantizeBound ? q : -kQuantizeBound;
+    const int v = static_cast<int>(std::nearbyint(q)) + zero_point;
+    out[i] = static_cast<int8_t>(std::min(std::max(v, -128), 127));
+  }
+}
+
+static void dequantize_scalar(const size_t n, const int8_t *in,
+                              const float scale, const int zero_point,
+                              float *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = scale * static_cast<float>(in[i] - zero_point);
+}
+
+// the reference of gemm_s8_vnni() below
+static void gemm_s8_scalar(const size_t M, const size_t N, const size_t K,
+                           const int8_t *A, const size_t lda, const int8_t *B,
+                           const size_t ldb, int32_t *C, const size_t ldc) {
+  for (size_t i = 0; i < M; i++) {
+    int32_t *c = C + i * ldc;
+    std::fill(c, c + N, 0);
+    for (size_t k = 0; k < K; k++) {
+      const int32_t a = A[i * lda + k];
+      const int8_t *b = B + k * ldb;
+      for (size_t j = 0; j < N; j++) c[j] += a * b[j];
+    }
+  }
+}
+
+#ifdef SINGA_SIMD_X86
+__attribute__((target("avx512f,avx512bw"))) static void quantize_avx512(
+    const size_t n, const float *in, const float scale, const int zero_point,
+    int8_t *out) {
+  const __m512 inv = _mm512_set1_ps(1.f / scale);
+  const __m512 hi = _mm512_set1_ps(kQuantizeBound);
+  const __m512 lo = _mm512_set1_ps(-kQuantizeBound);
+  const __m512i zp = _mm512_set1_epi32(zero_point);
+  for (size_t i = 0; i < n; i += 16) {
+    const __mmask16 m =
+        n - i >= 16 ? 0xffff : static_cast<__mmask16>((1u << (n - i)) - 1);
+    __m512 q = _mm512_mul_ps(_mm512_maskz_loadu_ps(m, in + i), inv);
+    q = _mm512_maskz_max_ps(m, _mm512_maskz_min_ps(m, q, hi), lo);
+    // rounds to the nearest even under the default MXCSR
+    const __m512i v =
+        _mm512_add_epi32(_mm512_maskz_cvtps_epi32(m, q), zp);
+    _mm512_mask_cvtsepi32_storeu_epi8(out + i, m, v);
+  }
+}
+
+__attribute__((target("avx512f"))) static void dequantize_avx512(
+    const size_t n, const int8_t *in, const float scale, const int zero_point,
+    float *out) {
+  const __m512 s = _mm512_set1_ps(scale);
+  const __m512i zp = _mm512_set1_epi32(zero_point);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512i v = _mm512_sub_epi32(
+        _mm512_maskz_cvtepi8_epi32(
+            avx512::kAll,
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i))),
+        zp);
+    const __m512 f = _mm512_maskz_cvtepi32_ps(avx512::kAll, v);
+    _mm512_storeu_ps(out + i, _mm512_mul_ps(s, f));
+  }
+  dequantize_scalar(n - i, in + i, scale, zero_point, out + i);
+}
+
+// vpdpbusd multiplies unsigned bytes of A by signed bytes of B and sums
+// groups of 4 products into int32 lanes. Hence A gets 128 added (stored as
+// unsigned), which adds 128 * (the sum of column j of B) to C[i][j]. B is
+// packed into panels of 16 columns, each a (K / 4) x 16 x 4 array, so that
+// one row of a panel is a vector holding 4 consecutive k of 16 columns.
+__attribute__((target("avx512f,avx512vnni"))) static void gemm_s8_vnni(
+    const size_t M, const size_t N, const size_t K, const int8_t *A,
+    const size_t lda, const int8_t *B, const size_t ldb, int32_t *C,
+    const size_t ldc) {
+  const size_t K4 = (K + 3) / 4;
+  std::vector<uint8_t> a(M * K4 * 4, 0);
+  for (size_t i = 0; i < M; i++)
+    for (size_t k = 0; k < K; k++)
+      a[i * K4 * 4 + k] = static_cast<uint8_t>(A[i * lda + k] ^ 0x80);
+  std::vector<int8_t> panel(K4 * 64);
+  for (size_t j0 = 0; j0 < N; j0 += 16) {
+    const size_t ncol = std::min<size_t>(16, N - j0);
+    int32_t colsum[16] = {0};
+    std::fill(panel.begin(), panel.end(), 0);
+    for (size_t k = 0; k < K; k++)
+      for (size_t j = 0; j < ncol; j++) {
+        const int8_t b = B[k * ldb + j0 + j];
+        panel[k / 4 * 64 + j * 4 + k % 4] = b;
+        colsum[j] += b;
+      }
+    __m512i corr =
+        _mm512_maskz_slli_epi32(avx512::kAll, _mm512_loadu_si512(colsum), 7);
+    const __mmask16 mask = static_cast<__mmask16>((1u << ncol) - 1);
+    // 4 rows at a time hide the latency of vpdpbusd
+    for (size_t i = 0; i < M; i += 4) {
+      const size_t nrow = std::min<size_t>(4, M - i);
+      __m512i acc[4] = {_mm512_setzero_si512(), _mm512_setzero_si512(),
+                        _mm512_setzero_si512(), _mm512_setzero_si512()};
+      const uint8_t *ai = a.data() + i * K4 * 4;
+      for (size_t k4 = 0; k4 < K4; k4++) {
+        const __m512i b = _mm512_loadu_si512(panel.data() + k4 * 64);
+        for (size_t r = 0; r < nrow; r++) {
+          int32_t a4;
+          memcpy(&a4, ai + r * K4 * 4 + k4 * 4, sizeof(a4));
+          acc[r] = _mm512_dpbusd_epi32(acc[r], _mm512_set1_epi32(a4), b);
+        }
+      }
+      for (size_t r = 0; r < nrow; r++)
+        _mm512_mask_storeu_epi32(C + (i + r) * ldc + j0, mask,
+                                 _mm512_sub_epi32(acc[r], corr));
+    }
+  }
+}
+
+static bool cpu_supports_avx512vnni() {
+  static const bool vnni = __builtin_cpu_supports("avx512vnni");
+  return vnni;
+}
+
+static bool cpu_supports_avx512bw() {
+  static const bool bw = __builtin_cpu_supports("avx512bw");
+  return bw;
+}
+#endif  // SINGA_SIMD_X86
+
+void quantize(const size_t n, const float *in, const float scale,
+              const int zero_point, int8_t *out) {
+#ifdef SINGA_SIMD_X86
+  if (simd_level() == kAVX512 && cpu_supports_avx512bw())
+    return quantize_avx512(n, in, scale, zero_point, out);
+#endif
+  quantize_scalar(n, in, scale, zero_point, out);
+}
+
+void dequantize(const size_t n, const int8_t *in, const float scale,
+                const int zero_point, float *out) {
+#ifdef SINGA_SIMD_X86
+  if (simd_level() == kAVX512)
+    return dequantize_avx512(n, in, scale, zero_point, out);
+#endif
+  dequantize_scalar(n, in, scale, zero_point, out);
+}
+
+void gemm_s8(const size_t M, const size_t N, const size_t K, const int8_t *A,
+             const size_t lda, const int8_t *B, const size_t ldb, int32_t *C,
+             const size_t ldc) {
+#ifdef SINGA_SIMD_X86
+  if (simd_level() == kAVX512 && cpu_supports_avx512vnni())
+    return gemm_s8_vnni(M, N, K, A, lda, B, ldb, C, ldc);
+#endif
+  gemm_s8_scalar(M, N, K, A, lda, B, ldb, C, ldc);
+}
+
+void gemm(bool trans_a, bool trans_b, const size_t M, const size_t N,
+          const size_t K, const float alpha, const float *A, const size_t lda,
+          const float *B, const size_t ldb, const float beta, float *C,
+          const size_t ldc) {
+#ifdef USE_CBLAS
+  cblas_sgemm(CblasRowMajor, trans_a ? CblasTrans : CblasNoTrans,
+              trans_b ? CblasTrans : CblasNoTrans, M, N, K, alpha, A, lda, B,
+              ldb, beta, C, ldc);
+#else
+  for (size_t i = 0; i < M; i++) {
+    float *c = C + i * ldc;
+    for (size_t j = 0; j < N; j++) c[j] = beta == 0.f ? 0.f : c[j] * beta;
+    for (size_t k = 0; k < K; k++) {
+      float a = alpha * (trans_a ? A[k * lda + i] : A[i * lda + k]);
+      for (size_t j = 0; j < N; j++)
+        c[j] += a * (trans_b ? B[j * ldb + k] : B[k * ldb + j]);
+    }
+  }
+#endif  // USE_CBLAS
+}
+
+size_t gemm_packed_size(const size_t K, const size_t N) {
+  return (N + kGemmPanel - 1) / kGemmPanel * kGemmPanel * K;
+}
+
+void gemm_pack(bool trans_b, const size_t K, const size_t N, const float *B,
+               const size_t ldb, float *packed) {
+  for (size_t j0 = 0; j0 < N; j0 += kGemmPanel) {
+    const size_t ncol = std::min(kGemmPanel, N - j0);
+    for (size_t k = 0; k < K; k++, packed += kGemmPanel) {
+      for (size_t j = 0; j < ncol; j++)
+        packed[j] = trans_b ? B[(j0 + j) * ldb + k] : B[k * ldb + j0 + j];
+      for (size_t j = ncol; j < kGemmPanel; j++) packed[j] = 0.f;
+    }
+  }
+}
+
+void gemm_packed(bool trans_a, const size_t M, const size_t N, const size_t K,
+                 const float alpha, const float *A, const size_t lda,
+                 const float *packed, const float beta, float *C,
+                 const size_t ldc) {
+  SIMD_DISPATCH(gemm_packed, trans_a, M, N, K, alpha, A, lda, packed, beta, C,
+                ldc);
+}
+
+}  // namespace cpp
+
+}  // namespace singa
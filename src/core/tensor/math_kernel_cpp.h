@@ -0,0 +1,150 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+#ifndef SRC_CORE_TENSOR_MATH_KERNEL_CPP_H_
+#define SRC_CORE_TENSOR_MATH_KERNEL_CPP_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/// Vectorized float32 kernels over contiguous arrays for lang::Cpp.
+/// The instruction set is picked at runtime (AVX-512, AVX2+FMA or NEON);
+/// exp, log, tanh, etc. use polynomial approximations (Cephes). Functions
+/// taking 'fast' use lower-degree polynomials (~1e-4 relative error) when it
+/// is true, otherwise the error is within a few ulp of libm.
+/// Functions returning bool return false if any input is out of the domain
+/// checked by the scalar implementation in tensor_math_cpp.h.
+namespace singa {
+
+namespace cpp {
+
+enum SimdLevel { kScalar = 0, kNeon, kAVX2, kAVX512 };
+
+/// The best level supported by the running CPU.
+SimdLevel SupportedSimdLevel();
+/// The level used by the kernels below; defaults to SupportedSimdLevel().
+SimdLevel GetSimdLevel();
+/// Select the level (e.g., for testing); it is capped by
+/// SupportedSimdLevel().
+void SetSimdLevel(SimdLevel level);
+
+// 1 input
+void abs(const size_t n, const float *in, float *out);
+void sign(const size_t n, const float *in, float *out);
+void relu(const size_t n, const float *in, float *out);
+void exp(const size_t n, const float *in, float *out, bool fast);
+bool log(const size_t n, const float *in, float *out);
+bool sqrt(const size_t n, const float *in, float *out);
+void tanh(const size_t n, const float *in, float *out, bool fast);
+void sigmoid(const size_t n, const float *in, float *out, bool fast);
+void softplus(const size_t n, const float *in, float *out, bool fast);
+void softsign(const size_t n, const float *in, float *out);
+void clamp(const size_t n, const float low, const float high, const float *in,
+           float *out);
+
+// 1 input and 1 scalar
+void add(const size_t n, const float *in, const float x, float *out);
+void mult(const size_t n, const float *in, const float x, float *out);
+/// out[i] = x / in[i]
+bool div(const size_t n, const float x, const float *in, float *out);
+/// out[i] = pow(in[i], x); computed as exp(x * log(in[i])) for positive
+/// inputs, otherwise by libm. The relative error grows with |x * log(in[i])|.
+void pow(const size_t n, const float *in, const float x, float *out);
+/// out[i] = in[i] OP x ? 1 : 0
+void ge(const size_t n, const float *in, const float x, float *out);
+void gt(const size_t n, const float *in, const float x, float *out);
+void le(const size_t n, const float *in, const float x, float *out);
+void lt(const size_t n, const float *in, const float x, float *out);
+void eq(const size_t n, const float *in, const float x, float *out);
+
+// 2 inputs
+void add(const size_t n, const float *in1, const float *in2, float *out);
+void sub(const size_t n, const float *in1, const float *in2, float *out);
+void mult(const size_t n, const float *in1, const float *in2, float *out);
+bool div(const size_t n, const float *in1, const float *in2, float *out);
+/// see pow() above
+void pow(const size_t n, const float *in1, const float *in2, float *out);
+/// out[i] = in2[i] > 0 ? in1[i] : 0
+void relu_backward(const size_t n, const float *in1, const float *in2,
+                   float *out);
+/// out[i] = in1[i] OP in2[i] ? 1 : 0
+void ge(const size_t n, const float *in1, const float *in2, float *out);
+void gt(const size_t n, const float *in1, const float *in2, float *out);
+void le(const size_t n, const float *in1, const float *in2, float *out);
+void lt(const size_t n, const float *in1, const float *in2, float *out);
+void eq(const size_t n, const float *in1, const float *in2, float *out);
+
+// conversions between float32 and the 16-bit formats, whose values are
+// passed as raw bits; float32 values are rounded to the nearest even value.
+/// IEEE half precision; uses F16C if the CPU supports it.
+void half_to_float(const size_t n, const uint16_t *in, float *out);
+void float_to_half(const size_t n, const float *in, uint16_t *out);
+/// bfloat16 (see singa::bfloat16); float_to_bfloat16() uses AVX512-BF16 if
+/// the CPU supports it, which flushes denormal inputs to zero.
+void bfloat16_to_float(const size_t n, const uint16_t *in, float *out);
+void float_to_bfloat16(const size_t n, const float *in, uint16_t *out);
+
+// int8 affine quantization, i.e., x = scale * (q - zero_point)
+/// out[i] = in[i] / scale rounded to the nearest even integer, plus
+/// zero_point, saturated to [-128, 127]; the division is a multiplication by
+/// 1 / scale. NaN gives 127.
+void quantize(const size_t n, const float *in, const float scale,
+              const int zero_point, int8_t *out);
+/// out[i] = scale * (in[i] - zero_point)
+void dequantize(const size_t n, const int8_t *in, const float scale,
+                const int zero_point, float *out);
+
+/// Row-major C = A * B for int8 A (M x K) and B (K x N) with int32
+/// accumulation; uses AVX512-VNNI if the CPU supports it. It is single
+/// threaded like gemm_packed(), and packs B panel by panel on every call.
+void gemm_s8(const size_t M, const size_t N, const size_t K, const int8_t *A,
+             const size_t lda, const int8_t *B, const size_t ldb, int32_t *C,
+             const size_t ldc);
+
+/// Row-major C = alpha * op(A) * op(B) + beta * C, where op(A) is M x K and
+/// op(B) is K x N; op transposes its argument if trans_a (trans_b) is true.
+/// Calls cblas_sgemm if available; C is not read if beta is 0.
+void gemm(bool trans_a, bool trans_b, const size_t M, const size_t N,
+          const size_t K, const float alpha, const float *A, const size_t lda,
+          const float *B, const size_t ldb, const float beta, float *C,
+          const size_t ldc);
+
+/// The number of columns of each panel of a packed matrix (see gemm_pack()).
+const size_t kGemmPanel = 16;
+/// The number of floats of op(B) (K x N) packed by gemm_pack().
+size_t gemm_packed_size(const size_t K, const size_t N);
+/// Pack op(B) into panels of kGemmPanel columns, each stored row by row and
+/// padded with zeros, so that gemm_packed() reads B sequentially. Panel p
+/// starts at packed + p * kGemmPanel * K.
+void gemm_pack(bool trans_b, const size_t K, const size_t N, const float *B,
+               const size_t ldb, float *packed);
+/// C = alpha * op(A) * B + beta * C as gemm(), for B packed by gemm_pack().
+/// It is single threaded; callers may split the panels (i.e., columns of C)
+/// or the rows of C among threads. C is not read if beta is 0.
+void gemm_packed(bool trans_a, const size_t M, const size_t N, const size_t K,
+                 const float alpha, const float *A, const size_t lda,
+                 const float *packed, const float beta, float *C,
+                 const size_t ldc);
+
+}  // namespace cpp
+
+}  // namespace singa
+
+#endif  // SRC_CORE_TENSOR_MATH_KERNEL_CPP_H_
@@ -0,0 +1,510 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+
+// No include guard: this file is included by math_kernel_cpp.cc once per
+// instruction set, inside a namespace that defines the vector type V, the
+// mask type M, kWidth, SIMD_TARGET and the primitives (load, store, set1,
+// add, sub, mul, div, fmadd, vabs, vsqrt, vround, cmp_*, is_nan, select,
+// mask_and, all, any, pow2n and vfrexp). The kernels below only use those
+// primitives, hence they are identical for every instruction set.
+
+// ===================== Transcendental functions ===========================
+
+// exp(x) = 2^n * exp(r), with r = x - n * ln2 and |r| <= ln2 / 2.
+// exp(r) is a degree 6 (Cephes expf) or degree 4 (fast) polynomial.
+SIMD_TARGET static inline V vexp(V x, bool fast) {
+  const V one = set1(1.f);
+  const V hi = set1(88.72283935546875f), lo = set1(-104.f);
+  M over = cmp_gt(x, hi), under = cmp_lt(x, lo), nan = is_nan(x);
+  V xc = select(over, hi, select(under, lo, x));
+
+  V n = vround(mul(xc, set1(1.44269504088896341f)));
+  V r = fmadd(n, set1(-0.693359375f), xc);
+  r = fmadd(n, set1(2.12194440e-4f), r);
+
+  V y;
+  if (fast) {
+    V p = fmadd(set1(4.16666667e-2f), r, set1(1.66666667e-1f));
+    p = fmadd(p, r, set1(5.0e-1f));
+    p = fmadd(p, r, one);
+    y = fmadd(p, r, one);
+  } else {
+    V p = fmadd(set1(1.9875691500e-4f), r, set1(1.3981999507e-3f));
+    p = fmadd(p, r, set1(8.3334519073e-3f));
+    p = fmadd(p, r, set1(4.1665795894e-2f));
+    p = fmadd(p, r, set1(1.6666665459e-1f));
+    p = fmadd(p, r, set1(5.0000001201e-1f));
+    y = add(fmadd(p, mul(r, r), r), one);
+  }
+  // scale in two steps, so that n in [-150, 128] stays representable
+  V n1 = vround(mul(n, set1(0.5f)));
+  y = mul(mul(y, pow2n(n1)), pow2n(sub(n, n1)));
+
+  y = select(over, set1(HUGE_VALF), y);
+  y = select(under, set1(0.f), y);
+  return select(nan, x, y);
+}
+
+// log(x) = e * ln2 + log(m), with m in [sqrt(0.5), sqrt(2)) (Cephes logf).
+SIMD_TARGET static inline V vlog(V x) {
+  const V one = set1(1.f), zero = set1(0.f);
+  // denormals are scaled into the normal range first
+  M denorm = cmp_lt(x, set1(1.17549435e-38f));
+  V xs = select(denorm, mul(x, set1(8388608.f)), x);
+  V m, e;
+  vfrexp(xs, &m, &e);
+  e = sub(e, select(denorm, set1(23.f), zero));
+
+  M small = cmp_lt(m, set1(0.707106781186547524f));
+  e = sub(e, select(small, one, zero));
+  m = sub(add(m, select(small, m, zero)), one);
+
+  V z = mul(m, m);
+  V p = fmadd(set1(7.0376836292e-2f), m, set1(-1.1514610310e-1f));
+  p = fmadd(p, m, set1(1.1676998740e-1f));
+  p = fmadd(p, m, set1(-1.2420140846e-1f));
+  p = fmadd(p, m, set1(1.4249322787e-1f));
+  p = fmadd(p, m, set1(-1.6668057665e-1f));
+  p = fmadd(p, m, set1(2.0000714765e-1f));
+  p = fmadd(p, m, set1(-2.4999993993e-1f));
+  p = fmadd(p, m, set1(3.3333331174e-1f));
+  V y = mul(mul(p, m), z);
+  y = fmadd(e, set1(-2.12194440e-4f), y);
+  y = fmadd(z, set1(-0.5f), y);
+  y = fmadd(e, set1(0.693359375f), add(m, y));
+
+  y = select(cmp_eq(x, set1(HUGE_VALF)), x, y);
+  y = select(cmp_eq(x, zero), set1(-HUGE_VALF), y);
+  y = select(cmp_lt(x, zero), set1(NAN), y);
+  return select(is_nan(x), x, y);
+}
+
+// tanh(x) = x + x^3 P(x^2) for |x| <= 0.625 (Cephes tanhf), otherwise
+// sign(x) * (1 - 2 / (exp(2|x|) + 1)).
+SIMD_TARGET static inline V vtanh(V x, bool fast) {
+  const V one = set1(1.f), zero = set1(0.f);
+  V ax = vabs(x);
+  V big = sub(one, div(set1(2.f), add(vexp(add(ax, ax), fast), one)));
+  big = select(cmp_lt(x, zero), sub(zero, big), big);
+
+  V z = mul(x, x);
+  V p = fmadd(set1(-5.70498872745e-3f), z, set1(2.06390887954e-2f));
+  p = fmadd(p, z, set1(-5.37397155531e-2f));
+  p = fmadd(p, z, set1(1.33314422036e-1f));
+  p = fmadd(p, z, set1(-3.33332819422e-1f));
+  V small = fmadd(mul(p, z), x, x);
+  return select(cmp_gt(ax, set1(0.625f)), big, small);
+}
+
+// pow(a, b) = exp(b * log(a)) for finite positive a; other lanes (where the
+// sign of the result depends on b) are delegated to libm.
+SIMD_TARGET static inline V vpow(V a, V b) {
+  M pos = mask_and(cmp_gt(a, set1(0.f)), cmp_lt(a, set1(HUGE_VALF)));
+  V y = vexp(mul(b, vlog(a)), false);
+  if (all(pos)) return y;
+  float av[kWidth], bv[kWidth], yv[kWidth], pv[kWidth];
+  store(av, a);
+  store(bv, b);
+  store(yv, y);
+  store(pv, select(pos, set1(1.f), set1(0.f)));
+  for (size_t k = 0; k < kWidth; k++)
+    if (pv[k] == 0.f) yv[k] = std::pow(av[k], bv[k]);
+  return load(yv);
+}
+
+// ===================== Loops ==============================================
+
+// apply op to in[0, n); the tail is padded with 1, which is a valid input
+// for every op below
+template <typename Op>
+SIMD_TARGET static inline void unary(const size_t n, const float *in,
+                                     float *out, const Op &op) {
+  size_t i = 0;
+  for (; i + kWidth <= n; i += kWidth) store(out + i, op(load(in + i)));
+  if (i < n) {
+    float x[kWidth], y[kWidth];
+    for (size_t k = 0; k < kWidth; k++) x[k] = i + k < n ? in[i + k] : 1.f;
+    store(y, op(load(x)));
+    for (size_t k = 0; i + k < n; k++) out[i + k] = y[k];
+  }
+}
+
+template <typename Op>
+SIMD_TARGET static inline void binary(const size_t n, const float *in1,
+                                      const float *in2, float *out,
+                                      const Op &op) {
+  size_t i = 0;
+  for (; i + kWidth <= n; i += kWidth)
+    store(out + i, op(load(in1 + i), load(in2 + i)));
+  if (i < n) {
+    float x1[kWidth], x2[kWidth], y[kWidth];
+    for (size_t k = 0; k < kWidth; k++) {
+      x1[k] = i + k < n ? in1[i + k] : 1.f;
+      x2[k] = i + k < n ? in2[i + k] : 1.f;
+    }
+    store(y, op(load(x1), load(x2)));
+    for (size_t k = 0; i + k < n; k++) out[i + k] = y[k];
+  }
+}
+
+// ===================== Element-wise operators =============================
+
+struct AbsOp {
+  SIMD_TARGET V operator()(V x) const { return vabs(x); }
+};
+
+struct SignOp {
+  SIMD_TARGET V operator()(V x) const {
+    const V one = set1(1.f), zero = set1(0.f);
+    return sub(select(cmp_gt(x, zero), one, zero),
+               select(cmp_lt(x, zero), one, zero));
+  }
+};
+
+struct ReLUOp {
+  SIMD_TARGET V operator()(V x) const {
+    return select(cmp_ge(x, set1(0.f)), x, set1(0.f));
+  }
+};
+
+struct ExpOp {
+  bool fast;
+  SIMD_TARGET V operator()(V x) const { return vexp(x, fast); }
+};
+
+struct LogOp {
+  bool *ok;
+  SIMD_TARGET V operator()(V x) const {
+    if (!all(cmp_gt(x, set1(0.f)))) *ok = false;
+    return vlog(x);
+  }
+};
+
+struct SqrtOp {
+  bool *ok;
+  SIMD_TARGET V operator()(V x) const {
+    if (!all(cmp_ge(x, set1(0.f)))) *ok = false;
+    return vsqrt(x);
+  }
+};
+
+struct TanhOp {
+  bool fast;
+  SIMD_TARGET V operator()(V x) const { return vtanh(x, fast); }
+};
+
+struct SigmoidOp {
+  bool fast;
+  SIMD_TARGET V operator()(V x) const {
+    const V one = set1(1.f);
+    return div(one, add(one, vexp(sub(set1(0.f), x), fast)));
+  }
+};
+
+// log(1 + exp(x)) = max(x, 0) + log(1 + exp(-|x|)), which does not overflow
+struct SoftPlusOp {
+  bool fast;
+  SIMD_TARGET V operator()(V x) const {
+    const V zero = set1(0.f);
+    V t = vexp(sub(zero, vabs(x)), fast);
+    return add(select(cmp_gt(x, zero), x, zero), vlog(add(set1(1.f), t)));
+  }
+};
+
+struct SoftSignOp {
+  SIMD_TARGET V operator()(V x) const {
+    return div(x, add(set1(1.f), vabs(x)));
+  }
+};
+
+struct ClampOp {
+  float low, high;
+  SIMD_TARGET V operator()(V x) const {
+    V l = set1(low), h = set1(high);
+    return select(cmp_lt(x, l), l, select(cmp_gt(x, h), h, x));
+  }
+};
+
+struct AddScalarOp {
+  float v;
+  SIMD_TARGET V operator()(V x) const { return add(x, set1(v)); }
+};
+
+struct MultScalarOp {
+  float v;
+  SIMD_TARGET V operator()(V x) const { return mul(x, set1(v)); }
+};
+
+struct ScalarDivOp {
+  float v;
+  bool *ok;
+  SIMD_TARGET V operator()(V x) const {
+    if (any(cmp_eq(x, set1(0.f)))) *ok = false;
+    return div(set1(v), x);
+  }
+};
+
+struct PowScalarOp {
+  float v;
+  SIMD_TARGET V operator()(V x) const { return vpow(x, set1(v)); }
+};
+
+#define SIMD_CMP_OP(Name, cmp)                                          \
+  struct Name##ScalarOp {                                               \
+    float v;                                                            \
+    SIMD_TARGET V operator()(V x) const {                               \
+      return select(cmp(x, set1(v)), set1(1.f), set1(0.f));             \
+    }                                                                   \
+  };                                                                    \
+  struct Name##Op {                                                     \
+    SIMD_TARGET V operator()(V x, V y) const {                          \
+      return select(cmp(x, y), set1(1.f), set1(0.f));                   \
+    }                                                                   \
+  };
+
+SIMD_CMP_OP(GE, cmp_ge)
+SIMD_CMP_OP(GT, cmp_gt)
+SIMD_CMP_OP(LE, cmp_le)
+SIMD_CMP_OP(LT, cmp_lt)
+SIMD_CMP_OP(EQ, cmp_eq)
+#undef SIMD_CMP_OP
+
+struct AddOp {
+  SIMD_TARGET V operator()(V x, V y) const { return add(x, y); }
+};
+
+struct SubOp {
+  SIMD_TARGET V operator()(V x, V y) const { return sub(x, y); }
+};
+
+struct MultOp {
+  SIMD_TARGET V operator()(V x, V y) const { return mul(x, y); }
+};
+
+struct DivOp {
+  bool *ok;
+  SIMD_TARGET V operator()(V x, V y) const {
+    if (any(cmp_eq(y, set1(0.f)))) *ok = false;
+    return div(x, y);
+  }
+};
+
+struct PowOp {
+  SIMD_TARGET V operator()(V x, V y) const { return vpow(x, y); }
+};
+
+struct ReLUBackwardOp {
+  SIMD_TARGET V operator()(V x, V y) const {
+    return select(cmp_gt(y, set1(0.f)), x, set1(0.f));
+  }
+};
+
+// ===================== Packed GEMM ========================================
+
+// C[0, R) x [0, ncol) = alpha * A * P + beta * C for R rows of A, where
+// A(i, k) = A[i * a_row + k * a_col] and P is a panel of gemm_pack(). The
+// R x kGemmPanel block of C is accumulated in registers.
+template <size_t R>
+SIMD_TARGET static inline void gemm_block(const size_t k, const float *A,
+                                          const size_t a_row,
+                                          const size_t a_col, const float *P,
+                                          const float alpha, const float beta,
+                                          float *C, const size_t ldc,
+                                          const size_t ncol) {
+  const size_t nv = kGemmPanel / kWidth;
+  V acc[R][kGemmPanel / kWidth];
+  for (size_t i = 0; i < R; i++)
+    for (size_t v = 0; v < nv; v++) acc[i][v] = set1(0.f);
+  for (size_t l = 0; l < k; l++, P += kGemmPanel) {
+    V b[kGemmPanel / kWidth];
+    for (size_t v = 0; v < nv; v++) b[v] = load(P + v * kWidth);
+    for (size_t i = 0; i < R; i++) {
+      V a = set1(A[i * a_row + l * a_col]);
+      for (size_t v = 0; v < nv; v++) acc[i][v] = fmadd(a, b[v], acc[i][v]);
+    }
+  }
+  float tmp[kGemmPanel];
+  for (size_t i = 0; i < R; i++) {
+    float *c = C + i * ldc;
+    float *dst = ncol == kGemmPanel ? c : tmp;
+    for (size_t v = 0; v < nv; v++) {
+      V y = mul(acc[i][v], set1(alpha));
+      if (beta != 0.f && dst == c)
+        y = fmadd(load(c + v * kWidth), set1(beta), y);
+      store(dst + v * kWidth, y);
+    }
+    if (dst == tmp)
+      for (size_t j = 0; j < ncol; j++)
+        c[j] = beta == 0.f ? tmp[j] : tmp[j] + beta * c[j];
+  }
+}
+
+// ===================== Entry points =======================================
+
+SIMD_TARGET void abs(const size_t n, const float *in, float *out) {
+  unary(n, in, out, AbsOp());
+}
+SIMD_TARGET void sign(const size_t n, const float *in, float *out) {
+  unary(n, in, out, SignOp());
+}
+SIMD_TARGET void relu(const size_t n, const float *in, float *out) {
+  unary(n, in, out, ReLUOp());
+}
+SIMD_TARGET void exp(const size_t n, const float *in, float *out, bool fast) {
+  unary(n, in, out, ExpOp{fast});
+}
+SIMD_TARGET bool log(const size_t n, const float *in, float *out) {
+  bool ok = true;
+  unary(n, in, out, LogOp{&ok});
+  return ok;
+}
+SIMD_TARGET bool sqrt(const size_t n, const float *in, float *out) {
+  bool ok = true;
+  unary(n, in, out, SqrtOp{&ok});
+  return ok;
+}
+SIMD_TARGET void tanh(const size_t n, const float *in, float *out, bool fast) {
+  unary(n, in, out, TanhOp{fast});
+}
+SIMD_TARGET void sigmoid(const size_t n, const float *in, float *out,
+                         bool fast) {
+  unary(n, in, out, SigmoidOp{fast});
+}
+SIMD_TARGET void softplus(const size_t n, const float *in, float *out,
+                          bool fast) {
+  unary(n, in, out, SoftPlusOp{fast});
+}
+SIMD_TARGET void softsign(const size_t n, const float *in, float *out) {
+  unary(n, in, out, SoftSignOp());
+}
+SIMD_TARGET void clamp(const size_t n, const float low, const float high,
+                       const float *in, float *out) {
+  unary(n, in, out, ClampOp{low, high});
+}
+
+SIMD_TARGET void add(const size_t n, const float *in, const float x,
+                     float *out) {
+  unary(n, in, out, AddScalarOp{x});
+}
+SIMD_TARGET void mult(const size_t n, const float *in, const float x,
+                      float *out) {
+  unary(n, in, out, MultScalarOp{x});
+}
+SIMD_TARGET bool div(const size_t n, const float x, const float *in,
+                     float *out) {
+  bool ok = true;
+  unary(n, in, out, ScalarDivOp{x, &ok});
+  return ok;
+}
+SIMD_TARGET void pow(const size_t n, const float *in, const float x,
+                     float *out) {
+  unary(n, in, out, PowScalarOp{x});
+}
+SIMD_TARGET void ge(const size_t n, const float *in, const float x,
+                    float *out) {
+  unary(n, in, out, GEScalarOp{x});
+}
+SIMD_TARGET void gt(const size_t n, const float *in, const float x,
+                    float *out) {
+  unary(n, in, out, GTScalarOp{x});
+}
+SIMD_TARGET void le(const size_t n, const float *in, const float x,
+                    float *out) {
+  unary(n, in, out, LEScalarOp{x});
+}
+SIMD_TARGET void lt(const size_t n, const float *in, const float x,
+                    float *out) {
+  unary(n, in, out, LTScalarOp{x});
+}
+SIMD_TARGET void eq(const size_t n, const float *in, const float x,
+                    float *out) {
+  unary(n, in, out, EQScalarOp{x});
+}
+
+SIMD_TARGET void add(const size_t n, const float *in1, const float *in2,
+                     float *out) {
+  binary(n, in1, in2, out, AddOp());
+}
+SIMD_TARGET void sub(const size_t n, const float *in1, const float *in2,
+                     float *out) {
+  binary(n, in1, in2, out, SubOp());
+}
+SIMD_TARGET void mult(const size_t n, const float *in1, const float *in2,
+                      float *out) {
+  binary(n, in1, in2, out, MultOp());
+}
+SIMD_TARGET bool div(const size_t n, const float *in1, const float *in2,
+                     float *out) {
+  bool ok = true;
+  binary(n, in1, in2, out, DivOp{&ok});
+  return ok;
+}
+SIMD_TARGET void pow(const size_t n, const float *in1, const float *in2,
+                     float *out) {
+  binary(n, in1, in2, out, PowOp());
+}
+SIMD_TARGET void relu_backward(const size_t n, const float *in1,
+                               const float *in2, float *out) {
+  binary(n, in1, in2, out, ReLUBackwardOp());
+}
+SIMD_TARGET void ge(const size_t n, const float *in1, const float *in2,
+                    float *out) {
+  binary(n, in1, in2, out, GEOp());
+}
+SIMD_TARGET void gt(const size_t n, const float *in1, const float *in2,
+                    float *out) {
+  binary(n, in1, in2, out, GTOp());
+}
+SIMD_TARGET void le(const size_t n, const float *in1, const float *in2,
+                    float *out) {
+  binary(n, in1, in2, out, LEOp());
+}
+SIMD_TARGET void lt(const size_t n, const float *in1, const float *in2,
+                    float *out) {
+  binary(n, in1, in2, out, LTOp());
+}
+SIMD_TARGET void eq(const size_t n, const float *in1, const float *in2,
+                    float *out) {
+  binary(n, in1, in2, out, EQOp());
+}
+
+// rows of the blocks of gemm_packed(), so that the accumulators of a block
+// take 12 vector registers (at least one row)
+const size_t kGemmRows = 12 * kWidth / kGemmPanel > 0
+                             ? 12 * kWidth / kGemmPanel : 1;
+
+SIMD_TARGET void gemm_packed(bool trans_a, const size_t m, const size_t n,
+                             const size_t k, const float alpha, const float *A,
+                             const size_t lda, const float *packed,
+                             const float beta, float *C, const size_t ldc) {
+  const size_t a_row = trans_a ? 1 : lda, a_col = trans_a ? lda : 1;
+  for (size_t j = 0; j < n; j += kGemmPanel) {
+    const float *P = packed + j * k;
+    const size_t ncol = n - j < kGemmPanel ? n - j : kGemmPanel;
+    size_t i = 0;
+    for (; i + kGemmRows <= m; i += kGemmRows)
+      gemm_block<kGemmRows>(k, A + i * a_row, a_row, a_col, P, alpha, beta,
+                            C + i * ldc + j, ldc, ncol);
+    for (; i < m; i++)
+      gemm_block<1>(k, A + i * a_row, a_row, a_col, P, alpha, beta,
+                    C + i * ldc + j, ldc, ncol);
+  }
+}
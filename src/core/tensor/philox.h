@@ -0,0 +1,78 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+#ifndef SRC_CORE_TENSOR_PHILOX_H_
+#define SRC_CORE_TENSOR_PHILOX_H_
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+/// Philox4x32-10, the counter-based generator of Salmon et al., "Parallel
+/// random numbers: as easy as 1, 2, 3" (SC'11). Block 'i' of the stream
+/// 'stream' of a key is a pure function of (key, stream, i), so any range of
+/// a stream can be generated independently, e.g., by several threads, with
+/// the same result.
+namespace singa {
+
+namespace philox {
+
+typedef std::array<uint32_t, 4> Block;
+
+/// The 4 random words of block 'index' of the stream 'stream' of 'key'.
+inline Block Generate(uint64_t key, uint64_t stream, uint64_t index) {
+  Block c = {{static_cast<uint32_t>(index), static_cast<uint32_t>(index >> 32),
+              static_cast<uint32_t>(stream),
+              static_cast<uint32_t>(stream >> 32)}};
+  uint32_t k0 = static_cast<uint32_t>(key);
+  uint32_t k1 = static_cast<uint32_t>(key >> 32);
+  for (int r = 0; r < 10; r++) {
+    if (r > 0) {
+      k0 += 0x9E3779B9u;
+      k1 += 0xBB67AE85u;
+    }
+    const uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * c[0];
+    const uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * c[2];
+    c = {{static_cast<uint32_t>(p1 >> 32) ^ c[1] ^ k0,
+          static_cast<uint32_t>(p1),
+          static_cast<uint32_t>(p0 >> 32) ^ c[3] ^ k1,
+          static_cast<uint32_t>(p0)}};
+  }
+  return c;
+}
+
+/// A float in [0, 1) from the 24 high bits of 'x'.
+inline float ToUniform(uint32_t x) { return (x >> 8) * (1.f / 16777216.f); }
+
+/// Two standard normal floats from two words (Box-Muller).
+inline void ToNormal(uint32_t x, uint32_t y, float *n0, float *n1) {
+  // (0, 1], so that the log is finite
+  const float u = ((x >> 8) + 1) * (1.f / 16777216.f);
+  const float v = ToUniform(y) * 6.28318530717958647f;
+  const float r = std::sqrt(-2.f * std::log(u));
+  *n0 = r * std::cos(v);
+  *n1 = r * std::sin(v);
+}
+
+}  // namespace philox
+
+}  // namespace singa
+
+#endif  // SRC_CORE_TENSOR_PHILOX_H_
@@ -15,9 +15,292 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#ifndef DISABLE_WARNINGS
+#include "singa/core/sparse_tensor.h"
 
-#include "singa/core/tensor.h"
-namespace singa {}
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
 
-#endif
+#include "singa/core/device.h"
+#include "singa/utils/thread_pool.h"
+
+namespace singa {
+
+namespace {
+// the minimum number of multiply-adds per thread
+const size_t kSparseGrain = 16384;
+
+// The conversions below size their outputs by the number of entries, hence
+// they work on the host memory of the CppCPU blocks directly.
+template <typename T>
+const T *HostData(const Tensor &t) {
+  return t.Size() == 0 ? nullptr : static_cast<const T *>(t.block()->data());
+}
+
+// Wait for the ops writing 't' before reading its HostData() outside
+// Exec(). The ops are only buffered while the graph is enabled, hence the
+// graph must be disabled.
+void SyncHost(const Tensor &t) {
+  CHECK(!t.device()->graph_enabled())
+      << "SparseTensor reads the data on the host; disable the graph first";
+  t.device()->Sync();
+}
+
+template <typename T>
+Tensor FromVector(const std::vector<T> &v, std::shared_ptr<Device> dev,
+                  DataType dtype) {
+  Tensor t(Shape{v.size()}, dev, dtype);
+  if (!v.empty())
+    memcpy(t.block()->mutable_data(), v.data(), sizeof(T) * v.size());
+  return t;
+}
+
+void CheckCpp(const Tensor &t) {
+  CHECK_EQ(t.device()->lang(), kCpp) << "SparseTensor is only on CppCPU";
+}
+
+// the row of every entry of the CSR 'rows' offsets
+std::vector<int> ExpandRows(const int *offsets, size_t nrows, size_t nnz) {
+  std::vector<int> rows(nnz);
+  for (size_t r = 0; r < nrows; r++)
+    std::fill(rows.begin() + offsets[r], rows.begin() + offsets[r + 1],
+              static_cast<int>(r));
+  return rows;
+}
+}  // namespace
+
+SparseTensor::SparseTensor(const Shape &shape, SparseFormat format,
+                           const Tensor &values, const Tensor &rows,
+                           const Tensor &cols)
+    : shape_(shape), format_(format), values_(values), rows_(rows),
+      cols_(cols) {
+  CHECK_EQ(shape_.size(), 2u) << "SparseTensor is a matrix";
+  CHECK_EQ(values_.data_type(), kFloat32);
+  CHECK_EQ(rows_.data_type(), kInt);
+  CHECK_EQ(cols_.data_type(), kInt);
+  CHECK(values_.is_contiguous() && rows_.is_contiguous() &&
+        cols_.is_contiguous());
+  CheckCpp(values_);
+  CHECK_EQ(cols_.Size(), values_.Size());
+  SyncHost(rows_);
+  SyncHost(cols_);
+  const size_t n = values_.Size();
+  const int *rptr = HostData<int>(rows_), *cptr = HostData<int>(cols_);
+  if (format_ == kCSR) {
+    CHECK_EQ(rows_.Size(), shape_[0] + 1) << "Expect rows + 1 CSR offsets";
+    CHECK_EQ(rptr[0], 0);
+    for (size_t r = 0; r < shape_[0]; r++)
+      CHECK_LE(rptr[r], rptr[r + 1]) << "The CSR offsets decrease at row " << r;
+    CHECK_EQ(static_cast<size_t>(rptr[shape_[0]]), n);
+  } else {
+    CHECK_EQ(rows_.Size(), n);
+    for (size_t i = 0; i < n; i++)
+      CHECK(rptr[i] >= 0 && static_cast<size_t>(rptr[i]) < shape_[0])
+          << "The row " << rptr[i] << " of entry " << i << " is out of range";
+  }
+  for (size_t i = 0; i < n; i++)
+    CHECK(cptr[i] >= 0 && static_cast<size_t>(cptr[i]) < shape_[1])
+        << "The column " << cptr[i] << " of entry " << i << " is out of range";
+}
+
+SparseTensor SparseTensor::Unchecked(const Shape &shape, SparseFormat format,
+                                     const Tensor &values, const Tensor &rows,
+                                     const Tensor &cols) {
+  SparseTensor t;
+  t.shape_ = shape;
+  t.format_ = format;
+  t.values_ = values;
+  t.rows_ = rows;
+  t.cols_ = cols;
+  return t;
+}
+
+SparseTensor SparseTensor::FromDense(const Tensor &dense,
+                                     SparseFormat format) {
+  CHECK_EQ(dense.nDim(), 2u);
+  CHECK_EQ(dense.data_type(), kFloat32);
+  CheckCpp(dense);
+  const Tensor in = Contiguous(dense);
+  SyncHost(in);
+  const size_t nrows = in.shape(0), ncols = in.shape(1);
+  const float *dptr = HostData<float>(in);
+  std::vector<float> values;
+  std::vector<int> offsets{0}, cols;
+  for (size_t r = 0; r < nrows; r++) {
+    for (size_t c = 0; c < ncols; c++) {
+      if (dptr[r * ncols + c] != 0.f) {
+        values.push_back(dptr[r * ncols + c]);
+        cols.push_back(static_cast<int>(c));
+      }
+    }
+    offsets.push_back(static_cast<int>(values.size()));
+  }
+  auto dev = in.device();
+  const SparseTensor csr = Unchecked(
+      in.shape(), kCSR, FromVector(values, dev, kFloat32),
+      FromVector(offsets, dev, kInt), FromVector(cols, dev, kInt));
+  return csr.ToFormat(format);
+}
+
+Tensor SparseTensor::ToDense() const {
+  Tensor out(shape_, device(), kFloat32);
+  out.SetValue(0.f);
+  if (nnz() == 0) return out;
+  const Tensor values = values_, rows = rows_, cols = cols_;
+  const SparseFormat format = format_;
+  const size_t nrows = shape_[0], ncols = shape_[1];
+  out.device()->Exec(
+      [out, values, rows, cols, format, nrows, ncols](Context *ctx) mutable {
+        const float *vptr = HostData<float>(values);
+        const int *rptr = HostData<int>(rows), *cptr = HostData<int>(cols);
+        float *optr = static_cast<float *>(out.block()->mutable_data());
+        if (format == kCSR) {
+          for (size_t r = 0; r < nrows; r++)
+            for (int i = rptr[r]; i < rptr[r + 1]; i++)
+              optr[r * ncols + cptr[i]] += vptr[i];
+        } else {
+          for (size_t i = 0; i < values.Size(); i++)
+            optr[rptr[i] * ncols + cptr[i]] += vptr[i];
+        }
+      },
+      {values_.block(), rows_.block(), cols_.block()}, {out.block()},
+      "SparseToDense");
+  return out;
+}
+
+SparseTensor SparseTensor::ToFormat(SparseFormat format) const {
+  if (format == format_) return *this;
+  auto dev = device();
+  SyncHost(values_);
+  SyncHost(rows_);
+  SyncHost(cols_);
+  const size_t nrows = shape_[0], n = nnz();
+  const int *rptr = HostData<int>(rows_), *cptr = HostData<int>(cols_);
+  if (format == kCOO)  // only the rows change
+    return Unchecked(shape_, kCOO, values_,
+                     FromVector(ExpandRows(rptr, nrows, n), dev, kInt), cols_);
+
+  // COO to CSR: a counting sort by row, then sort the columns of each row
+  // and sum the duplicated entries; the constructor checked the indices
+  const float *vptr = HostData<float>(values_);
+  std::vector<int> count(nrows + 1, 0);
+  for (size_t i = 0; i < n; i++) count[rptr[i] + 1]++;
+  std::partial_sum(count.begin(), count.end(), count.begin());
+  std::vector<int> order(n), next(count.begin(), count.end() - 1);
+  for (size_t i = 0; i < n; i++) order[next[rptr[i]]++] = static_cast<int>(i);
+  std::vector<float> values;
+  std::vector<int> offsets{0}, cols;
+  values.reserve(n);
+  cols.reserve(n);
+  for (size_t r = 0; r < nrows; r++) {
+    auto begin = order.begin() + count[r], end = order.begin() + count[r + 1];
+    std::stable_sort(begin, end,
+                     [cptr](int a, int b) { return cptr[a] < cptr[b]; });
+    for (auto it = begin; it != end; ++it) {
+      if (it != begin && cptr[*it] == cols.back())
+        values.back() += vptr[*it];
+      else {
+        values.push_back(vptr[*it]);
+        cols.push_back(cptr[*it]);
+      }
+    }
+    offsets.push_back(static_cast<int>(values.size()));
+  }
+  return Unchecked(shape_, kCSR, FromVector(values, dev, kFloat32),
+                   FromVector(offsets, dev, kInt), FromVector(cols, dev, kInt));
+}
+
+SparseTensor SparseTensor::Transpose() const {
+  const SparseTensor coo = ToCOO();
+  const SparseTensor t = Unchecked(Shape{shape_[1], shape_[0]}, kCOO,
+                                   coo.values_, coo.cols_, coo.rows_);
+  return t.ToFormat(format_);
+}
+
+Tensor Mult(const SparseTensor &A, const Tensor &B) {
+  CHECK_EQ(B.data_type(), kFloat32);
+  CheckCpp(B);
+  CHECK(B.nDim() == 1u || B.nDim() == 2u);
+  CHECK_EQ(B.shape(0), A.shape(1)) << "Mismatched inner dimensions";
+  const SparseTensor csr = A.ToCSR();
+  const size_t M = A.shape(0), N = B.nDim() == 1 ? 1 : B.shape(1);
+  Shape shape = B.nDim() == 1 ? Shape{M} : Shape{M, N};
+  Tensor C(shape, B.device(), kFloat32);
+  if (C.Size() == 0) return C;
+  const Tensor b = Contiguous(B);
+  const Tensor values = csr.values(), rows = csr.rows(), cols = csr.cols();
+  std::vector<Block *> read_blocks{rows.block()};
+  if (csr.nnz() > 0) {
+    read_blocks.push_back(values.block());
+    read_blocks.push_back(cols.block());
+  }
+  if (b.block() != nullptr) read_blocks.push_back(b.block());
+  C.device()->Exec(
+      [C, b, values, rows, cols, M, N](Context *ctx) mutable {
+        const float *vptr = HostData<float>(values), *bptr = HostData<float>(b);
+        const int *rptr = HostData<int>(rows), *cptr = HostData<int>(cols);
+        float *optr = static_cast<float *>(C.block()->mutable_data());
+        const size_t work = (values.Size() / M + 1) * N;
+        const size_t grain = std::max<size_t>(1, kSparseGrain / work);
+        // C[r, :] = sum_i A[r, cols[i]] * B[cols[i], :]; the rows are
+        // independent, so every thread owns a range of rows
+        ParallelFor(0, M, grain, ctx->num_threads, [&](size_t begin,
+                                                       size_t end) {
+          for (size_t r = begin; r < end; r++) {
+            float *o = optr + r * N;
+            std::fill(o, o + N, 0.f);
+            for (int i = rptr[r]; i < rptr[r + 1]; i++) {
+              const float v = vptr[i];
+              const float *brow = bptr + static_cast<size_t>(cptr[i]) * N;
+              for (size_t j = 0; j < N; j++) o[j] += v * brow[j];
+            }
+          }
+        });
+      },
+      read_blocks, {C.block()}, "SparseMult");
+  return C;
+}
+
+SparseTensor EltwiseMult(const SparseTensor &A, const Tensor &B) {
+  CHECK_EQ(B.data_type(), kFloat32);
+  CheckCpp(B);
+  CHECK(B.shape() == A.shape()) << "Expect B of the shape of A";
+  Tensor values(Shape{A.nnz()}, A.device(), kFloat32);
+  SparseTensor out = SparseTensor::Unchecked(A.shape(), A.format(), values,
+                                             A.rows(), A.cols());
+  if (A.nnz() == 0) return out;
+  const Tensor b = Contiguous(B), in = A.values(), rows = A.rows(),
+               cols = A.cols();
+  const bool csr = A.format() == kCSR;
+  const size_t M = A.shape(0), N = A.shape(1);
+  values.device()->Exec(
+      [values, in, b, rows, cols, csr, M, N](Context *ctx) mutable {
+        const float *iptr = HostData<float>(in), *bptr = HostData<float>(b);
+        const int *rptr = HostData<int>(rows), *cptr = HostData<int>(cols);
+        float *optr = static_cast<float *>(values.block()->mutable_data());
+        if (csr) {
+          const size_t grain = std::max<size_t>(
+              1, kSparseGrain / (values.Size() / M + 1));
+          ParallelFor(0, M, grain, ctx->num_threads, [&](size_t begin,
+                                                         size_t end) {
+            for (size_t r = begin; r < end; r++)
+              for (int i = rptr[r]; i < rptr[r + 1]; i++)
+                optr[i] = iptr[i] * bptr[r * N + cptr[i]];
+          });
+        } else {
+          ParallelFor(0, values.Size(), kSparseGrain, ctx->num_threads,
+                      [&](size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; i++)
+                          optr[i] = iptr[i] *
+                                    bptr[static_cast<size_t>(rptr[i]) * N +
+                                         cptr[i]];
+                      });
+        }
+      },
+      {in.block(), b.block(), rows.block(), cols.block()}, {values.block()},
+      "SparseEltwiseMult");
+  return out;
+}
+
+}  // namespace singa
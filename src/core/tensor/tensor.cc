@@ -16,9 +16,20 @@
  * limitations under the License.
  */
 #include "singa/core/tensor.h"
+
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <initializer_list>
 #include <utility>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // _WIN32
+
 #include "./tensor_math.h"
 #include "./tensor_math_cpp.h"
 #include "./tensor_math_cuda.h"
@@ -30,6 +41,8 @@ namespace singa {
 
 template half_float::half TypeCast(const float &x);
 template float TypeCast(const half_float::half &x);
+template bfloat16 TypeCast(const float &x);
+template float TypeCast(const bfloat16 &x);
 template int TypeCast(const float &x);
 template float TypeCast(const int &x);
 
@@ -50,7 +63,7 @@ Tensor::Tensor(const Shape &shape, DataType dtype)
     : data_type_(dtype), device_(defaultDevice), shape_(shape) {
   size_t size = Product(shape_) * SizeOf(data_type_);
   if (size) {
-    block_ = device_->NewBlock((int)size);
+    block_ = device_->NewBlock(size);
   }
   generate_stride();
 }
@@ -61,7 +74,7 @@ Tensor::Tensor(const Shape &shape, std::shared_ptr<Device> device,
     : data_type_(dtype), device_(device), shape_(shape) {
   size_t size = Product(shape_) * SizeOf(data_type_);
   if (size) {
-    block_ = device_->NewBlock((int)size);
+    block_ = device_->NewBlock(size);
   }
   generate_stride();
 }
@@ -90,7 +103,7 @@ Tensor &Tensor::ResetLike(const Tensor &in) {
       device_->FreeBlock(block_);
     device_ = in.device_;
     data_type_ = in.data_type_;
-    block_ = device_->NewBlock((int)in.MemSize());
+    block_ = device_->NewBlock(in.MemSize());
   }
   shape_ = in.shape_;
   stride_ = in.stride_;
@@ -101,7 +114,7 @@ Tensor &Tensor::Resize(const Shape &shape) {
   if (Size() != Product(shape)) {
     if (block_ != nullptr && block_->DecRefCount() == 0)
       device_->FreeBlock(block_);
-    block_ = device_->NewBlock((int)(Product(shape) * SizeOf(data_type_)));
+    block_ = device_->NewBlock(Product(shape) * SizeOf(data_type_));
   }
   shape_ = shape;
   generate_stride();
@@ -137,6 +150,22 @@ Tensor Resize(const Tensor &in, const Shape &shape) {
         { __VA_ARGS__ }                                                        \
         break;                                                                 \
       }                                                                        \
+      case (((kBFloat16) << _SwitchShift * 2) + (kFloat32 << _SwitchShift) +   \
+            kCpp): {                                                           \
+        typedef bfloat16 LDType;                                               \
+        typedef float RDType;                                                  \
+        typedef lang::Cpp Lang;                                                \
+        { __VA_ARGS__ }                                                        \
+        break;                                                                 \
+      }                                                                        \
+      case (((kFloat32) << _SwitchShift * 2) + (kBFloat16 << _SwitchShift) +   \
+            kCpp): {                                                           \
+        typedef float LDType;                                                  \
+        typedef bfloat16 RDType;                                               \
+        typedef lang::Cpp Lang;                                                \
+        { __VA_ARGS__ }                                                        \
+        break;                                                                 \
+      }                                                                        \
       case (((kFloat16) << _SwitchShift * 2) + (kFloat32 << _SwitchShift) +    \
             kCuda): {                                                          \
         typedef half_float::half LDType;                                       \
@@ -273,6 +302,9 @@ template void Tensor::CopyDataFromHostPtr(const unsigned char *src,
 template void Tensor::CopyDataFromHostPtr(const half_float::half *src,
                                           const size_t num,
                                           const size_t offset) const;
+template void Tensor::CopyDataFromHostPtr(const bfloat16 *src,
+                                          const size_t num,
+                                          const size_t offset) const;
 template void Tensor::CopyDataFromHostPtr(const float *src, const size_t num,
                                           const size_t offset) const;
 template void Tensor::CopyDataFromHostPtr(const int *src, const size_t num,
@@ -310,7 +342,7 @@ void Tensor::FromProto(const singa::TensorProto &proto) {
   block_ = nullptr;
   for (uint32_t s : proto.shape()) shape_.push_back(s);
   data_type_ = proto.data_type();
-  block_ = device_->NewBlock((int)(Product(shape()) * SizeOf(data_type_)));
+  block_ = device_->NewBlock(Product(shape()) * SizeOf(data_type_));
   // transpose_ = proto.transpose();
   stride_.clear();
   for (int32_t s : proto.stride()) stride_.push_back(s);
@@ -470,6 +502,78 @@ Tensor Tensor::Clone(std::shared_ptr<Device> device) const {
   return t;
 }
 
+Tensor Tensor::View(const Shape &shape, size_t offset) const {
+  CHECK(is_contiguous()) << "Only contiguous tensors have views";
+  CHECK_LE(offset + Product(shape), Size()) << "The view is out of range";
+  Tensor t;
+  t.device_ = device_;
+  t.data_type_ = data_type_;
+  t.shape_ = shape;
+  size_t bytes = Product(shape) * SizeOf(data_type_);
+  if (block_ != nullptr && bytes > 0) {
+    t.block_ = new Block(block_, bytes, offset * SizeOf(data_type_));
+    if (device_->graph_enabled()) {
+      // the view shares the parent from this point of each run of the graph,
+      // so earlier writes to the parent show through it
+      t.block_->release_view();
+      device_->Exec([t](Context *ctx) { t.block()->free_data(); }, {block_},
+                    {t.block_}, "View");
+    }
+  }
+  t.generate_stride();
+  return t;
+}
+
+Tensor Tensor::FromExternal(void *ptr, const Shape &shape, DataType dtype,
+                            std::function<void(void *)> deleter,
+                            std::shared_ptr<Device> device) {
+  Tensor t;
+  if (device != nullptr) t.device_ = device;
+  t.data_type_ = dtype;
+  t.shape_ = shape;
+  size_t bytes = Product(shape) * SizeOf(dtype);
+  if (bytes > 0) {
+    CHECK(ptr != nullptr);
+    t.block_ = new Block(ptr, bytes, t.device_.get(), std::move(deleter));
+  } else if (deleter) {
+    deleter(ptr);
+  }
+  t.generate_stride();
+  return t;
+}
+
+Tensor Tensor::FromMmap(const std::string &path, size_t offset,
+                        const Shape &shape, DataType dtype) {
+#ifdef _WIN32
+  LOG(FATAL) << "FromMmap is not supported on Windows";
+  return Tensor();
+#else
+  CHECK_EQ(offset % SizeOf(dtype), 0u)
+      << "The offset is not aligned to the data type";
+  const size_t bytes = Product(shape) * SizeOf(dtype);
+  int fd = open(path.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Cannot open " << path << ": " << strerror(errno);
+  struct stat st;
+  CHECK_EQ(fstat(fd, &st), 0) << "Cannot stat " << path;
+  CHECK_LE(offset + bytes, static_cast<size_t>(st.st_size))
+      << "The tensor is out of the range of " << path;
+  if (bytes == 0) {
+    close(fd);
+    return Tensor(shape, defaultDevice, dtype);
+  }
+  // mmap offsets must be page aligned
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t begin = offset / page * page, len = offset + bytes - begin;
+  void *base = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                    static_cast<off_t>(begin));
+  close(fd);  // the mapping keeps the file open
+  CHECK(base != MAP_FAILED) << "Cannot mmap " << path << ": "
+                            << strerror(errno);
+  return FromExternal(static_cast<char *>(base) + (offset - begin), shape,
+                      dtype, [base, len](void *) { munmap(base, len); });
+#endif  // _WIN32
+}
+
 void Tensor::Clone(Tensor *&other, std::shared_ptr<Device> device) const {
   if (device == nullptr) device = device_;
   other = new Tensor(shape_, device, data_type_);
@@ -603,6 +707,26 @@ GenUnaryScalarArgMemberFn(operator*=, EltwiseMult);
 GenUnaryScalarArgMemberFn(operator/=, Div);
 
 // ====================Tensor Operations=======================================
+// the device conducting copies from src to dst and the copy direction
+static Device *CopyDevice(const Tensor &dst, const Tensor &src,
+                          CopyDirection *direct) {
+  std::shared_ptr<Device> src_dev = src.device(), dst_dev = dst.device();
+  if (dst_dev->lang() != src_dev->lang()) {
+    // let the none cpp device conduct copy op
+    if (dst_dev->lang() == kCpp) {
+      *direct = kDeviceToHost;
+      return src_dev.get();
+    } else if (src_dev->lang() == kCpp) {
+      *direct = kHostToDevice;
+      return dst_dev.get();
+    } else {
+      LOG(FATAL) << "Not support mem copy between Cuda and OpenCL device";
+    }
+  }
+  *direct = src_dev->lang() == kCpp ? kHostToHost : kDeviceToDevice;
+  return src_dev.get();
+}
+
 void CopyDataToFrom(Tensor *dst, const Tensor &src, const size_t num,
                     const size_t dst_offset, const size_t src_offset) {
   auto width = SizeOf(src.data_type());
@@ -613,36 +737,47 @@ void CopyDataToFrom(Tensor *dst, const Tensor &src, const size_t num,
   CHECK_GE(src.MemSize(), s_offset + nBytes);
   CHECK_GE(dst->MemSize(), d_offset + nBytes);
 
-  Device *dev = nullptr;
   CopyDirection direct;
-  std::shared_ptr<Device> src_dev = src.device(), dst_dev = dst->device();
-  if (dst_dev->lang() != src_dev->lang()) {
-    // let the none cpp device conduct copy op
-    if (dst_dev->lang() == kCpp) {
-      dev = src_dev.get();
-      direct = kDeviceToHost;
-    } else if (src_dev->lang() == kCpp) {
-      dev = dst_dev.get();
-      direct = kHostToDevice;
-    } else {
-      LOG(FATAL) << "Not support mem copy between Cuda and OpenCL device";
-    }
-  } else {
-    dev = src_dev.get();
-    direct = src_dev->lang() == kCpp ? kHostToHost : kDeviceToDevice;
-  }
+  Device *dev = CopyDevice(*dst, src, &direct);
 
   Tensor &dstRef = *dst;
   dev->Exec(
       [dev, dstRef, src, nBytes, direct, d_offset,
        s_offset](Context *ctx) mutable {
         Block *from = src.block(), *to = dstRef.block();
-        dev->CopyDataToFrom(to, from, nBytes, direct, (int)d_offset,
-                            (int)s_offset, ctx);
+        dev->CopyDataToFrom(to, from, nBytes, direct, d_offset, s_offset,
+                            ctx);
       },
       {src.block()}, {dst->block()}, "CopyDataToFrom");
 }
 
+void CopyDataToFrom2D(Tensor *dst, const Tensor &src, const size_t width,
+                      const size_t height, const size_t dst_pitch,
+                      const size_t src_pitch, const size_t dst_offset,
+                      const size_t src_offset) {
+  auto unit = SizeOf(src.data_type());
+  CHECK_EQ(unit, SizeOf(dst->data_type()));
+  if (width == 0 || height == 0) return;
+  CHECK_LE(width, dst_pitch);
+  CHECK_LE(width, src_pitch);
+  CHECK_GE(src.Size(), src_offset + (height - 1) * src_pitch + width);
+  CHECK_GE(dst->Size(), dst_offset + (height - 1) * dst_pitch + width);
+
+  CopyDirection direct;
+  Device *dev = CopyDevice(*dst, src, &direct);
+
+  Tensor &dstRef = *dst;
+  dev->Exec(
+      [dev, dstRef, src, width, height, dst_pitch, src_pitch, direct,
+       dst_offset, src_offset, unit](Context *ctx) mutable {
+        dev->CopyDataToFrom2D(dstRef.block(), src.block(), width * unit,
+                              height, dst_pitch * unit, src_pitch * unit,
+                              direct, dst_offset * unit, src_offset * unit,
+                              ctx);
+      },
+      {src.block()}, {dst->block()}, "CopyDataToFrom2D");
+}
+
 void RepeatDataToFrom(bool broadcast_flag, const vector<size_t> &repeats,
                       int axis, Tensor *dst, const Tensor &src,
                       const size_t num) {
@@ -659,9 +794,9 @@ void RepeatDataToFrom(bool broadcast_flag, const vector<size_t> &repeats,
   auto width = SizeOf(src.data_type());
   CHECK_EQ(width, SizeOf(dst->data_type()));
   // size_t nBytes = num * width;
-  int chunk = width;
-  int axis_shape = 1;
-  int shape_outer = 1;
+  size_t chunk = width;
+  size_t axis_shape = 1;
+  size_t shape_outer = 1;
   if (axis == Noaxis) {
     axis_shape = 1;
     shape_outer = Product(src.shape());
@@ -695,13 +830,13 @@ void RepeatDataToFrom(bool broadcast_flag, const vector<size_t> &repeats,
     direct = src_dev->lang() == kCpp ? kHostToHost : kDeviceToDevice;
   }
 
-  int dst_offset = 0;
-  int src_offset = 0;
+  size_t dst_offset = 0;
+  size_t src_offset = 0;
   Tensor &dstRef = *dst;
-  for (int i = 0; i < shape_outer; i++) {
-    for (int j = 0; j < axis_shape; j++) {
-      int temp = broadcast_flag ? repeats[0] : repeats[j];
-      for (int k = 0; k < temp; k++) {
+  for (size_t i = 0; i < shape_outer; i++) {
+    for (size_t j = 0; j < axis_shape; j++) {
+      size_t temp = broadcast_flag ? repeats[0] : repeats[j];
+      for (size_t k = 0; k < temp; k++) {
         dev->Exec(
             [dev, dstRef, src, chunk, direct, dst_offset,
              src_offset](Context *ctx) mutable {
@@ -733,6 +868,11 @@ void RepeatDataToFrom(bool broadcast_flag, const vector<size_t> &repeats,
         { __VA_ARGS__ }                                             \
         break;                                                      \
       }                                                             \
+      case kBFloat16: {                                             \
+        typedef bfloat16 DType;                                     \
+        { __VA_ARGS__ }                                             \
+        break;                                                      \
+      }                                                             \
       case kInt: {                                                  \
         typedef int DType;                                          \
         { __VA_ARGS__ }                                             \
@@ -768,6 +908,12 @@ void RepeatDataToFrom(bool broadcast_flag, const vector<size_t> &repeats,
         { __VA_ARGS__ }                                        \
         break;                                                 \
       }                                                        \
+      case ((kBFloat16 << _SwitchShift) + kCpp): {             \
+        typedef bfloat16 DType;                                \
+        typedef lang::Cpp Lang;                                \
+        { __VA_ARGS__ }                                        \
+        break;                                                 \
+      }                                                        \
       case ((kFloat16 << _SwitchShift) + kCuda): {             \
         typedef half_float::half DType;                        \
         typedef lang::Cuda Lang;                               \
@@ -862,6 +1008,7 @@ void Tensor::SetValue(const SType x) {
 }
 template void Tensor::SetValue<float>(const float x);
 template void Tensor::SetValue<half_float::half>(const half_float::half x);
+template void Tensor::SetValue<bfloat16>(const bfloat16 x);
 template void Tensor::SetValue<int>(const int x);
 
 template <typename SType>
@@ -876,6 +1023,8 @@ void Tensor::get_value(SType *value, const size_t num) const {
 template void Tensor::get_value<float>(float *value, const size_t num) const;
 template void Tensor::get_value<half_float::half>(half_float::half *value,
                                                   const size_t num) const;
+template void Tensor::get_value<bfloat16>(bfloat16 *value,
+                                          const size_t num) const;
 template void Tensor::get_value<int>(int *value, const size_t num) const;
 
 // DEPRECATED
@@ -886,26 +1035,61 @@ void Tensor::GetValue(SType *value, const size_t num) const {
 template void Tensor::GetValue<float>(float *value, const size_t num) const;
 template void Tensor::GetValue<int>(int *value, const size_t num) const;
 
-#define EltwiseUnaryTensorFn(fn, t, ret)                               \
-  do {                                                                 \
-    TYPE_LANG_SWITCH(t.data_type(), DType, t.device()->lang(), Lang, { \
-      Tensor &retRef = *ret;                                           \
-      ret->device()->Exec(                                             \
-          [t, retRef](Context *ctx) mutable {                          \
-            fn<DType, Lang>(t, &retRef, ctx);                          \
-          },                                                           \
-          {t.block()}, {ret->block()}, #fn);                           \
-    });                                                                \
+// Describe an elementwise op buffered in the graph, which may then fuse it
+// with others; only ops over dense float32 tensors of lang::Cpp are fused.
+static EltwiseOpPtr FusibleOp(std::initializer_list<const Tensor *> in,
+                              const Tensor &out, EltwiseKernel &&kernel) {
+  auto dev = out.device();
+  if (!dev->graph_enabled() || dev->lang() != kCpp ||
+      out.data_type() != kFloat32 || !out.is_contiguous() ||
+      out.block()->parent() != nullptr)
+    return nullptr;
+  auto op = std::make_shared<EltwiseOp>();
+  for (auto t : in) {
+    if (t->device() != dev || t->data_type() != kFloat32 ||
+        !t->is_contiguous() || t->Size() != out.Size() ||
+        t->block()->parent() != nullptr)
+      return nullptr;
+    op->inputs.push_back(t->block());
+  }
+  op->output = out.block();
+  op->size = out.Size();
+  op->device = dev;
+  op->kernel = std::move(kernel);
+  return op;
+}
+
+#define EltwiseUnaryTensorFn(fn, t, ret, fusible)                       \
+  do {                                                                  \
+    TYPE_LANG_SWITCH(t.data_type(), DType, t.device()->lang(), Lang, {  \
+      Tensor &retRef = *ret;                                            \
+      EltwiseOpPtr eltwise;                                             \
+      if (fusible)                                                      \
+        eltwise = FusibleOp({&t}, *ret,                                 \
+                            [](const vector<Tensor> &in, Tensor *out,   \
+                               Context *ctx) {                          \
+                              fn<DType, Lang>(in[0], out, ctx);         \
+                            });                                         \
+      ret->device()->Exec(                                              \
+          [t, retRef](Context *ctx) mutable {                           \
+            fn<DType, Lang>(t, &retRef, ctx);                           \
+          },                                                            \
+          {t.block()}, {ret->block()}, #fn, false, std::move(eltwise)); \
+    });                                                                 \
   } while (0)
 
-#define GenUnaryTensorFn(fn)                             \
+#define GenUnaryTensorFnImpl(fn, fusible)                \
   Tensor fn(const Tensor &in) {                          \
     Tensor ret(in.shape(), in.device(), in.data_type()); \
     Tensor *retptr = &ret;                               \
-    EltwiseUnaryTensorFn(fn, in, retptr);                \
+    EltwiseUnaryTensorFn(fn, in, retptr, fusible);       \
     return ret;                                          \
   }                                                      \
-  void fn(const Tensor &in, Tensor *out) { EltwiseUnaryTensorFn(fn, in, out); }
+  void fn(const Tensor &in, Tensor *out) {               \
+    EltwiseUnaryTensorFn(fn, in, out, fusible);          \
+  }
+
+#define GenUnaryTensorFn(fn) GenUnaryTensorFnImpl(fn, true)
 
 GenUnaryTensorFn(Abs);
 GenUnaryTensorFn(Erf);
@@ -922,7 +1106,7 @@ GenUnaryTensorFn(SoftSign);
 GenUnaryTensorFn(Sign);
 GenUnaryTensorFn(Sqrt);
 GenUnaryTensorFn(Square);
-GenUnaryTensorFn(Transform);
+GenUnaryTensorFnImpl(Transform, false);
 GenUnaryTensorFn(Cos);
 GenUnaryTensorFn(Cosh);
 GenUnaryTensorFn(Acos);
@@ -935,39 +1119,36 @@ GenUnaryTensorFn(Tan);
 GenUnaryTensorFn(Tanh);
 GenUnaryTensorFn(Atan);
 GenUnaryTensorFn(Atanh);
-GenUnaryTensorFn(SoftMax);
+GenUnaryTensorFnImpl(SoftMax, false);
+GenUnaryTensorFnImpl(LogSoftMax, false);
 
 // add axis to softmax API according to ONNX specification
 // https://github.com/onnx/onnx/blob/master/docs/Operators.md#Softmax
-void SoftMax(const Tensor &in, Tensor *out, int axis) {
-  // {a_0, a_1, ..., a_k-1, a_k, ... a_n-1}
-  // reshape to
-  // { a_0 * a_1 * ... a_k-1, a_k * ... a_n-1 }
-
+// {a_0, a_1, ..., a_k-1, a_k, ... a_n-1} is coerced to
+// { a_0 * a_1 * ... a_k-1, a_k * ... a_n-1 }, which is a view of a
+// contiguous tensor. The kernels subtract the row max themselves.
+static Shape SoftMaxShape(const Tensor &in, int axis) {
   // assert axis \in {-r, r-1}
   CHECK_LE(axis, (int)in.shape().size() - 1);
   CHECK_GE(axis, -1 * (int)in.nDim());
-
-  Shape original_shape = in.shape();
   if (axis < 0) axis = in.shape().size() + axis;
 
   Shape coerced_shape = {1, 1};
   for (std::size_t i = 0, max = in.shape().size(); i != max; ++i) {
-    if (i < axis)
+    if (i < (size_t)axis)
       coerced_shape[0] *= in.shape()[i];
     else
       coerced_shape[1] *= in.shape()[i];
   }
+  return coerced_shape;
+}
+
+void SoftMax(const Tensor &in, Tensor *out, int axis) {
+  Shape original_shape = in.shape();
+  Shape coerced_shape = SoftMaxShape(in, axis);
   Tensor in_reshaped = Reshape(in, coerced_shape);
   out->Reshape(coerced_shape);
-
-  // optimise by minus x - x.max()
-  auto in_max = RowMax(in_reshaped);
-  in_max.Reshape({coerced_shape[0], 1});
-  in_reshaped = in_reshaped - in_max;
-
   SoftMax(in_reshaped, out);
-
   out->Reshape(original_shape);
 }
 
@@ -977,38 +1158,41 @@ Tensor SoftMax(const Tensor &in, int axis) {
   SoftMax(in, retptr, axis);
   return ret;
 }
-void SoftMaxBackward(const Tensor &in, Tensor *out, int axis,
-                     const Tensor &fdout) {
-  // {a_0, a_1, ..., a_k-1, a_k, ... a_n-1}
-  // reshape to
-  // { a_0 * a_1 * ... a_k-1, a_k * ... a_n-1 }
-
-  // assert axis \in {-r, r-1}
-  CHECK_LE(axis, (int)in.shape().size() - 1);
-  CHECK_GE(axis, -1 * (int)in.nDim());
 
+void LogSoftMax(const Tensor &in, Tensor *out, int axis) {
   Shape original_shape = in.shape();
-  if (axis < 0) axis = in.shape().size() + axis;
+  Shape coerced_shape = SoftMaxShape(in, axis);
+  Tensor in_reshaped = Reshape(in, coerced_shape);
+  out->Reshape(coerced_shape);
+  LogSoftMax(in_reshaped, out);
+  out->Reshape(original_shape);
+}
 
-  Shape coerced_shape = {1, 1};
-  for (std::size_t i = 0, max = in.shape().size(); i != max; ++i) {
-    if (i < axis)
-      coerced_shape[0] *= in.shape()[i];
-    else
-      coerced_shape[1] *= in.shape()[i];
-  }
+Tensor LogSoftMax(const Tensor &in, int axis) {
+  Tensor ret(in.shape(), in.device(), in.data_type());
+  LogSoftMax(in, &ret, axis);
+  return ret;
+}
 
+void SoftMaxBackward(const Tensor &in, Tensor *out, int axis,
+                     const Tensor &fdout) {
+  CHECK(in.shape() == fdout.shape());
+  Shape original_shape = in.shape();
+  Shape coerced_shape = SoftMaxShape(in, axis);
   Tensor in_reshaped = Reshape(in, coerced_shape);
+  Tensor fdout_reshaped = Reshape(fdout, coerced_shape);
   out->Reshape(coerced_shape);
 
   do {
     TYPE_LANG_SWITCH(in.data_type(), DType, in.device()->lang(), Lang, {
       Tensor &outRef = *out;
       out->device()->Exec(
-          [in, outRef, fdout](Context *ctx) mutable {
-            SoftMaxBackward<DType, Lang>(in, &outRef, fdout, ctx);
+          [in_reshaped, outRef, fdout_reshaped](Context *ctx) mutable {
+            SoftMaxBackward<DType, Lang>(in_reshaped, &outRef, fdout_reshaped,
+                                         ctx);
           },
-          {in.block(), fdout.block()}, {out->block()}, "SoftmaxBackward");
+          {in_reshaped.block(), fdout_reshaped.block()}, {out->block()},
+          "SoftmaxBackward");
     });
   } while (0);
 
@@ -1029,11 +1213,17 @@ Tensor SoftMaxBackward(const Tensor &in, int axis, const Tensor &fdout) {
           << "lhs dtype size" << sizeof(DType) << " rhs dtype size"        \
           << SizeOf(rhs.data_type());                                      \
       Tensor &retRef = *ret;                                               \
+      EltwiseOpPtr eltwise = FusibleOp(                                    \
+          {&lhs, &rhs}, *ret,                                              \
+          [](const vector<Tensor> &in, Tensor *out, Context *ctx) {        \
+            fn<DType, Lang>(in[0], in[1], out, ctx);                       \
+          });                                                              \
       ret->device()->Exec(                                                 \
           [lhs, rhs, retRef](Context *ctx) mutable {                       \
             fn<DType, Lang>(lhs, rhs, &retRef, ctx);                       \
           },                                                               \
-          {lhs.block(), rhs.block()}, {ret->block()}, #fn);                \
+          {lhs.block(), rhs.block()}, {ret->block()}, #fn, false,          \
+          std::move(eltwise));                                             \
     });                                                                    \
   } while (0)
 
@@ -1084,11 +1274,16 @@ GenBinaryTensorFn(ReLUBackward, ReLUBackward);
     TYPE_LANG_SWITCH(t.data_type(), DType, t.device()->lang(), Lang, {  \
       DType tmp_x = TypeCast<SType, DType>(x);                         \
       Tensor &retRef = *ret;                                            \
+      EltwiseOpPtr eltwise = FusibleOp(                                 \
+          {&t}, *ret,                                                   \
+          [tmp_x](const vector<Tensor> &in, Tensor *out, Context *ctx) { \
+            fn<DType, Lang>(in[0], tmp_x, out, ctx);                    \
+          });                                                           \
       ret->device()->Exec(                                              \
           [t, tmp_x, retRef](Context *ctx) mutable {                   \
             fn<DType, Lang>(t, tmp_x, &retRef, ctx);                   \
           },                                                            \
-          {t.block()}, {ret->block()}, #fn);                            \
+          {t.block()}, {ret->block()}, #fn, false, std::move(eltwise)); \
     });                                                                 \
   } while (0)
 
@@ -1156,7 +1351,9 @@ Tensor Average(const Tensor &M, int axis) {
   // fp16 CastType(float x) {
   //    ....
   // }
-  if (axis == 0) {
+  if (M.device()->lang() == kCpp) {
+    return ReduceMean(M, {axis});
+  } else if (axis == 0) {
     return Sum(M, 0) / (1.0f * M.shape(0));
   } else if (axis == 1) {
     return Sum(M, 1) / (1.0f * M.shape(1));
@@ -1168,6 +1365,7 @@ Tensor Average(const Tensor &M, int axis) {
 template <>
 float Sum<float>(const Tensor &in) {
   float s = 0.0f;
+  if (in.device()->lang() == kCpp) return SumAll(in).data<float>()[0];
   Tensor one(in.shape(), in.device(), in.data_type());
   one.SetValue(1.0f);
   TYPE_LANG_SWITCH(in.data_type(), DType, in.device()->lang(), Lang, {
@@ -1184,6 +1382,7 @@ float Sum<float>(const Tensor &in) {
 }
 
 Tensor Sum(const Tensor &M, int axis) {
+  if (M.device()->lang() == kCpp) return ReduceSum(M, {axis});
   if (axis == 0) {
     Tensor out(Shape{M.shape(1)}, M.device(), M.data_type());
     SumRows(M, &out);
@@ -1197,6 +1396,7 @@ Tensor Sum(const Tensor &M, int axis) {
 }
 
 Tensor SumAll(const Tensor &in) {
+  if (in.device()->lang() == kCpp) return ReduceSum(in);
   Tensor out({(size_t)1}, in.device(), in.data_type());
   Tensor one(in.shape(), in.device(), in.data_type());
   one.SetValue(1.0f);
@@ -1210,6 +1410,73 @@ Tensor SumAll(const Tensor &in) {
   return out;
 }
 
+// =============Reductions===================================================
+static Tensor ReduceAxes(const ReduceOp op, const Tensor &in,
+                         const vector<int> &axes, bool keepdims,
+                         DataType out_type, const string &name) {
+  const int ndim = (int)in.nDim();
+  vector<bool> reduced(ndim, axes.empty());
+  for (int axis : axes) {
+    if (axis < 0) axis += ndim;
+    CHECK(axis >= 0 && axis < ndim) << "Invalid axis for " << name;
+    reduced[axis] = true;
+  }
+  Shape kshape = in.shape(), shape;
+  for (int k = 0; k < ndim; k++) {
+    if (reduced[k])
+      kshape[k] = 1;
+    else
+      shape.push_back(in.shape(k));
+  }
+  Tensor out(kshape, in.device(), out_type);
+  if (in.Size() == 0) {
+    // 'in' has no block; the sum of no elements is 0, while the extrema of
+    // an empty axis are undefined
+    CHECK(op == kReduceSum || out.Size() == 0)
+        << name << " over an empty axis is undefined";
+    if (out.Size()) out.SetValue(0.f);
+  } else {
+    TYPE_LANG_SWITCH(in.data_type(), DType, in.device()->lang(), Lang, {
+      in.device()->Exec(
+          [op, in, out](Context *ctx) mutable {
+            Reduce<DType, Lang>(op, in, &out, ctx);
+          },
+          {in.block()}, {out.block()}, name);
+    });
+  }
+  if (!keepdims) out.Reshape(shape.empty() ? Shape{1} : shape);
+  return out;
+}
+
+Tensor ReduceSum(const Tensor &in, const vector<int> &axes, bool keepdims) {
+  return ReduceAxes(kReduceSum, in, axes, keepdims, in.data_type(),
+                    "ReduceSum");
+}
+
+Tensor ReduceMean(const Tensor &in, const vector<int> &axes, bool keepdims) {
+  Tensor out = ReduceSum(in, axes, keepdims);
+  out /= static_cast<float>(Product(in.shape()) / out.Size());
+  return out;
+}
+
+Tensor ReduceMax(const Tensor &in, const vector<int> &axes, bool keepdims) {
+  return ReduceAxes(kReduceMax, in, axes, keepdims, in.data_type(),
+                    "ReduceMax");
+}
+
+Tensor ReduceMin(const Tensor &in, const vector<int> &axes, bool keepdims) {
+  return ReduceAxes(kReduceMin, in, axes, keepdims, in.data_type(),
+                    "ReduceMin");
+}
+
+Tensor ArgMax(const Tensor &in, int axis, bool keepdims) {
+  return ReduceAxes(kReduceArgMax, in, {axis}, keepdims, kInt, "ArgMax");
+}
+
+Tensor ArgMin(const Tensor &in, int axis, bool keepdims) {
+  return ReduceAxes(kReduceArgMin, in, {axis}, keepdims, kInt, "ArgMin");
+}
+
 Tensor RowMax(const Tensor &in) {
   Tensor ret({in.shape(0)}, in.device(), in.data_type());
   TYPE_LANG_SWITCH(in.data_type(), DType, in.device()->lang(), Lang, {
@@ -1335,7 +1602,6 @@ Tensor ConcatenateRows(const vector<Tensor> &in) {
   return out;
 }
 Tensor ConcatRows(const vector<Tensor> &in) { return ConcatenateRows(in); }
-// TODO(wangwei) add a copypatch function for improve the efficiency on GPU.
 Tensor ConcatenateColumns(const vector<Tensor> &in) {
   size_t nrow = 0, ncol = 0;
   CHECK(in.size());
@@ -1349,14 +1615,11 @@ Tensor ConcatenateColumns(const vector<Tensor> &in) {
       CHECK_EQ(nrow, x.shape(0));
   }
   Tensor out(Shape{nrow, ncol}, in.at(0).device(), in.at(0).data_type());
-  for (size_t row = 0; row < nrow; row++) {
-    size_t dst_offset = row * ncol;
-    for (const auto &x : in) {
-      size_t src_offset = row * x.shape(1);
-      CopyDataToFrom(&out, x, x.shape(1), dst_offset, src_offset);
-      dst_offset += x.shape(1);
-    }
-    CHECK_EQ(dst_offset, row * ncol + ncol);
+  size_t dst_offset = 0;
+  for (const auto &x : in) {
+    CopyDataToFrom2D(&out, x, x.shape(1), nrow, ncol, x.shape(1), dst_offset,
+                     0);
+    dst_offset += x.shape(1);
   }
   return out;
 }
@@ -1379,14 +1642,19 @@ Tensor SliceOn(const Tensor &in, const size_t start, const size_t end,
                int axis) {
   Shape out_shape = in.shape();
   out_shape[axis] = end - start;
+  size_t nrow = 1;
+  for (int i = 0; i < axis; i++) nrow *= in.shape(i);
+  if (nrow == 1 && in.is_contiguous()) {
+    CHECK_LT(start, end);
+    CHECK_GE(in.shape(axis), end) << "Tensor size must >= end";
+    return in.View(out_shape, start * (in.Size() / in.shape(axis)));
+  }
   if (axis == 0) {
     auto ret = SliceRows(Reshape(in, {in.shape(0), in.Size() / in.shape(0)}),
                          start, end);
     ret.Reshape(out_shape);
     return ret;
   } else {
-    size_t nrow = 1;
-    for (int i = 0; i < axis; i++) nrow *= in.shape(i);
     auto suffix = in.Size() / nrow / in.shape(axis);
     auto ret = SliceColumns(Reshape(in, {nrow, in.Size() / nrow}),
                             start * suffix, end * suffix);
@@ -1396,7 +1664,12 @@ Tensor SliceOn(const Tensor &in, const size_t start, const size_t end,
 }
 
 Tensor SliceRows(const Tensor &in, const size_t start, const size_t end) {
-  return CopyRows(in, start, end);
+  if (!in.is_contiguous()) return CopyRows(in, start, end);
+  CHECK_LT(start, end);
+  CHECK_GE(in.shape(0), end) << "Tensor size must >= end";
+  Shape s = in.shape();
+  s[0] = end - start;
+  return in.View(s, start * (in.Size() / in.shape(0)));
 }
 
 Tensor CopyColumns(const Tensor &in, const size_t start, const size_t end) {
@@ -1405,11 +1678,8 @@ Tensor CopyColumns(const Tensor &in, const size_t start, const size_t end) {
   CHECK_GE(in.shape(1), end);
   Shape s{in.shape(0), end - start};
   Tensor out(s, in.device(), in.data_type());
-  for (size_t row = 0; row < out.shape(0); row++) {
-    size_t src_offset = row * in.shape(1) + start;
-    size_t dst_offset = row * out.shape(1);
-    CopyDataToFrom(&out, in, end - start, dst_offset, src_offset);
-  }
+  CopyDataToFrom2D(&out, in, end - start, in.shape(0), end - start,
+                   in.shape(1), 0, start);
   return out;
 }
 
@@ -1631,14 +1901,19 @@ void Mult(const SType alpha, const Tensor &A, const Tensor &B, const SType beta,
       Tensor A_tmp;
       Tensor B_tmp;
 
-      if (A.transpose() || A.broadcasted()) {
+      // the cpp kernel reads strided and broadcast operands directly
+      bool strided = A.device()->lang() == kCpp, trans;
+      size_t ld;
+      if (strided ? !GEMMLayout(A, &trans, &ld)
+                  : A.transpose() || A.broadcasted()) {
         A_tmp = Tensor(A.shape(), A.device(), A.data_type());
         singa::Transform(A, &A_tmp);
       } else {
         A_tmp = A;
       }
 
-      if (B.transpose() || B.broadcasted()) {
+      if (strided ? !GEMMLayout(B, &trans, &ld)
+                  : B.transpose() || B.broadcasted()) {
         B_tmp = Tensor(B.shape(), B.device(), B.data_type());
         singa::Transform(B, &B_tmp);
       } else {
@@ -1649,6 +1924,8 @@ void Mult(const SType alpha, const Tensor &A, const Tensor &B, const SType beta,
       CHECK_EQ(A_tmp.shape(0), B_tmp.shape(0));
       if (B.nDim() == 4u) CHECK_EQ(A_tmp.shape(1), B_tmp.shape(1));
 
+      read_blocks[0] = A_tmp.block();
+      read_blocks[1] = B_tmp.block();
       Tensor &CRef = *C;
       C->device()->Exec(
           [a, A_tmp, b, B_tmp, CRef, fakeC](Context *ctx) mutable {
@@ -1714,6 +1991,87 @@ void SoftmaxCrossEntropyBwd(const Tensor &t, Tensor *p) {
   });
 }
 
+// the batch size and the number of classes of the logits of
+// SoftmaxCrossEntropyFwd() and SoftmaxCrossEntropyBwd()
+static void SoftmaxCrossEntropyDims(const Tensor &x, const Tensor &t,
+                                    size_t *batchsize, size_t *dim) {
+  CHECK_LE(x.nDim(), 2u);
+  CHECK_LE(t.nDim(), 2u);
+  CHECK_EQ(x.data_type(), kFloat32);
+  CHECK(t.data_type() == kInt || t.data_type() == kFloat32)
+      << "Targets must be int or float32";
+  *batchsize = x.nDim() == 2u ? x.shape(0) : 1;
+  *dim = x.Size() / *batchsize;
+  CHECK(t.Size() == *batchsize || t.Size() == x.Size())
+      << "Targets must be a label or " << *dim << " weights per instance";
+}
+
+void SoftmaxCrossEntropyFwd(const Tensor &x, const Tensor &t, Tensor *loss,
+                            Tensor *lse, Tensor *grad, float smoothing) {
+  size_t batchsize, dim;
+  SoftmaxCrossEntropyDims(x, t, &batchsize, &dim);
+  CHECK_EQ(loss->Size(), batchsize);
+  BlockVec writes = {loss->block()};
+  Tensor lossRef = *loss, lseRef, gradRef;
+  if (lse != nullptr) {
+    CHECK_EQ(lse->Size(), batchsize);
+    lseRef = *lse;
+    writes.push_back(lse->block());
+  }
+  if (grad != nullptr) {
+    CHECK(grad->shape() == x.shape());
+    gradRef = *grad;
+    writes.push_back(grad->block());
+  }
+  bool has_lse = lse != nullptr, has_grad = grad != nullptr;
+  TYPE_LANG_SWITCH(x.data_type(), DType, x.device()->lang(), Lang, {
+    x.device()->Exec(
+        [batchsize, dim, smoothing, x, t, lossRef, lseRef, gradRef, has_lse,
+         has_grad](Context *ctx) mutable {
+          SoftmaxCrossEntropyFused<DType, Lang>(
+              t.Size() == batchsize, batchsize, dim, smoothing, x, t,
+              &lossRef, has_lse ? &lseRef : nullptr,
+              has_grad ? &gradRef : nullptr, ctx);
+        },
+        {x.block(), t.block()}, writes, "SoftmaxCrossEntropy");
+  });
+}
+
+Tensor SoftmaxCrossEntropyFwd(const Tensor &x, const Tensor &t, Tensor *lse,
+                              float smoothing) {
+  const size_t batchsize = x.nDim() == 2u ? x.shape(0) : 1;
+  Tensor loss(Shape{batchsize}, x.device(), x.data_type());
+  *lse = Tensor(Shape{batchsize}, x.device(), x.data_type());
+  SoftmaxCrossEntropyFwd(x, t, &loss, lse, nullptr, smoothing);
+  return loss;
+}
+
+void SoftmaxCrossEntropyBwd(const Tensor &x, const Tensor &t,
+                            const Tensor &lse, Tensor *grad, float smoothing) {
+  size_t batchsize, dim;
+  SoftmaxCrossEntropyDims(x, t, &batchsize, &dim);
+  CHECK_EQ(lse.Size(), batchsize);
+  CHECK(grad->shape() == x.shape());
+  TYPE_LANG_SWITCH(x.data_type(), DType, x.device()->lang(), Lang, {
+    Tensor &gradRef = *grad;
+    x.device()->Exec(
+        [batchsize, dim, smoothing, x, t, lse, gradRef](Context *ctx) mutable {
+          SoftmaxCrossEntropyFusedBwd<DType, Lang>(t.Size() == batchsize,
+                                                   batchsize, dim, smoothing,
+                                                   x, t, lse, &gradRef, ctx);
+        },
+        {x.block(), t.block(), lse.block()}, {grad->block()},
+        "SoftmaxCrossEntropyBackward");
+  });
+}
+
+Tensor SoftmaxCrossEntropyBwd(const Tensor &x, const Tensor &t,
+                              const Tensor &lse, float smoothing) {
+  Tensor grad(x.shape(), x.device(), x.data_type());
+  SoftmaxCrossEntropyBwd(x, t, lse, &grad, smoothing);
+  return grad;
+}
+
 Tensor &Tensor::Contiguous() {
   if (transpose()) {
     Tensor t(shape_, device_, data_type_);
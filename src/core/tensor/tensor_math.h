@@ -444,6 +444,29 @@ void GEMM(const DType alpha, const Tensor &A, const Tensor &B, const DType beta,
   LOG(FATAL) << "GEMM Not Implemented";
 }
 
+/// Get the layout of the matrices (the last two dimensions) of 't' for BLAS,
+/// i.e., whether they are stored transposed and the leading dimension.
+/// Return false if neither of the two dimensions is dense. The batch
+/// dimensions may have any stride, including 0 for broadcasting.
+inline bool GEMMLayout(const Tensor &t, bool *trans, size_t *ld) {
+  CHECK_GE(t.nDim(), 2u);
+  const size_t rows = t.shape().end()[-2], cols = t.shape().end()[-1];
+  const long srow = t.stride().end()[-2], scol = t.stride().end()[-1];
+  if ((cols == 1 || scol == 1) && (rows == 1 || srow >= (long)cols)) {
+    *trans = false;
+    *ld = rows == 1 ? cols : srow;
+    return true;
+  }
+  if ((rows == 1 || srow == 1) && (cols == 1 || scol >= (long)rows)) {
+    *trans = true;
+    *ld = cols == 1 ? rows : scol;
+    return true;
+  }
+  return false;
+}
+
+/// C[i] = alpha * A[i] * B[i] + beta * C[i] for each index i of the batch
+/// dimensions (all but the last two), which are the same for A, B and C.
 template <typename DType, typename Lang>
 void GEMMBatched(const DType alpha, const Tensor &A, const Tensor &B,
                  const DType beta, Tensor *C, Context *ctx) {
@@ -455,6 +478,13 @@ void SoftMax(const Tensor &in, Tensor *out, Context *ctx) {
   LOG(FATAL) << "Not Implemented";
 }
 
+/// out = log(softmax(in)) for each row of 'in', computed without forming
+/// softmax(in) so it does not underflow to log(0).
+template <typename DType, typename Lang>
+void LogSoftMax(const Tensor &in, Tensor *out, Context *ctx) {
+  LOG(FATAL) << "Not Implemented";
+}
+
 template <typename DType, typename Lang>
 void SoftMaxBackward(const Tensor &in, Tensor *out, const Tensor &fdout,
                      Context *ctx) {
@@ -476,10 +506,49 @@ void SoftmaxCrossEntropyBwd(bool int_target, const size_t batchsize,
   LOG(FATAL) << "Not Implemented";
 }
 
+/// Fused SoftMax and ComputeCrossEntropy of the logits 'x' whose targets are
+/// smoothed by 'smoothing'. 'lse' gets the log-sum-exp of each row and
+/// 'grad' the gradient w.r.t. 'x'; either may be nullptr.
+template <typename DType, typename Lang>
+void SoftmaxCrossEntropyFused(bool int_target, const size_t batchsize,
+                              const size_t dim, const float smoothing,
+                              const Tensor &x, const Tensor &t, Tensor *loss,
+                              Tensor *lse, Tensor *grad, Context *ctx) {
+  LOG(FATAL) << "Not Implemented";
+}
+
+/// The gradient of SoftmaxCrossEntropyFused() w.r.t. 'x' from the 'lse' it
+/// computed.
+template <typename DType, typename Lang>
+void SoftmaxCrossEntropyFusedBwd(bool int_target, const size_t batchsize,
+                                 const size_t dim, const float smoothing,
+                                 const Tensor &x, const Tensor &t,
+                                 const Tensor &lse, Tensor *grad,
+                                 Context *ctx) {
+  LOG(FATAL) << "Not Implemented";
+}
+
 template <typename DType, typename Lang>
 void RowMax(const Tensor &in, Tensor *out, Context *ctx) {
   LOG(FATAL) << "Not Implemented";
 }
+
+enum ReduceOp {
+  kReduceSum,
+  kReduceMax,
+  kReduceMin,
+  kReduceArgMax,
+  kReduceArgMin
+};
+
+/// Reduce 'in' into 'out', which has the same number of dimensions as 'in'
+/// and size 1 along the reduced axes. For kReduceArgMax (kReduceArgMin),
+/// 'out' is of kInt and gets the (row-major) index over the reduced axes of
+/// the first max (min) element.
+template <typename DType, typename Lang>
+void Reduce(const ReduceOp op, const Tensor &in, Tensor *out, Context *ctx) {
+  LOG(FATAL) << "Reduce Not Implemented";
+}
 // **************************************
 // Matrix functions
 // **************************************
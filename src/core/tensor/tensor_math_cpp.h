@@ -19,17 +19,27 @@
 #define SINGA_CORE_TENSOR_TENSOR_MATH_CPP_H_
 
 #include "./tensor_math.h"
+#include "./math_kernel_cpp.h"
+#include "./philox.h"
 //#include "./stacktrace.h"
 #include <math.h>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cfloat>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <memory>
 #include <sstream>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "singa/core/common.h"
 #include "singa/core/tensor.h"
+#include "singa/utils/thread_pool.h"
 
 #ifdef USE_CBLAS
 #include <cblas.h>
@@ -39,194 +49,304 @@ namespace singa {
 
 // ===================== Helper Functions =============================
 
-// generate a traversal_info vector based on the tensor's shape for the
-// traverse_next function to work
-vector<int> generate_traversal_info(const Tensor &x) {
-  vector<int> traversal_info = {};
-  for (size_t n = 0; n < (x.shape().size() + 2); ++n) {
-    traversal_info.push_back(0);
-  }
-  return traversal_info;
-};
-
-// generate shape multipliers
-// for e.g. tensor of shape (3,3), stride (1,3) will have shape multipliers of
-// (3,1)
-// for e.g. tensor of shape (3,3), stride (3,1) will also have shape multipliers
-// of (3,1)
-// this means that the 3rd, 6th, and 9th index of the array will always be the
-// starting element of their respective rows
-// so we need to need use the inner stride when jumping from 1st->2nd element,
-// and outer stride when jumping from 2nd->3rd
-vector<int> generate_shape_multipliers(const Tensor &x) {
-  Shape y_shape = x.shape();
-  if (y_shape.size() == 0) {
-    return {1};
-  }
-  vector<int> shape_multipliers = {1};
-  int cumulative_product = 1;
-
-  for (size_t n = 0; n < (y_shape.size() - 1); ++n) {
-    cumulative_product = cumulative_product * y_shape[y_shape.size() - 1 - n];
-    shape_multipliers.insert(shape_multipliers.begin(), cumulative_product);
-  }
-  return shape_multipliers;
-};
-
-// ******************************************************************************************
-// CPP traversal operations (works on const declarations without modifying
-// tensor variables)
-// ******************************************************************************************
-
-// this function checks whether the next index falls on a special multiplier of
-// the outer shape
-// so the algorithm knows when to jump over/back to a starting element of the
-// outer shape
-// for e.g. in [[1,4,7], [2,5,8], [3,6,9]], elements 1,2,3 are the starting
-// elements of their respective rows
-// this additional check only has 1 loop for 2d matrix
-// but runtime performance might degrade to O(nlog(n)) for higher dimensional
-// tensors
-int determine_order(vector<int> &shape_multipliers, int counter) {
-  for (size_t n = 0; n < (shape_multipliers.size() - 1); ++n) {
-    if ((counter % shape_multipliers[n]) == 0) {
-      return ((shape_multipliers.size()) - 1 - n);
+// Min number of elements processed by one thread in the elementwise
+// kernels, i.e., 64KB of floats, which keeps the per-thread working set
+// within the L2 cache and the scheduling overhead negligible.
+const size_t kEltwiseGrain = 16384;
+
+// Walks N tensors of the same shape but any strides (e.g., transposed, or
+// broadcasted with stride 0) in row-major order of the shape. Axes of size 1
+// are dropped and adjacent axes contiguous in all tensors are merged; the
+// walk is then a loop over rows of the innermost merged axis, along which
+// each tensor has a constant stride. E.g., adding a bias broadcasted to a
+// matrix walks the rows of the matrix, with stride 1 for the bias if it is
+// a row, or 0 if it is a column.
+template <size_t N>
+class StridedIter {
+ public:
+  StridedIter(const Shape &shape,
+              const std::array<const vector<int> *, N> &strides) {
+    for (size_t k = 0; k < shape.size(); k++) {
+      if (shape[k] == 1) continue;
+      std::array<long, N> stride;
+      bool merge = !shape_.empty();
+      for (size_t t = 0; t < N; t++) {
+        stride[t] = strides[t]->at(k);
+        if (merge && strides_.back()[t] != stride[t] * (long)shape[k])
+          merge = false;
+      }
+      if (merge) {
+        shape_.back() *= shape[k];
+        strides_.back() = stride;
+      } else {
+        shape_.push_back(shape[k]);
+        strides_.push_back(stride);
+      }
+    }
+    if (shape_.empty()) {
+      shape_.push_back(1);
+      strides_.push_back(std::array<long, N>{});
     }
   }
-  return 0;
-};
 
-// this function updates the base indexes with the current index after every
-// single traversal step,
-// can be generalized beyond 2d cases
-void update_base_index(const Tensor &x, vector<int> &traversal_info) {
-  for (int n = 0; n < (traversal_info[x.shape().size() + 1] + 1); ++n) {
-    traversal_info[n] = traversal_info[x.shape().size()];
+  /// the stride of tensor t along the rows
+  long inner_stride(size_t t) const { return strides_.back()[t]; }
+  /// the number of elements of each row
+  size_t row_size() const { return shape_.back(); }
+
+  /// Call fn(offset, len) for each segment of a row among the elements
+  /// [begin, end), where offset[t] is the offset of the first element of the
+  /// segment in tensor t, and len is the number of elements in it.
+  template <typename Fn>
+  void ForEachRow(size_t begin, size_t end, Fn &&fn) const {
+    const int last = (int)shape_.size() - 1;
+    vector<size_t> index(shape_.size());
+    std::array<long, N> offset{};
+    size_t rest = begin;
+    for (int k = last; k >= 0; k--) {
+      index[k] = rest % shape_[k];
+      rest /= shape_[k];
+      for (size_t t = 0; t < N; t++) offset[t] += index[k] * strides_[k][t];
+    }
+    while (begin < end) {
+      size_t len = std::min(shape_[last] - index[last], end - begin);
+      fn(offset, len);
+      begin += len;
+      // move to the start of the next row
+      for (size_t t = 0; t < N; t++)
+        offset[t] -= (long)index[last] * strides_[last][t];
+      index[last] = 0;
+      for (int k = last - 1; k >= 0; k--) {
+        if (++index[k] < shape_[k]) {
+          for (size_t t = 0; t < N; t++) offset[t] += strides_[k][t];
+          break;
+        }
+        index[k] = 0;
+        for (size_t t = 0; t < N; t++)
+          offset[t] -= (long)(shape_[k] - 1) * strides_[k][t];
+      }
+    }
   }
-};
 
-// function to traverse a const strided tensor object
-// it requires an additional vector, traversal_info {0,0,0,0 ...}, comprising
-// (x.shape().size()+2) elements of 0
-// for e.g. 2d matrix:
-// index 0 and 1 store the base row and column index respectively
-// index 2 stores the current index of the traversal
-// index 3 stores the order of the traversal for e.g. if the order is 0,
-// it means the next element can be navigated to using the innermost stride
-void traverse_next(const Tensor &x, vector<int> &shape_multipliers,
-                   vector<int> &traversal_info, int counter) {
-  update_base_index(x, traversal_info);
-  traversal_info[x.shape().size() + 1] =
-      determine_order(shape_multipliers, counter);
-  traversal_info[x.shape().size()] =
-      traversal_info[traversal_info[x.shape().size() + 1]] +
-      x.stride()[x.stride().size() - traversal_info[x.shape().size() + 1] - 1];
+ private:
+  vector<size_t> shape_;
+  vector<std::array<long, N>> strides_;
 };
 
-inline int next_offset(int offset, const vector<size_t> &shape,
-                       const vector<int> &stride, vector<int> *index) {
-  for (int k = shape.size() - 1; k >= 0; k--) {
-    if (index->at(k) + 1 < int(shape.at(k))) {
-      offset += stride.at(k);
-      index->at(k) += 1;
-      break;
-    }
-    index->at(k) = 0;
-    offset -= stride.at(k) * (shape.at(k) - 1);
-  }
-  return offset;
-}
-
-template <typename DType>
-void traverse_unary(const Tensor &in, Tensor *out,
-                    std::function<DType(DType)> func) {
+// apply func elementwise; the elements are split into chunks of at least
+// kEltwiseGrain elements, which are processed by up to ctx->num_threads
+// threads. Strided (transposed/broadcasted) tensors are walked row by row
+// with StridedIter.
+template <typename DType, typename Op>
+void traverse_unary(const Tensor &in, Tensor *out, Op func, Context *ctx) {
   DType *outPtr = static_cast<DType *>(out->block()->mutable_data());
   const DType *inPtr = static_cast<const DType *>(in.block()->data());
-  /*
-  vector<int> traversal_info = generate_traversal_info(in);
-  vector<int> shape_multipliers = generate_shape_multipliers(in);
-
-  for (size_t i = 0; i < in.Size(); i++) {
-    outPtr[i] = func(inPtr[traversal_info[in.shape().size()]]);
-    traverse_next(in, shape_multipliers, traversal_info, i + 1);
-  }
-  */
   CHECK(in.shape() == out->shape());
+  size_t size = Product(in.shape());
   if (in.stride() == out->stride()) {
-    for (size_t i = 0; i < in.Size(); i++) outPtr[i] = func(inPtr[i]);
+    ParallelFor(0, size, kEltwiseGrain, ctx->num_threads,
+                [&](size_t begin, size_t end) {
+                  for (size_t i = begin; i < end; i++)
+                    outPtr[i] = func(inPtr[i]);
+                });
   } else {
-    // LOG(INFO) << "not equal stride";
-    size_t in_offset = 0, out_offset = 0;
-    vector<int> in_idx(in.nDim(), 0), out_idx(out->nDim(), 0);
-    for (size_t i = 0; i < Product(in.shape()); i++) {
-      outPtr[out_offset] = func(inPtr[in_offset]);
-      out_offset =
-          next_offset(out_offset, out->shape(), out->stride(), &out_idx);
-      in_offset = next_offset(in_offset, in.shape(), in.stride(), &in_idx);
-    }
+    StridedIter<2> iter(in.shape(), {{&out->stride(), &in.stride()}});
+    const long so = iter.inner_stride(0), si = iter.inner_stride(1);
+    ParallelFor(
+        0, size, kEltwiseGrain, ctx->num_threads,
+        [&](size_t begin, size_t end) {
+          iter.ForEachRow(begin, end, [&](const std::array<long, 2> &offset,
+                                          size_t len) {
+            DType *o = outPtr + offset[0];
+            const DType *x = inPtr + offset[1];
+            if (so == 1 && si == 1) {
+              for (size_t j = 0; j < len; j++) o[j] = func(x[j]);
+            } else if (so == 1 && si == 0) {
+              const DType v = func(x[0]);
+              for (size_t j = 0; j < len; j++) o[j] = v;
+            } else {
+              for (size_t j = 0; j < len; j++) o[j * so] = func(x[j * si]);
+            }
+          });
+        });
   }
 }
 
-template <typename DType>
+template <typename DType, typename Op>
 void traverse_binary(const Tensor &in1, const Tensor &in2, Tensor *out,
-                     std::function<DType(DType, DType)> func) {
+                     Op func, Context *ctx) {
   DType *outPtr = static_cast<DType *>(out->block()->mutable_data());
   const DType *in1Ptr = static_cast<const DType *>(in1.block()->data());
   const DType *in2Ptr = static_cast<const DType *>(in2.block()->data());
-  /*
-  vector<int> traversal_info_in1 = generate_traversal_info(in1);
-  vector<int> traversal_info_in2 = generate_traversal_info(in2);
-  vector<int> shape_multipliers_in1 = generate_shape_multipliers(in1);
-  vector<int> shape_multipliers_in2 = generate_shape_multipliers(in2);
-
-  for (size_t i = 0; i < in1.Size(); i++) {
-    outPtr[i] = func(in1Ptr[traversal_info_in1[in1.shape().size()]],
-                     in2Ptr[traversal_info_in2[in2.shape().size()]]);
-    traverse_next(in1, shape_multipliers_in1, traversal_info_in1, i + 1);
-    traverse_next(in2, shape_multipliers_in2, traversal_info_in2, i + 1);
-  }
-  */
-  auto prod = Product(in1.shape());
   CHECK(in1.shape() == out->shape());
   CHECK(in2.shape() == out->shape());
+  size_t size = Product(in1.shape());
   if ((in1.stride() == out->stride()) && (in2.stride() == in1.stride())) {
-    for (size_t i = 0; i < prod; i++) outPtr[i] = func(in1Ptr[i], in2Ptr[i]);
+    ParallelFor(0, size, kEltwiseGrain, ctx->num_threads,
+                [&](size_t begin, size_t end) {
+                  for (size_t i = begin; i < end; i++)
+                    outPtr[i] = func(in1Ptr[i], in2Ptr[i]);
+                });
   } else {
-    /*
-    LOG(INFO) << "not equal stride";
-    std::ostringstream s1, s2, s3, s4, s5, s6;
-    std::copy(in1.stride().begin(), in1.stride().end(),
-    std::ostream_iterator<int>(s1, ", "));
-    std::copy(in2.stride().begin(), in2.stride().end(),
-    std::ostream_iterator<int>(s2, ", "));
-    std::copy(out->stride().begin(), out->stride().end(),
-    std::ostream_iterator<int>(s3, ", "));
-
-    std::copy(in1.shape().begin(), in1.shape().end(),
-    std::ostream_iterator<int>(s4, ", "));
-    std::copy(in2.shape().begin(), in2.shape().end(),
-    std::ostream_iterator<int>(s5, ", "));
-    std::copy(out->shape().begin(), out->shape().end(),
-    std::ostream_iterator<int>(s6, ", "));
-
-    LOG(INFO) << s1.str() << ": " << s4.str();
-    LOG(INFO) << s2.str() << ": " << s5.str();
-    LOG(INFO) << s3.str() << ": " << s6.str();
-    LOG(INFO) << Backtrace();
-    */
-
-    size_t in1_offset = 0, in2_offset = 0, out_offset = 0;
-    vector<int> in1_idx(in1.nDim(), 0), in2_idx(in2.nDim(), 0),
-        out_idx(out->nDim(), 0);
-    for (size_t i = 0; i < prod; i++) {
-      outPtr[out_offset] = func(in1Ptr[in1_offset], in2Ptr[in2_offset]);
-      out_offset =
-          next_offset(out_offset, out->shape(), out->stride(), &out_idx);
-      in1_offset = next_offset(in1_offset, in1.shape(), in1.stride(), &in1_idx);
-      in2_offset = next_offset(in2_offset, in2.shape(), in2.stride(), &in2_idx);
-      // LOG(INFO) <<  in1_offset << ", " << in2_offset << ", " << out_offset;
+    StridedIter<3> iter(in1.shape(),
+                        {{&out->stride(), &in1.stride(), &in2.stride()}});
+    const long so = iter.inner_stride(0), s1 = iter.inner_stride(1),
+               s2 = iter.inner_stride(2);
+    ParallelFor(
+        0, size, kEltwiseGrain, ctx->num_threads,
+        [&](size_t begin, size_t end) {
+          iter.ForEachRow(begin, end, [&](const std::array<long, 3> &offset,
+                                          size_t len) {
+            DType *o = outPtr + offset[0];
+            const DType *x = in1Ptr + offset[1], *y = in2Ptr + offset[2];
+            if (so == 1 && s1 == 1 && s2 == 1) {
+              for (size_t j = 0; j < len; j++) o[j] = func(x[j], y[j]);
+            } else if (so == 1 && s1 == 1 && s2 == 0) {
+              const DType v = y[0];
+              for (size_t j = 0; j < len; j++) o[j] = func(x[j], v);
+            } else if (so == 1 && s1 == 0 && s2 == 1) {
+              const DType v = x[0];
+              for (size_t j = 0; j < len; j++) o[j] = func(v, y[j]);
+            } else {
+              for (size_t j = 0; j < len; j++)
+                o[j * so] = func(x[j * s1], y[j * s2]);
+            }
+          });
+        });
+  }
+}
+
+// Edge (elements) of the square tiles of permute_copy; reading and writing a
+// 32 x 32 tile of floats touches 8KB, which stays in L1.
+const size_t kPermuteTile = 32;
+
+// out = in for tensors of the same shape but any strides, e.g., a
+// transposed (permuted) or broadcasted 'in' copied into a contiguous 'out'.
+// Axes of size 1 are dropped and adjacent axes contiguous in both tensors
+// are merged. If the axis read along (smallest stride of 'in') differs from
+// the axis written along (smallest stride of 'out'), the two are copied in
+// kPermuteTile x kPermuteTile tiles, so that both reads and writes follow
+// cache lines. Tiles (rows of at most kEltwiseGrain elements otherwise) of
+// all the other axes are split across ctx->num_threads threads.
+template <typename DType>
+void permute_copy(const Tensor &in, Tensor *out, Context *ctx) {
+  CHECK(in.shape() == out->shape());
+  DType *outPtr = static_cast<DType *>(out->block()->mutable_data());
+  const DType *inPtr = static_cast<const DType *>(in.block()->data());
+  const size_t size = Product(in.shape());
+  if (size == 0) return;
+
+  struct Axis {
+    size_t n;
+    long a, b;  // strides of in and out
+  };
+  vector<Axis> axes;
+  for (size_t k = 0; k < in.nDim(); k++) {
+    Axis x{in.shape(k), in.stride()[k], out->stride()[k]};
+    if (x.n == 1) continue;
+    if (!axes.empty() && axes.back().a == x.a * (long)x.n &&
+        axes.back().b == x.b * (long)x.n) {
+      axes.back() = Axis{axes.back().n * x.n, x.a, x.b};
+    } else {
+      axes.push_back(x);
     }
   }
+  if (axes.empty()) axes.push_back(Axis{1, 0, 0});
+
+  // the axes written (o) and read (r) along; r is -1 if it is o or if the
+  // reads are broadcasted
+  int o = 0, r = -1;
+  for (int k = 0; k < (int)axes.size(); k++) {
+    if (std::labs(axes[k].b) <= std::labs(axes[o].b)) o = k;
+    if (axes[k].a != 0 &&
+        (r < 0 || std::labs(axes[k].a) <= std::labs(axes[r].a)))
+      r = k;
+  }
+  if (r == o || (r >= 0 && std::labs(axes[r].a) >= std::labs(axes[o].a)))
+    r = -1;
+  const Axis ax_o = axes[o], ax_r = r < 0 ? Axis{1, 0, 0} : axes[r];
+  vector<Axis> outer;
+  for (int k = 0; k < (int)axes.size(); k++)
+    if (k != o && k != r) outer.push_back(axes[k]);
+  size_t num_outer = 1;
+  for (auto &x : outer) num_outer *= x.n;
+
+  const size_t tile_o =
+      r < 0 ? std::min(ax_o.n, kEltwiseGrain) : std::min(ax_o.n, kPermuteTile);
+  const size_t tile_r = std::min(ax_r.n, kPermuteTile);
+  const size_t blocks_o = (ax_o.n + tile_o - 1) / tile_o;
+  const size_t blocks_r = (ax_r.n + tile_r - 1) / tile_r;
+  const size_t grain = std::max<size_t>(1, kEltwiseGrain / (tile_o * tile_r));
+  ParallelFor(
+      0, num_outer * blocks_r * blocks_o, grain, ctx->num_threads,
+      [&](size_t begin, size_t end) {
+        for (size_t item = begin; item < end; item++) {
+          size_t idx = item;
+          const size_t bo = idx % blocks_o;
+          idx /= blocks_o;
+          const size_t br = idx % blocks_r;
+          idx /= blocks_r;
+          long in_offset = 0, out_offset = 0;
+          for (int k = (int)outer.size() - 1; k >= 0; k--) {
+            const long i = idx % outer[k].n;
+            idx /= outer[k].n;
+            in_offset += i * outer[k].a;
+            out_offset += i * outer[k].b;
+          }
+          const size_t o_end = std::min(ax_o.n, (bo + 1) * tile_o);
+          const size_t r_end = std::min(ax_r.n, (br + 1) * tile_r);
+          for (size_t i = br * tile_r; i < r_end; i++) {
+            const DType *src = inPtr + in_offset + (long)i * ax_r.a;
+            DType *dst = outPtr + out_offset + (long)i * ax_r.b;
+            if (ax_o.a == 1 && ax_o.b == 1) {
+              std::copy(src + bo * tile_o, src + o_end, dst + bo * tile_o);
+            } else {
+              for (size_t j = bo * tile_o; j < o_end; j++)
+                dst[(long)j * ax_o.b] = src[(long)j * ax_o.a];
+            }
+          }
+        }
+      });
+}
+
+// The vectorized float kernels in math_kernel_cpp.h work on dense arrays, so
+// they apply only if all operands share the same layout. Transcendental
+// functions keep calling libm if ctx->math_accuracy is kMathPrecise.
+inline bool use_simd(const Tensor &in, const Tensor &out, Context *ctx,
+                     bool transcendental = false) {
+  return cpp::GetSimdLevel() != cpp::kScalar && in.stride() == out.stride() &&
+         (!transcendental || ctx->math_accuracy != kMathPrecise);
+}
+
+inline bool use_simd(const Tensor &in1, const Tensor &in2, const Tensor &out,
+                     Context *ctx, bool transcendental = false) {
+  return in1.stride() == in2.stride() &&
+         use_simd(in1, out, ctx, transcendental);
+}
+
+// call kernel(n, in, out) on chunks of the dense arrays in parallel
+template <typename Kernel>
+void simd_unary(const Tensor &in, Tensor *out, Kernel kernel, Context *ctx) {
+  float *outPtr = static_cast<float *>(out->block()->mutable_data());
+  const float *inPtr = static_cast<const float *>(in.block()->data());
+  ParallelFor(0, out->Size(), kEltwiseGrain, ctx->num_threads,
+              [&](size_t begin, size_t end) {
+                kernel(end - begin, inPtr + begin, outPtr + begin);
+              });
+}
+
+// call kernel(n, in1, in2, out) on chunks of the dense arrays in parallel
+template <typename Kernel>
+void simd_binary(const Tensor &in1, const Tensor &in2, Tensor *out,
+                 Kernel kernel, Context *ctx) {
+  float *outPtr = static_cast<float *>(out->block()->mutable_data());
+  const float *in1Ptr = static_cast<const float *>(in1.block()->data());
+  const float *in2Ptr = static_cast<const float *>(in2.block()->data());
+  ParallelFor(0, out->Size(), kEltwiseGrain, ctx->num_threads,
+              [&](size_t begin, size_t end) {
+                kernel(end - begin, in1Ptr + begin, in2Ptr + begin,
+                       outPtr + begin);
+              });
 }
 
 // ******************************************************************************************
@@ -237,32 +357,18 @@ void traverse_binary(const Tensor &in1, const Tensor &in2, Tensor *out,
 
 template <>
 void Abs<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
-  traverse_unary<float>(in, out, [](float x) { return fabs(x); });
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [](size_t n, const float *x, float *y) { cpp::abs(n, x, y); },
+               ctx);
+    return;
+  }
+  traverse_unary<float>(in, out, [](float x) { return fabs(x); }, ctx);
 }
 
 template <>
 void Erf<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
-  traverse_unary<float>(in, out, [](float x) { return erff(x); });
-}
-
-template <>
-void CastCopy<float, half_float::half, lang::Cpp>(const Tensor *src,
-                                                  Tensor *dst, Context *ctx) {
-  half_float::half *dst_array =
-      static_cast<half_float::half *>(dst->block()->mutable_data());
-  const float *src_array = static_cast<const float *>(src->block()->data());
-  for (int i = 0; i < dst->Size(); ++i)
-    dst_array[i] = static_cast<half_float::half>(src_array[i]);
-}
-
-template <>
-void CastCopy<half_float::half, float, lang::Cpp>(const Tensor *src,
-                                                  Tensor *dst, Context *ctx) {
-  float *dst_array = static_cast<float *>(dst->block()->mutable_data());
-  const half_float::half *src_array =
-      static_cast<const half_float::half *>(src->block()->data());
-  for (int i = 0; i < dst->Size(); ++i)
-    dst_array[i] = static_cast<float>(src_array[i]);
+  traverse_unary<float>(in, out, [](float x) { return erff(x); }, ctx);
 }
 
 template <>
@@ -283,17 +389,17 @@ void CastCopy<int, float, lang::Cpp>(const Tensor *src, Tensor *dst,
 
 template <>
 void Ceil<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
-  traverse_unary<float>(in, out, [](float x) { return std::ceil(x); });
+  traverse_unary<float>(in, out, [](float x) { return std::ceil(x); }, ctx);
 }
 
 template <>
 void Floor<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
-  traverse_unary<float>(in, out, [](float x) { return std::floor(x); });
+  traverse_unary<float>(in, out, [](float x) { return std::floor(x); }, ctx);
 }
 
 template <>
 void Round<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
-  traverse_unary<float>(in, out, [](float x) { return std::round(x); });
+  traverse_unary<float>(in, out, [](float x) { return std::round(x); }, ctx);
 }
 
 template <>
@@ -305,7 +411,7 @@ void RoundE<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
     } else {
       return std::round(x);
     }
-  });
+  }, ctx);
 }
 
 #ifdef USE_DNNL
@@ -356,47 +462,50 @@ void SoftMaxBackward<float, lang::Cpp>(const Tensor &in, Tensor *out,
                                         {DNNL_ARG_DST, fdout_mem}});
   ctx->dnnl_stream.wait();
 }
-#else
-// native Softmax without DNNL
-template <>
-void SoftMax<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
-  CHECK_LE(in.nDim(), 2u)
-      << "Axis is required for SoftMax on multi dimemsional tensor";
-  out->CopyData(in);
-  size_t nrow = 1, ncol = in.Size(), size = ncol;
-  if (in.nDim() == 2u) {
-    nrow = in.shape(0);
-    ncol = size / nrow;
-    out->Reshape(Shape{nrow, ncol});
-  }
-  Tensor tmp = RowMax(*out);
-  SubColumn(tmp, out);
-  Exp(*out, out);
-
-  SumColumns(*out, &tmp);
-  DivColumn(tmp, out);
-  out->Reshape(in.shape());
-}
 #endif  // USE_DNNL
 
 template <>
 void Add<float, lang::Cpp>(const Tensor &in, const float x, Tensor *out,
                            Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [x](size_t n, const float *a, float *b) {
+                 cpp::add(n, a, x, b);
+               },
+               ctx);
+    return;
+  }
   auto add_lambda = [&x](float a) { return (a + x); };
-  traverse_unary<float>(in, out, add_lambda);
+  traverse_unary<float>(in, out, add_lambda, ctx);
 }
 
 template <>
 void Add<float, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                            Context *ctx) {
+  if (use_simd(in1, in2, *out, ctx)) {
+    simd_binary(in1, in2, out,
+                [](size_t n, const float *a, const float *b, float *c) {
+                  cpp::add(n, a, b, c);
+                },
+                ctx);
+    return;
+  }
   // CHECK_EQ(ctx->stream, nullptr);
   auto add_lambda_binary = [](float a, float b) { return (a + b); };
-  traverse_binary<float>(in1, in2, out, add_lambda_binary);
+  traverse_binary<float>(in1, in2, out, add_lambda_binary, ctx);
 }
 
 template <>
 void Clamp<float, lang::Cpp>(const float low, const float high,
                              const Tensor &in, Tensor *out, Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [low, high](size_t n, const float *a, float *b) {
+                 cpp::clamp(n, low, high, a, b);
+               },
+               ctx);
+    return;
+  }
   auto clamp_lambda = [&low, &high](float a) {
     if (a < low) {
       return low;
@@ -406,186 +515,352 @@ void Clamp<float, lang::Cpp>(const float low, const float high,
       return a;
     }
   };
-  traverse_unary<float>(in, out, clamp_lambda);
+  traverse_unary<float>(in, out, clamp_lambda, ctx);
 }
 
 template <>
 void Div<float, lang::Cpp>(const float x, const Tensor &in, Tensor *out,
                            Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    std::atomic<bool> ok(true);
+    simd_unary(in, out,
+               [x, &ok](size_t n, const float *a, float *b) {
+                 if (!cpp::div(n, x, a, b)) ok = false;
+               },
+               ctx);
+    CHECK(ok) << "Division by zero";
+    return;
+  }
   auto const_div = [&x](float a) {
     CHECK_NE(a, 0.f);
     return x / a;
   };
-  traverse_unary<float>(in, out, const_div);
+  traverse_unary<float>(in, out, const_div, ctx);
 }
 
 template <>
 void Div<float, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                            Context *ctx) {
+  if (use_simd(in1, in2, *out, ctx)) {
+    std::atomic<bool> ok(true);
+    simd_binary(in1, in2, out,
+                [&ok](size_t n, const float *a, const float *b, float *c) {
+                  if (!cpp::div(n, a, b, c)) ok = false;
+                },
+                ctx);
+    CHECK(ok) << "Division by zero";
+    return;
+  }
   auto binary_div = [](float a, float b) {
     CHECK_NE(b, 0.f);
     return a / b;
   };
-  traverse_binary<float>(in1, in2, out, binary_div);
+  traverse_binary<float>(in1, in2, out, binary_div, ctx);
 }
 
 template <>
 void EltwiseMult<float, lang::Cpp>(const Tensor &in, const float x, Tensor *out,
                                    Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [x](size_t n, const float *a, float *b) {
+                 cpp::mult(n, a, x, b);
+               },
+               ctx);
+    return;
+  }
   auto eltwisemult_lambda = [&x](float a) { return (a * x); };
-  traverse_unary<float>(in, out, eltwisemult_lambda);
+  traverse_unary<float>(in, out, eltwisemult_lambda, ctx);
 }
 
 template <>
 void EltwiseMult<float, lang::Cpp>(const Tensor &in1, const Tensor &in2,
                                    Tensor *out, Context *ctx) {
+  if (use_simd(in1, in2, *out, ctx)) {
+    simd_binary(in1, in2, out,
+                [](size_t n, const float *a, const float *b, float *c) {
+                  cpp::mult(n, a, b, c);
+                },
+                ctx);
+    return;
+  }
   auto eltwisemult_lambda_binary = [](float a, float b) { return (a * b); };
-  traverse_binary<float>(in1, in2, out, eltwisemult_lambda_binary);
+  traverse_binary<float>(in1, in2, out, eltwisemult_lambda_binary, ctx);
 }
 
 template <>
 void ReLUBackward<float, lang::Cpp>(const Tensor &in1, const Tensor &in2,
                                     Tensor *out, Context *ctx) {
+  if (use_simd(in1, in2, *out, ctx)) {
+    simd_binary(in1, in2, out,
+                [](size_t n, const float *a, const float *b, float *c) {
+                  cpp::relu_backward(n, a, b, c);
+                },
+                ctx);
+    return;
+  }
   auto relubackward_lambda = [](float a, float b) { return (b > 0) ? a : 0.f; };
-  traverse_binary<float>(in1, in2, out, relubackward_lambda);
+  traverse_binary<float>(in1, in2, out, relubackward_lambda, ctx);
 }
 
 template <>
 void Exp<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
-  traverse_unary<float>(in, out, [](float x) { return exp(x); });
+  if (use_simd(in, *out, ctx, true)) {
+    bool fast = ctx->math_accuracy == kMathLow;
+    simd_unary(in, out,
+               [fast](size_t n, const float *x, float *y) {
+                 cpp::exp(n, x, y, fast);
+               },
+               ctx);
+    return;
+  }
+  traverse_unary<float>(in, out, [](float x) { return exp(x); }, ctx);
 }
 
 template <>
 void GE<float, lang::Cpp>(const Tensor &in, const float x, Tensor *out,
                           Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [x](size_t n, const float *a, float *b) {
+                 cpp::ge(n, a, x, b);
+               },
+               ctx);
+    return;
+  }
   auto ge_lambda = [&x](float a) { return (a >= x) ? 1.f : 0.f; };
-  traverse_unary<float>(in, out, ge_lambda);
+  traverse_unary<float>(in, out, ge_lambda, ctx);
 }
 
 template <>
 void GE<float, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                           Context *ctx) {
+  if (use_simd(in1, in2, *out, ctx)) {
+    simd_binary(in1, in2, out,
+                [](size_t n, const float *a, const float *b, float *c) {
+                  cpp::ge(n, a, b, c);
+                },
+                ctx);
+    return;
+  }
   auto ge_lambda_binary = [](float a, float b) { return (a >= b) ? 1.f : 0.f; };
-  traverse_binary<float>(in1, in2, out, ge_lambda_binary);
+  traverse_binary<float>(in1, in2, out, ge_lambda_binary, ctx);
 }
 
 template <>
 void GE<int, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                         Context *ctx) {
   auto ge_lambda_binary = [](int a, int b) { return (a >= b) ? 1.f : 0.f; };
-  traverse_binary<int>(in1, in2, out, ge_lambda_binary);
+  traverse_binary<int>(in1, in2, out, ge_lambda_binary, ctx);
 }
 
 template <>
 void GT<float, lang::Cpp>(const Tensor &in, const float x, Tensor *out,
                           Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [x](size_t n, const float *a, float *b) {
+                 cpp::gt(n, a, x, b);
+               },
+               ctx);
+    return;
+  }
   auto gt_lambda = [&x](float a) { return (a > x) ? 1.f : 0.f; };
-  traverse_unary<float>(in, out, gt_lambda);
+  traverse_unary<float>(in, out, gt_lambda, ctx);
 }
 
 template <>
 void GT<float, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                           Context *ctx) {
+  if (use_simd(in1, in2, *out, ctx)) {
+    simd_binary(in1, in2, out,
+                [](size_t n, const float *a, const float *b, float *c) {
+                  cpp::gt(n, a, b, c);
+                },
+                ctx);
+    return;
+  }
   auto gt_lambda_binary = [](float a, float b) { return (a > b) ? 1.f : 0.f; };
-  traverse_binary<float>(in1, in2, out, gt_lambda_binary);
+  traverse_binary<float>(in1, in2, out, gt_lambda_binary, ctx);
 }
 
 template <>
 void GT<int, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                         Context *ctx) {
   auto gt_lambda_binary = [](int a, int b) { return (a > b) ? 1.f : 0.f; };
-  traverse_binary<int>(in1, in2, out, gt_lambda_binary);
+  traverse_binary<int>(in1, in2, out, gt_lambda_binary, ctx);
 }
 
 template <>
 void LE<float, lang::Cpp>(const Tensor &in, const float x, Tensor *out,
                           Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [x](size_t n, const float *a, float *b) {
+                 cpp::le(n, a, x, b);
+               },
+               ctx);
+    return;
+  }
   auto le_lambda = [&x](float a) { return (a <= x) ? 1.f : 0.f; };
-  traverse_unary<float>(in, out, le_lambda);
+  traverse_unary<float>(in, out, le_lambda, ctx);
 }
 
 template <>
 void LE<float, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                           Context *ctx) {
+  if (use_simd(in1, in2, *out, ctx)) {
+    simd_binary(in1, in2, out,
+                [](size_t n, const float *a, const float *b, float *c) {
+                  cpp::le(n, a, b, c);
+                },
+                ctx);
+    return;
+  }
   auto le_lambda_binary = [](float a, float b) { return (a <= b) ? 1.f : 0.f; };
-  traverse_binary<float>(in1, in2, out, le_lambda_binary);
+  traverse_binary<float>(in1, in2, out, le_lambda_binary, ctx);
 }
 
 template <>
 void LE<int, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                         Context *ctx) {
   auto le_lambda_binary = [](int a, int b) { return (a <= b) ? 1.f : 0.f; };
-  traverse_binary<int>(in1, in2, out, le_lambda_binary);
+  traverse_binary<int>(in1, in2, out, le_lambda_binary, ctx);
 }
 
 template <>
 void Log<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
+  if (use_simd(in, *out, ctx, true)) {
+    std::atomic<bool> ok(true);
+    simd_unary(in, out,
+               [&ok](size_t n, const float *a, float *b) {
+                 if (!cpp::log(n, a, b)) ok = false;
+               },
+               ctx);
+    CHECK(ok) << "Log of a non-positive value";
+    return;
+  }
   auto ulog = [](float a) {
     CHECK_GT(a, 0.f);
     return log(a);
   };
-  traverse_unary<float>(in, out, ulog);
+  traverse_unary<float>(in, out, ulog, ctx);
 }
 
 template <>
 void LT<float, lang::Cpp>(const Tensor &in, const float x, Tensor *out,
                           Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [x](size_t n, const float *a, float *b) {
+                 cpp::lt(n, a, x, b);
+               },
+               ctx);
+    return;
+  }
   auto lt_lambda = [&x](float a) { return (a < x) ? 1.f : 0.f; };
-  traverse_unary<float>(in, out, lt_lambda);
+  traverse_unary<float>(in, out, lt_lambda, ctx);
 }
 
 template <>
 void LT<float, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                           Context *ctx) {
+  if (use_simd(in1, in2, *out, ctx)) {
+    simd_binary(in1, in2, out,
+                [](size_t n, const float *a, const float *b, float *c) {
+                  cpp::lt(n, a, b, c);
+                },
+                ctx);
+    return;
+  }
   auto lt_lambda_binary = [](float a, float b) { return (a < b) ? 1.f : 0.f; };
-  traverse_binary<float>(in1, in2, out, lt_lambda_binary);
+  traverse_binary<float>(in1, in2, out, lt_lambda_binary, ctx);
 }
 
 template <>
 void LT<int, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                         Context *ctx) {
   auto lt_lambda_binary = [](int a, int b) { return (a < b) ? 1.f : 0.f; };
-  traverse_binary<int>(in1, in2, out, lt_lambda_binary);
+  traverse_binary<int>(in1, in2, out, lt_lambda_binary, ctx);
 }
 
 template <>
 void EQ<float, lang::Cpp>(const Tensor &in, const float x, Tensor *out,
                           Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [x](size_t n, const float *a, float *b) {
+                 cpp::eq(n, a, x, b);
+               },
+               ctx);
+    return;
+  }
   auto eq_lambda = [&x](float a) { return (a == x) ? 1.f : 0.f; };
-  traverse_unary<float>(in, out, eq_lambda);
+  traverse_unary<float>(in, out, eq_lambda, ctx);
 }
 
 template <>
 void EQ<float, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                           Context *ctx) {
+  if (use_simd(in1, in2, *out, ctx)) {
+    simd_binary(in1, in2, out,
+                [](size_t n, const float *a, const float *b, float *c) {
+                  cpp::eq(n, a, b, c);
+                },
+                ctx);
+    return;
+  }
   auto eq_lambda_binary = [](float a, float b) { return (a == b) ? 1.f : 0.f; };
-  traverse_binary<float>(in1, in2, out, eq_lambda_binary);
+  traverse_binary<float>(in1, in2, out, eq_lambda_binary, ctx);
 }
 
 template <>
 void EQ<int, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                         Context *ctx) {
   auto eq_lambda_binary = [](int a, int b) { return (a == b) ? 1.f : 0.f; };
-  traverse_binary<int>(in1, in2, out, eq_lambda_binary);
+  traverse_binary<int>(in1, in2, out, eq_lambda_binary, ctx);
 }
 
 template <>
 void Pow<float, lang::Cpp>(const Tensor &in, const float x, Tensor *out,
                            Context *ctx) {
-  traverse_unary<float>(in, out, [x](float y) { return pow(y, x); });
+  // exp(x * log(in)) loses accuracy for large |x * log(in)|
+  if (ctx->math_accuracy == kMathLow && use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [x](size_t n, const float *a, float *b) {
+                 cpp::pow(n, a, x, b);
+               },
+               ctx);
+    return;
+  }
+  traverse_unary<float>(in, out, [x](float y) { return pow(y, x); }, ctx);
 }
 
 template <>
 void Pow<float, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                            Context *ctx) {
+  if (ctx->math_accuracy == kMathLow && use_simd(in1, in2, *out, ctx)) {
+    simd_binary(in1, in2, out,
+                [](size_t n, const float *a, const float *b, float *c) {
+                  cpp::pow(n, a, b, c);
+                },
+                ctx);
+    return;
+  }
   auto pow_lambda_binary = [](float a, float b) { return pow(a, b); };
-  traverse_binary<float>(in1, in2, out, pow_lambda_binary);
+  traverse_binary<float>(in1, in2, out, pow_lambda_binary, ctx);
 }
 
 template <>
 void ReLU<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [](size_t n, const float *x, float *y) { cpp::relu(n, x, y); },
+               ctx);
+    return;
+  }
   auto relu_lambda = [](float a) { return (a >= 0.f) ? a : 0.f; };
-  traverse_unary<float>(in, out, relu_lambda);
+  traverse_unary<float>(in, out, relu_lambda, ctx);
 }
 
 template <>
@@ -600,53 +875,93 @@ void Set<int, lang::Cpp>(const int x, Tensor *out, Context *ctx) {
   for (size_t i = 0; i < out->Size(); i++) outPtr[i] = x;
 }
 
-template <>
-void Set<half_float::half, lang::Cpp>(const half_float::half x, Tensor *out,
-                                      Context *ctx) {
-  half_float::half *outPtr =
-      static_cast<half_float::half *>(out->block()->mutable_data());
-  for (size_t i = 0; i < out->Size(); i++) outPtr[i] = x;
-}
-
 template <>
 void Sigmoid<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
+  if (use_simd(in, *out, ctx, true)) {
+    bool fast = ctx->math_accuracy == kMathLow;
+    simd_unary(in, out,
+               [fast](size_t n, const float *x, float *y) {
+                 cpp::sigmoid(n, x, y, fast);
+               },
+               ctx);
+    return;
+  }
   auto sigmoid_lambda = [](float a) { return 1.f / (1.f + exp(-a)); };
-  traverse_unary<float>(in, out, sigmoid_lambda);
+  traverse_unary<float>(in, out, sigmoid_lambda, ctx);
 }
 
 template <>
 void Sign<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [](size_t n, const float *x, float *y) { cpp::sign(n, x, y); },
+               ctx);
+    return;
+  }
   auto sign_lambda = [](float a) { return (a > 0) - (a < 0); };
-  traverse_unary<float>(in, out, sign_lambda);
+  traverse_unary<float>(in, out, sign_lambda, ctx);
 }
 
 template <>
 void SoftPlus<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
+  if (use_simd(in, *out, ctx, true)) {
+    bool fast = ctx->math_accuracy == kMathLow;
+    simd_unary(in, out,
+               [fast](size_t n, const float *x, float *y) {
+                 cpp::softplus(n, x, y, fast);
+               },
+               ctx);
+    return;
+  }
   auto softplus_lambda = [](float a) { return log(1.f + exp(a)); };
-  traverse_unary<float>(in, out, softplus_lambda);
+  traverse_unary<float>(in, out, softplus_lambda, ctx);
 }
 
 template <>
 void SoftSign<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    simd_unary(in, out,
+               [](size_t n, const float *x, float *y) { cpp::softsign(n, x, y); },
+               ctx);
+    return;
+  }
   auto softsign_lambda = [](float a) { return a / (1.f + fabs(a)); };
-  traverse_unary<float>(in, out, softsign_lambda);
+  traverse_unary<float>(in, out, softsign_lambda, ctx);
 }
 
 template <>
 void Sqrt<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
+  if (use_simd(in, *out, ctx)) {
+    std::atomic<bool> ok(true);
+    simd_unary(in, out,
+               [&ok](size_t n, const float *a, float *b) {
+                 if (!cpp::sqrt(n, a, b)) ok = false;
+               },
+               ctx);
+    CHECK(ok) << "Sqrt of a negative value";
+    return;
+  }
   auto usqrt = [](float a) {
     CHECK_GE(a, 0.f);
     return sqrt(a);
   };
-  traverse_unary<float>(in, out, usqrt);
+  traverse_unary<float>(in, out, usqrt, ctx);
 }
 
 template <>
 void Sub<float, lang::Cpp>(const Tensor &in1, const Tensor &in2, Tensor *out,
                            Context *ctx) {
+  if (use_simd(in1, in2, *out, ctx)) {
+    simd_binary(in1, in2, out,
+                [](size_t n, const float *a, const float *b, float *c) {
+                  cpp::sub(n, a, b, c);
+                },
+                ctx);
+    return;
+  }
   // CHECK_EQ(ctx->stream, nullptr);
   auto sub_lambda_binary = [](float a, float b) { return (a - b); };
-  traverse_binary<float>(in1, in2, out, sub_lambda_binary);
+  traverse_binary<float>(in1, in2, out, sub_lambda_binary, ctx);
 }
 
 // sum all elements of input into out
@@ -665,7 +980,7 @@ void Sum<float, lang::Cpp>(const Tensor &in, float *out, Context *ctx) {
   template <>                                                              \
   void fn<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) { \
     auto fn_lambda = [](float a) { return cppfn(a); };                     \
-    traverse_unary<float>(in, out, fn_lambda);                             \
+    traverse_unary<float>(in, out, fn_lambda, ctx);                        \
   }
 
 GenUnaryTensorCppFn(Cos, cos);
@@ -677,66 +992,83 @@ GenUnaryTensorCppFn(Sinh, sinh);
 GenUnaryTensorCppFn(Asin, asin);
 GenUnaryTensorCppFn(Asinh, asinh);
 GenUnaryTensorCppFn(Tan, tan);
-GenUnaryTensorCppFn(Tanh, tanh);
 GenUnaryTensorCppFn(Atan, atan);
 GenUnaryTensorCppFn(Atanh, atanh);
 
+template <>
+void Tanh<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
+  if (use_simd(in, *out, ctx, true)) {
+    bool fast = ctx->math_accuracy == kMathLow;
+    simd_unary(in, out,
+               [fast](size_t n, const float *x, float *y) {
+                 cpp::tanh(n, x, y, fast);
+               },
+               ctx);
+    return;
+  }
+  traverse_unary<float>(in, out, [](float x) { return tanh(x); }, ctx);
+}
+
 template <>
 void Transform<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
-  auto identity = [](float a) { return a; };
-  traverse_unary<float>(in, out, identity);
+  permute_copy<float>(in, out, ctx);
 }
 
 template <>
 void Transform<int, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
-  auto identity = [](int a) { return a; };
-  traverse_unary<int>(in, out, identity);
+  permute_copy<int>(in, out, ctx);
 }
 
-template <>
-void Transform<half_float::half, lang::Cpp>(const Tensor &in, Tensor *out,
-                                            Context *ctx) {
-  auto identity = [](half_float::half a) { return a; };
-  traverse_unary<half_float::half>(in, out, identity);
+// Fill the dense 'out' from a new Philox stream of the context, in parallel;
+// fill(block, i, n, out) writes out[i, i + n) (n <= 4) from the random words
+// of block i / 4, so the result does not depend on the number of threads.
+template <typename Fill>
+void philox_fill(Tensor *out, Fill fill, Context *ctx) {
+  CHECK(out->is_contiguous());
+  float *outPtr = static_cast<float *>(out->block()->mutable_data());
+  const uint64_t key = ctx->random_seed, stream = ctx->random_stream++;
+  ParallelFor(0, (out->Size() + 3) / 4, kEltwiseGrain / 4, ctx->num_threads,
+              [&](size_t begin, size_t end) {
+                for (size_t b = begin; b < end; b++) {
+                  const size_t i = b * 4;
+                  fill(philox::Generate(key, stream, b),
+                       (std::min)(size_t(4), out->Size() - i), outPtr + i);
+                }
+              });
 }
 
 template <>
 void Bernoulli<float, lang::Cpp>(const float p, Tensor *out, Context *ctx) {
-  std::bernoulli_distribution distribution(p);
-  float *outPtr = static_cast<float *>(out->block()->mutable_data());
-  for (size_t i = 0; i < out->Size(); i++) {
-    outPtr[i] = distribution(ctx->random_generator) ? 1.0f : 0.0f;
-  }
+  philox_fill(out,
+              [p](const philox::Block &r, size_t n, float *y) {
+                for (size_t k = 0; k < n; k++)
+                  y[k] = philox::ToUniform(r[k]) < p ? 1.0f : 0.0f;
+              },
+              ctx);
 }
 
 template <>
 void Gaussian<float, lang::Cpp>(const float mean, const float std, Tensor *out,
                                 Context *ctx) {
-  std::normal_distribution<float> distribution(mean, std);
-  float *outPtr = static_cast<float *>(out->block()->mutable_data());
-  for (size_t i = 0; i < out->Size(); i++) {
-    outPtr[i] = static_cast<float>(distribution(ctx->random_generator));
-  }
-}
-
-template <>
-void Gaussian<half_float::half, lang::Cpp>(const half_float::half mean,
-                                           const half_float::half std,
-                                           Tensor *out, Context *ctx) {
-  Tensor tmp(out->shape(), out->device(), kFloat32);
-  Gaussian<float, lang::Cpp>(static_cast<float>(mean), static_cast<float>(std),
-                             &tmp, ctx);
-  CastCopy<float, half_float::half, lang::Cpp>(&tmp, out, ctx);
+  philox_fill(out,
+              [mean, std](const philox::Block &r, size_t n, float *y) {
+                float z[4];
+                philox::ToNormal(r[0], r[1], z, z + 1);
+                philox::ToNormal(r[2], r[3], z + 2, z + 3);
+                for (size_t k = 0; k < n; k++) y[k] = mean + std * z[k];
+              },
+              ctx);
 }
 
 template <>
 void Uniform<float, lang::Cpp>(const float low, const float high, Tensor *out,
                                Context *ctx) {
-  std::uniform_real_distribution<float> distribution(low, high);
-  float *outPtr = static_cast<float *>(out->block()->mutable_data());
-  for (size_t i = 0; i < out->Size(); i++) {
-    outPtr[i] = static_cast<float>(distribution(ctx->random_generator));
-  }
+  philox_fill(out,
+              [low, high](const philox::Block &r, size_t n, float *y) {
+                for (size_t k = 0; k < n; k++)
+                  y[k] = low + (high - low) * philox::ToUniform(r[k]);
+              },
+              ctx);
 }
 
 // ====================Blas operations======================================
@@ -809,11 +1141,13 @@ void Axpy<float, lang::Cpp>(const float alpha, const Tensor &in, Tensor *out,
   if (in.stride() == out->stride()) {
     cblas_saxpy(in.Size(), alpha, inPtr, 1, outPtr, 1);
   } else {
-    // LOG(FATAL) << "Axpy, input and output strides do not match." ;
-    Tensor t(in.shape(), in.device(), in.data_type());
-    EltwiseMult<float, lang::Cpp>(in, alpha, &t, ctx);
-    float *tPtr = static_cast<float *>(t.block()->mutable_data());
-    cblas_saxpy(in.Size(), 1, tPtr, 1, outPtr, 1);
+    StridedIter<2> iter(in.shape(), {{&out->stride(), &in.stride()}});
+    const long so = iter.inner_stride(0), si = iter.inner_stride(1);
+    iter.ForEachRow(0, in.Size(), [&](const std::array<long, 2> &offset,
+                                      size_t len) {
+      for (size_t j = 0; j < len; j++)
+        outPtr[offset[0] + j * so] += alpha * inPtr[offset[1] + j * si];
+    });
   }
 }
 
@@ -887,73 +1221,6 @@ void GEMV<float, lang::Cpp>(const float alpha, const Tensor &A, const Tensor &v,
   }
 }
 
-template <>
-void GEMM<float, lang::Cpp>(const float alpha, const Tensor &A, const Tensor &B,
-                            const float beta, Tensor *C, Context *ctx) {
-  auto transA = A.transpose();
-  auto transa = transA ? CblasTrans : CblasNoTrans;
-  auto transB = B.transpose();
-  auto transb = transB ? CblasTrans : CblasNoTrans;
-  const size_t nrowA = A.shape()[0];
-  const size_t ncolA = A.shape()[1];
-  const size_t ncolB = B.shape()[1];
-  auto lda = transA ? nrowA : ncolA;
-  auto ldb = transB ? ncolA : ncolB;
-  auto ldc = ncolB;
-  const float *APtr = static_cast<const float *>(A.block()->data());
-  const float *BPtr = static_cast<const float *>(B.block()->data());
-  float *CPtr = static_cast<float *>(C->block()->mutable_data());
-  cblas_sgemm(CblasRowMajor, transa, transb, nrowA, ncolB, ncolA, alpha, APtr,
-              lda, BPtr, ldb, beta, CPtr, ldc);
-}
-
-/*
- * implement matmul for 3d 4d tensor
- *   simulate cblas_sgemm_batch();
- *   which is only available in intel cblas
- */
-template <>
-void GEMMBatched<float, lang::Cpp>(const float alpha, const Tensor &A,
-                                   const Tensor &B, const float beta, Tensor *C,
-                                   Context *ctx) {
-  const float *APtr = static_cast<const float *>(A.block()->data());
-  const float *BPtr = static_cast<const float *>(B.block()->data());
-  float *CPtr = static_cast<float *>(C->block()->mutable_data());
-
-  auto transA = A.transpose();
-  auto transa = transA ? CblasTrans : CblasNoTrans;
-  auto transB = B.transpose();
-  auto transb = transB ? CblasTrans : CblasNoTrans;
-
-  const size_t ncolB = B.shape().end()[-1];
-  const size_t nrowA = A.shape().end()[-2];
-  const size_t ncolA = A.shape().end()[-1];
-
-  auto lda = transA ? nrowA : ncolA;
-  auto ldb = transB ? ncolA : ncolB;
-  auto ldc = ncolB;
-  const int group_count = 1;
-
-  size_t group_size = A.shape()[0];                // 3d
-  if (A.nDim() == 4u) group_size *= A.shape()[1];  // 4d
-
-  auto matrix_stride_A = A.shape().end()[-1] * A.shape().end()[-2];
-  auto matrix_stride_B = B.shape().end()[-1] * B.shape().end()[-2];
-  auto matrix_stride_C = C->shape().end()[-1] * C->shape().end()[-2];
-  auto offset_A = 0;
-  auto offset_B = 0;
-  auto offset_C = 0;
-
-  for (int i = 0; i < group_size; i++) {
-    cblas_sgemm(CblasRowMajor, transa, transb, nrowA, ncolB, ncolA, alpha,
-                APtr + offset_A, lda, BPtr + offset_B, ldb, beta,
-                CPtr + offset_C, ldc);
-    offset_A += matrix_stride_A;
-    offset_B += matrix_stride_B;
-    offset_C += matrix_stride_C;
-  }
-}
-
 #else
 
 template <>
@@ -1002,13 +1269,13 @@ void Axpy<float, lang::Cpp>(const float alpha, const Tensor &in, Tensor *out,
                             Context *ctx) {
   float *outPtr = static_cast<float *>(out->block()->mutable_data());
   const float *inPtr = static_cast<const float *>(in.block()->data());
-  vector<int> traversal_info = generate_traversal_info(in);
-  vector<int> shape_multipliers = generate_shape_multipliers(in);
-
-  for (size_t i = 0; i < in.Size(); i++) {
-    outPtr[i] += alpha * inPtr[traversal_info[in.shape().size()]];
-    traverse_next(in, shape_multipliers, traversal_info, i + 1);
-  }
+  StridedIter<2> iter(in.shape(), {{&out->stride(), &in.stride()}});
+  const long so = iter.inner_stride(0), si = iter.inner_stride(1);
+  iter.ForEachRow(0, in.Size(), [&](const std::array<long, 2> &offset,
+                                    size_t len) {
+    for (size_t j = 0; j < len; j++)
+      outPtr[offset[0] + j * so] += alpha * inPtr[offset[1] + j * si];
+  });
 }
 
 template <>
@@ -1023,25 +1290,16 @@ template <>
 void Dot<float, lang::Cpp>(const Tensor &in1, const Tensor &in2, float *out,
                            Context *ctx) {
   float sum = 0;
-  // const float *in1Ptr = static_cast<const float *>(in1.data());
-  // const float *in2Ptr = static_cast<const float *>(in2.data());
-  // for (size_t i = 0; i < in.Size(); i++) {
-  //   sum += in1Ptr[i] * in2Ptr[i];
-  // }
-  float *outPtr = static_cast<float *>(out->block()->mutable_data());
   const float *in1Ptr = static_cast<const float *>(in1.block()->data());
   const float *in2Ptr = static_cast<const float *>(in2.block()->data());
-  vector<int> traversal_info_in1 = generate_traversal_info(in1);
-  vector<int> traversal_info_in2 = generate_traversal_info(in2);
-  vector<int> shape_multipliers_in1 = generate_shape_multipliers(in1);
-  vector<int> shape_multipliers_in2 = generate_shape_multipliers(in2);
-
-  for (size_t i = 0; i < in1.Size(); i++) {
-    sum += in1Ptr[traversal_info_in1[in1.shape().size()]] *
-           in2Ptr[traversal_info_in2[in2.shape().size()]];
-    traverse_next(in1, shape_multipliers_in1, traversal_info_in1, i + 1);
-    traverse_next(in2, shape_multipliers_in2, traversal_info_in2, i + 1);
-  }
+  StridedIter<2> iter(in1.shape(), {{&in1.stride(), &in2.stride()}});
+  const long s1 = iter.inner_stride(0), s2 = iter.inner_stride(1);
+  iter.ForEachRow(0, in1.Size(), [&](const std::array<long, 2> &offset,
+                                     size_t len) {
+    for (size_t j = 0; j < len; j++)
+      sum += in1Ptr[offset[0] + j * s1] * in2Ptr[offset[1] + j * s2];
+  });
+  *out = sum;
 }
 
 template <>
@@ -1064,6 +1322,132 @@ void GEMV<float, lang::Cpp>(const float alpha, const Tensor &A, const Tensor &v,
 }
 
 #endif  // USE_CBLAS
+
+// The packed op(B) of cpp::gemm_packed(), cached on the block of a constant B
+struct PackedGemmB : public BlockCache {
+  bool trans;
+  size_t K, N, ldb;
+  std::vector<float> data;
+};
+
+// Constant B blocks (except views, whose parent may be written) keep their
+// packed form, so repeated calls, e.g., inference with the same weights, do
+// not pack B every time as cblas_sgemm does. cpp::gemm_packed() keeps a small
+// block of C in registers, which does not pay off for larger M, where the
+// packing is a small part of the cost.
+constexpr size_t kPackedGemmMaxRows = 64;
+
+inline std::shared_ptr<PackedGemmB> packed_gemm_b(const Tensor &B, bool trans,
+                                                  const size_t K,
+                                                  const size_t N,
+                                                  const size_t ldb) {
+  Block *blk = B.block();
+  auto packed = std::dynamic_pointer_cast<PackedGemmB>(blk->cache());
+  if (packed == nullptr || packed->trans != trans || packed->K != K ||
+      packed->N != N || packed->ldb != ldb) {
+    packed = std::make_shared<PackedGemmB>();
+    packed->trans = trans, packed->K = K, packed->N = N, packed->ldb = ldb;
+    packed->data.resize(cpp::gemm_packed_size(K, N));
+    cpp::gemm_pack(trans, K, N, static_cast<const float *>(blk->data()), ldb,
+                   packed->data.data());
+    blk->set_cache(packed);
+  }
+  return packed;
+}
+
+template <>
+void GEMM<float, lang::Cpp>(const float alpha, const Tensor &A, const Tensor &B,
+                            const float beta, Tensor *C, Context *ctx) {
+  auto transA = A.transpose();
+  auto transB = B.transpose();
+  const size_t nrowA = A.shape()[0];
+  const size_t ncolA = A.shape()[1];
+  const size_t ncolB = B.shape()[1];
+  auto lda = transA ? nrowA : ncolA;
+  auto ldb = transB ? ncolA : ncolB;
+  auto ldc = ncolB;
+  const float *APtr = static_cast<const float *>(A.block()->data());
+  float *CPtr = static_cast<float *>(C->block()->mutable_data());
+  if (B.block()->constant() && B.block()->parent() == nullptr &&
+      nrowA <= kPackedGemmMaxRows) {
+    auto packed = packed_gemm_b(B, transB, ncolA, ncolB, ldb);
+    const float *PPtr = packed->data.data();
+    // split the panels among threads
+    const size_t npanel = (ncolB + cpp::kGemmPanel - 1) / cpp::kGemmPanel;
+    const size_t grain =
+        (std::max)(size_t(1), kEltwiseGrain / (nrowA * ncolA + 1));
+    ParallelFor(0, npanel, grain, ctx->num_threads, [&](size_t p0, size_t p1) {
+      const size_t j0 = p0 * cpp::kGemmPanel;
+      const size_t j1 = (std::min)(ncolB, p1 * cpp::kGemmPanel);
+      cpp::gemm_packed(transA, nrowA, j1 - j0, ncolA, alpha, APtr, lda,
+                       PPtr + j0 * ncolA, beta, CPtr + j0, ldc);
+    });
+    return;
+  }
+  const float *BPtr = static_cast<const float *>(B.block()->data());
+  cpp::gemm(transA, transB, nrowA, ncolB, ncolA, alpha, APtr, lda, BPtr, ldb,
+            beta, CPtr, ldc);
+}
+
+// Operands may have any batch strides (e.g., 0 if broadcast) and matrices
+// stored either way (see GEMMLayout()). The batch entries are distributed
+// among the threads; if there are fewer entries than threads, the rows of
+// each product are split too.
+template <>
+void GEMMBatched<float, lang::Cpp>(const float alpha, const Tensor &A,
+                                   const Tensor &B, const float beta, Tensor *C,
+                                   Context *ctx) {
+  CHECK(C->is_contiguous());
+  CHECK_EQ(A.nDim(), C->nDim());
+  CHECK_EQ(B.nDim(), C->nDim());
+  bool transA, transB;
+  size_t lda, ldb;
+  CHECK(GEMMLayout(A, &transA, &lda) && GEMMLayout(B, &transB, &ldb))
+      << "The matrices of batched GEMM must be dense in one dimension";
+  const size_t nrowA = A.shape().end()[-2];
+  const size_t ncolA = A.shape().end()[-1];
+  const size_t ncolB = B.shape().end()[-1];
+  const size_t ldc = ncolB;
+
+  // batch dimensions, with the strides of A and B
+  const size_t nbatch_dim = C->nDim() - 2;
+  size_t nbatch = 1;
+  for (size_t d = 0; d < nbatch_dim; d++) {
+    CHECK_EQ(A.shape(d), C->shape(d));
+    CHECK_EQ(B.shape(d), C->shape(d));
+    nbatch *= C->shape(d);
+  }
+
+  const float *APtr = static_cast<const float *>(A.block()->data());
+  const float *BPtr = static_cast<const float *>(B.block()->data());
+  float *CPtr = static_cast<float *>(C->block()->mutable_data());
+
+  const size_t flops = nrowA * ncolA * ncolB;
+  size_t nsplit = 1;
+  if (nbatch < (size_t)ctx->num_threads && flops > kEltwiseGrain)
+    nsplit = (std::min)(nrowA, (ctx->num_threads + nbatch - 1) / nbatch);
+  const size_t grain = (std::max)(size_t(1), kEltwiseGrain / (flops + 1));
+  ParallelFor(0, nbatch * nsplit, grain, ctx->num_threads, [&](size_t t0,
+                                                                size_t t1) {
+    for (size_t t = t0; t < t1; t++) {
+      const size_t g = t / nsplit, part = t % nsplit;
+      long offA = 0, offB = 0;
+      for (size_t d = nbatch_dim, rest = g; d-- > 0; rest /= C->shape(d)) {
+        const size_t idx = rest % C->shape(d);
+        offA += idx * A.stride()[d];
+        offB += idx * B.stride()[d];
+      }
+      const size_t r0 = nrowA * part / nsplit;
+      const size_t r1 = nrowA * (part + 1) / nsplit;
+      // row r of op(A) starts at column r of a transposed A
+      offA += r0 * (transA ? 1 : lda);
+      cpp::gemm(transA, transB, r1 - r0, ncolB, ncolA, alpha, APtr + offA,
+                lda, BPtr + offB, ldb, beta, CPtr + (g * nrowA + r0) * ldc,
+                ldc);
+    }
+  });
+}
+
 template <>
 void ComputeCrossEntropy<float, lang::Cpp>(bool int_target,
                                            const size_t batchsize,
@@ -1133,21 +1517,1078 @@ void RowMax<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
   float *outPtr = static_cast<float *>(out->block()->mutable_data());
   const size_t nrow = in.shape()[0];
   const size_t ncol = in.shape()[1];
-  vector<int> traversal_info = generate_traversal_info(in);
-  vector<int> shape_multipliers = generate_shape_multipliers(in);
+  StridedIter<1> iter(in.shape(), {{&in.stride()}});
+  const long stride = iter.inner_stride(0);
 
   for (size_t r = 0; r < nrow; r++) {
-    int counter_offset = (r * ncol);
     float maxval = 0;
-    for (size_t c = 0; c < ncol; c++) {
-      maxval = (std::max)(maxval, inPtr[traversal_info[in.shape().size()]]);
-      traverse_next(in, shape_multipliers, traversal_info,
-                    counter_offset + c + 1);
-    }
+    iter.ForEachRow(r * ncol, (r + 1) * ncol,
+                    [&](const std::array<long, 1> &offset, size_t len) {
+                      for (size_t j = 0; j < len; j++)
+                        maxval = (std::max)(maxval,
+                                            inPtr[offset[0] + j * stride]);
+                    });
     outPtr[r] = maxval;
   }
 }
 
+// Sum of n elements 'stride' apart, added pairwise in blocks of 256 with 8
+// independent accumulators (vectorized for stride 1), so the rounding error
+// grows with log(n) instead of n.
+template <typename DType>
+DType pairwise_sum(const DType *x, long stride, size_t n) {
+  if (n > 256) {
+    size_t half = n / 2 / 8 * 8;
+    return pairwise_sum(x, stride, half) +
+           pairwise_sum(x + half * stride, stride, n - half);
+  }
+  DType acc[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  size_t i = 0;
+  if (stride == 1) {
+    for (; i + 8 <= n; i += 8)
+      for (int k = 0; k < 8; k++) acc[k] += x[i + k];
+  } else {
+    for (; i + 8 <= n; i += 8)
+      for (int k = 0; k < 8; k++) acc[k] += x[(i + k) * stride];
+  }
+  DType sum = ((acc[0] + acc[1]) + (acc[2] + acc[3])) +
+              ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+  for (; i < n; i++) sum += x[i * stride];
+  return sum;
+}
+
+// Reducers of reduce_cpp. A State accumulates the elements of one output,
+// given with their (row-major) index over the reduced axes.
+template <typename DType>
+struct SumReducer {
+  typedef DType OutType;
+  // the sum of no elements is 0
+  static const bool kHasIdentity = true;
+  // Kahan summation of the partial sums
+  struct State {
+    DType sum = 0, comp = 0;
+  };
+  static void Add(State *s, DType x, size_t idx) {
+    DType y = x - s->comp, t = s->sum + y;
+    s->comp = (t - s->sum) - y;
+    s->sum = t;
+  }
+  static void AddRow(State *s, const DType *x, long stride, size_t n,
+                     size_t idx) {
+    Add(s, pairwise_sum(x, stride, n), idx);
+  }
+  static void Merge(State *s, const State &other) {
+    Add(s, other.sum, 0);
+    Add(s, -other.comp, 0);
+  }
+  static OutType Result(const State &s) { return s.sum; }
+};
+
+// max (min) and, if kArg, the index of its first occurrence
+template <typename DType, bool kMax, bool kArg>
+struct ExtremumReducer {
+  typedef typename std::conditional<kArg, int, DType>::type OutType;
+  // there is no extremum of no elements
+  static const bool kHasIdentity = false;
+  struct State {
+    DType value = 0;
+    size_t idx = 0;
+    bool empty = true;
+  };
+  static bool Better(DType x, DType y) { return kMax ? x > y : x < y; }
+  static void Add(State *s, DType x, size_t idx) {
+    if (s->empty || Better(x, s->value)) {
+      s->value = x;
+      s->idx = idx;
+      s->empty = false;
+    }
+  }
+  static void AddRow(State *s, const DType *x, long stride, size_t n,
+                     size_t idx) {
+    for (size_t i = 0; i < n; i++) Add(s, x[i * stride], idx + i);
+  }
+  // 'other' holds later elements
+  static void Merge(State *s, const State &other) {
+    if (!other.empty) Add(s, other.value, other.idx);
+  }
+  static OutType Result(const State &s) {
+    return kArg ? OutType(s.idx) : OutType(s.value);
+  }
+};
+
+// Reduce 'in' into 'out' along the axes of size 1 in 'out' (see Reduce in
+// tensor_math.h). The kept and the reduced axes are walked by StridedIter,
+// so 'in' may have any strides. Outputs are split across threads; if there
+// are fewer outputs than threads, each output is reduced by all threads in
+// chunks of kEltwiseGrain elements, whose results are merged in order.
+// Each output reduces rows along the reduced axis of the smallest stride,
+// unless the kept axis of the smallest stride has a smaller one, e.g., when
+// summing the rows of a matrix; then a row of outputs is updated by each
+// reduced element in turn.
+template <typename DType, typename R>
+void reduce_cpp(const Tensor &in, Tensor *out, Context *ctx) {
+  typedef typename R::OutType OutType;
+  typedef typename R::State State;
+  CHECK_EQ(in.nDim(), out->nDim());
+  Shape kshape, rshape;
+  vector<int> kin, kout, rin;
+  for (size_t k = 0; k < in.nDim(); k++) {
+    if (out->shape(k) == in.shape(k)) {
+      kshape.push_back(in.shape(k));
+      kin.push_back(in.stride()[k]);
+      kout.push_back(out->stride()[k]);
+    } else {
+      CHECK_EQ(out->shape(k), 1u);
+      rshape.push_back(in.shape(k));
+      rin.push_back(in.stride()[k]);
+    }
+  }
+  size_t num_out = 1, len = 1;
+  for (auto n : kshape) num_out *= n;
+  for (auto n : rshape) len *= n;
+  if (num_out == 0) return;
+  StridedIter<2> kept(kshape, {{&kin, &kout}});
+  StridedIter<1> reduced(rshape, {{&rin}});
+  const long kin_s = kept.inner_stride(0), kout_s = kept.inner_stride(1);
+  OutType *outPtr = static_cast<OutType *>(out->block()->mutable_data());
+  if (len == 0) {
+    // 'in' is empty (and may have no block); every output is the identity
+    CHECK(R::kHasIdentity) << "The reduction of an empty axis is undefined";
+    kept.ForEachRow(0, num_out, [&](const std::array<long, 2> &offset,
+                                    size_t n) {
+      for (size_t j = 0; j < n; j++) outPtr[offset[1] + j * kout_s] = OutType();
+    });
+    return;
+  }
+  const DType *inPtr = static_cast<const DType *>(in.block()->data());
+  const long rin_s = reduced.inner_stride(0);
+  const size_t threads = ctx->num_threads;
+
+  // reduce the elements [begin, end) of the reduced axes at 'x'
+  auto reduce_range = [&](const DType *x, size_t begin, size_t end,
+                          State *state) {
+    size_t idx = begin;
+    reduced.ForEachRow(begin, end, [&](const std::array<long, 1> &offset,
+                                       size_t n) {
+      R::AddRow(state, x + offset[0], rin_s, n, idx);
+      idx += n;
+    });
+  };
+
+  if (num_out < threads && len >= 2 * kEltwiseGrain) {
+    const size_t chunks = (len + kEltwiseGrain - 1) / kEltwiseGrain;
+    vector<State> partial(chunks);
+    kept.ForEachRow(0, num_out, [&](const std::array<long, 2> &offset,
+                                    size_t n) {
+      for (size_t j = 0; j < n; j++) {
+        const DType *x = inPtr + offset[0] + j * kin_s;
+        ParallelFor(0, chunks, 1, threads, [&](size_t begin, size_t end) {
+          for (size_t c = begin; c < end; c++) {
+            partial[c] = State();
+            reduce_range(x, c * kEltwiseGrain,
+                         std::min(len, (c + 1) * kEltwiseGrain), &partial[c]);
+          }
+        });
+        State state;
+        for (auto &p : partial) R::Merge(&state, p);
+        outPtr[offset[1] + j * kout_s] = R::Result(state);
+      }
+    });
+  } else if (kept.row_size() > 1 && std::labs(kin_s) < std::labs(rin_s)) {
+    const size_t kBlock = 256;
+    ParallelFor(0, num_out, std::max<size_t>(1, kEltwiseGrain / len), threads,
+                [&](size_t begin, size_t end) {
+                  State state[kBlock];
+                  kept.ForEachRow(begin, end, [&](const std::array<long, 2>
+                                                      &offset,
+                                                  size_t n) {
+                    for (size_t j0 = 0; j0 < n; j0 += kBlock) {
+                      const size_t m = std::min(kBlock, n - j0);
+                      const DType *x = inPtr + offset[0] + j0 * kin_s;
+                      std::fill(state, state + m, State());
+                      size_t idx = 0;
+                      reduced.ForEachRow(
+                          0, len, [&](const std::array<long, 1> &roffset,
+                                      size_t rn) {
+                            for (size_t i = 0; i < rn; i++, idx++) {
+                              const DType *row = x + roffset[0] + i * rin_s;
+                              for (size_t j = 0; j < m; j++)
+                                R::Add(&state[j], row[j * kin_s], idx);
+                            }
+                          });
+                      for (size_t j = 0; j < m; j++)
+                        outPtr[offset[1] + (j0 + j) * kout_s] =
+                            R::Result(state[j]);
+                    }
+                  });
+                });
+  } else {
+    ParallelFor(0, num_out, std::max<size_t>(1, kEltwiseGrain / len), threads,
+                [&](size_t begin, size_t end) {
+                  kept.ForEachRow(begin, end, [&](const std::array<long, 2>
+                                                      &offset,
+                                                  size_t n) {
+                    for (size_t j = 0; j < n; j++) {
+                      State state;
+                      reduce_range(inPtr + offset[0] + j * kin_s, 0, len,
+                                   &state);
+                      outPtr[offset[1] + j * kout_s] = R::Result(state);
+                    }
+                  });
+                });
+  }
+}
+
+template <typename DType>
+void reduce_cpp(const ReduceOp op, const Tensor &in, Tensor *out,
+                Context *ctx) {
+  switch (op) {
+    case kReduceSum:
+      reduce_cpp<DType, SumReducer<DType>>(in, out, ctx);
+      break;
+    case kReduceMax:
+      reduce_cpp<DType, ExtremumReducer<DType, true, false>>(in, out, ctx);
+      break;
+    case kReduceMin:
+      reduce_cpp<DType, ExtremumReducer<DType, false, false>>(in, out, ctx);
+      break;
+    case kReduceArgMax:
+      reduce_cpp<DType, ExtremumReducer<DType, true, true>>(in, out, ctx);
+      break;
+    case kReduceArgMin:
+      reduce_cpp<DType, ExtremumReducer<DType, false, true>>(in, out, ctx);
+      break;
+    default:
+      LOG(FATAL) << "Unknown reduction " << op;
+  }
+}
+
+template <>
+void Reduce<float, lang::Cpp>(const ReduceOp op, const Tensor &in,
+                              Tensor *out, Context *ctx) {
+  reduce_cpp<float>(op, in, out, ctx);
+}
+
+template <>
+void Reduce<int, lang::Cpp>(const ReduceOp op, const Tensor &in, Tensor *out,
+                            Context *ctx) {
+  reduce_cpp<int>(op, in, out, ctx);
+}
+
+// Softmax over each row of a dense 1d or 2d tensor. A row is processed by
+// one thread in chunks of kSoftMaxChunk elements: each chunk is shifted by
+// its own max and exponentiated while it is in cache, and the row max and
+// sum of exponentials are merged online, i.e., s = s * exp(m - m') +
+// s_c * exp(m_c - m'). So the input is read once and the output is only
+// rescaled, instead of the max, exp and sum passes over the whole row.
+constexpr size_t kSoftMaxChunk = 1024;
+
+inline void softmax_dims(const Tensor &in, size_t *nrow, size_t *ncol) {
+  CHECK_LE(in.nDim(), 2u)
+      << "Axis is required for SoftMax on multi dimemsional tensor";
+  CHECK(in.is_contiguous()) << "SoftMax requires dense rows";
+  *nrow = in.nDim() == 2u ? in.shape(0) : 1;
+  *ncol = in.nDim() == 2u ? in.shape(1) : in.Size();
+}
+
+// out[i] = exp(in[i] - x); 'in' and 'out' may be the same array.
+inline void softmax_exp(const size_t n, const float *in, const float x,
+                        float *out, Context *ctx) {
+  if (cpp::GetSimdLevel() != cpp::kScalar &&
+      ctx->math_accuracy != kMathPrecise) {
+    cpp::add(n, in, -x, out);
+    cpp::exp(n, out, out, ctx->math_accuracy == kMathLow);
+  } else {
+    for (size_t i = 0; i < n; i++) out[i] = std::exp(in[i] - x);
+  }
+}
+
+// Return the max and the sum of exp(x - max) of the row 'in'. The max of
+// each chunk is written into 'chunk_max' and exp(x - chunk max) into 'out',
+// unless 'chunk_max' is nullptr, in which case 'out' is a buffer of
+// kSoftMaxChunk elements reused by all chunks. Chunks of -inf (e.g., masked
+// out) add nothing; a row of -inf has no softmax and returns NaN for both.
+inline std::pair<float, float> softmax_online(const size_t n, const float *in,
+                                              float *out, float *chunk_max,
+                                              Context *ctx) {
+  const float inf = std::numeric_limits<float>::infinity();
+  float m = -inf, s = 0.f;
+  for (size_t b = 0, c = 0; b < n; b += kSoftMaxChunk, c++) {
+    const size_t len = std::min(kSoftMaxChunk, n - b);
+    float mc = in[b];
+    for (size_t i = 1; i < len; i++) mc = (std::max)(mc, in[b + i]);
+    float *e = chunk_max == nullptr ? out : out + b;
+    if (chunk_max != nullptr) chunk_max[c] = mc;
+    // exp(x - mc) would be NaN
+    if (mc == -inf) {
+      if (chunk_max != nullptr) std::fill(e, e + len, 0.f);
+      continue;
+    }
+    softmax_exp(len, in + b, mc, e, ctx);
+    const float sc = pairwise_sum(e, 1, len);
+    if (mc > m) {
+      s = s * std::exp(m - mc) + sc;
+      m = mc;
+    } else {
+      s += sc * std::exp(mc - m);
+    }
+  }
+  if (m == -inf) {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    return std::make_pair(nan, nan);
+  }
+  return std::make_pair(m, s);
+}
+
+inline void softmax_cpp(const Tensor &in, Tensor *out, Context *ctx) {
+  size_t nrow, ncol;
+  softmax_dims(in, &nrow, &ncol);
+  const float *inPtr = static_cast<const float *>(in.block()->data());
+  float *outPtr = static_cast<float *>(out->block()->mutable_data());
+  const size_t grain = (std::max)(size_t(1), kEltwiseGrain / (ncol + 1));
+  ParallelFor(0, nrow, grain, ctx->num_threads, [&](size_t r0, size_t r1) {
+    std::vector<float> chunk_max((ncol + kSoftMaxChunk - 1) / kSoftMaxChunk);
+    for (size_t r = r0; r < r1; r++) {
+      const float *x = inPtr + r * ncol;
+      float *y = outPtr + r * ncol;
+      auto ms = softmax_online(ncol, x, y, chunk_max.data(), ctx);
+      for (size_t b = 0, c = 0; b < ncol; b += kSoftMaxChunk, c++) {
+        const size_t len = std::min(kSoftMaxChunk, ncol - b);
+        cpp::mult(len, y + b, std::exp(chunk_max[c] - ms.first) / ms.second,
+                  y + b);
+      }
+    }
+  });
+}
+
+// log(softmax(x)) = x - max - log(sum(exp(x - max))); the exponentials go
+// to a per-thread buffer, so 'out' may be 'in'.
+inline void log_softmax_cpp(const Tensor &in, Tensor *out, Context *ctx) {
+  size_t nrow, ncol;
+  softmax_dims(in, &nrow, &ncol);
+  const float *inPtr = static_cast<const float *>(in.block()->data());
+  float *outPtr = static_cast<float *>(out->block()->mutable_data());
+  const size_t grain = (std::max)(size_t(1), kEltwiseGrain / (ncol + 1));
+  ParallelFor(0, nrow, grain, ctx->num_threads, [&](size_t r0, size_t r1) {
+    std::vector<float> buf(std::min(kSoftMaxChunk, ncol));
+    for (size_t r = r0; r < r1; r++) {
+      const float *x = inPtr + r * ncol;
+      auto ms = softmax_online(ncol, x, buf.data(), nullptr, ctx);
+      cpp::add(ncol, x, -(ms.first + std::log(ms.second)), outPtr + r * ncol);
+    }
+  });
+}
+
+// dx = y * (dy - sum(dy * y)) for each row, where 'dy' is the gradient of
+// the softmax output 'y'; 'dx' may be 'dy' or 'y'.
+inline void softmax_backward_cpp(const Tensor &dy, Tensor *dx, const Tensor &y,
+                                 Context *ctx) {
+  size_t nrow, ncol;
+  softmax_dims(dy, &nrow, &ncol);
+  CHECK(y.is_contiguous() && y.Size() == dy.Size());
+  const float *dyPtr = static_cast<const float *>(dy.block()->data());
+  const float *yPtr = static_cast<const float *>(y.block()->data());
+  float *dxPtr = static_cast<float *>(dx->block()->mutable_data());
+  const size_t grain = (std::max)(size_t(1), kEltwiseGrain / (ncol + 1));
+  ParallelFor(0, nrow, grain, ctx->num_threads, [&](size_t r0, size_t r1) {
+    std::vector<float> buf(std::min(kSoftMaxChunk, ncol));
+    for (size_t r = r0; r < r1; r++) {
+      const float *g = dyPtr + r * ncol, *p = yPtr + r * ncol;
+      float dot = 0.f;
+      for (size_t b = 0; b < ncol; b += kSoftMaxChunk) {
+        const size_t len = std::min(kSoftMaxChunk, ncol - b);
+        cpp::mult(len, g + b, p + b, buf.data());
+        dot += pairwise_sum(buf.data(), 1, len);
+      }
+      for (size_t b = 0; b < ncol; b += kSoftMaxChunk) {
+        const size_t len = std::min(kSoftMaxChunk, ncol - b);
+        cpp::add(len, g + b, -dot, buf.data());
+        cpp::mult(len, buf.data(), p + b, dxPtr + r * ncol + b);
+      }
+    }
+  });
+}
+
+#ifndef USE_DNNL
+template <>
+void SoftMax<float, lang::Cpp>(const Tensor &in, Tensor *out, Context *ctx) {
+  softmax_cpp(in, out, ctx);
+}
+
+template <>
+void SoftMaxBackward<float, lang::Cpp>(const Tensor &in, Tensor *out,
+                                       const Tensor &fdout, Context *ctx) {
+  softmax_backward_cpp(in, out, fdout, ctx);
+}
+#endif  // USE_DNNL
+
+template <>
+void LogSoftMax<float, lang::Cpp>(const Tensor &in, Tensor *out,
+                                  Context *ctx) {
+  log_softmax_cpp(in, out, ctx);
+}
+
+// The smoothed target of a row of SoftmaxCrossEntropyFused(), i.e.,
+// w = (1 - smoothing) * t / sum(t) + smoothing / dim, where t is the one-hot
+// vector of the label for int targets. The loss of the row is
+// lse - sum(w * x) since sum(w) = 1, and the gradient is exp(x - lse) - w.
+template <typename TType>
+struct SmoothedTarget {
+  SmoothedTarget(bool int_target, const size_t dim, const float smoothing,
+                 const TType *t)
+      : int_target(int_target), dim(dim), t(t), uniform(smoothing / dim),
+        scale(1.f - smoothing) {}
+
+  void SetRow(const size_t r) {
+    if (int_target) {
+      label = static_cast<int>(t[r]);
+      CHECK(label >= 0 && (size_t)label < dim) << "Wrong label " << label;
+      weight = scale;
+    } else {
+      row = t + r * dim;
+      double sum = 0;
+      for (size_t j = 0; j < dim; j++) sum += row[j];
+      weight = sum > 0 ? static_cast<float>(scale / sum) : 0.f;
+    }
+  }
+
+  // sum(w * x)
+  float Dot(const float *x) const {
+    float ret = uniform != 0.f ? uniform * pairwise_sum(x, 1, dim) : 0.f;
+    if (int_target) return ret + weight * x[label];
+    double dot = 0;
+    for (size_t j = 0; j < dim; j++) dot += row[j] * x[j];
+    return ret + weight * static_cast<float>(dot);
+  }
+
+  // g -= w
+  void Sub(float *g) const {
+    if (int_target) {
+      if (uniform != 0.f) cpp::add(dim, g, -uniform, g);
+      g[label] -= weight;
+    } else {
+      for (size_t j = 0; j < dim; j++) g[j] -= weight * row[j] + uniform;
+    }
+  }
+
+  const bool int_target;
+  const size_t dim;
+  const TType *t;
+  const float uniform, scale;
+  const TType *row = nullptr;
+  int label = 0;
+  float weight = 0.f;
+};
+
+// Compute the loss and the log-sum-exp of each row in one pass over 'x' if
+// lseIn is nullptr, otherwise read the log-sum-exp from it; write the
+// gradient in a second pass if gradPtr is not nullptr.
+template <typename TType>
+void softmax_cross_entropy_cpp(bool int_target, const size_t batchsize,
+                               const size_t dim, const float smoothing,
+                               const float *xPtr, const TType *tPtr,
+                               const float *lseIn, float *lossPtr,
+                               float *lsePtr, float *gradPtr, Context *ctx) {
+  const size_t grain = (std::max)(size_t(1), kEltwiseGrain / (dim + 1));
+  ParallelFor(0, batchsize, grain, ctx->num_threads, [&](size_t r0,
+                                                          size_t r1) {
+    SmoothedTarget<TType> target(int_target, dim, smoothing, tPtr);
+    std::vector<float> buf(lseIn == nullptr ? std::min(kSoftMaxChunk, dim)
+                                            : 0);
+    for (size_t r = r0; r < r1; r++) {
+      const float *x = xPtr + r * dim;
+      float lse;
+      target.SetRow(r);
+      if (lseIn == nullptr) {
+        auto ms = softmax_online(dim, x, buf.data(), nullptr, ctx);
+        lse = ms.first + std::log(ms.second);
+        if (lossPtr != nullptr) lossPtr[r] = lse - target.Dot(x);
+        if (lsePtr != nullptr) lsePtr[r] = lse;
+      } else {
+        lse = lseIn[r];
+      }
+      if (gradPtr != nullptr) {
+        float *g = gradPtr + r * dim;
+        softmax_exp(dim, x, lse, g, ctx);
+        target.Sub(g);
+      }
+    }
+  });
+}
+
+template <>
+void SoftmaxCrossEntropyFused<float, lang::Cpp>(
+    bool int_target, const size_t batchsize, const size_t dim,
+    const float smoothing, const Tensor &x, const Tensor &t, Tensor *loss,
+    Tensor *lse, Tensor *grad, Context *ctx) {
+  CHECK(x.is_contiguous() && t.is_contiguous());
+  const float *xPtr = static_cast<const float *>(x.block()->data());
+  float *lossPtr = static_cast<float *>(loss->block()->mutable_data());
+  float *lsePtr = lse == nullptr
+                      ? nullptr
+                      : static_cast<float *>(lse->block()->mutable_data());
+  float *gradPtr = grad == nullptr
+                       ? nullptr
+                       : static_cast<float *>(grad->block()->mutable_data());
+  if (t.data_type() == kInt)
+    softmax_cross_entropy_cpp(
+        int_target, batchsize, dim, smoothing, xPtr,
+        static_cast<const int *>(t.block()->data()), nullptr, lossPtr, lsePtr,
+        gradPtr, ctx);
+  else
+    softmax_cross_entropy_cpp(
+        int_target, batchsize, dim, smoothing, xPtr,
+        static_cast<const float *>(t.block()->data()), nullptr, lossPtr,
+        lsePtr, gradPtr, ctx);
+}
+
+template <>
+void SoftmaxCrossEntropyFusedBwd<float, lang::Cpp>(
+    bool int_target, const size_t batchsize, const size_t dim,
+    const float smoothing, const Tensor &x, const Tensor &t, const Tensor &lse,
+    Tensor *grad, Context *ctx) {
+  CHECK(x.is_contiguous() && t.is_contiguous());
+  const float *xPtr = static_cast<const float *>(x.block()->data());
+  const float *lsePtr = static_cast<const float *>(lse.block()->data());
+  float *gradPtr = static_cast<float *>(grad->block()->mutable_data());
+  if (t.data_type() == kInt)
+    softmax_cross_entropy_cpp(int_target, batchsize, dim, smoothing, xPtr,
+                              static_cast<const int *>(t.block()->data()),
+                              lsePtr, nullptr, nullptr, gradPtr, ctx);
+  else
+    softmax_cross_entropy_cpp(int_target, batchsize, dim, smoothing, xPtr,
+                              static_cast<const float *>(t.block()->data()),
+                              lsePtr, nullptr, nullptr, gradPtr, ctx);
+}
+
+// ===================== float16 and bfloat16 =================================
+// There is no float16 or bfloat16 arithmetic on CPU. The ops on tensors of
+// these types widen the operands into float32 (tile by tile for the
+// elementwise ops) with the vectorized conversions of math_kernel_cpp.h,
+// apply the float32 op and round the result back. Hence the computation,
+// including the accumulation of reductions and GEMM, is done in float32,
+// while the tensors (e.g., activations and weights) take half the memory of
+// float32 tensors.
+
+inline void convert(const size_t n, const half_float::half *in, float *out) {
+  cpp::half_to_float(n, reinterpret_cast<const uint16_t *>(in), out);
+}
+
+inline void convert(const size_t n, const float *in, half_float::half *out) {
+  cpp::float_to_half(n, in, reinterpret_cast<uint16_t *>(out));
+}
+
+inline void convert(const size_t n, const bfloat16 *in, float *out) {
+  cpp::bfloat16_to_float(n, reinterpret_cast<const uint16_t *>(in), out);
+}
+
+inline void convert(const size_t n, const float *in, bfloat16 *out) {
+  cpp::float_to_bfloat16(n, in, reinterpret_cast<uint16_t *>(out));
+}
+
+// out = in for tensors of the same shape but any strides, converting the
+// elements from SType to DType with convert()
+template <typename SType, typename DType>
+void convert_copy(const Tensor &in, Tensor *out, Context *ctx) {
+  CHECK(in.shape() == out->shape());
+  const size_t size = Product(in.shape());
+  if (size == 0) return;
+  DType *outPtr = static_cast<DType *>(out->block()->mutable_data());
+  const SType *inPtr = static_cast<const SType *>(in.block()->data());
+  StridedIter<2> iter(in.shape(), {{&out->stride(), &in.stride()}});
+  const long so = iter.inner_stride(0), si = iter.inner_stride(1);
+  ParallelFor(
+      0, size, kEltwiseGrain, ctx->num_threads, [&](size_t begin, size_t end) {
+        iter.ForEachRow(begin, end, [&](const std::array<long, 2> &offset,
+                                        size_t len) {
+          DType *o = outPtr + offset[0];
+          const SType *x = inPtr + offset[1];
+          if (so == 1 && si == 1) {
+            convert(len, x, o);
+          } else {
+            for (size_t j = 0; j < len; j++) convert(1, x + j * si, o + j * so);
+          }
+        });
+      });
+}
+
+// A float32 copy of 'in', which is contiguous (transposed or broadcasted
+// operands are materialized) so that the float32 ops take their fast paths.
+template <typename DType>
+Tensor widen(const Tensor &in, Context *ctx) {
+  Tensor out(in.shape(), in.device(), kFloat32);
+  convert_copy<DType, float>(in, &out, ctx);
+  return out;
+}
+
+// The elementwise ops convert the operands tile by tile into float32
+// buffers on the stack instead of widening the whole tensors, so that no
+// float32 copy of the tensors is allocated and a tile (8KB per operand)
+// stays in the L1 cache between the conversions and the op.
+const size_t kReducedTile = 2048;
+
+// out = fn(ins), where fn(x, y) applies the float32 op to the tiles x of
+// the inputs and writes the result into the tile y, which is x[0]. The
+// tiles are smaller than kEltwiseGrain, so the float32 op runs on the
+// calling thread.
+template <typename DType, size_t N, typename Fn>
+void reduced_eltwise(const std::array<const Tensor *, N> &ins, Tensor *out,
+                     Fn fn, Context *ctx) {
+  const size_t size = Product(out->shape());
+  if (size == 0) return;
+  std::array<const vector<int> *, N + 1> strides;
+  std::array<const DType *, N> inPtrs;
+  strides[0] = &out->stride();
+  for (size_t t = 0; t < N; t++) {
+    CHECK(ins[t]->shape() == out->shape());
+    strides[t + 1] = &ins[t]->stride();
+    inPtrs[t] = static_cast<const DType *>(ins[t]->block()->data());
+  }
+  DType *outPtr = static_cast<DType *>(out->block()->mutable_data());
+  StridedIter<N + 1> iter(out->shape(), strides);
+  auto dev = out->device();
+  ParallelFor(
+      0, size, kEltwiseGrain, ctx->num_threads, [&](size_t begin, size_t end) {
+        float buf[N][kReducedTile];
+        for (size_t lo = begin; lo < end; lo += kReducedTile) {
+          const size_t hi = std::min(end, lo + kReducedTile);
+          size_t pos = 0;
+          iter.ForEachRow(lo, hi, [&](const std::array<long, N + 1> &offset,
+                                      size_t len) {
+            for (size_t t = 0; t < N; t++) {
+              const DType *x = inPtrs[t] + offset[t + 1];
+              const long s = iter.inner_stride(t + 1);
+              if (s == 1) {
+                convert(len, x, buf[t] + pos);
+              } else {
+                for (size_t j = 0; j < len; j++)
+                  convert(1, x + j * s, buf[t] + pos + j);
+              }
+            }
+            pos += len;
+          });
+          std::array<Tensor, N> x;
+          for (size_t t = 0; t < N; t++)
+            x[t] = Tensor::FromExternal(buf[t], Shape{hi - lo}, kFloat32,
+                                        nullptr, dev);
+          fn(x, &x[0]);
+          pos = 0;
+          iter.ForEachRow(lo, hi, [&](const std::array<long, N + 1> &offset,
+                                      size_t len) {
+            DType *o = outPtr + offset[0];
+            const long s = iter.inner_stride(0);
+            if (s == 1) {
+              convert(len, buf[0] + pos, o);
+            } else {
+              for (size_t j = 0; j < len; j++)
+                convert(1, buf[0] + pos + j, o + j * s);
+            }
+            pos += len;
+          });
+        }
+      });
+}
+
+// out = fn(in), where fn(x, y) applies the float32 op in place
+template <typename DType, typename Fn>
+void reduced_unary(const Tensor &in, Tensor *out, Fn fn, Context *ctx) {
+  reduced_eltwise<DType, 1>(
+      {{&in}}, out,
+      [&fn](const std::array<Tensor, 1> &x, Tensor *y) { fn(x[0], y); }, ctx);
+}
+
+// out = fn(in1, in2), where fn(x, y, z) applies the float32 op, z being x
+template <typename DType, typename Fn>
+void reduced_binary(const Tensor &in1, const Tensor &in2, Tensor *out, Fn fn,
+                    Context *ctx) {
+  reduced_eltwise<DType, 2>({{&in1, &in2}}, out,
+                            [&fn](const std::array<Tensor, 2> &x, Tensor *y) {
+                              fn(x[0], x[1], y);
+                            },
+                            ctx);
+}
+
+// out = fn(in), where fn(x, y) applies the float32 op whose result y may
+// not be x, e.g., because it has another shape
+template <typename DType, typename Fn>
+void reduced_map(const Tensor &in, Tensor *out, Fn fn, Context *ctx) {
+  Tensor y(out->shape(), out->device(), kFloat32);
+  fn(widen<DType>(in, ctx), &y);
+  convert_copy<float, DType>(y, out, ctx);
+}
+
+#define GenReducedUnaryFn(fn, DType)                                   \
+  template <>                                                          \
+  void fn<DType, lang::Cpp>(const Tensor &in, Tensor *out,             \
+                            Context *ctx) {                            \
+    reduced_unary<DType>(in, out,                                      \
+                         [ctx](const Tensor &x, Tensor *y) {           \
+                           fn<float, lang::Cpp>(x, y, ctx);            \
+                         },                                            \
+                         ctx);                                         \
+  }
+
+#define GenReducedScalarFn(fn, DType)                                  \
+  template <>                                                          \
+  void fn<DType, lang::Cpp>(const Tensor &in, const DType v,           \
+                            Tensor *out, Context *ctx) {               \
+    reduced_unary<DType>(in, out,                                      \
+                         [v, ctx](const Tensor &x, Tensor *y) {        \
+                           fn<float, lang::Cpp>(x, v, y, ctx);         \
+                         },                                            \
+                         ctx);                                         \
+  }
+
+#define GenReducedBinaryFn(fn, DType)                                  \
+  template <>                                                          \
+  void fn<DType, lang::Cpp>(const Tensor &in1, const Tensor &in2,      \
+                            Tensor *out, Context *ctx) {               \
+    reduced_binary<DType>(                                             \
+        in1, in2, out,                                                 \
+        [ctx](const Tensor &x, const Tensor &y, Tensor *z) {           \
+          fn<float, lang::Cpp>(x, y, z, ctx);                          \
+        },                                                             \
+        ctx);                                                          \
+  }
+
+// the unary and binary ops of a 16-bit type and their conversions
+#define GenReducedFns(DType)                                           \
+  GenReducedUnaryFn(Abs, DType);                                       \
+  GenReducedUnaryFn(Acos, DType);                                      \
+  GenReducedUnaryFn(Acosh, DType);                                     \
+  GenReducedUnaryFn(Asin, DType);                                      \
+  GenReducedUnaryFn(Asinh, DType);                                     \
+  GenReducedUnaryFn(Atan, DType);                                      \
+  GenReducedUnaryFn(Atanh, DType);                                     \
+  GenReducedUnaryFn(Ceil, DType);                                      \
+  GenReducedUnaryFn(Cos, DType);                                       \
+  GenReducedUnaryFn(Cosh, DType);                                      \
+  GenReducedUnaryFn(Erf, DType);                                       \
+  GenReducedUnaryFn(Exp, DType);                                       \
+  GenReducedUnaryFn(Floor, DType);                                     \
+  GenReducedUnaryFn(Log, DType);                                       \
+  GenReducedUnaryFn(ReLU, DType);                                      \
+  GenReducedUnaryFn(Round, DType);                                     \
+  GenReducedUnaryFn(RoundE, DType);                                    \
+  GenReducedUnaryFn(Sigmoid, DType);                                   \
+  GenReducedUnaryFn(Sign, DType);                                      \
+  GenReducedUnaryFn(Sin, DType);                                       \
+  GenReducedUnaryFn(Sinh, DType);                                      \
+  GenReducedUnaryFn(SoftPlus, DType);                                  \
+  GenReducedUnaryFn(SoftSign, DType);                                  \
+  GenReducedUnaryFn(Sqrt, DType);                                      \
+  GenReducedUnaryFn(Tan, DType);                                       \
+  GenReducedUnaryFn(Tanh, DType);                                      \
+  GenReducedScalarFn(Add, DType);                                      \
+  GenReducedScalarFn(EltwiseMult, DType);                              \
+  GenReducedScalarFn(EQ, DType);                                       \
+  GenReducedScalarFn(GE, DType);                                       \
+  GenReducedScalarFn(GT, DType);                                       \
+  GenReducedScalarFn(LE, DType);                                       \
+  GenReducedScalarFn(LT, DType);                                       \
+  GenReducedScalarFn(Pow, DType);                                      \
+  GenReducedBinaryFn(Add, DType);                                      \
+  GenReducedBinaryFn(Div, DType);                                      \
+  GenReducedBinaryFn(EltwiseMult, DType);                              \
+  GenReducedBinaryFn(EQ, DType);                                       \
+  GenReducedBinaryFn(GE, DType);                                       \
+  GenReducedBinaryFn(GT, DType);                                       \
+  GenReducedBinaryFn(LE, DType);                                       \
+  GenReducedBinaryFn(LT, DType);                                       \
+  GenReducedBinaryFn(Pow, DType);                                      \
+  GenReducedBinaryFn(ReLUBackward, DType);                             \
+  GenReducedBinaryFn(Sub, DType);                                      \
+                                                                       \
+  template <>                                                          \
+  void CastCopy<float, DType, lang::Cpp>(const Tensor *src,            \
+                                         Tensor *dst, Context *ctx) {  \
+    convert_copy<float, DType>(*src, dst, ctx);                        \
+  }                                                                    \
+                                                                       \
+  template <>                                                          \
+  void CastCopy<DType, float, lang::Cpp>(const Tensor *src,            \
+                                         Tensor *dst, Context *ctx) {  \
+    convert_copy<DType, float>(*src, dst, ctx);                        \
+  }
+
+GenReducedFns(half_float::half);
+GenReducedFns(bfloat16);
+
+// the other ops are templates over the 16-bit type, which are specialized
+// below for both types
+template <typename DType>
+void reduced_set(const DType x, Tensor *out, Context *ctx) {
+  DType *outPtr = static_cast<DType *>(out->block()->mutable_data());
+  ParallelFor(0, out->Size(), kEltwiseGrain, ctx->num_threads,
+              [&](size_t begin, size_t end) {
+                std::fill(outPtr + begin, outPtr + end, x);
+              });
+}
+
+template <typename DType>
+void reduced_clamp(const DType low, const DType high, const Tensor &in,
+                   Tensor *out, Context *ctx) {
+  reduced_unary<DType>(in, out,
+                       [low, high, ctx](const Tensor &x, Tensor *y) {
+                         Clamp<float, lang::Cpp>(low, high, x, y, ctx);
+                       },
+                       ctx);
+}
+
+template <typename DType>
+void reduced_div(const DType v, const Tensor &in, Tensor *out, Context *ctx) {
+  reduced_unary<DType>(in, out,
+                       [v, ctx](const Tensor &x, Tensor *y) {
+                         Div<float, lang::Cpp>(v, x, y, ctx);
+                       },
+                       ctx);
+}
+
+template <typename DType>
+void reduced_sum(const Tensor &in, DType *out, Context *ctx) {
+  float s = 0.f;
+  Sum<float, lang::Cpp>(widen<DType>(in, ctx), &s, ctx);
+  *out = static_cast<DType>(s);
+}
+
+template <typename DType>
+void reduced_asum(const Tensor &in, DType *out, Context *ctx) {
+  float s = 0.f;
+  Asum<float, lang::Cpp>(widen<DType>(in, ctx), &s, ctx);
+  *out = static_cast<DType>(s);
+}
+
+template <typename DType>
+void reduced_dot(const Tensor &in1, const Tensor &in2, DType *out,
+                 Context *ctx) {
+  float s = 0.f;
+  Dot<float, lang::Cpp>(widen<DType>(in1, ctx), widen<DType>(in2, ctx), &s,
+                        ctx);
+  *out = static_cast<DType>(s);
+}
+
+// out = alpha * in + out
+template <typename DType>
+void reduced_axpy(const DType alpha, const Tensor &in, Tensor *out,
+                  Context *ctx) {
+  Tensor y = widen<DType>(*out, ctx);
+  Axpy<float, lang::Cpp>(alpha, widen<DType>(in, ctx), &y, ctx);
+  convert_copy<float, DType>(y, out, ctx);
+}
+
+template <typename DType>
+void reduced_scale(const DType x, Tensor *out, Context *ctx) {
+  Tensor y = widen<DType>(*out, ctx);
+  Scale<float, lang::Cpp>(x, &y, ctx);
+  convert_copy<float, DType>(y, out, ctx);
+}
+
+template <typename DType>
+void reduced_gemv(const DType alpha, const Tensor &A, const Tensor &v,
+                  const DType beta, Tensor *out, Context *ctx) {
+  Tensor y(out->shape(), out->device(), kFloat32);
+  if (static_cast<float>(beta) != 0.f)
+    convert_copy<DType, float>(*out, &y, ctx);
+  GEMV<float, lang::Cpp>(alpha, widen<DType>(A, ctx), widen<DType>(v, ctx),
+                         beta, &y, ctx);
+  convert_copy<float, DType>(y, out, ctx);
+}
+
+// C is read only if beta is not 0, as for float32
+template <typename DType>
+void reduced_gemm(const DType alpha, const Tensor &A, const Tensor &B,
+                  const DType beta, Tensor *C, Context *ctx) {
+  Tensor c(C->shape(), C->device(), kFloat32);
+  if (static_cast<float>(beta) != 0.f)
+    convert_copy<DType, float>(*C, &c, ctx);
+  GEMM<float, lang::Cpp>(alpha, widen<DType>(A, ctx), widen<DType>(B, ctx),
+                         beta, &c, ctx);
+  convert_copy<float, DType>(c, C, ctx);
+}
+
+template <typename DType>
+void reduced_gemm_batched(const DType alpha, const Tensor &A, const Tensor &B,
+                          const DType beta, Tensor *C, Context *ctx) {
+  Tensor c(C->shape(), C->device(), kFloat32);
+  if (static_cast<float>(beta) != 0.f)
+    convert_copy<DType, float>(*C, &c, ctx);
+  GEMMBatched<float, lang::Cpp>(alpha, widen<DType>(A, ctx),
+                                widen<DType>(B, ctx), beta, &c, ctx);
+  convert_copy<float, DType>(c, C, ctx);
+}
+
+template <typename DType>
+void reduced_dgmm(const bool side_right, const Tensor &M, const Tensor &v,
+                  Tensor *out, Context *ctx) {
+  Tensor y(out->shape(), out->device(), kFloat32);
+  DGMM<float, lang::Cpp>(side_right, widen<DType>(M, ctx),
+                         widen<DType>(v, ctx), &y, ctx);
+  convert_copy<float, DType>(y, out, ctx);
+}
+
+// the arg reductions write the kInt 'out' directly
+template <typename DType>
+void reduced_reduce(const ReduceOp op, const Tensor &in, Tensor *out,
+                    Context *ctx) {
+  if (out->data_type() == kInt) {
+    Reduce<float, lang::Cpp>(op, widen<DType>(in, ctx), out, ctx);
+    return;
+  }
+  reduced_map<DType>(in, out,
+                     [op, ctx](const Tensor &x, Tensor *y) {
+                       Reduce<float, lang::Cpp>(op, x, y, ctx);
+                     },
+                     ctx);
+}
+
+template <typename DType>
+void reduced_softmax_backward(const Tensor &in, Tensor *out,
+                              const Tensor &fdout, Context *ctx) {
+  Tensor y(out->shape(), out->device(), kFloat32);
+  SoftMaxBackward<float, lang::Cpp>(widen<DType>(in, ctx), &y,
+                                    widen<DType>(fdout, ctx), ctx);
+  convert_copy<float, DType>(y, out, ctx);
+}
+
+#define GenReducedMapFn(fn, DType)                                     \
+  template <>                                                          \
+  void fn<DType, lang::Cpp>(const Tensor &in, Tensor *out,             \
+                            Context *ctx) {                            \
+    reduced_map<DType>(in, out,                                        \
+                       [ctx](const Tensor &x, Tensor *y) {             \
+                         fn<float, lang::Cpp>(x, y, ctx);              \
+                       },                                              \
+                       ctx);                                           \
+  }
+
+// the other ops of a 16-bit type
+#define GenReducedOtherFns(DType)                                      \
+  GenReducedMapFn(LogSoftMax, DType);                                  \
+  GenReducedMapFn(RowMax, DType);                                      \
+  GenReducedMapFn(SoftMax, DType);                                     \
+                                                                       \
+  template <>                                                          \
+  void Set<DType, lang::Cpp>(const DType x, Tensor *out,               \
+                             Context *ctx) {                           \
+    reduced_set(x, out, ctx);                                          \
+  }                                                                    \
+  template <>                                                          \
+  void Transform<DType, lang::Cpp>(const Tensor &in, Tensor *out,      \
+                                   Context *ctx) {                     \
+    permute_copy<DType>(in, out, ctx);                                 \
+  }                                                                    \
+  template <>                                                          \
+  void Clamp<DType, lang::Cpp>(const DType low, const DType high,      \
+                               const Tensor &in, Tensor *out,          \
+                               Context *ctx) {                         \
+    reduced_clamp(low, high, in, out, ctx);                            \
+  }                                                                    \
+  template <>                                                          \
+  void Div<DType, lang::Cpp>(const DType x, const Tensor &in,          \
+                             Tensor *out, Context *ctx) {              \
+    reduced_div(x, in, out, ctx);                                      \
+  }                                                                    \
+  template <>                                                          \
+  void Sum<DType, lang::Cpp>(const Tensor &in, DType *out,             \
+                             Context *ctx) {                           \
+    reduced_sum(in, out, ctx);                                         \
+  }                                                                    \
+  template <>                                                          \
+  void Asum<DType, lang::Cpp>(const Tensor &in, DType *out,            \
+                              Context *ctx) {                          \
+    reduced_asum(in, out, ctx);                                        \
+  }                                                                    \
+  template <>                                                          \
+  void Nrm2<DType, lang::Cpp>(const Tensor &in, float *out,            \
+                              Context *ctx) {                          \
+    Nrm2<float, lang::Cpp>(widen<DType>(in, ctx), out, ctx);           \
+  }                                                                    \
+  template <>                                                          \
+  void Amax<DType, lang::Cpp>(const Tensor &in, size_t *out,           \
+                              Context *ctx) {                          \
+    Amax<float, lang::Cpp>(widen<DType>(in, ctx), out, ctx);           \
+  }                                                                    \
+  template <>                                                          \
+  void Amin<DType, lang::Cpp>(const Tensor &in, size_t *out,           \
+                              Context *ctx) {                          \
+    Amin<float, lang::Cpp>(widen<DType>(in, ctx), out, ctx);           \
+  }                                                                    \
+  template <>                                                          \
+  void Dot<DType, lang::Cpp>(const Tensor &in1, const Tensor &in2,     \
+                             DType *out, Context *ctx) {               \
+    reduced_dot(in1, in2, out, ctx);                                   \
+  }                                                                    \
+  template <>                                                          \
+  void Axpy<DType, lang::Cpp>(const DType alpha, const Tensor &in,     \
+                              Tensor *out, Context *ctx) {             \
+    reduced_axpy(alpha, in, out, ctx);                                 \
+  }                                                                    \
+  template <>                                                          \
+  void Scale<DType, lang::Cpp>(const DType x, Tensor *out,             \
+                               Context *ctx) {                         \
+    reduced_scale(x, out, ctx);                                        \
+  }                                                                    \
+  template <>                                                          \
+  void GEMV<DType, lang::Cpp>(const DType alpha, const Tensor &A,      \
+                              const Tensor &v, const DType beta,       \
+                              Tensor *out, Context *ctx) {             \
+    reduced_gemv(alpha, A, v, beta, out, ctx);                         \
+  }                                                                    \
+  template <>                                                          \
+  void GEMM<DType, lang::Cpp>(const DType alpha, const Tensor &A,      \
+                              const Tensor &B, const DType beta,       \
+                              Tensor *C, Context *ctx) {               \
+    reduced_gemm(alpha, A, B, beta, C, ctx);                           \
+  }                                                                    \
+  template <>                                                          \
+  void GEMMBatched<DType, lang::Cpp>(const DType alpha,                \
+                                     const Tensor &A, const Tensor &B, \
+                                     const DType beta, Tensor *C,      \
+                                     Context *ctx) {                   \
+    reduced_gemm_batched(alpha, A, B, beta, C, ctx);                   \
+  }                                                                    \
+  template <>                                                          \
+  void DGMM<DType, lang::Cpp>(const bool side_right, const Tensor &M,  \
+                              const Tensor &v, Tensor *out,            \
+                              Context *ctx) {                          \
+    reduced_dgmm<DType>(side_right, M, v, out, ctx);                   \
+  }                                                                    \
+  template <>                                                          \
+  void Reduce<DType, lang::Cpp>(const ReduceOp op, const Tensor &in,   \
+                                Tensor *out, Context *ctx) {           \
+    reduced_reduce<DType>(op, in, out, ctx);                           \
+  }                                                                    \
+  template <>                                                          \
+  void SoftMaxBackward<DType, lang::Cpp>(const Tensor &in, Tensor *out, \
+                                         const Tensor &fdout,          \
+                                         Context *ctx) {               \
+    reduced_softmax_backward<DType>(in, out, fdout, ctx);              \
+  }                                                                    \
+  template <>                                                          \
+  void Bernoulli<DType, lang::Cpp>(const float p, Tensor *out,         \
+                                   Context *ctx) {                     \
+    Tensor y(out->shape(), out->device(), kFloat32);                   \
+    Bernoulli<float, lang::Cpp>(p, &y, ctx);                           \
+    convert_copy<float, DType>(y, out, ctx);                           \
+  }                                                                    \
+  template <>                                                          \
+  void Gaussian<DType, lang::Cpp>(const DType mean, const DType std,   \
+                                  Tensor *out, Context *ctx) {         \
+    Tensor y(out->shape(), out->device(), kFloat32);                   \
+    Gaussian<float, lang::Cpp>(mean, std, &y, ctx);                    \
+    convert_copy<float, DType>(y, out, ctx);                           \
+  }                                                                    \
+  template <>                                                          \
+  void Uniform<DType, lang::Cpp>(const DType low, const DType high,    \
+                                 Tensor *out, Context *ctx) {          \
+    Tensor y(out->shape(), out->device(), kFloat32);                   \
+    Uniform<float, lang::Cpp>(low, high, &y, ctx);                     \
+    convert_copy<float, DType>(y, out, ctx);                           \
+  }
+
+GenReducedOtherFns(half_float::half);
+GenReducedOtherFns(bfloat16);
+
 // =========Matrix operations ================================================
 /*
 template <>
@@ -1337,6 +1337,30 @@ void SoftMax<half_float::half, lang::Cuda>(const Tensor& in, Tensor* out,
       generate_tensor_nd_desc(tmp), outPtr));
 }
 
+template <>
+void LogSoftMax<float, lang::Cuda>(const Tensor& in, Tensor* out,
+                                   Context* ctx) {
+  CHECK_LE(in.shape().size(), 5)
+      << "Dimensions (shape) beyond 5 are currently not supported";
+  auto tmp = in;
+  while (tmp.shape().size() < 4) {
+    auto s = tmp.shape();
+    s.push_back(1);
+    tmp.Reshape(s);
+  }
+
+  const float* inPtr = static_cast<const float*>(in.block()->data());
+  float* outPtr = static_cast<float*>(out->block()->mutable_data());
+
+  float alpha = 1.0;
+  float beta = 0.0;
+
+  check_cudnn(cudnnSoftmaxForward(
+      ctx->cudnn_handle, CUDNN_SOFTMAX_LOG, CUDNN_SOFTMAX_MODE_INSTANCE,
+      (void*)(&alpha), generate_tensor_nd_desc(tmp), inPtr, (void*)(&beta),
+      generate_tensor_nd_desc(tmp), outPtr));
+}
+
 template <>
 void SoftMaxBackward<float, lang::Cuda>(const Tensor& in, Tensor* out,
                                         const Tensor& fdout, Context* ctx) {
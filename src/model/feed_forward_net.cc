@@ -134,10 +134,10 @@ void FeedForwardNet::Train(size_t batchsize, int nb_epoch, const Tensor& x,
     Tensor dummy;
     Train(batchsize, nb_epoch, x, y, dummy, dummy);
   } else {
-    const Tensor train_x = CopyRows(x, 0, num_train);
-    const Tensor train_y = CopyRows(y, 0, num_train);
-    const Tensor test_x = CopyRows(x, num_train, x.shape(0));
-    const Tensor test_y = CopyRows(y, num_train, y.shape(0));
+    const Tensor train_x = SliceRows(x, 0, num_train);
+    const Tensor train_y = SliceRows(y, 0, num_train);
+    const Tensor test_x = SliceRows(x, num_train, x.shape(0));
+    const Tensor test_y = SliceRows(y, num_train, y.shape(0));
     Train(batchsize, nb_epoch, train_x, train_y, test_x, test_y);
   }
 }
@@ -163,8 +163,8 @@ void FeedForwardNet::Train(size_t batchsize, int nb_epoch, const Tensor& x,
     size_t b = 0;
     for (; b < x.shape(0) / batchsize; b++) {
       size_t idx = index[b];
-      const Tensor bx = CopyRows(x, idx * batchsize, (idx + 1) * batchsize);
-      const Tensor by = CopyRows(y, idx * batchsize, (idx + 1) * batchsize);
+      const Tensor bx = SliceRows(x, idx * batchsize, (idx + 1) * batchsize);
+      const Tensor by = SliceRows(y, idx * batchsize, (idx + 1) * batchsize);
       const auto ret = TrainOnBatch(epoch, bx, by);
       loss += ret.first;
       metric += ret.second;
@@ -246,19 +246,19 @@ std::pair<Tensor, Tensor> FeedForwardNet::Evaluate(const Tensor& x,
   Tensor loss(Shape{x.shape(0)}), metric(Shape{x.shape(0)});
   for (size_t b = 0; b < x.shape(0) / batchsize; b++) {
     int start = (int)(b * batchsize), end = (int)(start + batchsize);
-    const Tensor bx = CopyRows(x, start, end);
-    const Tensor by = CopyRows(y, start, end);
+    const Tensor bx = SliceRows(x, start, end);
+    const Tensor by = SliceRows(y, start, end);
     const auto ret = EvaluateOnBatch(bx, by);
     CopyDataToFrom(&loss, ret.first, batchsize, start, 0);
     CopyDataToFrom(&metric, ret.second, batchsize, start, 0);
   }
   {
     int start = (int)(x.shape(0) - batchsize), end = (int)x.shape(0);
-    const Tensor bx = CopyRows(x, start, end);
-    const Tensor by = CopyRows(y, start, end);
+    const Tensor bx = SliceRows(x, start, end);
+    const Tensor by = SliceRows(y, start, end);
     const auto ret = EvaluateOnBatch(bx, by);
-    int dst_offset = (int)(x.shape(0) - num_extra_samples);
-    int src_offset = (int)(batchsize - num_extra_samples);
+    size_t dst_offset = x.shape(0) - num_extra_samples;
+    size_t src_offset = batchsize - num_extra_samples;
     CopyDataToFrom(&loss, ret.first, num_extra_samples, dst_offset, src_offset);
     CopyDataToFrom(&metric, ret.second, num_extra_samples, dst_offset,
                    src_offset);
@@ -282,13 +282,13 @@ const Tensor FeedForwardNet::Predict(const Tensor& x, size_t batchsize) {
   Tensor y(Shape{x.shape(0), Product(outshape)}, x.device());
   for (size_t b = 0; b < x.shape(0) / batchsize; b++) {
     int start = (int)(b * batchsize), end = (int)(start + batchsize);
-    const Tensor bx = CopyRows(x, start, end);
+    const Tensor bx = SliceRows(x, start, end);
     CopyDataToFrom(&y, PredictOnBatch(bx), batchsize * y.shape(1),
                    start * y.shape(1), 0);
   }
   if (num_extra_samples > 0) {
     int start = (int)(x.shape(0) - batchsize), end = (int)(x.shape(0));
-    const Tensor bx = CopyRows(x, start, end);
+    const Tensor bx = SliceRows(x, start, end);
     CopyDataToFrom(&y, PredictOnBatch(bx), num_extra_samples * y.shape(1),
                    (x.shape(0) - num_extra_samples) * y.shape(1),
                    (batchsize - num_extra_samples) * y.shape(1));
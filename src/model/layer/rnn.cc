@@ -22,6 +22,43 @@
 #include "singa/utils/string.h"
 
 namespace singa {
+namespace {
+// Pad the inputs x1 ... xn, whose batch sizes are non-increasing, into one
+// tensor of shape {n, bs, dim}; lengths receives the number of steps of
+// every sequence.
+Tensor PadInputs(size_t num, size_t dim, const vector<Tensor> &in,
+                 Tensor *lengths) {
+  size_t batchsize = in.at(0).shape(0);
+  Tensor out(Shape{num, batchsize, dim}, in.at(0).device());
+  out.SetValue(0.0f);
+  vector<int> len(batchsize, 0);
+  for (size_t i = 0; i < num; i++) {
+    size_t bs = in.at(i).shape(0);
+    CHECK_LE(bs, i == 0 ? batchsize : in.at(i - 1).shape(0))
+        << "The batchsize of x" << i + 1 << " should be <= that of x" << i;
+    CHECK_EQ(in.at(i).Size(), bs * dim);
+    CopyDataToFrom(&out, in.at(i), in.at(i).Size(), i * batchsize * dim);
+    for (size_t b = 0; b < bs; b++) len[b]++;
+  }
+  *lengths = Tensor(Shape{batchsize}, in.at(0).device(), kInt);
+  lengths->CopyDataFromHostPtr(len.data(), batchsize);
+  return out;
+}
+
+// The reverse of PadInputs(); the batch sizes are taken from in.
+vector<Tensor> UnpadOutput(size_t num, size_t dim, const vector<Tensor> &in,
+                           const Tensor &output) {
+  vector<Tensor> outputs;
+  size_t batchsize = output.shape(1);
+  for (size_t i = 0; i < num; i++) {
+    Tensor out(Shape{in.at(i).shape(0), dim}, output.device());
+    CopyDataToFrom(&out, output, out.Size(), 0, i * batchsize * dim);
+    outputs.push_back(out);
+  }
+  return outputs;
+}
+}  // namespace
+
 RegisterLayerClass(singa_rnn, RNN);
 RegisterLayerClass(singacpp_rnn, RNN);
 RegisterLayerClass(singacuda_rnn, RNN);
@@ -75,29 +112,101 @@ void RNN::Setup(const Shape& in_sample, const LayerConf &conf) {
   size_t weight_size = 0;
   for (size_t i = 0; i < num_stacks_; i++) {
     size_t dim = hidden_size_ * (in_sample[0] +  hidden_size_ + 2);
-    if (i > 0)
-      dim = hidden_size_ * (hidden_size_ +  hidden_size_ + 2);
+    if (i > 0)  // the input is the output of all directions
+      dim = hidden_size_ * (hidden_size_ * num_directions_ + hidden_size_ + 2);
     weight_size += mult * dim;
   }
   weight_.Resize(Shape{weight_size});
 }
 
 const vector<Tensor> RNN::Forward(int flag, const vector<Tensor>& inputs) {
-  vector<Tensor> data_output;
-  LOG(FATAL) << "CPU RNN is not implemented!";
-  return data_output;
+  CHECK_EQ(inputs.at(0).device()->lang(), kCpp);
+  CHECK_EQ(input_mode_, "linear")
+      << "Only the 'linear' input mode is supported on CPU";
+  // hx (and cx) is at the end of inputs
+  CHECK_GT(inputs.size(), 1u + has_cell_);
+  size_t num_x = inputs.size() - has_cell_ - 1;
+  Tensor seq_lengths;
+  Tensor x = PadInputs(num_x, input_size_, inputs, &seq_lengths);
+  if (handle_ == nullptr) {
+    int mode = 3;  // gru
+    if (rnn_mode_ == "relu")
+      mode = 0;
+    else if (rnn_mode_ == "tanh")
+      mode = 1;
+    else if (rnn_mode_ == "lstm")
+      mode = 2;
+    handle_ = std::make_shared<CpuRNNHandle>(
+        x, hidden_size_, mode, num_stacks_, 1, dropout_, num_directions_ - 1);
+    CHECK_EQ(handle_->weights_size, weight_.Size());
+  }
+  Tensor hx = inputs.at(num_x), cx;
+  if (has_cell_) cx = inputs.at(num_x + 1);
+
+  vector<Tensor> out;
+  if (flag & kTrain) {
+    // a new reserve space, as the layer may be called several times before
+    // Backward()
+    handle_->reserve_space = Tensor();
+    out = CpuRNNForwardTrainingEx(x, hx, cx, weight_, seq_lengths, *handle_);
+    buf_.push(x);
+    buf_.push(out[0]);
+    buf_.push(hx);
+    buf_.push(cx);
+    buf_.push(seq_lengths);
+    buf_.push(handle_->reserve_space);
+  } else {
+    out = CpuRNNForwardInferenceEx(x, hx, cx, weight_, seq_lengths, *handle_);
+  }
+  auto outputs =
+      UnpadOutput(num_x, hidden_size_ * num_directions_, inputs, out[0]);
+  outputs.push_back(out[1]);
+  if (has_cell_) outputs.push_back(out[2]);
+  return outputs;
 }
 
 const std::pair<vector<Tensor>, vector<Tensor>> RNN::Backward(int flag,
     const vector<Tensor>& grads) {
-  vector<Tensor> param_grad;
-  vector<Tensor> data_grad;
-  LOG(FATAL) << "CPU RNN is not implemented!";
+  CHECK(handle_ != nullptr) << "Forward() must be called before Backward()";
+  handle_->reserve_space = buf_.top();
+  buf_.pop();
+  const Tensor seq_lengths = buf_.top();
+  buf_.pop();
+  const Tensor cx = buf_.top();
+  buf_.pop();
+  const Tensor hx = buf_.top();
+  buf_.pop();
+  const Tensor y = buf_.top();
+  buf_.pop();
+  const Tensor x = buf_.top();
+  buf_.pop();
+  handle_->seq_length = x.shape(0);
+  handle_->batch_size = x.shape(1);
+
+  // dhy (and dcy) is at last
+  CHECK_GT(grads.size(), 1u + has_cell_);
+  size_t num_dy = grads.size() - has_cell_ - 1;
+  CHECK_EQ(num_dy, x.shape(0));
+  Tensor dy_lengths;
+  Tensor dy = PadInputs(num_dy, hidden_size_ * num_directions_, grads,
+                        &dy_lengths);
+  Tensor dhy = grads.at(num_dy), dcy;
+  if (has_cell_) dcy = grads.at(num_dy + 1);
+
+  auto dxs = CpuRNNBackwardxEx(y, dy, dhy, dcy, weight_, hx, cx, seq_lengths,
+                               *handle_);
+  Tensor dw = CpuRNNBackwardWEx(x, hx, y, seq_lengths, *handle_);
+
+  vector<Tensor> param_grad{dw};
+  auto data_grad = UnpadOutput(num_dy, input_size_, grads, dxs[0]);
+  data_grad.push_back(dxs[1]);
+  if (has_cell_) data_grad.push_back(dxs[2]);
   return std::make_pair(data_grad, param_grad);
 }
 
 void RNN::ToDevice(std::shared_ptr<Device> device) {
   Layer::ToDevice(device);
   weight_.ToDevice(device);
+  handle_ = nullptr;
 }
 }  /* singa */
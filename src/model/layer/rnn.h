@@ -24,6 +24,7 @@
 #include <stack>
 
 #include "singa/model/layer.h"
+#include "../operation/rnn.h"
 
 namespace singa {
 /// To enable use the same layer multiple times in one iteration in RNN,
@@ -55,6 +56,8 @@ class RNN : public Layer {
   /// lstm.
   const vector<Tensor> Forward(int flag, const vector<Tensor>& inputs) override;
 
+  /// On lang::Cpp devices the steps are run by CpuRNNHandle; only the
+  /// 'linear' input mode is supported there.
   /// The grads vector includes <dy1, dy2, ... dyn, dhy, dcy>, the symbols are
   /// similar to those for Forward. dcy is missing for gru/relu/tanh RNNs and is
   /// valid for lstm.
@@ -91,6 +94,8 @@ class RNN : public Layer {
   float dropout_ = 0.0f;
   string input_mode_, direction_, rnn_mode_;
   Tensor weight_;
+  /// created by the first Forward() on lang::Cpp devices
+  std::shared_ptr<CpuRNNHandle> handle_;
 };
 }  // namespace singa
 #endif  // SRC_MODEL_LAYER_RNN_H_
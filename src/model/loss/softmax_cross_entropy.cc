@@ -30,6 +30,17 @@ Tensor SoftmaxCrossEntropy::Forward(int flag, const Tensor& prediction,
     batchsize = prediction.shape(0);
   size_t dim = prediction.Size() / batchsize;
   const Tensor& input = Reshape(prediction, Shape{batchsize, dim});
+  if (input.device()->lang() == kCpp && target.data_type() == kInt) {
+    // fused kernels; only the log-sum-exp of each row is buffered
+    Tensor lse;
+    Tensor loss = SoftmaxCrossEntropyFwd(input, target, &lse);
+    if (flag & kTrain) {
+      buf_.push(input);
+      buf_.push(lse);
+      buf_.push(target);
+    }
+    return loss;
+  }
   Tensor prob = SoftMax(input);
   // LOG(INFO) << "prob: " << prob.L2();
 
@@ -50,6 +61,12 @@ Tensor SoftmaxCrossEntropy::Backward() {
   buf_.pop();
   Tensor prob = buf_.top();
   buf_.pop();
+  if (prob.device()->lang() == kCpp && target.data_type() == kInt) {
+    // 'prob' is the log-sum-exp of the fused forward pass
+    Tensor input = buf_.top();
+    buf_.pop();
+    return SoftmaxCrossEntropyBwd(input, target, prob);
+  }
   SoftmaxCrossEntropyBwd(target, &prob);
   return prob;
 }
@@ -20,10 +20,30 @@
  ************************************************************/
 #include "batchnorm.h"
 
+#include <algorithm>
 #include <cctype>
+#include <cmath>
+
+#include "singa/utils/thread_pool.h"
 
 namespace singa {
 
+#ifndef USE_DNNL
+namespace {
+// Run fn(c_begin, c_end) over ranges of channels in parallel. The data of
+// channel c of sample n is x[(n * channels + c) * spatial + i] for i in
+// [0, spatial); iterating n, c, i in this order keeps the accesses
+// contiguous for both 2d (spatial = 1) and 4d inputs.
+void ParallelChannels(const BatchNormHandle &bnh, Context *ctx,
+                      const std::function<void(size_t, size_t)> &fn) {
+  size_t spatial = bnh.height * bnh.width;
+  // aim for at least 16K elements per thread
+  size_t grain = std::max<size_t>(1, 16384 / (bnh.batchsize * spatial));
+  ParallelFor(0, bnh.channels, grain, ctx->num_threads, fn);
+}
+}  // namespace
+#endif  // USE_DNNL
+
 BatchNormHandle::BatchNormHandle(const float momentum, const Tensor& input) {
   factor = momentum;
   batchsize = input.shape(0);
@@ -43,7 +63,6 @@ BatchNormHandle::BatchNormHandle(const float momentum, const Tensor& input) {
 #ifdef USE_DNNL
   if (input.device()->lang() == kCpp) {
     use_dnnl = true;
-    epsilon = 1e-5f;
     x_dims = dnnl::memory::dims(input.shape().begin(), input.shape().end());
 
     // support f32 only
@@ -255,6 +274,196 @@ const std::vector<Tensor> CpuBatchNormBackwardx(
   return {dx, dbnScale, dbnBias};
 }
 
+#else   // native cpp
+
+Tensor CpuBatchNormForwardInference(const BatchNormHandle& bnh, const Tensor& x,
+                                    const Tensor& bnScale, const Tensor& bnBias,
+                                    Tensor& running_mean, Tensor& running_var) {
+  CHECK_EQ(x.device()->lang(), kCpp);
+  CHECK_EQ(x.data_type(), kFloat32);
+  CHECK_EQ(x.Size(), bnh.batchsize * bnh.channels * bnh.height * bnh.width);
+  Tensor y;
+  y.ResetLike(x);
+  Tensor rm = running_mean, rv = running_var;
+
+  y.device()->Exec(
+      [y, x, bnScale, bnBias, rm, rv, &bnh](Context* ctx) mutable {
+        const float* xptr = static_cast<const float*>(x.block()->data());
+        const float* sptr = static_cast<const float*>(bnScale.block()->data());
+        const float* bptr = static_cast<const float*>(bnBias.block()->data());
+        const float* mptr = static_cast<const float*>(rm.block()->data());
+        const float* vptr = static_cast<const float*>(rv.block()->data());
+        float* yptr = static_cast<float*>(y.block()->mutable_data());
+        const size_t C = bnh.channels, S = bnh.height * bnh.width;
+        ParallelChannels(bnh, ctx, [&](size_t c0, size_t c1) {
+          // y = x * a + b per channel
+          std::vector<float> a(c1 - c0), b(c1 - c0);
+          for (size_t c = c0; c < c1; c++) {
+            a[c - c0] = sptr[c] / std::sqrt(vptr[c] + bnh.epsilon);
+            b[c - c0] = bptr[c] - mptr[c] * a[c - c0];
+          }
+          for (size_t n = 0; n < bnh.batchsize; n++)
+            for (size_t c = c0; c < c1; c++) {
+              const float* xi = xptr + (n * C + c) * S;
+              float* yi = yptr + (n * C + c) * S;
+              const float ac = a[c - c0], bc = b[c - c0];
+              for (size_t i = 0; i < S; i++) yi[i] = xi[i] * ac + bc;
+            }
+        });
+      },
+      {x.block(), bnScale.block(), bnBias.block(), rm.block(), rv.block()},
+      {y.block()}, "CpuBatchNormForwardInference");
+
+  return y;
+}
+
+const std::vector<Tensor> CpuBatchNormForwardTraining(
+    const BatchNormHandle& bnh, const Tensor& x, const Tensor& bnScale,
+    const Tensor& bnBias, Tensor& running_mean, Tensor& running_var) {
+  CHECK_EQ(x.device()->lang(), kCpp);
+  CHECK_EQ(x.data_type(), kFloat32);
+  CHECK_EQ(x.Size(), bnh.batchsize * bnh.channels * bnh.height * bnh.width);
+  Tensor y;
+  y.ResetLike(x);
+
+  // mean and (biased) var for local batch
+  Tensor mean;
+  mean.ResetLike(running_mean);
+  Tensor var;
+  var.ResetLike(running_var);
+  Tensor rm = running_mean, rv = running_var;
+
+  y.device()->Exec(
+      [y, mean, var, x, bnScale, bnBias, rm, rv, &bnh](Context* ctx) mutable {
+        const float* xptr = static_cast<const float*>(x.block()->data());
+        const float* sptr = static_cast<const float*>(bnScale.block()->data());
+        const float* bptr = static_cast<const float*>(bnBias.block()->data());
+        float* yptr = static_cast<float*>(y.block()->mutable_data());
+        float* mptr = static_cast<float*>(mean.block()->mutable_data());
+        float* vptr = static_cast<float*>(var.block()->mutable_data());
+        float* rmptr = static_cast<float*>(rm.block()->mutable_data());
+        float* rvptr = static_cast<float*>(rv.block()->mutable_data());
+        const size_t C = bnh.channels, S = bnh.height * bnh.width;
+        const float m = static_cast<float>(bnh.batchsize * S);
+        ParallelChannels(bnh, ctx, [&](size_t c0, size_t c1) {
+          // two passes (mean, then squared deviations) for stability
+          std::fill(mptr + c0, mptr + c1, 0.f);
+          std::fill(vptr + c0, vptr + c1, 0.f);
+          for (size_t n = 0; n < bnh.batchsize; n++)
+            for (size_t c = c0; c < c1; c++) {
+              const float* xi = xptr + (n * C + c) * S;
+              float sum = 0.f;
+              for (size_t i = 0; i < S; i++) sum += xi[i];
+              mptr[c] += sum;
+            }
+          for (size_t c = c0; c < c1; c++) mptr[c] /= m;
+          for (size_t n = 0; n < bnh.batchsize; n++)
+            for (size_t c = c0; c < c1; c++) {
+              const float* xi = xptr + (n * C + c) * S;
+              const float mc = mptr[c];
+              float sum = 0.f;
+              for (size_t i = 0; i < S; i++) sum += (xi[i] - mc) * (xi[i] - mc);
+              vptr[c] += sum;
+            }
+          std::vector<float> a(c1 - c0), b(c1 - c0);
+          for (size_t c = c0; c < c1; c++) {
+            vptr[c] /= m;
+            a[c - c0] = sptr[c] / std::sqrt(vptr[c] + bnh.epsilon);
+            b[c - c0] = bptr[c] - mptr[c] * a[c - c0];
+            // the running var is unbiased, see
+            // https://arxiv.org/pdf/1502.03167.pdf
+            rmptr[c] = rmptr[c] * (1 - bnh.factor) + mptr[c] * bnh.factor;
+            rvptr[c] = rvptr[c] * (1 - bnh.factor) +
+                       vptr[c] * (m / std::max(m - 1, 1.f)) * bnh.factor;
+          }
+          for (size_t n = 0; n < bnh.batchsize; n++)
+            for (size_t c = c0; c < c1; c++) {
+              const float* xi = xptr + (n * C + c) * S;
+              float* yi = yptr + (n * C + c) * S;
+              const float ac = a[c - c0], bc = b[c - c0];
+              for (size_t i = 0; i < S; i++) yi[i] = xi[i] * ac + bc;
+            }
+        });
+      },
+      {x.block(), bnScale.block(), bnBias.block(), rm.block(), rv.block()},
+      {y.block(), rm.block(), rv.block(), mean.block(), var.block()},
+      "CpuBatchNormForwardTraining");
+
+  return {y, mean, var};
+}
+
+const std::vector<Tensor> CpuBatchNormBackwardx(
+    const BatchNormHandle& bnh, const Tensor& y, const Tensor& dy,
+    const Tensor& x, const Tensor& bnScale, const Tensor& bnBias,
+    const Tensor& mean, const Tensor& var) {
+  CHECK_EQ(x.device()->lang(), kCpp);
+  CHECK_EQ(dy.device()->lang(), kCpp);
+  CHECK_EQ(mean.device()->lang(), kCpp);
+  CHECK_EQ(var.device()->lang(), kCpp);
+  CHECK_EQ(bnScale.device()->lang(), kCpp);
+  CHECK_EQ(dy.Size(), x.Size());
+
+  Tensor dx;
+  dx.ResetLike(dy);
+  Tensor dbnScale;
+  dbnScale.ResetLike(bnScale);
+  Tensor dbnBias;
+  dbnBias.ResetLike(bnBias);
+
+  dx.device()->Exec(
+      [dx, dbnScale, dbnBias, dy, x, bnScale, mean, var,
+       &bnh](Context* ctx) mutable {
+        const float* xptr = static_cast<const float*>(x.block()->data());
+        const float* dyptr = static_cast<const float*>(dy.block()->data());
+        const float* sptr = static_cast<const float*>(bnScale.block()->data());
+        const float* mptr = static_cast<const float*>(mean.block()->data());
+        const float* vptr = static_cast<const float*>(var.block()->data());
+        float* dxptr = static_cast<float*>(dx.block()->mutable_data());
+        float* dsptr = static_cast<float*>(dbnScale.block()->mutable_data());
+        float* dbptr = static_cast<float*>(dbnBias.block()->mutable_data());
+        const size_t C = bnh.channels, S = bnh.height * bnh.width;
+        const float m = static_cast<float>(bnh.batchsize * S);
+        ParallelChannels(bnh, ctx, [&](size_t c0, size_t c1) {
+          std::vector<float> istd(c1 - c0);
+          for (size_t c = c0; c < c1; c++)
+            istd[c - c0] = 1.f / std::sqrt(vptr[c] + bnh.epsilon);
+          // dbias = sum(dy), dscale = sum(dy * xhat)
+          std::fill(dsptr + c0, dsptr + c1, 0.f);
+          std::fill(dbptr + c0, dbptr + c1, 0.f);
+          for (size_t n = 0; n < bnh.batchsize; n++)
+            for (size_t c = c0; c < c1; c++) {
+              const float* xi = xptr + (n * C + c) * S;
+              const float* dyi = dyptr + (n * C + c) * S;
+              const float mc = mptr[c];
+              float sdy = 0.f, sdyx = 0.f;
+              for (size_t i = 0; i < S; i++) {
+                sdy += dyi[i];
+                sdyx += dyi[i] * (xi[i] - mc);
+              }
+              dbptr[c] += sdy;
+              dsptr[c] += sdyx;
+            }
+          for (size_t c = c0; c < c1; c++) dsptr[c] *= istd[c - c0];
+          // dx = scale * istd * (dy - dbias / m - xhat * dscale / m)
+          for (size_t n = 0; n < bnh.batchsize; n++)
+            for (size_t c = c0; c < c1; c++) {
+              const float* xi = xptr + (n * C + c) * S;
+              const float* dyi = dyptr + (n * C + c) * S;
+              float* dxi = dxptr + (n * C + c) * S;
+              const float is = istd[c - c0], k = sptr[c] * is;
+              const float db = dbptr[c] / m, ds = dsptr[c] * is / m,
+                          mc = mptr[c];
+              for (size_t i = 0; i < S; i++)
+                dxi[i] = k * (dyi[i] - db - (xi[i] - mc) * ds);
+            }
+        });
+      },
+      {x.block(), dy.block(), bnScale.block(), mean.block(), var.block()},
+      {dx.block(), dbnScale.block(), dbnBias.block()}, "CpuBatchNormBackwardx");
+
+  return {dx, dbnScale, dbnBias};
+}
+
 #endif  // USE_DNNL
 
 #ifdef USE_CUDNN
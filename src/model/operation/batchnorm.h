@@ -52,6 +52,7 @@ class BatchNormHandle {
   ~BatchNormHandle();
 
   float factor;
+  float epsilon = 1e-5f;
 
   size_t batchsize;
   size_t channels;
@@ -63,7 +64,6 @@ class BatchNormHandle {
       false;  // useful flag if both USE_CUDNN and USE_DNNL are enabled
 
 #ifdef USE_DNNL
-  float epsilon;
   dnnl::memory::dims x_dims;
   dnnl::memory::desc x_md;
   // as no default constructor, we need to declare it as pointer
@@ -72,7 +72,6 @@ class BatchNormHandle {
 #endif  // USE_DNNL
 };
 
-#ifdef USE_DNNL
 Tensor CpuBatchNormForwardInference(const BatchNormHandle &bnh, const Tensor &x,
                                     const Tensor &bnScale, const Tensor &bnBias,
                                     Tensor &running_mean, Tensor &running_var);
@@ -85,7 +84,6 @@ const std::vector<Tensor> CpuBatchNormBackwardx(
     const BatchNormHandle &bnh, const Tensor &y, const Tensor &dy,
     const Tensor &x, const Tensor &bnScale, const Tensor &bnBias,
     const Tensor &mean, const Tensor &var);
-#endif  // USE_DNNL
 
 #ifdef USE_CUDNN
 
@@ -22,10 +22,83 @@
 
 #include "convolution.h"
 
+#include <algorithm>
 #include <cctype>
 
+#include "../../core/tensor/math_kernel_cpp.h"
+#include "singa/utils/thread_pool.h"
+
 namespace singa {
 
+#ifndef USE_DNNL
+namespace {
+// 1x1 kernel with stride 1 and no padding, where the col matrix is the image
+bool IsPointwise(const ConvHandle &ch) {
+  return ch.kernel_h == 1 && ch.kernel_w == 1 && ch.stride_h == 1 &&
+         ch.stride_w == 1 && ch.pad_h == 0 && ch.pad_w == 0;
+}
+
+// unfold a channels x height x width image into a
+// (channels * kernel_h * kernel_w) x (conv_height * conv_width) matrix
+void Im2col(const float *im, const ConvHandle &ch, float *col) {
+  const long height = ch.height, width = ch.width;
+  for (size_t r = 0; r < ch.col_height; r++) {
+    const size_t kw = r % ch.kernel_w, kh = (r / ch.kernel_w) % ch.kernel_h;
+    const float *src = im + r / (ch.kernel_w * ch.kernel_h) * height * width;
+    for (size_t oh = 0; oh < ch.conv_height; oh++, col += ch.conv_width) {
+      long ih = (long)(oh * ch.stride_h + kh) - (long)ch.pad_h;
+      if (ih < 0 || ih >= height) {
+        std::fill(col, col + ch.conv_width, 0.f);
+        continue;
+      }
+      const float *row = src + ih * width;
+      for (size_t ow = 0; ow < ch.conv_width; ow++) {
+        long iw = (long)(ow * ch.stride_w + kw) - (long)ch.pad_w;
+        col[ow] = (iw >= 0 && iw < width) ? row[iw] : 0.f;
+      }
+    }
+  }
+}
+
+// the adjoint of Im2col, i.e., sum the columns back into the image
+void Col2im(const float *col, const ConvHandle &ch, float *im) {
+  const long height = ch.height, width = ch.width;
+  std::fill(im, im + ch.imagesize, 0.f);
+  for (size_t r = 0; r < ch.col_height; r++) {
+    const size_t kw = r % ch.kernel_w, kh = (r / ch.kernel_w) % ch.kernel_h;
+    float *dst = im + r / (ch.kernel_w * ch.kernel_h) * height * width;
+    for (size_t oh = 0; oh < ch.conv_height; oh++, col += ch.conv_width) {
+      long ih = (long)(oh * ch.stride_h + kh) - (long)ch.pad_h;
+      if (ih < 0 || ih >= height) continue;
+      float *row = dst + ih * width;
+      for (size_t ow = 0; ow < ch.conv_width; ow++) {
+        long iw = (long)(ow * ch.stride_w + kw) - (long)ch.pad_w;
+        if (iw >= 0 && iw < width) row[iw] += col[ow];
+      }
+    }
+  }
+}
+
+// Split the batch into one contiguous range of samples per col_buffer slice
+// and run fn(slice, sample) for every sample in parallel.
+void ForEachSample(const ConvHandle &ch, Context *ctx,
+                   const std::function<void(size_t, size_t)> &fn) {
+  size_t col_size = ch.col_height * ch.col_width;
+  size_t nslices =
+      IsPointwise(ch) ? ch.batchsize : ch.col_buffer.Size() / col_size;
+  size_t nthreads = std::min(
+      {nslices, ch.batchsize, static_cast<size_t>(ctx->num_threads)});
+  nthreads = std::max<size_t>(nthreads, 1);
+  ParallelFor(0, nthreads, 1, nthreads, [&](size_t begin, size_t end) {
+    for (size_t t = begin; t < end; t++)
+      for (size_t n = t * ch.batchsize / nthreads;
+           n < (t + 1) * ch.batchsize / nthreads; n++)
+        fn(t, n);
+  });
+}
+}  // namespace
+#endif  // USE_DNNL
+
 ConvHandle::ConvHandle(const Tensor &input,
                        const std::vector<size_t> &kernel_size,
                        const std::vector<size_t> &stride,
@@ -62,6 +135,11 @@ ConvHandle::ConvHandle(const Tensor &input,
   col_width = conv_height * conv_width;
   imagesize = input.Size() / batchsize;
 
+  CHECK_EQ(in_channels % groups, 0u)
+      << "in_channels should be divisible by groups";
+  CHECK_EQ(out_channels % groups, 0u)
+      << "out_channels should be divisible by groups";
+
 #ifdef USE_DNNL
   if (input.device()->lang() == kCpp) {
     use_dnnl = true;
@@ -82,6 +160,15 @@ ConvHandle::ConvHandle(const Tensor &input,
     // singa api
     db = new Tensor(Shape{num_filters}, input.device(), input.data_type());
   }
+#else   // native cpp
+  bool pointwise = kernel_h == 1 && kernel_w == 1 && stride_h == 1 &&
+                   stride_w == 1 && pad_h == 0 && pad_w == 0;
+  if (input.device()->lang() == kCpp && !pointwise) {
+    size_t nslices = std::min<size_t>(
+        batchsize, std::max(input.device()->context(0)->num_threads, 1));
+    col_buffer = Tensor(Shape{nslices * col_height * col_width},
+                        input.device(), input.data_type());
+  }
 #endif  // USE_DNNL
 }
 
@@ -101,8 +188,9 @@ Tensor CpuConvForward(const Tensor &x, Tensor &W, Tensor &b,
         x.shape(3) == ch.width)
       << "input sample shape should not change";
 
-  CHECK(W.shape(0) == ch.num_filters && W.shape(1) == ch.channels &&
-        W.shape(2) == ch.kernel_h && W.shape(3) == ch.kernel_w)
+  CHECK(W.shape(0) == ch.num_filters &&
+        W.shape(1) == ch.channels / ch.group && W.shape(2) == ch.kernel_h &&
+        W.shape(3) == ch.kernel_w)
       << "weights shape should not change";
 
 #ifdef USE_DNNL
@@ -188,39 +276,48 @@ Tensor CpuConvForward(const Tensor &x, Tensor &W, Tensor &b,
       {x.block(), W.block(), b.block()}, {output.block()}, "CpuConvForward");
 
   return output;
-#else   // cpp naive, error due to Im2col importing
-/*
-  Shape w_shape = W.shape();
-  Shape b_shape;
-  if (ch.bias_term) b_shape = b.shape();
-
-  W.Reshape(Shape{ch.num_filters, ch.col_height});
-  if (ch.bias_term) b.Reshape(Shape{ch.num_filters});
-
-  DataType dtype = x.data_type();
-  auto dev = x.device();
+#else   // native cpp
+  CHECK_EQ(x.data_type(), kFloat32);
   Shape shape{ch.batchsize, ch.num_filters, ch.conv_height, ch.conv_width};
-  Tensor output(shape, dev, dtype);
-  Tensor col_data(Shape{ch.col_height, ch.col_width});  // broadcasted image
-
-  float *data_col = new float[ch.col_height * ch.col_width];
-  auto in_data = x.data<float>();
-  for (size_t num = 0; num < ch.batchsize; num++) {
-    Im2col(in_data + num * ch.imagesize, ch.channels, ch.height, ch.width,
-           ch.kernel_h, ch.kernel_w, ch.pad_h, ch.pad_w, ch.stride_h,
-           ch.stride_w, data_col);
-
-    col_data.CopyDataFromHostPtr(data_col, ch.col_height * ch.col_width);
-    Tensor each = Mult(W, col_data);
-    if (ch.bias_term) {
-      AddColumn(b, &each);
-    }
-    CopyDataToFrom(&output, each, each.Size(), num * each.Size());
-  };
-  W.Reshape(w_shape);
-  if (ch.bias_term) b.Reshape(b_shape);
+  Tensor output(shape, x.device(), x.data_type());
+  Tensor col = ch.col_buffer;
+  std::vector<Block *> read_blocks{x.block(), W.block()};
+  if (ch.bias_term) read_blocks.push_back(b.block());
+  std::vector<Block *> write_blocks{output.block()};
+  if (col.block() != nullptr) write_blocks.push_back(col.block());
+
+  output.device()->Exec(
+      [output, x, W, b, col, &ch](Context *ctx) mutable {
+        const float *xptr = static_cast<const float *>(x.block()->data());
+        const float *wptr = static_cast<const float *>(W.block()->data());
+        const float *bptr =
+            ch.bias_term ? static_cast<const float *>(b.block()->data())
+                         : nullptr;
+        float *yptr = static_cast<float *>(output.block()->mutable_data());
+        float *colptr = IsPointwise(ch) ? nullptr
+                                        : static_cast<float *>(
+                                              col.block()->mutable_data());
+        // per group: y[Fg, HW] = W[Fg, Cg*k*k] * col[Cg*k*k, HW]
+        const size_t M = ch.num_filters / ch.group, N = ch.col_width,
+                     K = ch.col_height / ch.group;
+        ForEachSample(ch, ctx, [&](size_t t, size_t n) {
+          const float *cn = xptr + n * ch.imagesize;
+          if (colptr != nullptr) {
+            float *buf = colptr + t * ch.col_height * ch.col_width;
+            Im2col(cn, ch, buf);
+            cn = buf;
+          }
+          float *yn = yptr + n * ch.num_filters * N;
+          for (size_t g = 0; g < ch.group; g++)
+            cpp::gemm(false, false, M, N, K, 1.0f, wptr + g * M * K, K,
+                      cn + g * K * N, N, 0.0f, yn + g * M * N, N);
+          if (bptr != nullptr)
+            for (size_t f = 0; f < ch.num_filters; f++)
+              for (size_t i = 0; i < N; i++) yn[f * N + i] += bptr[f];
+        });
+      },
+      read_blocks, write_blocks, "CpuConvForward");
   return output;
-*/
 #endif  // USE_DNNL
 }
 
@@ -234,8 +331,9 @@ Tensor CpuConvBackwardx(const Tensor &dy, Tensor &W, const Tensor &x,
         dy.shape(3) == ch.conv_width)
       << "input gradients shape should not change";
 
-  CHECK(W.shape(0) == ch.num_filters && W.shape(1) == ch.channels &&
-        W.shape(2) == ch.kernel_h && W.shape(3) == ch.kernel_w)
+  CHECK(W.shape(0) == ch.num_filters &&
+        W.shape(1) == ch.channels / ch.group && W.shape(2) == ch.kernel_h &&
+        W.shape(3) == ch.kernel_w)
       << "weights shape should not change";
 
 #ifdef USE_DNNL
@@ -285,28 +383,39 @@ Tensor CpuConvBackwardx(const Tensor &dy, Tensor &W, const Tensor &x,
 
   return dx;
 
-#else   // NOT USE_DNNL
-/*  // error due to importing Col2im
-  Shape w_shape = W.shape();
-  W.Reshape(Shape{ch.num_filters, ch.col_height});
-
+#else   // native cpp
+  CHECK_EQ(dy.data_type(), kFloat32);
   Tensor dx;
   dx.ResetLike(x);
-
-  float *dx_b = new float[ch.imagesize];
-
-  for (size_t num = 0; num < ch.batchsize; num++) {
-    Tensor grad_b(Shape{ch.num_filters, ch.conv_height * ch.conv_width});
-    CopyDataToFrom(&grad_b, dy, grad_b.Size(), 0, num * grad_b.Size());
-    Tensor dcol_b = Mult(Transpose(W), grad_b);
-    auto dcol_data = dcol_b.data<float>();
-    Col2im(dcol_data, ch.channels, ch.height, ch.width, ch.kernel_h,
-           ch.kernel_w, ch.pad_h, ch.pad_w, ch.stride_h, ch.stride_w, dx_b);
-    dx.CopyDataFromHostPtr(dx_b, ch.imagesize, num * ch.imagesize);
-  }
-  W.Reshape(w_shape);
+  Tensor col = ch.col_buffer;
+  std::vector<Block *> write_blocks{dx.block()};
+  if (col.block() != nullptr) write_blocks.push_back(col.block());
+
+  dx.device()->Exec(
+      [dx, dy, W, col, &ch](Context *ctx) mutable {
+        const float *dyptr = static_cast<const float *>(dy.block()->data());
+        const float *wptr = static_cast<const float *>(W.block()->data());
+        float *dxptr = static_cast<float *>(dx.block()->mutable_data());
+        float *colptr = IsPointwise(ch) ? nullptr
+                                        : static_cast<float *>(
+                                              col.block()->mutable_data());
+        // per group: dcol[Cg*k*k, HW] = W[Fg, Cg*k*k]^T * dy[Fg, HW]
+        const size_t M = ch.col_height / ch.group, N = ch.col_width,
+                     K = ch.num_filters / ch.group;
+        ForEachSample(ch, ctx, [&](size_t t, size_t n) {
+          float *dxn = dxptr + n * ch.imagesize;
+          float *dcol = colptr == nullptr
+                            ? dxn
+                            : colptr + t * ch.col_height * ch.col_width;
+          const float *dyn = dyptr + n * ch.num_filters * N;
+          for (size_t g = 0; g < ch.group; g++)
+            cpp::gemm(true, false, M, N, K, 1.0f, wptr + g * K * M, M,
+                      dyn + g * K * N, N, 0.0f, dcol + g * M * N, N);
+          if (colptr != nullptr) Col2im(dcol, ch, dxn);
+        });
+      },
+      {dy.block(), W.block()}, write_blocks, "CpuConvBackwardx");
   return dx;
-*/
 #endif  // USE_DNNL
 }
 
@@ -381,30 +490,48 @@ Tensor CpuConvBackwardW(const Tensor &dy, const Tensor &x, const Tensor &W,
 
   return dW;
 #else   // native cpp
-/* // error due to importing Im2col
+  CHECK_EQ(dy.data_type(), kFloat32);
   Tensor dW;
   dW.ResetLike(W);
-  dW.SetValue(0.0f);
-
-  Shape w_shape = W.shape();
-  dW.Reshape(Shape{ch.num_filters, ch.col_height});
-
-  Tensor col_data(Shape{ch.col_height, ch.col_width});  // broadcasted image
-
-  float *data_col = new float[ch.col_height * ch.col_width];
-  auto in_data = dy.data<float>();
-  for (size_t num = 0; num < ch.batchsize; num++) {
-    Im2col(in_data + num * ch.imagesize, ch.channels, ch.height, ch.width,
-           ch.kernel_h, ch.kernel_w, ch.pad_h, ch.pad_w, ch.stride_h,
-           ch.stride_w, data_col);
-    col_data.CopyDataFromHostPtr(data_col, ch.col_height * ch.col_width);
-    Tensor grad_b(Shape{ch.num_filters, ch.conv_height * ch.conv_width});
-    CopyDataToFrom(&grad_b, dy, grad_b.Size(), 0, num * grad_b.Size());
-    dW += Mult(grad_b, Transpose(col_data));
-  }
-  dW.Reshape(w_shape);
+  Tensor col = ch.col_buffer;
+  std::vector<Block *> write_blocks{dW.block()};
+  if (col.block() != nullptr) write_blocks.push_back(col.block());
+
+  dW.device()->Exec(
+      [dW, dy, x, col, &ch](Context *ctx) mutable {
+        const float *dyptr = static_cast<const float *>(dy.block()->data());
+        const float *xptr = static_cast<const float *>(x.block()->data());
+        float *dwptr = static_cast<float *>(dW.block()->mutable_data());
+        float *colptr = IsPointwise(ch) ? nullptr
+                                        : static_cast<float *>(
+                                              col.block()->mutable_data());
+        // per group: dW[Fg, Cg*k*k] += dy[Fg, HW] * col[Cg*k*k, HW]^T
+        const size_t M = ch.num_filters / ch.group,
+                     N = ch.col_height / ch.group, K = ch.col_width;
+        const size_t wsize = dW.Size();
+        // slice 0 accumulates into dW, the others into partial sums
+        std::vector<float> partial(
+            (std::min<size_t>(ch.batchsize, ctx->num_threads) - 1) * wsize,
+            0.f);
+        std::fill(dwptr, dwptr + wsize, 0.f);
+        ForEachSample(ch, ctx, [&](size_t t, size_t n) {
+          const float *cn = xptr + n * ch.imagesize;
+          if (colptr != nullptr) {
+            float *buf = colptr + t * ch.col_height * ch.col_width;
+            Im2col(cn, ch, buf);
+            cn = buf;
+          }
+          float *acc = t == 0 ? dwptr : partial.data() + (t - 1) * wsize;
+          const float *dyn = dyptr + n * ch.num_filters * K;
+          for (size_t g = 0; g < ch.group; g++)
+            cpp::gemm(false, true, M, N, K, 1.0f, dyn + g * M * K, K,
+                      cn + g * N * K, K, 1.0f, acc + g * M * N, N);
+        });
+        for (size_t p = 0; p < partial.size(); p += wsize)
+          for (size_t i = 0; i < wsize; i++) dwptr[i] += partial[p + i];
+      },
+      {dy.block(), x.block()}, write_blocks, "CpuConvBackwardW");
   return dW;
-*/
 #endif  // USE_DNNL
 }
 
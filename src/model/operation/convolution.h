@@ -76,6 +76,10 @@ class ConvHandle {
   bool use_dnnl =
       false;  // useful flag if both USE_CUDNN and USE_DNNL are enabled
 
+  // native cpp implementation: one col_height x col_width slice per thread,
+  // shared by the forward and backward functions of this handle
+  Tensor col_buffer;
+
 #ifdef USE_DNNL
   dnnl::memory::data_type dtype;
   dnnl::memory::dims b_dims;
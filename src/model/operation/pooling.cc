@@ -20,10 +20,109 @@
  ************************************************************/
 #include "pooling.h"
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
+
+#include "singa/utils/thread_pool.h"
 
 namespace singa {
 
+#ifndef USE_DNNL
+namespace {
+// number of (n, c) planes processed together by one thread
+const size_t kPlaneGrain = 4;
+
+// Output columns [begin, end) whose window column ow * stride_w + kw - pad_w
+// is inside the input.
+inline void ValidColumns(const PoolingHandle &ph, int kw, int *begin,
+                         int *end) {
+  int off = kw - ph.pad_w;
+  *begin = off >= 0 ? 0 : (-off + ph.stride_w - 1) / ph.stride_w;
+  *end = ph.width - off <= 0
+             ? 0
+             : std::min(ph.pooled_width,
+                        (ph.width - off + ph.stride_w - 1) / ph.stride_w);
+}
+
+// Max pooling over one input plane. The windows are scanned row by row and
+// the innermost loop runs over the output columns, which vectorizes.
+void MaxPoolPlane(const PoolingHandle &ph, const float *in, float *out,
+                  int *argmax) {
+  const size_t pw = ph.pooled_width;
+  for (int oh = 0; oh < ph.pooled_height; oh++) {
+    float *o = out + oh * pw;
+    int *a = argmax + oh * pw;
+    std::fill(o, o + pw, -std::numeric_limits<float>::infinity());
+    std::fill(a, a + pw, -1);
+    int hstart = oh * ph.stride_h - ph.pad_h;
+    for (int ih = std::max(hstart, 0);
+         ih < std::min(hstart + ph.kernel_h, ph.height); ih++) {
+      const float *row = in + ih * ph.width;
+      for (int kw = 0; kw < ph.kernel_w; kw++) {
+        int begin, end, off = kw - ph.pad_w;
+        ValidColumns(ph, kw, &begin, &end);
+        for (int ow = begin; ow < end; ow++) {
+          int iw = ow * ph.stride_w + off;
+          bool larger = row[iw] > o[ow] || a[ow] < 0;
+          o[ow] = larger ? row[iw] : o[ow];
+          a[ow] = larger ? ih * ph.width + iw : a[ow];
+        }
+      }
+    }
+  }
+}
+
+// Average pooling over one input plane; padded elements are excluded from the
+// count, following cudnn's and dnnl's exclude_padding convention.
+void AvgPoolPlane(const PoolingHandle &ph, const float *in, float *out) {
+  const size_t pw = ph.pooled_width;
+  for (int oh = 0; oh < ph.pooled_height; oh++) {
+    float *o = out + oh * pw;
+    std::fill(o, o + pw, 0.f);
+    int hstart = oh * ph.stride_h - ph.pad_h;
+    int h0 = std::max(hstart, 0);
+    int h1 = std::min(hstart + ph.kernel_h, ph.height);
+    for (int ih = h0; ih < h1; ih++) {
+      const float *row = in + ih * ph.width;
+      for (int kw = 0; kw < ph.kernel_w; kw++) {
+        int begin, end, off = kw - ph.pad_w;
+        ValidColumns(ph, kw, &begin, &end);
+        for (int ow = begin; ow < end; ow++)
+          o[ow] += row[ow * ph.stride_w + off];
+      }
+    }
+    for (int ow = 0; ow < ph.pooled_width; ow++) {
+      int wstart = ow * ph.stride_w - ph.pad_w;
+      int count = (h1 - h0) * (std::min(wstart + ph.kernel_w, ph.width) -
+                               std::max(wstart, 0));
+      o[ow] = count > 0 ? o[ow] / count : 0.f;
+    }
+  }
+}
+
+// the gradient of AvgPoolPlane; dx is zeroed first
+void AvgPoolPlaneBackward(const PoolingHandle &ph, const float *dy,
+                          float *dx) {
+  std::fill(dx, dx + ph.height * ph.width, 0.f);
+  for (int oh = 0; oh < ph.pooled_height; oh++) {
+    int hstart = oh * ph.stride_h - ph.pad_h;
+    int h0 = std::max(hstart, 0);
+    int h1 = std::min(hstart + ph.kernel_h, ph.height);
+    for (int ow = 0; ow < ph.pooled_width; ow++) {
+      int wstart = ow * ph.stride_w - ph.pad_w;
+      int w0 = std::max(wstart, 0),
+          w1 = std::min(wstart + ph.kernel_w, ph.width);
+      if (h1 <= h0 || w1 <= w0) continue;
+      float g = dy[oh * ph.pooled_width + ow] / ((h1 - h0) * (w1 - w0));
+      for (int ih = h0; ih < h1; ih++)
+        for (int iw = w0; iw < w1; iw++) dx[ih * ph.width + iw] += g;
+    }
+  }
+}
+}  // namespace
+#endif  // USE_DNNL
+
 PoolingHandle::PoolingHandle(const Tensor &input,
                              const std::vector<int> &kernel_size,
                              const std::vector<int> &stride,
@@ -85,6 +184,11 @@ PoolingHandle::PoolingHandle(const Tensor &input,
     auto ws_md = pool_fwd_pd.workspace_desc();
     ws_mem = dnnl::memory(ws_md, eng);
   }
+#else
+  if (input.device()->lang() == kCpp && is_max_pooling)
+    argmax = Tensor(Shape{static_cast<size_t>(batchsize * channels *
+                                              pooled_height * pooled_width)},
+                    input.device(), kInt);
 #endif  // USE_DNNL
 }
 
@@ -143,6 +247,92 @@ Tensor CpuPoolingBackward(const PoolingHandle &ph, const Tensor &grad,
 
   return in_grad;
 }
+
+#else   // native cpp
+
+Tensor CpuPoolingForward(const PoolingHandle &ph, const Tensor &x) {
+  CHECK_EQ(x.device()->lang(), kCpp);
+  CHECK_EQ(x.data_type(), kFloat32);
+  CHECK(x.shape(0) == static_cast<size_t>(ph.batchsize) &&
+        x.shape(1) == static_cast<size_t>(ph.channels) &&
+        x.shape(2) == static_cast<size_t>(ph.height) &&
+        x.shape(3) == static_cast<size_t>(ph.width))
+      << "input shape should not change";
+  Tensor y({(unsigned long)ph.batchsize, (unsigned long)ph.channels,
+            (unsigned long)ph.pooled_height, (unsigned long)ph.pooled_width},
+           x.device(), x.data_type());
+  Tensor argmax = ph.argmax;
+  std::vector<Block *> write_blocks{y.block()};
+  if (ph.is_max_pooling) write_blocks.push_back(argmax.block());
+
+  y.device()->Exec(
+      [y, x, argmax, &ph](Context *ctx) mutable {
+        const float *xptr = static_cast<const float *>(x.block()->data());
+        float *yptr = static_cast<float *>(y.block()->mutable_data());
+        int *aptr = ph.is_max_pooling
+                        ? static_cast<int *>(argmax.block()->mutable_data())
+                        : nullptr;
+        const size_t isize = ph.height * ph.width;
+        const size_t osize = ph.pooled_height * ph.pooled_width;
+        ParallelFor(0, ph.batchsize * ph.channels, kPlaneGrain,
+                    ctx->num_threads, [&](size_t begin, size_t end) {
+                      for (size_t i = begin; i < end; i++) {
+                        if (aptr != nullptr)
+                          MaxPoolPlane(ph, xptr + i * isize, yptr + i * osize,
+                                       aptr + i * osize);
+                        else
+                          AvgPoolPlane(ph, xptr + i * isize, yptr + i * osize);
+                      }
+                    });
+      },
+      {x.block()}, write_blocks, "CpuPoolingForward");
+
+  return y;
+}
+
+Tensor CpuPoolingBackward(const PoolingHandle &ph, const Tensor &grad,
+                          const Tensor &x, const Tensor &y) {
+  CHECK_EQ(x.device()->lang(), kCpp);
+  CHECK_EQ(grad.device()->lang(), kCpp);
+  CHECK_EQ(y.device()->lang(), kCpp);
+  CHECK_EQ(grad.Size(), y.Size());
+  Tensor in_grad;
+  in_grad.ResetLike(x);
+  Tensor argmax = ph.argmax;
+  std::vector<Block *> read_blocks{grad.block()};
+  if (ph.is_max_pooling) read_blocks.push_back(argmax.block());
+
+  in_grad.device()->Exec(
+      [in_grad, grad, argmax, &ph](Context *ctx) mutable {
+        const float *dyptr = static_cast<const float *>(grad.block()->data());
+        float *dxptr = static_cast<float *>(in_grad.block()->mutable_data());
+        const int *aptr =
+            ph.is_max_pooling
+                ? static_cast<const int *>(argmax.block()->data())
+                : nullptr;
+        const size_t isize = ph.height * ph.width;
+        const size_t osize = ph.pooled_height * ph.pooled_width;
+        ParallelFor(
+            0, ph.batchsize * ph.channels, kPlaneGrain, ctx->num_threads,
+            [&](size_t begin, size_t end) {
+              for (size_t i = begin; i < end; i++) {
+                float *dx = dxptr + i * isize;
+                const float *dy = dyptr + i * osize;
+                if (aptr == nullptr) {
+                  AvgPoolPlaneBackward(ph, dy, dx);
+                  continue;
+                }
+                std::fill(dx, dx + isize, 0.f);
+                const int *a = aptr + i * osize;
+                for (size_t j = 0; j < osize; j++)
+                  if (a[j] >= 0) dx[a[j]] += dy[j];
+              }
+            });
+      },
+      read_blocks, {in_grad.block()}, "CpuPoolingBackward");
+
+  return in_grad;
+}
 #endif  // USE_DNNL
 
 #ifdef USE_CUDNN
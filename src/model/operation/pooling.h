@@ -67,14 +67,16 @@ class PoolingHandle {
   dnnl::memory ws_mem;
   dnnl::pooling_forward::primitive_desc pool_fwd_pd;
   dnnl::pooling_backward::primitive_desc pool_bwd_pd;
+#else
+  // native cpp max pooling: int32 offset of the max element within its input
+  // plane for every output element, written by forward and read by backward
+  Tensor argmax;
 #endif  // USE_DNNL
 };
 
-#ifdef USE_DNNL
 Tensor CpuPoolingForward(const PoolingHandle &ph, const Tensor &x);
 Tensor CpuPoolingBackward(const PoolingHandle &ph, const Tensor &dy,
                           const Tensor &x, const Tensor &y);
-#endif  // USE_DNNL
 
 #ifdef USE_CUDNN
 class CudnnPoolingHandle : public PoolingHandle {
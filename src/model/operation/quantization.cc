@@ -0,0 +1,415 @@
+/*********************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ ************************************************************/
+#include "./quantization.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../../core/tensor/math_kernel_cpp.h"
+#include "singa/utils/thread_pool.h"
+
+namespace singa {
+
+namespace {
+// the minimum number of elements per thread of the element-wise loops
+const size_t kQuantGrain = 16384;
+
+void CheckParams(const QuantParams &params) {
+  CHECK(!params.scale.empty()) << "Empty quantization parameters";
+  CHECK_EQ(params.scale.size(), params.zero_point.size());
+  for (const float s : params.scale) CHECK_GT(s, 0.f);
+}
+
+// The size of the channel axis of 'shape' and the number of elements of one
+// channel block, i.e., the product of the dimensions after the axis.
+void ChannelDims(const Shape &shape, const QuantParams &params,
+                 size_t *channels, size_t *inner) {
+  *channels = 1;
+  *inner = Product(shape);
+  if (params.axis >= 0) {
+    CHECK_LT(static_cast<size_t>(params.axis), shape.size());
+    *channels = shape[params.axis];
+    *inner = Product(shape, params.axis + 1);
+  }
+  CHECK_EQ(params.scale.size(), *channels)
+      << "Expect one scale per channel of axis " << params.axis;
+}
+
+// Split [0, n) into chunks and call fn(begin, end, channel) for the runs of
+// each chunk that lie in a single channel.
+void ForEachRun(size_t n, size_t channels, size_t inner, int num_threads,
+                const std::function<void(size_t, size_t, size_t)> &fn) {
+  ParallelFor(0, n, kQuantGrain, num_threads, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end;) {
+      const size_t stop = std::min(end, (i / inner + 1) * inner);
+      fn(i, stop, i / inner % channels);
+      i = stop;
+    }
+  });
+}
+
+// the int8 version of Im2col() in convolution.cc, padded by 'pad'
+void Im2colInt8(const int8_t *im, const ConvHandle &ch, const int8_t pad,
+                int8_t *col) {
+  const long height = ch.height, width = ch.width;
+  for (size_t r = 0; r < ch.col_height; r++) {
+    const size_t kw = r % ch.kernel_w, kh = (r / ch.kernel_w) % ch.kernel_h;
+    const int8_t *src = im + r / (ch.kernel_w * ch.kernel_h) * height * width;
+    for (size_t oh = 0; oh < ch.conv_height; oh++, col += ch.conv_width) {
+      long ih = (long)(oh * ch.stride_h + kh) - (long)ch.pad_h;
+      if (ih < 0 || ih >= height) {
+        std::fill(col, col + ch.conv_width, pad);
+        continue;
+      }
+      const int8_t *row = src + ih * width;
+      for (size_t ow = 0; ow < ch.conv_width; ow++) {
+        long iw = (long)(ow * ch.stride_w + kw) - (long)ch.pad_w;
+        col[ow] = (iw >= 0 && iw < width) ? row[iw] : pad;
+      }
+    }
+  }
+}
+
+bool IsPointwiseConv(const ConvHandle &ch) {
+  return ch.kernel_h == 1 && ch.kernel_w == 1 && ch.stride_h == 1 &&
+         ch.stride_w == 1 && ch.pad_h == 0 && ch.pad_w == 0;
+}
+
+// the scale and zero point of output channel c
+float ScaleOf(const QuantParams &p, size_t c) {
+  return p.scale.size() == 1 ? p.scale[0] : p.scale[c];
+}
+int ZeroPointOf(const QuantParams &p, size_t c) {
+  return p.zero_point.size() == 1 ? p.zero_point[0] : p.zero_point[c];
+}
+bool HasZeroPoint(const QuantParams &p) {
+  for (const int z : p.zero_point)
+    if (z != 0) return true;
+  return false;
+}
+
+void CheckInt8(const Tensor &t) {
+  CHECK_EQ(t.data_type(), kChar) << "Expect an int8 (kChar) tensor";
+  CHECK_EQ(t.device()->lang(), kCpp) << "Int8 ops are only on CppCPU";
+  CHECK(t.is_contiguous() && !t.transpose());
+}
+}  // namespace
+
+QuantParams ChooseQuantParams(float min, float max, bool symmetric) {
+  CHECK_LE(min, max) << "Empty range";
+  min = std::min(min, 0.f);
+  max = std::max(max, 0.f);
+  QuantParams params;
+  if (symmetric) {
+    const float a = std::max(-min, max);
+    params.scale.push_back(a > 0.f ? a / 127.f : 1.f);
+    params.zero_point.push_back(0);
+  } else {
+    const float scale = max > min ? (max - min) / 255.f : 1.f;
+    // min maps onto -128, and 0 onto the zero point
+    const int zp = -128 + static_cast<int>(std::nearbyint(-min / scale));
+    params.scale.push_back(scale);
+    params.zero_point.push_back(std::min(std::max(zp, -128), 127));
+  }
+  return params;
+}
+
+QuantParams ChooseQuantParams(const std::vector<float> &min,
+                              const std::vector<float> &max, int axis,
+                              bool symmetric) {
+  CHECK_EQ(min.size(), max.size());
+  CHECK_GE(axis, 0);
+  QuantParams params;
+  params.axis = axis;
+  for (size_t c = 0; c < min.size(); c++) {
+    QuantParams p = ChooseQuantParams(min[c], max[c], symmetric);
+    params.scale.push_back(p.scale[0]);
+    params.zero_point.push_back(p.zero_point[0]);
+  }
+  return params;
+}
+
+QuantizedTensor Quantize(const Tensor &in, const QuantParams &params) {
+  CHECK_EQ(in.data_type(), kFloat32);
+  CHECK_EQ(in.device()->lang(), kCpp) << "Quantize is only on CppCPU";
+  CheckParams(params);
+  size_t channels, inner;
+  ChannelDims(in.shape(), params, &channels, &inner);
+  QuantizedTensor out{Tensor(in.shape(), in.device(), kChar), params};
+  if (in.Size() == 0) return out;
+  // strided inputs, e.g., transposed weights, are made contiguous first
+  Tensor x = in.is_contiguous() && !in.transpose() ? in : Contiguous(in);
+  Tensor y = out.data;
+  y.device()->Exec(
+      [x, y, params, channels, inner](Context *ctx) mutable {
+        const float *xptr = static_cast<const float *>(x.block()->data());
+        int8_t *yptr = static_cast<int8_t *>(y.block()->mutable_data());
+        ForEachRun(x.Size(), channels, inner, ctx->num_threads,
+                   [&](size_t begin, size_t end, size_t c) {
+                     cpp::quantize(end - begin, xptr + begin, params.scale[c],
+                                   params.zero_point[c], yptr + begin);
+                   });
+      },
+      {x.block()}, {y.block()}, "Quantize");
+  return out;
+}
+
+Tensor Dequantize(const QuantizedTensor &in) {
+  CheckInt8(in.data);
+  CheckParams(in.params);
+  size_t channels, inner;
+  ChannelDims(in.data.shape(), in.params, &channels, &inner);
+  Tensor y(in.data.shape(), in.data.device(), kFloat32);
+  if (y.Size() == 0) return y;
+  Tensor x = in.data;
+  const QuantParams params = in.params;
+  y.device()->Exec(
+      [x, y, params, channels, inner](Context *ctx) mutable {
+        const int8_t *xptr = static_cast<const int8_t *>(x.block()->data());
+        float *yptr = static_cast<float *>(y.block()->mutable_data());
+        ForEachRun(x.Size(), channels, inner, ctx->num_threads,
+                   [&](size_t begin, size_t end, size_t c) {
+                     cpp::dequantize(end - begin, xptr + begin,
+                                     params.scale[c], params.zero_point[c],
+                                     yptr + begin);
+                   });
+      },
+      {x.block()}, {y.block()}, "Dequantize");
+  return y;
+}
+
+Tensor MultInt8(const Tensor &A, const Tensor &B) {
+  CheckInt8(A);
+  CheckInt8(B);
+  CHECK_EQ(A.nDim(), 2u);
+  CHECK_EQ(B.nDim(), 2u);
+  CHECK_EQ(A.shape(1), B.shape(0)) << "Mismatched inner dimensions";
+  const size_t M = A.shape(0), K = A.shape(1), N = B.shape(1);
+  Tensor C(Shape{M, N}, A.device(), kInt);
+  if (C.Size() == 0) return C;
+  C.device()->Exec(
+      [A, B, C, M, N, K](Context *ctx) mutable {
+        const int8_t *aptr = static_cast<const int8_t *>(A.block()->data());
+        const int8_t *bptr = static_cast<const int8_t *>(B.block()->data());
+        int32_t *cptr = static_cast<int32_t *>(C.block()->mutable_data());
+        if (K == 0) {
+          std::fill(cptr, cptr + M * N, 0);
+          return;
+        }
+        // one contiguous block of rows per thread, which packs B once
+        const size_t grain = std::max<size_t>(1, kQuantGrain / (N * K));
+        ParallelFor(0, M, grain, ctx->num_threads, [&](size_t b, size_t e) {
+          cpp::gemm_s8(e - b, N, K, aptr + b * K, K, bptr, N, cptr + b * N,
+                       N);
+        });
+      },
+      {A.block(), B.block()}, {C.block()}, "MultInt8");
+  return C;
+}
+
+Tensor QuantizedDense(const QuantizedTensor &x, const QuantizedTensor &W,
+                      const Tensor &b) {
+  CheckInt8(x.data);
+  CheckInt8(W.data);
+  CheckParams(x.params);
+  CheckParams(W.params);
+  CHECK_EQ(x.data.nDim(), 2u);
+  CHECK_EQ(W.data.nDim(), 2u);
+  CHECK_EQ(x.params.scale.size(), 1u) << "Expect a per tensor x";
+  const size_t M = x.data.shape(0), K = x.data.shape(1), N = W.data.shape(1);
+  CHECK_EQ(W.data.shape(0), K) << "Mismatched inner dimensions";
+  CHECK(W.params.scale.size() == 1 ||
+        (W.params.axis == 1 && W.params.scale.size() == N))
+      << "Expect W per tensor or per output channel (axis 1)";
+  const bool bias = b.Size() > 0;
+  if (bias) {
+    CHECK_EQ(b.data_type(), kFloat32);
+    CHECK_EQ(b.Size(), N);
+  }
+
+  Tensor y(Shape{M, N}, x.data.device(), kFloat32);
+  if (y.Size() == 0) return y;
+  Tensor xd = x.data, wd = W.data;
+  const QuantParams xp = x.params, wp = W.params;
+  std::vector<Block *> read_blocks{xd.block(), wd.block()};
+  if (bias) read_blocks.push_back(b.block());
+  y.device()->Exec(
+      [xd, wd, b, y, xp, wp, bias, M, N, K](Context *ctx) mutable {
+        const int8_t *xptr = static_cast<const int8_t *>(xd.block()->data());
+        const int8_t *wptr = static_cast<const int8_t *>(wd.block()->data());
+        const float *bptr =
+            bias ? static_cast<const float *>(b.block()->data()) : nullptr;
+        float *yptr = static_cast<float *>(y.block()->mutable_data());
+        const int zx = xp.zero_point[0];
+        const bool zw = HasZeroPoint(wp);
+        // sum_k (x_ik - zx) (w_kj - zw_j) = acc_ij - zx * colsum_j
+        //     - zw_j * rowsum_i + K * zx * zw_j
+        std::vector<int32_t> colsum(N, 0);
+        for (size_t k = 0; k < K; k++)
+          for (size_t j = 0; j < N; j++) colsum[j] += wptr[k * N + j];
+        const size_t grain = std::max<size_t>(1, kQuantGrain / (N * K + 1));
+        ParallelFor(0, M, grain, ctx->num_threads, [&](size_t b, size_t e) {
+          std::vector<int32_t> acc((e - b) * N, 0);
+          if (K > 0)
+            cpp::gemm_s8(e - b, N, K, xptr + b * K, K, wptr, N, acc.data(),
+                         N);
+          for (size_t i = b; i < e; i++) {
+            int32_t rowsum = 0;
+            if (zw)
+              for (size_t k = 0; k < K; k++) rowsum += xptr[i * K + k];
+            const int32_t *a = acc.data() + (i - b) * N;
+            float *yi = yptr + i * N;
+            for (size_t j = 0; j < N; j++) {
+              const int32_t z = ZeroPointOf(wp, j);
+              const int32_t s =
+                  a[j] - zx * colsum[j] - z * rowsum + (int32_t)K * zx * z;
+              yi[j] = xp.scale[0] * ScaleOf(wp, j) * s;
+              if (bptr != nullptr) yi[j] += bptr[j];
+            }
+          }
+        });
+      },
+      read_blocks, {y.block()}, "QuantizedDense");
+  return y;
+}
+
+Tensor QuantizedConvForward(const QuantizedTensor &x,
+                            const QuantizedTensor &W, const Tensor &b,
+                            const ConvHandle &ch) {
+  CheckInt8(x.data);
+  CheckInt8(W.data);
+  CheckParams(x.params);
+  CheckParams(W.params);
+  CHECK_EQ(x.params.scale.size(), 1u) << "Expect a per tensor x";
+  CHECK_EQ(x.data.Size(), ch.batchsize * ch.imagesize);
+  CHECK_EQ(W.data.Size(), ch.num_filters * ch.col_height / ch.group);
+  CHECK(W.params.scale.size() == 1 ||
+        (W.params.axis == 0 && W.params.scale.size() == ch.num_filters))
+      << "Expect W per tensor or per filter (axis 0)";
+  const bool bias = ch.bias_term && b.Size() > 0;
+  if (bias) {
+    CHECK_EQ(b.data_type(), kFloat32);
+    CHECK_EQ(b.Size(), ch.num_filters);
+  }
+
+  Shape shape{ch.batchsize, ch.num_filters, ch.conv_height, ch.conv_width};
+  Tensor y(shape, x.data.device(), kFloat32);
+  if (y.Size() == 0) return y;
+  Tensor xd = x.data, wd = W.data;
+  const QuantParams xp = x.params, wp = W.params;
+  std::vector<Block *> read_blocks{xd.block(), wd.block()};
+  if (bias) read_blocks.push_back(b.block());
+  y.device()->Exec(
+      [xd, wd, b, y, xp, wp, bias, &ch](Context *ctx) mutable {
+        const int8_t *xptr = static_cast<const int8_t *>(xd.block()->data());
+        const int8_t *wptr = static_cast<const int8_t *>(wd.block()->data());
+        const float *bptr =
+            bias ? static_cast<const float *>(b.block()->data()) : nullptr;
+        float *yptr = static_cast<float *>(y.block()->mutable_data());
+        // per group: y[Fg, HW] = W[Fg, Cg*k*k] * col[Cg*k*k, HW]
+        const size_t M = ch.num_filters / ch.group, N = ch.col_width,
+                     K = ch.col_height / ch.group;
+        const int zx = xp.zero_point[0];
+        const bool zw = HasZeroPoint(wp);
+        std::vector<int32_t> rowsum(ch.num_filters, 0);
+        for (size_t f = 0; f < ch.num_filters; f++)
+          for (size_t k = 0; k < K; k++) rowsum[f] += wptr[f * K + k];
+        const bool pointwise = IsPointwiseConv(ch);
+        ParallelFor(
+            0, ch.batchsize, 1, ctx->num_threads, [&](size_t b, size_t e) {
+              std::vector<int8_t> col(pointwise ? 0 : ch.col_height * N);
+              std::vector<int32_t> acc(M * N), colsum(zw ? N : 0);
+              for (size_t n = b; n < e; n++) {
+                const int8_t *cn = xptr + n * ch.imagesize;
+                if (!pointwise) {
+                  Im2colInt8(cn, ch, static_cast<int8_t>(zx), col.data());
+                  cn = col.data();
+                }
+                float *yn = yptr + n * ch.num_filters * N;
+                for (size_t g = 0; g < ch.group; g++) {
+                  const int8_t *cg = cn + g * K * N;
+                  cpp::gemm_s8(M, N, K, wptr + g * M * K, K, cg, N,
+                               acc.data(), N);
+                  if (zw) {
+                    std::fill(colsum.begin(), colsum.end(), 0);
+                    for (size_t k = 0; k < K; k++)
+                      for (size_t i = 0; i < N; i++) colsum[i] += cg[k * N + i];
+                  }
+                  for (size_t m = 0; m < M; m++) {
+                    const size_t f = g * M + m;
+                    const int32_t z = ZeroPointOf(wp, f);
+                    const int32_t c = (int32_t)K * zx * z - zx * rowsum[f];
+                    const float s = xp.scale[0] * ScaleOf(wp, f);
+                    const float bf = bptr != nullptr ? bptr[f] : 0.f;
+                    const int32_t *a = acc.data() + m * N;
+                    float *yf = yn + f * N;
+                    for (size_t i = 0; i < N; i++) {
+                      const int32_t cs = zw ? z * colsum[i] : 0;
+                      yf[i] = s * (a[i] + c - cs) + bf;
+                    }
+                  }
+                }
+              }
+            });
+      },
+      read_blocks, {y.block()}, "QuantizedConvForward");
+  return y;
+}
+
+void RangeObserver::Observe(const Tensor &t) {
+  CHECK_EQ(t.data_type(), kFloat32);
+  if (t.Size() == 0) return;
+  Tensor lo = ReduceMin(t), hi = ReduceMax(t);
+  lo.ToHost();
+  hi.ToHost();
+  min_ = std::min(min_, lo.data<float>()[0]);
+  max_ = std::max(max_, hi.data<float>()[0]);
+}
+
+std::vector<RangeObserver> Calibrate(
+    const std::function<std::vector<Tensor>(const Tensor &)> &forward,
+    const std::vector<Tensor> &batches) {
+  std::vector<RangeObserver> observers;
+  for (const Tensor &batch : batches) {
+    const std::vector<Tensor> acts = forward(batch);
+    if (observers.empty()) observers.resize(acts.size());
+    CHECK_EQ(acts.size(), observers.size())
+        << "The number of activations differs across batches";
+    for (size_t i = 0; i < acts.size(); i++) observers[i].Observe(acts[i]);
+  }
+  return observers;
+}
+
+std::vector<RangeObserver> Calibrate(FeedForwardNet *net,
+                                     const std::vector<Tensor> &batches) {
+  CHECK(net != nullptr);
+  const auto &layers = net->layers();
+  return Calibrate(
+      [&layers](const Tensor &x) {
+        std::vector<Tensor> acts{x};
+        for (const auto &layer : layers)
+          acts.push_back(layer->Forward(kEval, acts.back()));
+        return acts;
+      },
+      batches);
+}
+
+}  // namespace singa
@@ -0,0 +1,111 @@
+/*********************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ ************************************************************/
+#ifndef SINGA_MODEL_OPERATION_QUANTIZATION_H_
+#define SINGA_MODEL_OPERATION_QUANTIZATION_H_
+
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "./convolution.h"
+#include "singa/core/tensor.h"
+#include "singa/model/feed_forward_net.h"
+
+namespace singa {
+
+/// The parameters of the int8 affine quantization x = scale * (q -
+/// zero_point). They are per tensor if 'axis' is -1 (one scale and one zero
+/// point), otherwise per channel along 'axis' (one of each per index of the
+/// axis), e.g., per output channel of the weights.
+struct QuantParams {
+  std::vector<float> scale;
+  std::vector<int> zero_point;
+  int axis = -1;
+};
+
+/// Parameters mapping [min, max] (extended to include 0, so that 0 is exact)
+/// onto [-128, 127]; symmetric parameters have zero point 0 and map
+/// [-a, a], with a = max(|min|, |max|), onto [-127, 127].
+QuantParams ChooseQuantParams(float min, float max, bool symmetric = false);
+/// Per channel parameters from the range of each channel.
+QuantParams ChooseQuantParams(const std::vector<float> &min,
+                              const std::vector<float> &max, int axis,
+                              bool symmetric = true);
+
+/// An int8 (kChar) tensor with its quantization parameters.
+struct QuantizedTensor {
+  Tensor data;
+  QuantParams params;
+};
+
+/// Quantize the float32 'in' on CppCPU; 'in' may be strided.
+QuantizedTensor Quantize(const Tensor &in, const QuantParams &params);
+/// The float32 values of 'in'.
+Tensor Dequantize(const QuantizedTensor &in);
+
+/// C = A * B for int8 (kChar) matrices, with the int32 (kInt) result.
+Tensor MultInt8(const Tensor &A, const Tensor &B);
+
+/// y = x * W + b in float32 from the int8 product of x (batch x in, per
+/// tensor) and W (in x out, per tensor or per output channel, i.e., axis
+/// 1). 'b' (float32) may be empty. The int32 accumulators are corrected for
+/// the zero points and scaled once per element.
+Tensor QuantizedDense(const QuantizedTensor &x, const QuantizedTensor &W,
+                      const Tensor &b);
+
+/// The convolution of CpuConvForward() from the int8 product of x (per
+/// tensor) and W (per tensor or per filter, i.e., axis 0). The padding is
+/// filled with the zero point of x, i.e., with 0 as in float32.
+Tensor QuantizedConvForward(const QuantizedTensor &x,
+                            const QuantizedTensor &W, const Tensor &b,
+                            const ConvHandle &ch);
+
+/// Track the range of float32 tensors, e.g., the activations of a layer
+/// over calibration batches.
+class RangeObserver {
+ public:
+  void Observe(const Tensor &t);
+  float min() const { return min_; }
+  float max() const { return max_; }
+  QuantParams Params(bool symmetric = false) const {
+    return ChooseQuantParams(min_, max_, symmetric);
+  }
+
+ private:
+  float min_ = std::numeric_limits<float>::max();
+  float max_ = std::numeric_limits<float>::lowest();
+};
+
+/// Post-training calibration: run 'forward' over the sample 'batches' and
+/// observe the activations it returns, which must come in the same order
+/// for every batch, e.g., the inputs of the layers to be quantized of an
+/// autograd model. Returns one observer per activation.
+std::vector<RangeObserver> Calibrate(
+    const std::function<std::vector<Tensor>(const Tensor &)> &forward,
+    const std::vector<Tensor> &batches);
+/// Observe the input of every layer of 'net' and the output of the last
+/// one, running the net in kEval mode.
+std::vector<RangeObserver> Calibrate(FeedForwardNet *net,
+                                     const std::vector<Tensor> &batches);
+
+}  // namespace singa
+
+#endif  // SINGA_MODEL_OPERATION_QUANTIZATION_H_
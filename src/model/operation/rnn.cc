@@ -21,7 +21,11 @@
 
 #include "rnn.h"
 
+#include <algorithm>
 #include <map>
+
+#include "../../core/tensor/math_kernel_cpp.h"
+#include "singa/utils/thread_pool.h"
 namespace singa {
 #ifdef USE_CUDNN
 CudnnRNNHandle::CudnnRNNHandle(const Tensor &x, const int hidden_size,
@@ -805,4 +809,668 @@ Tensor GpuRNNBackwardWEx(const Tensor &x, const Tensor &hx, const Tensor &y,
 }
 
 #endif  // USE_CUDNN
+
+namespace {
+// Sizes of one CpuRNN call. The activations of every (time step, sample)
+// are recorded in S floats: the gates, plus the cell state for lstm and the
+// recurrent projection of the new memory gate for gru.
+struct RNNDims {
+  size_t T, B, F, H, G, D, L, S;
+  int mode;
+  bool fast = false;
+  int num_threads = 1;
+  // length of every sequence
+  std::vector<int> len;
+
+  size_t GH() const { return G * H; }
+  size_t DH() const { return D * H; }
+  size_t TB() const { return T * B; }
+  size_t in_size(size_t l) const { return l == 0 ? F : D * H; }
+};
+
+RNNDims GetDims(const CpuRNNHandle &h) {
+  RNNDims d;
+  d.T = h.seq_length;
+  d.B = h.batch_size;
+  d.F = h.feature_size;
+  d.H = h.hidden_size;
+  d.G = h.gates;
+  d.D = h.bidirectional ? 2 : 1;
+  d.L = h.num_layers;
+  d.mode = h.mode;
+  d.S = d.G * d.H + (d.mode >= 2 ? d.H : 0);
+  return d;
+}
+
+// the runtime settings; called inside Exec()
+void SetRuntime(const Tensor &seq_lengths, Context *ctx, RNNDims *d) {
+  d->fast = ctx->math_accuracy == kMathLow;
+  d->num_threads = ctx->num_threads;
+  d->len.assign(d->B, static_cast<int>(d->T));
+  if (seq_lengths.Size() == 0) return;
+  CHECK_EQ(seq_lengths.Size(), d->B) << "one length per sequence is required";
+  for (size_t b = 0; b < d->B; b++) {
+    if (seq_lengths.data_type() == kInt)
+      d->len[b] = static_cast<const int *>(seq_lengths.block()->data())[b];
+    else
+      d->len[b] = static_cast<int>(
+          static_cast<const float *>(seq_lengths.block()->data())[b]);
+    CHECK(d->len[b] >= 0 && d->len[b] <= static_cast<int>(d->T))
+        << "sequence length " << d->len[b] << " is out of [0, " << d->T << "]";
+  }
+}
+
+// Reserve space: for every layer, the activations of each direction
+// (T * B * S each), followed by the layer output (T * B * D * H) except for
+// the last layer whose output is y.
+size_t ReserveSize(const RNNDims &d) {
+  return d.L * d.D * d.TB() * d.S + (d.L - 1) * d.TB() * d.DH();
+}
+size_t RecordOffset(const RNNDims &d, size_t l, size_t dir) {
+  return l * (d.D * d.TB() * d.S + d.TB() * d.DH()) + dir * d.TB() * d.S;
+}
+size_t OutputOffset(const RNNDims &d, size_t l) {
+  return RecordOffset(d, l, d.D);
+}
+
+// Workspace: the gradients w.r.t. the input projection and the recurrent
+// projection of every layer and direction, T * B * G * H each.
+size_t WorkspaceSize(const RNNDims &d) {
+  return d.L * d.D * 2 * d.TB() * d.GH();
+}
+size_t DgxOffset(const RNNDims &d, size_t l, size_t dir) {
+  return (l * d.D + dir) * 2 * d.TB() * d.GH();
+}
+size_t DghOffset(const RNNDims &d, size_t l, size_t dir) {
+  return DgxOffset(d, l, dir) + d.TB() * d.GH();
+}
+
+// offsets of the weights of one pseudo layer; the matrices (biases) of all
+// gates are contiguous
+struct LayerOffsets {
+  size_t W, R, bW, bR;
+};
+
+LayerOffsets GetOffsets(const CpuRNNHandle &h, size_t pseudo_layer) {
+  int p = static_cast<int>(pseudo_layer), g = static_cast<int>(h.gates);
+  auto offset = [&](int id, bool is_bias) {
+    return std::get<0>(h.weights_mapping.at(std::make_tuple(id, p, is_bias)));
+  };
+  return {offset(0, false), offset(g, false), offset(0, true),
+          offset(g, true)};
+}
+
+// One time step of one sample. gx is the input projection (with its bias),
+// gh the recurrent projection (without its bias). act receives the
+// activations (S floats) and h (c) is updated in place.
+void StepForward(const RNNDims &d, const float *gx, const float *gh,
+                 const float *bR, float *act, float *h, float *c) {
+  const size_t H = d.H;
+  if (d.mode == 0 || d.mode == 1) {
+    for (size_t k = 0; k < H; k++) act[k] = gx[k] + gh[k] + bR[k];
+    if (d.mode == 0)
+      cpp::relu(H, act, act);
+    else
+      cpp::tanh(H, act, act, d.fast);
+    std::copy(act, act + H, h);
+  } else if (d.mode == 2) {
+    for (size_t k = 0; k < 4 * H; k++) act[k] = gx[k] + gh[k] + bR[k];
+    cpp::sigmoid(2 * H, act, act, d.fast);              // input, forget
+    cpp::tanh(H, act + 2 * H, act + 2 * H, d.fast);     // new memory
+    cpp::sigmoid(H, act + 3 * H, act + 3 * H, d.fast);  // output
+    const float *i = act, *f = act + H, *g = act + 2 * H, *o = act + 3 * H;
+    float *cn = act + 4 * H;
+    for (size_t k = 0; k < H; k++) cn[k] = c[k] = f[k] * c[k] + i[k] * g[k];
+    cpp::tanh(H, cn, h, d.fast);
+    for (size_t k = 0; k < H; k++) h[k] *= o[k];
+  } else {
+    for (size_t k = 0; k < 2 * H; k++) act[k] = gx[k] + gh[k] + bR[k];
+    cpp::sigmoid(2 * H, act, act, d.fast);  // reset, update
+    const float *r = act, *z = act + H;
+    float *n = act + 2 * H, *hn = act + 3 * H;
+    for (size_t k = 0; k < H; k++) {
+      hn[k] = gh[2 * H + k] + bR[2 * H + k];
+      n[k] = gx[2 * H + k] + r[k] * hn[k];
+    }
+    cpp::tanh(H, n, n, d.fast);
+    for (size_t k = 0; k < H; k++) h[k] = (1 - z[k]) * n[k] + z[k] * h[k];
+  }
+}
+
+// The gradients of one time step of one sample. dh is the gradient of the
+// step output, act the recorded activations and hp (cp) the previous hidden
+// (cell) state. dgx (dgh) receives the gradient of the input (recurrent)
+// projection. dc is replaced by the gradient of the previous cell state; dhz
+// receives the gradient of the previous hidden state that bypasses the
+// recurrent matrices (gru only).
+void StepBackward(const RNNDims &d, const float *dh, const float *act,
+                  const float *hp, const float *cp, float *dgx, float *dgh,
+                  float *dc, float *dhz, float *tmp) {
+  const size_t H = d.H;
+  if (d.mode == 0) {
+    for (size_t k = 0; k < H; k++) dgx[k] = act[k] > 0.f ? dh[k] : 0.f;
+    std::copy(dgx, dgx + H, dgh);
+  } else if (d.mode == 1) {
+    for (size_t k = 0; k < H; k++) dgx[k] = dh[k] * (1 - act[k] * act[k]);
+    std::copy(dgx, dgx + H, dgh);
+  } else if (d.mode == 2) {
+    const float *i = act, *f = act + H, *g = act + 2 * H, *o = act + 3 * H;
+    cpp::tanh(H, act + 4 * H, tmp, d.fast);
+    for (size_t k = 0; k < H; k++) {
+      float dct = dc[k] + dh[k] * o[k] * (1 - tmp[k] * tmp[k]);
+      dgx[k] = dct * g[k] * i[k] * (1 - i[k]);
+      dgx[H + k] = dct * cp[k] * f[k] * (1 - f[k]);
+      dgx[2 * H + k] = dct * i[k] * (1 - g[k] * g[k]);
+      dgx[3 * H + k] = dh[k] * tmp[k] * o[k] * (1 - o[k]);
+      dc[k] = dct * f[k];
+    }
+    std::copy(dgx, dgx + 4 * H, dgh);
+  } else {
+    const float *r = act, *z = act + H, *n = act + 2 * H, *hn = act + 3 * H;
+    for (size_t k = 0; k < H; k++) {
+      float dn = dh[k] * (1 - z[k]) * (1 - n[k] * n[k]);
+      dgx[2 * H + k] = dn;
+      dgh[2 * H + k] = dn * r[k];
+      dgx[k] = dgh[k] = dn * hn[k] * r[k] * (1 - r[k]);
+      dgx[H + k] = dgh[H + k] = dh[k] * (hp[k] - n[k]) * z[k] * (1 - z[k]);
+      dhz[k] = dh[k] * z[k];
+    }
+  }
+}
+
+// out (T * B, G * H) = in (T * B, K) * W^T + bias, in parallel over rows.
+// This is the input projection of all time steps of one layer.
+void InputProjection(const RNNDims &d, const float *in, size_t K,
+                     const float *W, const float *bias, float *out) {
+  const size_t GH = d.GH();
+  ParallelFor(0, d.TB(), 16, d.num_threads, [&](size_t r0, size_t r1) {
+    cpp::gemm(false, true, r1 - r0, GH, K, 1.f, in + r0 * K, K, W, K, 0.f,
+              out + r0 * GH, GH);
+    for (size_t r = r0; r < r1; r++)
+      for (size_t j = 0; j < GH; j++) out[r * GH + j] += bias[j];
+  });
+}
+
+// Run the recurrence of one direction of layer l for the samples [b0, b1).
+// gx holds the input projections; y is the layer output (T * B, D * H); the
+// activations are recorded in rec if it is not null.
+void ForwardRecurrence(const RNNDims &d, size_t l, size_t dir,
+                       const float *W, const LayerOffsets &off,
+                       const float *gx, const float *hx, const float *cx,
+                       float *y, float *rec, float *hy, float *cy, size_t b0,
+                       size_t b1) {
+  const size_t H = d.H, GH = d.GH(), nb = b1 - b0, p = l * d.D + dir;
+  const float *R = W + off.R, *bR = W + off.bR;
+  std::vector<float> h(nb * H, 0.f), c(nb * H, 0.f), gh(nb * GH),
+      scratch(d.S);
+  int steps = 0;
+  for (size_t i = 0; i < nb; i++) {
+    size_t src = (p * d.B + b0 + i) * H;
+    if (hx != nullptr) std::copy(hx + src, hx + src + H, h.data() + i * H);
+    if (cx != nullptr && d.mode == 2)
+      std::copy(cx + src, cx + src + H, c.data() + i * H);
+    steps = std::max(steps, d.len[b0 + i]);
+  }
+  for (int s = 0; s < steps; s++) {
+    // recurrent projection of the whole sub-batch
+    cpp::gemm(false, true, nb, GH, H, 1.f, h.data(), H, R, H, 0.f, gh.data(),
+              GH);
+    for (size_t i = 0; i < nb; i++) {
+      size_t b = b0 + i;
+      if (s >= d.len[b]) continue;
+      size_t t = dir == 0 ? s : d.len[b] - 1 - s, row = t * d.B + b;
+      float *act = rec != nullptr ? rec + row * d.S : scratch.data();
+      StepForward(d, gx + row * GH, gh.data() + i * GH, bR, act,
+                  h.data() + i * H, c.data() + i * H);
+      std::copy(h.data() + i * H, h.data() + (i + 1) * H,
+                y + row * d.DH() + dir * H);
+    }
+  }
+  for (size_t i = 0; i < nb; i++) {
+    size_t dst = (p * d.B + b0 + i) * H;
+    std::copy(h.data() + i * H, h.data() + (i + 1) * H, hy + dst);
+    std::copy(c.data() + i * H, c.data() + (i + 1) * H, cy + dst);
+  }
+}
+
+// The backward pass of ForwardRecurrence(). dy is the gradient of the layer
+// output; dgx and dgh receive the gate gradients (T * B, G * H).
+void BackwardRecurrence(const RNNDims &d, size_t l, size_t dir,
+                        const float *W, const LayerOffsets &off,
+                        const float *dy, const float *y, const float *rec,
+                        const float *hx, const float *cx, const float *dhy,
+                        const float *dcy, float *dgx, float *dgh, float *dhx,
+                        float *dcx, size_t b0, size_t b1) {
+  const size_t H = d.H, GH = d.GH(), DH = d.DH(), nb = b1 - b0;
+  const size_t p = l * d.D + dir;
+  const float *R = W + off.R;
+  std::vector<float> dh(nb * H, 0.f), dc(nb * H, 0.f), dhz(nb * H, 0.f),
+      dgs(nb * GH), dhn(nb * H), dht(H), tmp(H), zeros(H, 0.f);
+  int steps = 0;
+  for (size_t i = 0; i < nb; i++) {
+    size_t src = (p * d.B + b0 + i) * H;
+    if (dhy != nullptr) std::copy(dhy + src, dhy + src + H, dh.data() + i * H);
+    if (dcy != nullptr && d.mode == 2)
+      std::copy(dcy + src, dcy + src + H, dc.data() + i * H);
+    steps = std::max(steps, d.len[b0 + i]);
+  }
+  for (int s = steps - 1; s >= 0; s--) {
+    for (size_t i = 0; i < nb; i++) {
+      size_t b = b0 + i;
+      float *g = dgs.data() + i * GH;
+      if (s >= d.len[b]) {
+        std::fill(g, g + GH, 0.f);
+        continue;
+      }
+      size_t t = dir == 0 ? s : d.len[b] - 1 - s, row = t * d.B + b;
+      const float *hp = zeros.data(), *cp = zeros.data();
+      if (s > 0) {
+        size_t prev = (dir == 0 ? t - 1 : t + 1) * d.B + b;
+        hp = y + prev * DH + dir * H;
+        if (d.mode == 2) cp = rec + prev * d.S + 4 * H;
+      } else {
+        if (hx != nullptr) hp = hx + (p * d.B + b) * H;
+        if (cx != nullptr) cp = cx + (p * d.B + b) * H;
+      }
+      for (size_t k = 0; k < H; k++)
+        dht[k] = dh[i * H + k] + dy[row * DH + dir * H + k];
+      StepBackward(d, dht.data(), rec + row * d.S, hp, cp, dgx + row * GH, g,
+                   dc.data() + i * H, dhz.data() + i * H, tmp.data());
+      std::copy(g, g + GH, dgh + row * GH);
+    }
+    cpp::gemm(false, false, nb, H, GH, 1.f, dgs.data(), GH, R, H, 0.f,
+              dhn.data(), H);
+    for (size_t i = 0; i < nb; i++) {
+      if (s >= d.len[b0 + i]) continue;
+      for (size_t k = 0; k < H; k++)
+        dh[i * H + k] = dhn[i * H + k] + (d.mode == 3 ? dhz[i * H + k] : 0.f);
+    }
+  }
+  for (size_t i = 0; i < nb; i++) {
+    size_t dst = (p * d.B + b0 + i) * H;
+    std::copy(dh.data() + i * H, dh.data() + (i + 1) * H, dhx + dst);
+    std::copy(dc.data() + i * H, dc.data() + (i + 1) * H, dcx + dst);
+  }
+}
+
+void RNNForward(const RNNDims &d, const CpuRNNHandle &h, const float *x,
+                const float *hx, const float *cx, const float *W, float *y,
+                float *hy, float *cy, float *reserve) {
+  const size_t TB = d.TB(), DH = d.DH(), GH = d.GH();
+  std::vector<float> gx(d.D * TB * GH);
+  // outputs of the inner layers if they are not kept in the reserve space
+  std::vector<float> inner[2];
+  std::vector<LayerOffsets> off(d.D);
+  const float *in = x;
+  for (size_t l = 0; l < d.L; l++) {
+    float *out = y;
+    if (l + 1 < d.L && reserve != nullptr) {
+      out = reserve + OutputOffset(d, l);
+    } else if (l + 1 < d.L) {
+      inner[l % 2].resize(TB * DH);
+      out = inner[l % 2].data();
+    }
+    std::fill(out, out + TB * DH, 0.f);
+    for (size_t dir = 0; dir < d.D; dir++) {
+      off[dir] = GetOffsets(h, l * d.D + dir);
+      InputProjection(d, in, d.in_size(l), W + off[dir].W, W + off[dir].bW,
+                      gx.data() + dir * TB * GH);
+    }
+    // the samples are independent, so split the batch over the threads
+    ParallelFor(0, d.B, 1, d.num_threads, [&](size_t b0, size_t b1) {
+      for (size_t dir = 0; dir < d.D; dir++)
+        ForwardRecurrence(
+            d, l, dir, W, off[dir], gx.data() + dir * TB * GH, hx, cx, out,
+            reserve == nullptr ? nullptr : reserve + RecordOffset(d, l, dir),
+            hy, cy, b0, b1);
+    });
+    in = out;
+  }
+}
+
+void RNNBackwardData(const RNNDims &d, const CpuRNNHandle &h, const float *y,
+                     const float *dy, const float *dhy, const float *dcy,
+                     const float *W, const float *hx, const float *cx,
+                     const float *reserve, float *ws, float *dx, float *dhx,
+                     float *dcx) {
+  const size_t TB = d.TB(), DH = d.DH(), GH = d.GH();
+  // rows beyond the end of the sequences must stay 0
+  std::fill(ws, ws + WorkspaceSize(d), 0.f);
+  std::vector<float> dout(dy, dy + TB * DH), din;
+  std::vector<LayerOffsets> off(d.D);
+  for (size_t l = d.L; l-- > 0;) {
+    const float *out = l + 1 == d.L ? y : reserve + OutputOffset(d, l);
+    for (size_t dir = 0; dir < d.D; dir++)
+      off[dir] = GetOffsets(h, l * d.D + dir);
+    ParallelFor(0, d.B, 1, d.num_threads, [&](size_t b0, size_t b1) {
+      for (size_t dir = 0; dir < d.D; dir++)
+        BackwardRecurrence(d, l, dir, W, off[dir], dout.data(), out,
+                           reserve + RecordOffset(d, l, dir), hx, cx, dhy, dcy,
+                           ws + DgxOffset(d, l, dir), ws + DghOffset(d, l, dir),
+                           dhx, dcx, b0, b1);
+    });
+    // the gradient of the layer input, which is the output of layer l - 1
+    const size_t K = d.in_size(l);
+    if (l > 0) din.resize(TB * K);
+    float *dinp = l == 0 ? dx : din.data();
+    ParallelFor(0, TB, 16, d.num_threads, [&](size_t r0, size_t r1) {
+      for (size_t dir = 0; dir < d.D; dir++)
+        cpp::gemm(false, false, r1 - r0, K, GH, 1.f,
+                  ws + DgxOffset(d, l, dir) + r0 * GH, GH, W + off[dir].W, K,
+                  dir == 0 ? 0.f : 1.f, dinp + r0 * K, K);
+    });
+    if (l > 0) dout.swap(din);
+  }
+}
+
+void RNNBackwardWeights(const RNNDims &d, const CpuRNNHandle &h,
+                        const float *x, const float *hx, const float *y,
+                        const float *reserve, const float *ws, float *dW) {
+  const size_t TB = d.TB(), DH = d.DH(), GH = d.GH(), H = d.H;
+  std::fill(dW, dW + h.weights_size, 0.f);
+  std::vector<float> hprev(TB * H);
+  for (size_t l = 0; l < d.L; l++) {
+    const float *in = l == 0 ? x : reserve + OutputOffset(d, l - 1);
+    const float *out = l + 1 == d.L ? y : reserve + OutputOffset(d, l);
+    const size_t K = d.in_size(l);
+    for (size_t dir = 0; dir < d.D; dir++) {
+      const size_t p = l * d.D + dir;
+      LayerOffsets off = GetOffsets(h, p);
+      // the hidden state entering every step
+      for (size_t t = 0; t < d.T; t++)
+        for (size_t b = 0; b < d.B; b++) {
+          float *dst = hprev.data() + (t * d.B + b) * H;
+          int len = d.len[b];
+          bool first = dir == 0 ? t == 0 : static_cast<int>(t) == len - 1;
+          if (static_cast<int>(t) >= len || (first && hx == nullptr)) {
+            std::fill(dst, dst + H, 0.f);
+          } else {
+            const float *src =
+                first ? hx + (p * d.B + b) * H
+                      : out + ((dir == 0 ? t - 1 : t + 1) * d.B + b) * DH +
+                            dir * H;
+            std::copy(src, src + H, dst);
+          }
+        }
+      const float *dgx = ws + DgxOffset(d, l, dir);
+      const float *dgh = ws + DghOffset(d, l, dir);
+      // one GEMM over all time steps for each matrix, split by gate rows
+      ParallelFor(0, GH, 16, d.num_threads, [&](size_t j0, size_t j1) {
+        cpp::gemm(true, false, j1 - j0, K, TB, 1.f, dgx + j0, GH, in, K, 0.f,
+                  dW + off.W + j0 * K, K);
+        cpp::gemm(true, false, j1 - j0, H, TB, 1.f, dgh + j0, GH,
+                  hprev.data(), H, 0.f, dW + off.R + j0 * H, H);
+        for (size_t r = 0; r < TB; r++)
+          for (size_t j = j0; j < j1; j++) {
+            dW[off.bW + j] += dgx[r * GH + j];
+            dW[off.bR + j] += dgh[r * GH + j];
+          }
+      });
+    }
+  }
+}
+
+const float *DataOrNull(const Tensor &t) {
+  if (t.Size() == 0) return nullptr;
+  return static_cast<const float *>(t.block()->data());
+}
+
+void AppendBlock(const Tensor &t, std::vector<Block *> *blocks) {
+  if (t.block() != nullptr) blocks->push_back(t.block());
+}
+
+void CheckStates(const Tensor &t, const RNNDims &d) {
+  if (t.Size() != 0)
+    CHECK_EQ(t.Size(), d.L * d.D * d.B * d.H)
+        << "states should be in shape {layers * directions, bs, hidden}";
+}
+
+vector<Tensor> CpuRNNForward(const Tensor &x, const Tensor &hx,
+                             const Tensor &cx, const Tensor &W,
+                             const Tensor &seq_lengths, bool training,
+                             CpuRNNHandle &h) {
+  CHECK_EQ(x.device()->lang(), kCpp);
+  CHECK_EQ(x.data_type(), kFloat32);
+  CHECK_EQ(h.feature_size, x.shape(2)) << "feature size should not change";
+  CHECK_EQ(h.weights_size, W.Size()) << "weights size should not change";
+
+  // update batch size and seq length to accommodate their changes
+  h.seq_length = x.shape(0);
+  h.batch_size = x.shape(1);
+  RNNDims d = GetDims(h);
+  CheckStates(hx, d);
+  CheckStates(cx, d);
+
+  Tensor y(Shape{d.T, d.B, d.DH()}, x.device());
+  Tensor hy(Shape{d.L * d.D, d.B, d.H}, x.device());
+  Tensor cy(Shape{d.L * d.D, d.B, d.H}, x.device());
+  Tensor reserve;
+  if (training) {
+    if (h.reserve_space.Size() != ReserveSize(d))
+      h.reserve_space = Tensor(Shape{ReserveSize(d)}, x.device());
+    reserve = h.reserve_space;
+  }
+  Tensor x_con = Contiguous(x);
+
+  std::vector<Block *> read_blocks{x_con.block(), W.block()},
+      write_blocks{y.block(), hy.block(), cy.block()};
+  AppendBlock(hx, &read_blocks);
+  AppendBlock(cx, &read_blocks);
+  AppendBlock(seq_lengths, &read_blocks);
+  AppendBlock(reserve, &write_blocks);
+
+  y.device()->Exec(
+      [y, hy, cy, x_con, hx, cx, W, seq_lengths, reserve, d,
+       &h](Context *ctx) mutable {
+        SetRuntime(seq_lengths, ctx, &d);
+        float *rptr = nullptr;
+        if (reserve.Size() != 0)
+          rptr = static_cast<float *>(reserve.block()->mutable_data());
+        RNNForward(d, h, DataOrNull(x_con), DataOrNull(hx), DataOrNull(cx),
+                   DataOrNull(W),
+                   static_cast<float *>(y.block()->mutable_data()),
+                   static_cast<float *>(hy.block()->mutable_data()),
+                   static_cast<float *>(cy.block()->mutable_data()), rptr);
+      },
+      read_blocks, write_blocks,
+      training ? "CpuRNNForwardTraining" : "CpuRNNForwardInference");
+  return {y, hy, cy};
+}
+
+vector<Tensor> CpuRNNBackwardData(const Tensor &y, const Tensor &dy,
+                                  const Tensor &dhy, const Tensor &dcy,
+                                  const Tensor &W, const Tensor &hx,
+                                  const Tensor &cx, const Tensor &seq_lengths,
+                                  CpuRNNHandle &h) {
+  CHECK_EQ(dy.device()->lang(), kCpp);
+  RNNDims d = GetDims(h);
+  CHECK_EQ(y.Size(), d.TB() * d.DH()) << "y is not from the last forward pass";
+  CHECK_EQ(dy.Size(), y.Size());
+  CHECK_EQ(h.reserve_space.Size(), ReserveSize(d))
+      << "call CpuRNNForwardTraining before the backward pass";
+  CheckStates(dhy, d);
+  CheckStates(dcy, d);
+  if (h.workspace.Size() != WorkspaceSize(d))
+    h.workspace = Tensor(Shape{WorkspaceSize(d)}, y.device());
+
+  Tensor dx(Shape{d.T, d.B, d.F}, y.device());
+  Tensor dhx(Shape{d.L * d.D, d.B, d.H}, y.device());
+  Tensor dcx(Shape{d.L * d.D, d.B, d.H}, y.device());
+  Tensor y_con = Contiguous(y), dy_con = Contiguous(dy);
+  Tensor reserve = h.reserve_space, ws = h.workspace;
+
+  std::vector<Block *> read_blocks{y_con.block(), dy_con.block(), W.block(),
+                                   reserve.block()};
+  AppendBlock(dhy, &read_blocks);
+  AppendBlock(dcy, &read_blocks);
+  AppendBlock(hx, &read_blocks);
+  AppendBlock(cx, &read_blocks);
+  AppendBlock(seq_lengths, &read_blocks);
+
+  dx.device()->Exec(
+      [dx, dhx, dcx, y_con, dy_con, dhy, dcy, W, hx, cx, seq_lengths, reserve,
+       ws, d, &h](Context *ctx) mutable {
+        SetRuntime(seq_lengths, ctx, &d);
+        RNNBackwardData(d, h, DataOrNull(y_con), DataOrNull(dy_con),
+                        DataOrNull(dhy), DataOrNull(dcy), DataOrNull(W),
+                        DataOrNull(hx), DataOrNull(cx), DataOrNull(reserve),
+                        static_cast<float *>(ws.block()->mutable_data()),
+                        static_cast<float *>(dx.block()->mutable_data()),
+                        static_cast<float *>(dhx.block()->mutable_data()),
+                        static_cast<float *>(dcx.block()->mutable_data()));
+      },
+      read_blocks, {dx.block(), dhx.block(), dcx.block(), ws.block()},
+      "CpuRNNBackwardx");
+  return {dx, dhx, dcx};
+}
+
+Tensor CpuRNNBackwardWeights(const Tensor &x, const Tensor &hx,
+                             const Tensor &y, const Tensor &seq_lengths,
+                             CpuRNNHandle &h) {
+  RNNDims d = GetDims(h);
+  CHECK_EQ(x.Size(), d.TB() * d.F) << "x is not from the last forward pass";
+  CHECK_EQ(h.workspace.Size(), WorkspaceSize(d))
+      << "call CpuRNNBackwardx before CpuRNNBackwardW";
+  Tensor dW(Shape{h.weights_size}, x.device());
+  Tensor x_con = Contiguous(x), y_con = Contiguous(y);
+  Tensor reserve = h.reserve_space, ws = h.workspace;
+
+  std::vector<Block *> read_blocks{x_con.block(), y_con.block(),
+                                   reserve.block(), ws.block()};
+  AppendBlock(hx, &read_blocks);
+  AppendBlock(seq_lengths, &read_blocks);
+
+  dW.device()->Exec(
+      [dW, x_con, hx, y_con, seq_lengths, reserve, ws, d,
+       &h](Context *ctx) mutable {
+        SetRuntime(seq_lengths, ctx, &d);
+        RNNBackwardWeights(d, h, DataOrNull(x_con), DataOrNull(hx),
+                           DataOrNull(y_con), DataOrNull(reserve),
+                           DataOrNull(ws),
+                           static_cast<float *>(dW.block()->mutable_data()));
+      },
+      read_blocks, {dW.block()}, "CpuRNNBackwardW");
+  return dW;
+}
+}  // namespace
+
+CpuRNNHandle::CpuRNNHandle(const Tensor &x, const int hidden_size,
+                           const int mode, const int num_layers,
+                           const int bias, const float dropout,
+                           const int bidirectional)
+    : bias(bias),
+      mode(mode),
+      dropout(dropout),
+      bidirectional(bidirectional),
+      hidden_size(hidden_size),
+      num_layers(num_layers) {
+  CHECK_EQ(bias, 1) << "Current implementation always include bias";
+  CHECK(bidirectional == 0 || bidirectional == 1)
+      << "bidirectional should be 0 or 1 not " << bidirectional;
+  CHECK(mode >= 0 && mode <= 3)
+      << "mode should be 0 (relu), 1 (tanh), 2 (lstm) or 3 (gru) not " << mode;
+  CHECK_EQ(dropout, 0.0f) << "dropout is not supported by CpuRNNHandle";
+  CHECK_GT(num_layers, 0);
+  CHECK_EQ(x.device()->lang(), kCpp);
+
+  dev = x.device();
+  batch_first = 0;
+
+  // x shape {seq, bs, ..}
+  seq_length = x.shape(0);
+  batch_size = x.shape(1);
+  feature_size = x.shape(2);
+  gates = mode == 2 ? 4 : (mode == 3 ? 3 : 1);
+
+  // per pseudo layer: the input and recurrent matrices, then their biases
+  size_t directions = bidirectional ? 2 : 1, offset = 0;
+  for (size_t p = 0; p < this->num_layers * directions; p++) {
+    size_t input_size =
+        p < directions ? feature_size : this->hidden_size * directions;
+    for (size_t id = 0; id < 2 * gates; id++) {
+      size_t size = this->hidden_size * (id < gates ? input_size
+                                                    : this->hidden_size);
+      weights_mapping[std::make_tuple(id, p, false)] =
+          std::make_tuple(offset, size);
+      offset += size;
+    }
+    for (size_t id = 0; id < 2 * gates; id++) {
+      weights_mapping[std::make_tuple(id, p, true)] =
+          std::make_tuple(offset, this->hidden_size);
+      offset += this->hidden_size;
+    }
+  }
+  weights_size = offset;
+}
+
+vector<Tensor> CpuRNNForwardTraining(const Tensor &x, const Tensor &hx,
+                                     const Tensor &cx, const Tensor &W,
+                                     CpuRNNHandle &h) {
+  return CpuRNNForward(x, hx, cx, W, Tensor(), true, h);
+}
+
+vector<Tensor> CpuRNNForwardInference(const Tensor &x, const Tensor &hx,
+                                      const Tensor &cx, const Tensor &W,
+                                      CpuRNNHandle &h) {
+  return CpuRNNForward(x, hx, cx, W, Tensor(), false, h);
+}
+
+vector<Tensor> CpuRNNBackwardx(const Tensor &y, const Tensor &dy,
+                               const Tensor &dhy, const Tensor &dcy,
+                               const Tensor &W, const Tensor &hx,
+                               const Tensor &cx, CpuRNNHandle &h) {
+  return CpuRNNBackwardData(y, dy, dhy, dcy, W, hx, cx, Tensor(), h);
+}
+
+Tensor CpuRNNBackwardW(const Tensor &x, const Tensor &hx, const Tensor &y,
+                       CpuRNNHandle &h) {
+  return CpuRNNBackwardWeights(x, hx, y, Tensor(), h);
+}
+
+void CpuRNNSetParam(int linLayerID, int pseudoLayer, Tensor &weights,
+                    Tensor &paramValues, bool is_bias, CpuRNNHandle &h) {
+  size_t offset, size;
+  std::tie(offset, size) =
+      h.weights_mapping[std::make_tuple(linLayerID, pseudoLayer, is_bias)];
+  CHECK_EQ(size, paramValues.size()) << "param size is not expected";
+  CopyDataToFrom(&weights, paramValues, size, offset, 0);
+}
+
+Tensor CpuRNNGetParamCopy(int linLayerID, int pseudoLayer, Tensor &weights,
+                          bool is_bias, CpuRNNHandle &h) {
+  size_t offset, size;
+  std::tie(offset, size) =
+      h.weights_mapping[std::make_tuple(linLayerID, pseudoLayer, is_bias)];
+  Tensor paramCopy(Shape{size}, weights.device());
+  CopyDataToFrom(&paramCopy, weights, size, 0, offset);
+  return paramCopy;
+}
+
+vector<Tensor> CpuRNNForwardTrainingEx(const Tensor &x, const Tensor &hx,
+                                       const Tensor &cx, const Tensor &W,
+                                       const Tensor &seq_lengths,
+                                       CpuRNNHandle &h) {
+  return CpuRNNForward(x, hx, cx, W, seq_lengths, true, h);
+}
+
+vector<Tensor> CpuRNNForwardInferenceEx(const Tensor &x, const Tensor &hx,
+                                        const Tensor &cx, const Tensor &W,
+                                        const Tensor &seq_lengths,
+                                        CpuRNNHandle &h) {
+  return CpuRNNForward(x, hx, cx, W, seq_lengths, false, h);
+}
+
+vector<Tensor> CpuRNNBackwardxEx(const Tensor &y, const Tensor &dy,
+                                 const Tensor &dhy, const Tensor &dcy,
+                                 const Tensor &W, const Tensor &hx,
+                                 const Tensor &cx, const Tensor &seq_lengths,
+                                 CpuRNNHandle &h) {
+  return CpuRNNBackwardData(y, dy, dhy, dcy, W, hx, cx, seq_lengths, h);
+}
+
+Tensor CpuRNNBackwardWEx(const Tensor &x, const Tensor &hx, const Tensor &y,
+                         const Tensor &seq_lengths, CpuRNNHandle &h) {
+  return CpuRNNBackwardWeights(x, hx, y, seq_lengths, h);
+}
+
 }  // namespace singa
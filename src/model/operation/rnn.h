@@ -19,6 +19,8 @@
 #define SRC_MODEL_OPERATION_RNN_H_
 
 #include <iostream>
+#include <map>
+#include <memory>
 #include <tuple>
 #include <vector>
 
@@ -34,6 +36,88 @@
 
 namespace singa {
 
+/// RNN for lang::Cpp devices with the same constructor and entry points as
+/// CudnnRNNHandle. mode: 0 - relu, 1 - tanh, 2 - lstm, 3 - gru. x and y are
+/// {seq, bs, feature}; hx, cx, hy and cy are {num_layers * directions, bs,
+/// hidden}. The weights of every pseudo layer (layer * directions +
+/// direction) are stored together: the input matrices of all gates
+/// (linLayerID 0 .. gates - 1, hidden x input each), the recurrent matrices
+/// (gates .. 2 * gates - 1, hidden x hidden each), then the biases in the same
+/// order. The gate order follows cudnn, i.e., input, forget, new memory and
+/// output for lstm, reset, update and new memory for gru.
+class CpuRNNHandle {
+ public:
+  CpuRNNHandle(const Tensor &x, const int hidden_size, const int mode = 0,
+               const int num_layers = 1, const int bias = 1,
+               const float dropout = 0.0f, const int bidirectional = 0);
+
+  std::shared_ptr<Device> dev;
+
+  // parameters
+  int bias;
+  int mode;
+  float dropout;
+  int bidirectional;
+  size_t feature_size;
+  size_t hidden_size;
+  size_t num_layers;
+  int batch_first;
+  // 1 for relu/tanh, 4 for lstm, 3 for gru
+  size_t gates;
+
+  size_t weights_size;
+  size_t batch_size;
+  size_t seq_length;
+
+  // gate activations (and the outputs of the inner layers) of every time
+  // step, written by the forward training pass for the backward passes
+  Tensor reserve_space;
+  // gate gradients, written by CpuRNNBackwardx for CpuRNNBackwardW
+  Tensor workspace;
+
+  // linLayerID, pseudoLayer, is_bias => offset, size
+  std::map<std::tuple<int, int, bool>, std::tuple<size_t, size_t>>
+      weights_mapping;
+};
+
+vector<Tensor> CpuRNNForwardTraining(const Tensor &x, const Tensor &hx,
+                                     const Tensor &cx, const Tensor &W,
+                                     CpuRNNHandle &h);
+vector<Tensor> CpuRNNForwardInference(const Tensor &x, const Tensor &hx,
+                                      const Tensor &cx, const Tensor &W,
+                                      CpuRNNHandle &h);
+vector<Tensor> CpuRNNBackwardx(const Tensor &y, const Tensor &dy,
+                               const Tensor &dhy, const Tensor &dcy,
+                               const Tensor &W, const Tensor &hx,
+                               const Tensor &cx, CpuRNNHandle &h);
+Tensor CpuRNNBackwardW(const Tensor &x, const Tensor &hx, const Tensor &y,
+                       CpuRNNHandle &h);
+
+void CpuRNNSetParam(int linLayerID, int pseudoLayer, Tensor &weights,
+                    Tensor &paramValues, bool is_bias, CpuRNNHandle &h);
+Tensor CpuRNNGetParamCopy(int linLayerID, int pseudoLayer, Tensor &weights,
+                          bool is_bias, CpuRNNHandle &h);
+
+/// The *Ex functions take the length of every sequence in the batch
+/// (seq_lengths, {bs}); x and y are padded to {seq, bs, feature}, and y is 0
+/// beyond the end of each sequence. hy and cy are the states after the last
+/// step of each sequence. Unlike cudnn, the lengths need not be sorted.
+vector<Tensor> CpuRNNForwardTrainingEx(const Tensor &x, const Tensor &hx,
+                                       const Tensor &cx, const Tensor &W,
+                                       const Tensor &seq_lengths,
+                                       CpuRNNHandle &h);
+vector<Tensor> CpuRNNForwardInferenceEx(const Tensor &x, const Tensor &hx,
+                                        const Tensor &cx, const Tensor &W,
+                                        const Tensor &seq_lengths,
+                                        CpuRNNHandle &h);
+vector<Tensor> CpuRNNBackwardxEx(const Tensor &y, const Tensor &dy,
+                                 const Tensor &dhy, const Tensor &dcy,
+                                 const Tensor &W, const Tensor &hx,
+                                 const Tensor &cx, const Tensor &seq_lengths,
+                                 CpuRNNHandle &h);
+Tensor CpuRNNBackwardWEx(const Tensor &x, const Tensor &hx, const Tensor &y,
+                         const Tensor &seq_lengths, CpuRNNHandle &h);
+
 #ifdef USE_CUDNN
 class CudnnRNNHandle {
  public:
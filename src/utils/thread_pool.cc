@@ -0,0 +1,130 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+
+#include "singa/utils/thread_pool.h"
+
+#include <algorithm>
+
+namespace singa {
+
+namespace {
+// set for the lifetime of every worker thread
+thread_local bool in_worker = false;
+
+// completion counter shared by the chunks of one ParallelFor call
+struct ChunkLatch {
+  std::mutex mutex;
+  std::condition_variable done;
+  size_t pending = 0;
+};
+}  // namespace
+
+ThreadPool::ThreadPool(size_t num_workers) { Reserve(num_workers); }
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  condition_.notify_all();
+  for (auto& t : workers_) t.join();
+}
+
+ThreadPool* ThreadPool::Global() {
+  static ThreadPool pool(HardwareConcurrency() - 1);
+  return &pool;
+}
+
+bool ThreadPool::InWorker() { return in_worker; }
+
+size_t ThreadPool::HardwareConcurrency() {
+  size_t n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+size_t ThreadPool::size() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return workers_.size();
+}
+
+void ThreadPool::Reserve(size_t num_workers) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (workers_.size() < num_workers)
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+void ThreadPool::Submit(std::function<void()>&& task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push(std::move(task));
+  }
+  condition_.notify_one();
+}
+
+void ThreadPool::WorkerLoop() {
+  in_worker = true;
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+      if (stop_ && tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+    task();
+  }
+}
+
+void ThreadPool::ParallelFor(size_t begin, size_t end, size_t grain,
+                             size_t max_threads,
+                             const std::function<void(size_t, size_t)>& fn) {
+  if (end <= begin) return;
+  size_t n = end - begin;
+  grain = std::max<size_t>(grain, 1);
+  size_t nchunks = std::min(n / grain, max_threads);
+  if (nchunks > 1 && !in_worker) nchunks = std::min(nchunks, size() + 1);
+  if (nchunks <= 1 || in_worker) {
+    fn(begin, end);
+    return;
+  }
+
+  // spread the remainder over the leading chunks
+  size_t step = n / nchunks, rest = n % nchunks;
+  ChunkLatch latch;
+  latch.pending = nchunks - 1;
+  size_t first_end = begin + step + (rest > 0 ? 1 : 0);
+  size_t start = first_end;
+  for (size_t c = 1; c < nchunks; c++) {
+    size_t stop = start + step + (c < rest ? 1 : 0);
+    Submit([&fn, &latch, start, stop]() {
+      fn(start, stop);
+      std::lock_guard<std::mutex> lock(latch.mutex);
+      if (--latch.pending == 0) latch.done.notify_one();
+    });
+    start = stop;
+  }
+  fn(begin, first_end);
+  std::unique_lock<std::mutex> lock(latch.mutex);
+  latch.done.wait(lock, [&latch]() { return latch.pending == 0; });
+}
+
+}  // namespace singa
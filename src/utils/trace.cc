@@ -0,0 +1,156 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+
+#include "singa/utils/trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+namespace singa {
+
+namespace {
+// the buffer of the calling thread in the global recorder
+thread_local void* local_buffer = nullptr;
+
+void WriteString(std::ostream& os, const std::string& str) {
+  os << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      os << buf;
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+// trace-event times are in microseconds
+void WriteTime(std::ostream& os, int64_t ns) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.3f", ns / 1e3);
+  os << buf;
+}
+}  // namespace
+
+TraceRecorder* TraceRecorder::Global() {
+  static TraceRecorder recorder;
+  return &recorder;
+}
+
+void TraceRecorder::Start(size_t max_events) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& buffer : buffers_) {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    buffer->events.clear();
+  }
+  max_events_ = max_events;
+  num_events_ = 0;
+  start_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+               .count();
+  enabled_ = true;
+}
+
+void TraceRecorder::Stop() { enabled_ = false; }
+
+int64_t TraceRecorder::Now() const {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+             .count() -
+         start_.load(std::memory_order_relaxed);
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::LocalBuffer() {
+  if (local_buffer == nullptr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.emplace_back(new ThreadBuffer());
+    buffers_.back()->tid = static_cast<int>(buffers_.size());
+    local_buffer = buffers_.back().get();
+  }
+  return static_cast<ThreadBuffer*>(local_buffer);
+}
+
+void TraceRecorder::Record(TraceEvent&& event) {
+  if (!enabled() || num_events_++ >= max_events_) return;
+  ThreadBuffer* buffer = LocalBuffer();
+  event.tid = buffer->tid;
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  buffer->events.push_back(std::move(event));
+}
+
+size_t TraceRecorder::num_events() const {
+  return std::min(num_events_.load(), max_events_.load());
+}
+
+size_t TraceRecorder::num_dropped() const {
+  size_t n = num_events_.load(), max_events = max_events_.load();
+  return n > max_events ? n - max_events : 0;
+}
+
+std::vector<TraceEvent> TraceRecorder::events() {
+  std::vector<TraceEvent> ret;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& buffer : buffers_) {
+      std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+      ret.insert(ret.end(), buffer->events.begin(), buffer->events.end());
+    }
+  }
+  std::stable_sort(ret.begin(), ret.end(),
+                   [](const TraceEvent& a, const TraceEvent& b) {
+                     return a.start < b.start;
+                   });
+  return ret;
+}
+
+void TraceRecorder::Dump(std::ostream& os) {
+  auto all = events();
+  os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  for (size_t i = 0; i < all.size(); ++i) {
+    const TraceEvent& e = all[i];
+    os << (i ? ",\n" : "\n") << "{\"name\":";
+    WriteString(os, e.name);
+    os << ",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+       << e.tid << ",\"ts\":";
+    WriteTime(os, e.start);
+    os << ",\"dur\":";
+    WriteTime(os, e.end - e.start);
+    os << ",\"args\":{\"device\":" << e.device
+       << ",\"iteration\":" << e.iteration << ",\"node\":" << e.node
+       << ",\"read_bytes\":" << e.read_bytes
+       << ",\"write_bytes\":" << e.write_bytes << "}}";
+  }
+  os << "\n]}\n";
+}
+
+bool TraceRecorder::Dump(const std::string& path) {
+  std::ofstream ofs(path);
+  if (!ofs.is_open()) return false;
+  Dump(ofs);
+  return ofs.good();
+}
+
+}  // namespace singa
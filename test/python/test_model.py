@@ -31,6 +31,7 @@ from singa import device
 from singa import layer
 from singa import model
 from singa import opt
+from singa import quantization
 
 from cuda_helper import gpu_dev, cpu_dev
 
@@ -494,6 +495,31 @@ class TestPythonModule(unittest.TestCase):
     def test_run_in_serial_gpu(self):
         self._train_one_batch_helper(gpu_dev, True, True, True)
 
+    def test_calibrate_cpu(self):
+        self.generate_data(cpu_dev)
+        m = MLP(num_classes=2, perceptron_size=3)
+        m.compile([self.inputs], is_train=True, use_graph=False)
+        self.get_params(m)
+        observers = quantization.calibrate(m, [self.inputs, self.inputs * 2])
+        self.assertTrue(m.training)
+        self.assertEqual(['linear1', 'linear2'], list(observers.keys()))
+
+        # the inputs of linear2 are the relu outputs of both batches
+        x = np.concatenate([self.data, self.data * 2])
+        self.numpy_forward(x)
+        obs1, obs2 = observers['linear1'], observers['linear2']
+        self.assertAlmostEqual(x.min(), obs1.min(), places=5)
+        self.assertAlmostEqual(x.max(), obs1.max(), places=5)
+        self.assertAlmostEqual(self.x3.min(), obs2.min(), places=4)
+        self.assertAlmostEqual(self.x3.max(), obs2.max(), places=4)
+
+        params = obs1.Params()
+        qx = quantization.quantize(self.inputs, params)
+        x_ = tensor.to_numpy(quantization.dequantize(qx))
+        np.testing.assert_allclose(x_,
+                                   self.data,
+                                   atol=params.scale[0] / 2 + 1e-6)
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -584,6 +584,34 @@ class TestPythonOperation(unittest.TestCase):
     def test_MeanSquareError_gpu(self):
         self._MeanSquareError_helper(gpu_dev)
 
+    def _SoftMaxCrossEntropy_helper(self, dev, smoothing):
+        X = np.array([0.8, -1.2, 3.3, -3.6, -0.5, 0.5, 2.0, 1.0,
+                      0.1]).reshape(3, 3).astype(np.float32)
+        T = np.array([2, 0, 1]).astype(np.int32)
+        x = tensor.from_numpy(X)
+        t = tensor.from_numpy(T)
+        x.to_device(dev)
+        t.to_device(dev)
+
+        loss = autograd.softmax_cross_entropy(x, t, smoothing)
+        dx = loss.creator.backward()
+
+        e = np.exp(X - X.max(axis=1, keepdims=True))
+        p = e / e.sum(axis=1, keepdims=True)
+        w = (1 - smoothing) * np.eye(3)[T] + smoothing / 3
+        loss_np = -(w * np.log(p)).sum() / 3
+        self.assertAlmostEqual(tensor.to_numpy(loss)[0], loss_np, places=5)
+        np.testing.assert_array_almost_equal(
+            tensor.to_numpy(tensor.from_raw_tensor(dx)), (p - w) / 3)
+
+    def test_SoftMaxCrossEntropy_cpu(self):
+        self._SoftMaxCrossEntropy_helper(cpu_dev, 0.0)
+        self._SoftMaxCrossEntropy_helper(cpu_dev, 0.1)
+
+    @unittest.skipIf(not singa_wrap.USE_CUDA, 'CUDA is not enabled')
+    def test_SoftMaxCrossEntropy_gpu(self):
+        self._SoftMaxCrossEntropy_helper(gpu_dev, 0.0)
+
     def _Abs_helper(self, dev):
         X = np.array([0.8, -1.2, 3.3, -3.6, -0.5,
                       0.5]).reshape(3, 2).astype(np.float32)
@@ -612,6 +612,43 @@ class TestTensorMethods(unittest.TestCase):
     def test_kint_kint_bc_gpu(self, dev=gpu_dev):
         self._kint_kint_bc(gpu_dev)
 
+    def test_sparse_tensor_cpu(self):
+        dense = np.array([[0, 2, 0, 1], [0, 0, 0, 0], [3, 0, 4, 0]],
+                         dtype=np.float32)
+        rhs = np.random.rand(4, 5).astype(np.float32)
+        vec = np.random.rand(4).astype(np.float32)
+        other = np.random.rand(3, 4).astype(np.float32)
+
+        # the CSR arrays of dense, and its COO entries with a duplicate
+        csr = tensor.SparseTensor.from_csr((3, 4), [2, 1, 3, 4], [0, 2, 2, 4],
+                                           [1, 3, 0, 2], cpu_dev)
+        coo = tensor.SparseTensor.from_coo((3, 4), [3, 2, 1, 1, 3],
+                                           [2, 0, 0, 2, 2], [2, 1, 3, 2, 0],
+                                           cpu_dev)
+        t = tensor.from_numpy(dense, cpu_dev)
+        for sp in [
+                csr, coo,
+                tensor.SparseTensor.from_dense(t),
+                tensor.SparseTensor.from_dense(t, singa_api.kCOO)
+        ]:
+            self.assertEqual((3, 4), sp.shape)
+            self.assertEqual(4, sp.to_csr().nnz())
+            np.testing.assert_array_almost_equal(tensor.to_numpy(sp.to_dense()),
+                                                 dense)
+            np.testing.assert_array_almost_equal(
+                tensor.to_numpy(sp.T.to_dense()), dense.T)
+            np.testing.assert_array_almost_equal(
+                tensor.to_numpy(sp @ tensor.from_numpy(rhs, cpu_dev)),
+                dense @ rhs,
+                decimal=5)
+            np.testing.assert_array_almost_equal(
+                tensor.to_numpy(sp.matmul(tensor.from_numpy(vec, cpu_dev))),
+                dense @ vec,
+                decimal=5)
+            prod = sp.mult(tensor.from_numpy(other, cpu_dev))
+            self.assertEqual(4, prod.to_csr().nnz())
+            np.testing.assert_array_almost_equal(
+                tensor.to_numpy(prod.to_dense()), dense * other)
 
 if __name__ == '__main__':
     unittest.main()
@@ -19,6 +19,10 @@
  *
  *************************************************************/
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "singa/core/device.h"
 #include "singa/core/tensor.h"
@@ -109,6 +113,71 @@ TEST_F(TestSoftmaxCrossEntropy, CppBackwardAryTarget) {
   EXPECT_FLOAT_EQ(gdat[6], -0.75);
   EXPECT_FLOAT_EQ(gdat[7], 0.25);
 }
+
+TEST_F(TestSoftmaxCrossEntropy, CppIntTarget) {
+  // int targets use the fused kernels
+  Tensor it(singa::Shape{2}, singa::defaultDevice, singa::kInt);
+  p.CopyDataFromHostPtr(pdat, 8);
+  it.CopyDataFromHostPtr(tdat, 2);
+
+  singa::SoftmaxCrossEntropy cross_entropy;
+  const Tensor& loss = cross_entropy.Forward(singa::kTrain, p, it);
+  const Tensor& grad = cross_entropy.Backward();
+  auto ldat = loss.data<float>();
+  auto gdat = grad.data<float>();
+  EXPECT_FLOAT_EQ(ldat[0], (float)-log(0.25));
+  EXPECT_FLOAT_EQ(ldat[1], (float)-log(0.25));
+  for (int i = 0; i < 8; i++)
+    EXPECT_FLOAT_EQ(gdat[i], i == 0 || i == 6 ? -0.75f : 0.25f);
+}
+
+TEST_F(TestSoftmaxCrossEntropy, CppFused) {
+  // rows of a few chunks of the online softmax, in parallel
+  const size_t n = 16, dim = 2500;
+  const float eps = 0.1f;
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  std::vector<float> x(n * dim), onehot(n * dim, 0.f);
+  std::vector<int> label(n);
+  for (size_t i = 0; i < x.size(); i++) x[i] = (i * 7 % 101) * 0.2f - 10.f;
+  for (size_t r = 0; r < n; r++) {
+    label[r] = (r * 331) % dim;
+    onehot[r * dim + label[r]] = 1.f;
+  }
+  Tensor in(singa::Shape{n, dim}, dev), lt(singa::Shape{n}, dev, singa::kInt);
+  Tensor ot(in.shape(), dev);
+  in.CopyDataFromHostPtr(x.data(), x.size());
+  lt.CopyDataFromHostPtr(label.data(), n);
+  ot.CopyDataFromHostPtr(onehot.data(), onehot.size());
+
+  Tensor lse, lse2;
+  Tensor loss = singa::SoftmaxCrossEntropyFwd(in, lt, &lse, eps);
+  Tensor grad = singa::SoftmaxCrossEntropyBwd(in, lt, lse, eps);
+  // one-hot float targets, with the gradient from the forward pass
+  Tensor loss2(singa::Shape{n}, dev), grad2(in.shape(), dev);
+  lse2.ResetLike(loss2);
+  singa::SoftmaxCrossEntropyFwd(in, ot, &loss2, &lse2, &grad2, eps);
+
+  const float *lptr = loss.data<float>(), *l2ptr = loss2.data<float>();
+  const float *gptr = grad.data<float>(), *g2ptr = grad2.data<float>();
+  for (size_t r = 0; r < n; r++) {
+    const float *xr = x.data() + r * dim;
+    double m = *std::max_element(xr, xr + dim), s = 0, expected = 0;
+    for (size_t j = 0; j < dim; j++) s += std::exp(xr[j] - m);
+    for (size_t j = 0; j < dim; j++) {
+      double logp = xr[j] - m - std::log(s);
+      double w = (1 - eps) * (j == (size_t)label[r]) + eps / dim;
+      expected -= w * logp;
+      size_t k = r * dim + j;
+      EXPECT_NEAR(std::exp(logp) - w, gptr[k], 1e-6);
+      EXPECT_NEAR(std::exp(logp) - w, g2ptr[k], 1e-6);
+    }
+    EXPECT_NEAR(expected, lptr[r], 1e-4);
+    EXPECT_NEAR(expected, l2ptr[r], 1e-4);
+    EXPECT_NEAR(m + std::log(s), lse.data<float>()[r], 1e-4);
+  }
+}
+
 #ifdef USE_CUDA
 
 TEST_F(TestSoftmaxCrossEntropy, CudaForward) {
@@ -0,0 +1,228 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "../src/core/tensor/math_kernel_cpp.h"
+#include "gtest/gtest.h"
+#include "singa/core/device.h"
+#include "singa/core/tensor.h"
+
+using singa::bfloat16;
+using singa::Shape;
+using singa::Tensor;
+namespace cpp = singa::cpp;
+
+// Run every test on all instruction sets supported by this CPU.
+class MathKernelCpp : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    // 37 is not a multiple of the vector width, to cover the tail
+    for (int i = 0; i < 37 * 20; i++) x.push_back((i % 37 - 18) * 0.37f);
+    for (int i = 0; i < 37 * 20; i++) pos.push_back(1e-3f + i * 0.13f);
+    y.resize(x.size());
+    for (int l = cpp::kScalar; l <= cpp::SupportedSimdLevel(); l++)
+      levels.push_back(static_cast<cpp::SimdLevel>(l));
+  }
+  virtual void TearDown() { cpp::SetSimdLevel(cpp::SupportedSimdLevel()); }
+
+  std::vector<float> x, pos, y;
+  std::vector<cpp::SimdLevel> levels;
+};
+
+TEST_F(MathKernelCpp, Exp) {
+  for (auto level : levels) {
+    cpp::SetSimdLevel(level);
+    cpp::exp(x.size(), x.data(), y.data(), false);
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_NEAR(std::exp(x[i]), y[i], 4e-7 * std::exp(x[i]));
+    cpp::exp(x.size(), x.data(), y.data(), true);
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_NEAR(std::exp(x[i]), y[i], 1e-4 * std::exp(x[i]));
+  }
+}
+
+TEST_F(MathKernelCpp, ExpSpecialValues) {
+  std::vector<float> in = {100.f, -200.f, 88.7f, -100.f, NAN, 0.f};
+  std::vector<float> out(in.size());
+  for (auto level : levels) {
+    cpp::SetSimdLevel(level);
+    cpp::exp(in.size(), in.data(), out.data(), false);
+    EXPECT_TRUE(std::isinf(out[0]));
+    EXPECT_EQ(0.f, out[1]);
+    EXPECT_NEAR(std::exp(88.7f), out[2], 1e-6 * std::exp(88.7f));
+    EXPECT_NEAR(std::exp(-100.f), out[3], 1e-6 * std::exp(-100.f));
+    EXPECT_TRUE(std::isnan(out[4]));
+    EXPECT_EQ(1.f, out[5]);
+  }
+}
+
+TEST_F(MathKernelCpp, Log) {
+  for (auto level : levels) {
+    cpp::SetSimdLevel(level);
+    EXPECT_TRUE(cpp::log(pos.size(), pos.data(), y.data()));
+    for (size_t i = 0; i < pos.size(); i++)
+      EXPECT_NEAR(std::log(pos[i]), y[i], 1e-6 * (1 + std::fabs(y[i])));
+    EXPECT_FALSE(cpp::log(x.size(), x.data(), y.data()));
+  }
+}
+
+TEST_F(MathKernelCpp, TanhSigmoid) {
+  for (auto level : levels) {
+    cpp::SetSimdLevel(level);
+    cpp::tanh(x.size(), x.data(), y.data(), false);
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_NEAR(std::tanh(x[i]), y[i], 1e-6 * (1e-2 + std::fabs(y[i])));
+    cpp::sigmoid(x.size(), x.data(), y.data(), false);
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_NEAR(1.f / (1.f + std::exp(-x[i])), y[i], 1e-6);
+    cpp::softplus(x.size(), x.data(), y.data(), false);
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_NEAR(std::log1p(std::exp(x[i])), y[i], 1e-6 * (1 + y[i]));
+  }
+}
+
+TEST_F(MathKernelCpp, Elementwise) {
+  std::vector<float> z(x.size());
+  for (auto level : levels) {
+    cpp::SetSimdLevel(level);
+    cpp::relu(x.size(), x.data(), y.data());
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_EQ(x[i] >= 0.f ? x[i] : 0.f, y[i]);
+    cpp::sign(x.size(), x.data(), y.data());
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_EQ(float((x[i] > 0) - (x[i] < 0)), y[i]);
+    cpp::clamp(x.size(), -1.f, 2.f, x.data(), y.data());
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_EQ(std::min(std::max(x[i], -1.f), 2.f), y[i]);
+    cpp::mult(x.size(), x.data(), pos.data(), y.data());
+    for (size_t i = 0; i < x.size(); i++) EXPECT_EQ(x[i] * pos[i], y[i]);
+    EXPECT_TRUE(cpp::div(x.size(), x.data(), pos.data(), y.data()));
+    for (size_t i = 0; i < x.size(); i++) EXPECT_EQ(x[i] / pos[i], y[i]);
+    EXPECT_FALSE(cpp::div(x.size(), 1.f, x.data(), y.data()));
+    cpp::ge(x.size(), x.data(), 0.37f, y.data());
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_EQ(x[i] >= 0.37f ? 1.f : 0.f, y[i]);
+    cpp::relu_backward(x.size(), pos.data(), x.data(), z.data());
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_EQ(x[i] > 0.f ? pos[i] : 0.f, z[i]);
+    cpp::pow(x.size(), x.data(), 2.f, y.data());
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_NEAR(x[i] * x[i], y[i], 1e-5 * (1 + y[i]));
+  }
+}
+
+TEST_F(MathKernelCpp, Float16Conversions) {
+  // 1 + 2^-8 and 1 + 3 * 2^-8 are ties of bfloat16, 2^-25 underflows half
+  std::vector<float> in = x;
+  for (float v : {1.00390625f, 1.01171875f, 65504.f, 1e6f, 2.98e-8f, -0.f,
+                  INFINITY, NAN})
+    in.push_back(v);
+  std::vector<uint16_t> bits(in.size());
+  std::vector<float> out(in.size());
+  EXPECT_EQ(0x3f80, bfloat16::FromFloat(in[x.size()]));
+  EXPECT_EQ(0x3f82, bfloat16::FromFloat(in[x.size() + 1]));
+  for (auto level : levels) {
+    cpp::SetSimdLevel(level);
+    cpp::float_to_bfloat16(in.size(), in.data(), bits.data());
+    for (size_t i = 0; i + 1 < in.size(); i++)
+      EXPECT_EQ(bfloat16::FromFloat(in[i]), bits[i]);
+    cpp::bfloat16_to_float(in.size(), bits.data(), out.data());
+    for (size_t i = 0; i + 1 < in.size(); i++)
+      EXPECT_EQ(bfloat16::ToFloat(bits[i]), out[i]);
+    EXPECT_TRUE(std::isnan(out.back()));
+
+    cpp::float_to_half(in.size(), in.data(), bits.data());
+    cpp::half_to_float(in.size(), bits.data(), out.data());
+    for (size_t i = 0; i + 1 < in.size(); i++) {
+      const half_float::half h = static_cast<half_float::half>(in[i]);
+      uint16_t expected;
+      memcpy(&expected, &h, sizeof(expected));
+      EXPECT_EQ(expected, bits[i]);
+      EXPECT_EQ(static_cast<float>(h), out[i]);
+    }
+    EXPECT_TRUE(std::isinf(out[x.size() + 3]));
+    EXPECT_EQ(0.f, out[x.size() + 4]);
+    EXPECT_TRUE(std::isnan(out.back()));
+  }
+}
+
+TEST_F(MathKernelCpp, Int8) {
+  // ties, saturation, the boundaries of int8 and NaN
+  std::vector<float> in = x;
+  for (float v : {2.5f, -2.5f, 3.5f, 1e3f, -1e3f, 1e30f, -1e30f, NAN})
+    in.push_back(v * 0.37f);
+  std::vector<int8_t> q(in.size());
+  std::vector<float> out(in.size());
+  // M, N and K are not multiples of the vector widths
+  const size_t M = 7, N = 37, K = 45;
+  std::vector<int8_t> A(M * K), B(K * N);
+  for (size_t i = 0; i < A.size(); i++) A[i] = i % 5 ? (i * 37) % 256 : -128;
+  for (size_t i = 0; i < B.size(); i++) B[i] = i % 7 ? (i * 91) % 256 : 127;
+  std::vector<int32_t> C(M * N), expected(M * N, 0);
+  for (size_t i = 0; i < M; i++)
+    for (size_t j = 0; j < N; j++)
+      for (size_t k = 0; k < K; k++)
+        expected[i * N + j] += A[i * K + k] * B[k * N + j];
+
+  for (auto level : levels) {
+    cpp::SetSimdLevel(level);
+    for (int zp : {0, -5, 127}) {
+      cpp::quantize(in.size(), in.data(), 0.37f, zp, q.data());
+      for (size_t i = 0; i + 1 < in.size(); i++) {
+        const float r = std::nearbyint(in[i] * (1.f / 0.37f));
+        const float v = std::min(std::max(r + zp, -128.f), 127.f);
+        EXPECT_EQ(static_cast<int>(v), q[i]) << in[i];
+      }
+      EXPECT_EQ(127, q.back());
+      cpp::dequantize(in.size(), q.data(), 0.37f, zp, out.data());
+      for (size_t i = 0; i < in.size(); i++)
+        EXPECT_EQ(0.37f * (q[i] - zp), out[i]);
+    }
+    // an odd ldc, with the padding of C left as is
+    std::fill(C.begin(), C.end(), -1);
+    cpp::gemm_s8(M, N - 1, K, A.data(), K, B.data(), N, C.data(), N);
+    for (size_t i = 0; i < M; i++) {
+      for (size_t j = 0; j + 1 < N; j++)
+        EXPECT_EQ(expected[i * N + j], C[i * N + j]);
+      EXPECT_EQ(-1, C[i * N + N - 1]);
+    }
+    cpp::gemm_s8(M, N, K, A.data(), K, B.data(), N, C.data(), N);
+    EXPECT_EQ(expected, C);
+  }
+}
+
+TEST_F(MathKernelCpp, TensorAccuracy) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  Tensor t(Shape{x.size()}, dev);
+  t.CopyDataFromHostPtr(x.data(), x.size());
+  for (auto acc : {singa::kMathPrecise, singa::kMathHigh, singa::kMathLow}) {
+    dev->SetMathAccuracy(acc);
+    Tensor p = Tanh(t);
+    const float *dptr = p.data<float>();
+    float tol = acc == singa::kMathLow ? 1e-4f : 1e-6f;
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_NEAR(std::tanh(x[i]), dptr[i], tol);
+  }
+}
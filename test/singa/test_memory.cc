@@ -19,8 +19,12 @@
  *
  *************************************************************/
 
+#include <cstdint>
+
 #include "gtest/gtest.h"
+#include "singa/core/device.h"
 #include "singa/core/memory.h"
+#include "singa/core/tensor.h"
 #include "singa/singa_config.h"
 #include "singa/utils/cuda_utils.h"
 #include "singa/utils/logging.h"
@@ -97,3 +101,108 @@ TEST(MemPool, CompareCudaCnmem) {
   EXPECT_GE(cuda_time, cn_time);
 }
 #endif  // USE_CUDA
+
+TEST(CppMemPool, SizeClass) {
+  using singa::CppMemPool;
+  EXPECT_EQ(64u, CppMemPool::SizeClass(1));
+  EXPECT_EQ(64u, CppMemPool::SizeClass(64));
+  EXPECT_EQ(128u, CppMemPool::SizeClass(65));
+  EXPECT_EQ(640u, CppMemPool::SizeClass(600));
+  EXPECT_EQ(1024u, CppMemPool::SizeClass(1000));
+  EXPECT_EQ(1280u, CppMemPool::SizeClass(1025));
+  for (size_t size = 1; size < (1u << 20); size = size * 3 + 1) {
+    size_t cls = CppMemPool::SizeClass(size);
+    EXPECT_GE(cls, size);
+    EXPECT_EQ(0u, cls % 64);
+    if (size > 64) {
+      EXPECT_LE(cls, size + size / 4 + 64);
+    }
+  }
+}
+
+TEST(CppMemPool, Reuse) {
+  singa::CppMemPool pool;
+  void *a = nullptr, *b = nullptr, *c = nullptr;
+  pool.Malloc(&a, 1000);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(a) % 64);
+  EXPECT_EQ(std::make_pair(size_t(0), size_t(1024)), pool.GetMemUsage());
+  pool.Free(a);
+  EXPECT_EQ(std::make_pair(size_t(1024), size_t(1024)), pool.GetMemUsage());
+  // the same size class
+  pool.Malloc(&b, 900);
+  EXPECT_EQ(a, b);
+  pool.Malloc(&c, 1000);
+  EXPECT_NE(b, c);
+  EXPECT_EQ(3u, pool.num_mallocs());
+  EXPECT_EQ(1u, pool.num_hits());
+  EXPECT_EQ(2048u, pool.peak_usage());
+  pool.Free(b);
+  pool.Free(c);
+  pool.ReleaseCache();
+  EXPECT_EQ(std::make_pair(size_t(0), size_t(0)), pool.GetMemUsage());
+}
+
+TEST(CppMemPool, Options) {
+  singa::CppMemPool pool(true, true, 4096);
+  void *a = nullptr, *b = nullptr;
+  pool.Malloc(&a, 3u << 20);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(a) % (2u << 20));
+  memset(a, 1, 100);
+  pool.Free(a);
+  // larger than the cache limit
+  EXPECT_EQ(std::make_pair(size_t(0), size_t(0)), pool.GetMemUsage());
+
+  pool.Malloc(&a, 100);
+  memset(a, 1, 100);
+  pool.Free(a);
+  pool.Malloc(&b, 100);
+  EXPECT_EQ(a, b);
+  for (int i = 0; i < 100; i++)
+    EXPECT_EQ(0, static_cast<const char *>(b)[i]);
+  pool.Free(b);
+}
+
+TEST(CppMemPool, CppCPU) {
+  auto pool = std::make_shared<singa::CppMemPool>();
+  auto dev = std::make_shared<singa::CppCPU>(pool);
+  {
+    singa::Tensor t(singa::Shape{250}, dev);
+    t.SetValue(1.0f);
+    EXPECT_EQ(1024u, dev->GetAllocatedMem());
+  }
+  EXPECT_EQ(0u, dev->GetAllocatedMem());
+  singa::Tensor t(singa::Shape{256}, dev);
+  t.SetValue(1.0f);
+  EXPECT_EQ(1u, pool->num_hits());
+}
+
+TEST(CppMemPool, CacheLimit) {
+  singa::CppMemPool pool;
+  void *a = nullptr, *b = nullptr;
+  pool.Malloc(&a, 1024);
+  pool.Malloc(&b, 4096);
+  pool.Free(a);
+  pool.Free(b);
+  EXPECT_EQ(5120u, pool.GetMemUsage().first);
+  // trim the cache to the new cap, then keep it below the cap
+  pool.SetMaxCacheSize(4096);
+  EXPECT_LE(pool.GetMemUsage().first, 4096u);
+  pool.Malloc(&a, 8192);
+  pool.Free(a);
+  EXPECT_LE(pool.GetMemUsage().first, 4096u);
+  pool.ReleaseCache();
+  EXPECT_EQ(std::make_pair(size_t(0), size_t(0)), pool.GetMemUsage());
+
+  auto dev = std::make_shared<singa::CppCPU>();
+  auto dpool = std::dynamic_pointer_cast<singa::CppMemPool>(dev->pool());
+  ASSERT_NE(nullptr, dpool);
+  EXPECT_EQ(singa::CppMemPool::DefaultMaxCacheSize(), dpool->max_cache_size());
+  EXPECT_GT(dpool->max_cache_size(), 0u);
+  {
+    singa::Tensor t(singa::Shape{256}, dev);
+    t.SetValue(1.0f);
+  }
+  EXPECT_EQ(1024u, dpool->GetMemUsage().first);
+  dev->ReleaseCache();
+  EXPECT_EQ(0u, dpool->GetMemUsage().first);
+}
@@ -85,4 +85,120 @@ TEST(DNNLOperationBatchNorm, Backward) {
                                        moving_mean, moving_var);
 }
 
+#else  // native cpp
+
+#include <cmath>
+#include <vector>
+
+#include "singa/core/device.h"
+
+namespace {
+const size_t kN = 3, kC = 4, kH = 2, kW = 3, kS = kH * kW;
+
+std::vector<float> Channel(const float *x, size_t c) {
+  std::vector<float> v;
+  for (size_t n = 0; n < kN; n++)
+    for (size_t i = 0; i < kS; i++) v.push_back(x[(n * kC + c) * kS + i]);
+  return v;
+}
+}  // namespace
+
+TEST(CppOperationBatchNorm, ForwardTraining) {
+  auto dev = std::make_shared<CppCPU>();
+  dev->SetNumThreads(3);
+  std::vector<float> x(kN * kC * kS);
+  for (size_t i = 0; i < x.size(); i++) x[i] = (i * 7 % 11) * 0.3f - 1.0f;
+  Tensor in(Shape{kN, kC, kH, kW}, dev);
+  in.CopyDataFromHostPtr(x.data(), x.size());
+  const float s[kC] = {1.0f, 2.0f, 0.5f, -1.0f}, b[kC] = {0.f, 1.f, 2.f, 3.f};
+  Tensor scale(Shape{kC}, dev), bias(Shape{kC}, dev);
+  scale.CopyDataFromHostPtr(s, kC);
+  bias.CopyDataFromHostPtr(b, kC);
+  Tensor rm(Shape{kC}, dev), rv(Shape{kC}, dev);
+  rm.SetValue(0.f);
+  rv.SetValue(1.f);
+
+  BatchNormHandle handle(0.1f, in);
+  auto ret = CpuBatchNormForwardTraining(handle, in, scale, bias, rm, rv);
+  const float *yptr = ret[0].data<float>();
+  const float *mptr = ret[1].data<float>();
+  const float *vptr = ret[2].data<float>();
+  const float *rmptr = rm.data<float>();
+  const float *rvptr = rv.data<float>();
+  for (size_t c = 0; c < kC; c++) {
+    auto v = Channel(x.data(), c);
+    float mean = 0.f, var = 0.f;
+    for (float e : v) mean += e / v.size();
+    for (float e : v) var += (e - mean) * (e - mean) / v.size();
+    EXPECT_NEAR(mean, mptr[c], 1e-5f);
+    EXPECT_NEAR(var, vptr[c], 1e-5f);
+    EXPECT_NEAR(0.1f * mean, rmptr[c], 1e-5f);
+    EXPECT_NEAR(0.9f + 0.1f * var * v.size() / (v.size() - 1), rvptr[c],
+                1e-5f);
+    auto y = Channel(yptr, c);
+    for (size_t i = 0; i < v.size(); i++)
+      EXPECT_NEAR((v[i] - mean) / std::sqrt(var + 1e-5f) * s[c] + b[c], y[i],
+                  1e-4f);
+  }
+
+  Tensor out = CpuBatchNormForwardInference(handle, in, scale, bias, rm, rv);
+  const float *optr = out.data<float>();
+  for (size_t i = 0; i < x.size(); i++) {
+    size_t c = i / kS % kC;
+    EXPECT_NEAR((x[i] - rmptr[c]) / std::sqrt(rvptr[c] + 1e-5f) * s[c] + b[c],
+                optr[i], 1e-4f);
+  }
+}
+
+TEST(CppOperationBatchNorm, Backward) {
+  // check the gradient of L = sum(y * w) by finite difference
+  std::vector<float> x(kN * kC * kS), w(x.size());
+  for (size_t i = 0; i < x.size(); i++) {
+    x[i] = (i * 7 % 11) * 0.3f - 1.0f;
+    w[i] = (i * 5 % 13) * 0.1f - 0.6f;
+  }
+  const float s[kC] = {1.0f, 2.0f, 0.5f, -1.0f}, b[kC] = {0.f, 1.f, 2.f, 3.f};
+  Tensor in(Shape{kN, kC, kH, kW}), dy(Shape{kN, kC, kH, kW});
+  in.CopyDataFromHostPtr(x.data(), x.size());
+  dy.CopyDataFromHostPtr(w.data(), w.size());
+  Tensor scale(Shape{kC}), bias(Shape{kC}), rm(Shape{kC}), rv(Shape{kC});
+  scale.CopyDataFromHostPtr(s, kC);
+  bias.CopyDataFromHostPtr(b, kC);
+  BatchNormHandle handle(0.1f, in);
+  auto loss = [&](const std::vector<float> &xv) {
+    in.CopyDataFromHostPtr(xv.data(), xv.size());
+    auto ret = CpuBatchNormForwardTraining(handle, in, scale, bias, rm, rv);
+    const float *yptr = ret[0].data<float>();
+    double l = 0;
+    for (size_t i = 0; i < xv.size(); i++) l += yptr[i] * w[i];
+    return l;
+  };
+
+  loss(x);
+  auto ret = CpuBatchNormForwardTraining(handle, in, scale, bias, rm, rv);
+  auto grads = CpuBatchNormBackwardx(handle, ret[0], dy, in, scale, bias,
+                                     ret[1], ret[2]);
+  const float *dxptr = grads[0].data<float>();
+  const float *dsptr = grads[1].data<float>();
+  const float *dbptr = grads[2].data<float>();
+  const float eps = 1e-2f;
+  for (size_t i = 0; i < x.size(); i += 5) {
+    auto xp = x, xm = x;
+    xp[i] += eps;
+    xm[i] -= eps;
+    EXPECT_NEAR((loss(xp) - loss(xm)) / (2 * eps), dxptr[i], 2e-2);
+  }
+  for (size_t c = 0; c < kC; c++) {
+    auto wc = Channel(w.data(), c);
+    float db = 0.f;
+    for (float e : wc) db += e;
+    EXPECT_NEAR(db, dbptr[c], 1e-4f);
+    // dscale = sum(dy * (y - bias) / scale)
+    auto y = Channel(ret[0].data<float>(), c);
+    float ds = 0.f;
+    for (size_t i = 0; i < y.size(); i++) ds += wc[i] * (y[i] - b[c]) / s[c];
+    EXPECT_NEAR(ds, dsptr[c], 1e-4f);
+  }
+}
+
 #endif  // USE_DNNL
@@ -240,6 +240,101 @@ TEST(DNNLOperation_Convolution, Backward) {
   EXPECT_FLOAT_EQ(dy[0] * x[4] + dy[4] * x[13], dwptr[8]);
 }
 
+#else  // native cpp
+
+#include <vector>
+
+#include "singa/core/device.h"
+
+namespace {
+// direct convolution as the reference; returns y, and dx and dW for dy = 1
+void NaiveConv(const std::vector<float> &x, const std::vector<float> &w,
+               const std::vector<float> &b, size_t n, size_t c, size_t h,
+               size_t wd, size_t f, size_t k, size_t s, size_t p, size_t g,
+               std::vector<float> *y, std::vector<float> *dx,
+               std::vector<float> *dw) {
+  size_t oh = (h + 2 * p - k) / s + 1, ow = (wd + 2 * p - k) / s + 1;
+  size_t cg = c / g, fg = f / g;
+  y->assign(n * f * oh * ow, 0.f);
+  dx->assign(x.size(), 0.f);
+  dw->assign(w.size(), 0.f);
+  for (size_t i = 0; i < n; i++)
+    for (size_t o = 0; o < f; o++)
+      for (size_t r = 0; r < oh; r++)
+        for (size_t q = 0; q < ow; q++) {
+          float sum = b.empty() ? 0.f : b[o];
+          for (size_t ci = 0; ci < cg; ci++)
+            for (size_t kh = 0; kh < k; kh++)
+              for (size_t kw = 0; kw < k; kw++) {
+                long ih = (long)(r * s + kh) - (long)p;
+                long iw = (long)(q * s + kw) - (long)p;
+                if (ih < 0 || ih >= (long)h || iw < 0 || iw >= (long)wd)
+                  continue;
+                size_t xi = ((i * c + o / fg * cg + ci) * h + ih) * wd + iw;
+                size_t wi = ((o * cg + ci) * k + kh) * k + kw;
+                sum += x[xi] * w[wi];
+                (*dx)[xi] += w[wi];
+                (*dw)[wi] += x[xi];
+              }
+          (*y)[((i * f + o) * oh + r) * ow + q] = sum;
+        }
+}
+
+void CheckConv(size_t n, size_t c, size_t h, size_t f, size_t k, size_t s,
+               size_t p, size_t g, bool bias_flag, int num_threads) {
+  auto dev = std::make_shared<CppCPU>();
+  dev->SetNumThreads(num_threads);
+  std::vector<float> x(n * c * h * h), w(f * c / g * k * k), b;
+  for (size_t i = 0; i < x.size(); i++) x[i] = (i % 7) * 0.5f - 1.f;
+  for (size_t i = 0; i < w.size(); i++) w[i] = (i % 5) * 0.25f - 0.5f;
+  if (bias_flag)
+    for (size_t i = 0; i < f; i++) b.push_back(0.1f * i);
+  std::vector<float> y, dx, dw;
+  NaiveConv(x, w, b, n, c, h, h, f, k, s, p, g, &y, &dx, &dw);
+
+  Tensor in(Shape{n, c, h, h}, dev);
+  in.CopyDataFromHostPtr(x.data(), x.size());
+  Tensor weight(Shape{f, c / g, k, k}, dev);
+  weight.CopyDataFromHostPtr(w.data(), w.size());
+  Tensor bias(Shape{f}, dev);
+  bias.SetValue(0.f);
+  if (bias_flag) bias.CopyDataFromHostPtr(b.data(), f);
+
+  ConvHandle ch(in, {k, k}, {s, s}, {p, p}, c, f, bias_flag, g);
+  Tensor out = CpuConvForward(in, weight, bias, ch);
+  ASSERT_EQ(y.size(), out.Size());
+  const float *yptr = out.data<float>();
+  for (size_t i = 0; i < y.size(); i++) EXPECT_NEAR(y[i], yptr[i], 1e-4f);
+
+  Tensor grad(out.shape(), dev);
+  grad.SetValue(1.f);
+  Tensor in_grad = CpuConvBackwardx(grad, weight, in, ch);
+  const float *dxptr = in_grad.data<float>();
+  for (size_t i = 0; i < dx.size(); i++) EXPECT_NEAR(dx[i], dxptr[i], 1e-4f);
+  Tensor w_grad = CpuConvBackwardW(grad, in, weight, ch);
+  const float *dwptr = w_grad.data<float>();
+  for (size_t i = 0; i < dw.size(); i++) EXPECT_NEAR(dw[i], dwptr[i], 1e-3f);
+}
+}  // namespace
+
+TEST(CppOperation_Convolution, Padding) {
+  CheckConv(2, 3, 5, 4, 3, 1, 1, 1, true, 1);
+}
+
+TEST(CppOperation_Convolution, StrideMultiThread) {
+  CheckConv(5, 2, 7, 3, 3, 2, 1, 1, false, 3);
+}
+
+TEST(CppOperation_Convolution, Group) {
+  CheckConv(3, 4, 6, 6, 3, 2, 1, 2, true, 2);
+  // depthwise
+  CheckConv(2, 4, 5, 4, 3, 1, 1, 4, true, 2);
+}
+
+TEST(CppOperation_Convolution, Pointwise) {
+  CheckConv(4, 6, 4, 4, 1, 1, 0, 2, true, 3);
+}
+
 #endif  // USE_DNNL
 
 #endif  // USE_CBLAS
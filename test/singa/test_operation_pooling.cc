@@ -95,4 +95,62 @@ TEST(DNNLOperationPooling, BackwardAvg) {
   Tensor in_grad = CpuPoolingBackward(pool_handle, grad, in, out);
 }
 
+#else  // native cpp
+
+#include "singa/core/device.h"
+
+TEST(CppOperationPooling, MaxPadding) {
+  const size_t batchsize = 2, c = 1, h = 3, w = 3;
+  const float x[batchsize * c * h * w] = {1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f,
+                                          7.0f, 8.0f, 9.0f, 9.0f, 8.0f, 7.0f,
+                                          6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f};
+  auto dev = std::make_shared<CppCPU>();
+  dev->SetNumThreads(2);
+  Tensor in(Shape{batchsize, c, h, w}, dev);
+  in.CopyDataFromHostPtr(x, batchsize * c * h * w);
+
+  PoolingHandle pool_handle(in, {2, 2}, {2, 2}, {1, 1}, true);
+  Tensor out = CpuPoolingForward(pool_handle, in);
+  EXPECT_EQ(Shape({2, 1, 2, 2}), out.shape());
+  const float *yptr = out.data<float>();
+  const float y[] = {1.0f, 3.0f, 7.0f, 9.0f, 9.0f, 8.0f, 6.0f, 5.0f};
+  for (size_t i = 0; i < 8; i++) EXPECT_FLOAT_EQ(y[i], yptr[i]);
+
+  const float dy[] = {0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f};
+  Tensor grad(out.shape(), dev);
+  grad.CopyDataFromHostPtr(dy, 8);
+  Tensor in_grad = CpuPoolingBackward(pool_handle, grad, in, out);
+  const float *dxptr = in_grad.data<float>();
+  const float dx[] = {0.1f, 0.0f, 0.2f, 0.0f, 0.0f, 0.0f, 0.3f, 0.0f, 0.4f,
+                      0.5f, 0.6f, 0.0f, 0.7f, 0.8f, 0.0f, 0.0f, 0.0f, 0.0f};
+  for (size_t i = 0; i < 18; i++) EXPECT_FLOAT_EQ(dx[i], dxptr[i]);
+}
+
+TEST(CppOperationPooling, AvgExcludePadding) {
+  const size_t batchsize = 1, c = 2, h = 3, w = 3;
+  const float x[batchsize * c * h * w] = {1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f,
+                                          7.0f, 8.0f, 9.0f, 1.0f, 1.0f, 1.0f,
+                                          1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+  Tensor in(Shape{batchsize, c, h, w});
+  in.CopyDataFromHostPtr(x, batchsize * c * h * w);
+
+  PoolingHandle pool_handle(in, {3, 3}, {2, 2}, {1, 1}, false);
+  Tensor out = CpuPoolingForward(pool_handle, in);
+  EXPECT_EQ(Shape({1, 2, 2, 2}), out.shape());
+  const float *yptr = out.data<float>();
+  const float y[] = {3.0f, 4.0f, 6.0f, 7.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+  for (size_t i = 0; i < 8; i++) EXPECT_FLOAT_EQ(y[i], yptr[i]);
+
+  Tensor grad(out.shape());
+  grad.SetValue(4.0f);
+  Tensor in_grad = CpuPoolingBackward(pool_handle, grad, in, out);
+  // every window covers 4 inputs; the center is covered by all 4 windows
+  const float *dxptr = in_grad.data<float>();
+  const float dx[] = {1.0f, 2.0f, 1.0f, 2.0f, 4.0f, 2.0f, 1.0f, 2.0f, 1.0f};
+  for (size_t i = 0; i < 9; i++) {
+    EXPECT_FLOAT_EQ(dx[i], dxptr[i]);
+    EXPECT_FLOAT_EQ(dx[i], dxptr[i + 9]);
+  }
+}
+
 #endif  // USE_DNNL
@@ -0,0 +1,184 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+#include <cmath>
+#include <vector>
+
+#include "../src/model/operation/quantization.h"
+#include "gtest/gtest.h"
+
+using namespace singa;
+
+namespace {
+Tensor Sequence(const Shape &shape, float scale, float offset) {
+  Tensor t(shape);
+  std::vector<float> v(t.Size());
+  for (size_t i = 0; i < v.size(); i++)
+    v[i] = (static_cast<int>(i * 37 % 101) - 50) * scale + offset;
+  t.CopyDataFromHostPtr(v.data(), v.size());
+  return t;
+}
+
+void ExpectNear(const Tensor &expected, const Tensor &actual, float tol) {
+  ASSERT_EQ(expected.shape(), actual.shape());
+  Tensor e = Contiguous(expected), a = Contiguous(actual);
+  const float *eptr = e.data<float>(), *aptr = a.data<float>();
+  for (size_t i = 0; i < e.Size(); i++) EXPECT_NEAR(eptr[i], aptr[i], tol);
+}
+}  // namespace
+
+TEST(OperationQuantization, ChooseQuantParams) {
+  QuantParams p = ChooseQuantParams(-1.f, 3.f);
+  EXPECT_FLOAT_EQ(4.f / 255, p.scale[0]);
+  EXPECT_EQ(-64, p.zero_point[0]);
+  // the range is extended to include 0
+  p = ChooseQuantParams(1.f, 2.f);
+  EXPECT_EQ(-128, p.zero_point[0]);
+  p = ChooseQuantParams(-3.f, 1.f, true);
+  EXPECT_FLOAT_EQ(3.f / 127, p.scale[0]);
+  EXPECT_EQ(0, p.zero_point[0]);
+  p = ChooseQuantParams(0.f, 0.f);
+  EXPECT_EQ(1.f, p.scale[0]);
+
+  p = ChooseQuantParams({-1.f, -2.f}, {1.f, 4.f}, 0);
+  EXPECT_EQ(0, p.axis);
+  EXPECT_FLOAT_EQ(1.f / 127, p.scale[0]);
+  EXPECT_FLOAT_EQ(4.f / 127, p.scale[1]);
+}
+
+TEST(OperationQuantization, QuantizeDequantize) {
+  Tensor x = Sequence(Shape{40, 1000}, 0.05f, 0.5f);
+  QuantParams p = ChooseQuantParams(-2.f, 3.f);
+  QuantizedTensor q = Quantize(x, p);
+  EXPECT_EQ(kChar, q.data.data_type());
+  ExpectNear(x, Dequantize(q), p.scale[0] / 2 + 1e-6f);
+
+  // 0 is exact, and the values out of range saturate
+  Tensor y(Shape{3});
+  const float v[3] = {0.f, 100.f, -100.f};
+  y.CopyDataFromHostPtr(v, 3);
+  Tensor d = Dequantize(Quantize(y, p));
+  EXPECT_EQ(0.f, d.data<float>()[0]);
+  EXPECT_NEAR(3.f, d.data<float>()[1], p.scale[0]);
+  EXPECT_NEAR(-2.f, d.data<float>()[2], p.scale[0]);
+
+  // per channel along axis 1 of a transposed (strided) tensor
+  Tensor t = Transpose(Sequence(Shape{5, 3}, 0.02f, 0.f));
+  QuantParams pc = ChooseQuantParams({-1.f, -2.f, -3.f, -4.f, -5.f},
+                                     {1.f, 2.f, 3.f, 4.f, 5.f}, 1);
+  QuantizedTensor qc = Quantize(t, pc);
+  Tensor dc = Dequantize(qc);
+  Tensor tc = Contiguous(t);
+  for (size_t i = 0; i < 3; i++)
+    for (size_t c = 0; c < 5; c++)
+      EXPECT_NEAR(tc.data<float>()[i * 5 + c], dc.data<float>()[i * 5 + c],
+                  pc.scale[c] / 2 + 1e-6f);
+}
+
+TEST(OperationQuantization, MultInt8) {
+  const size_t M = 9, K = 70, N = 33;
+  QuantParams p = ChooseQuantParams(-128.f, 127.f);
+  p.scale[0] = 1.f;
+  p.zero_point[0] = 0;
+  Tensor a = Sequence(Shape{M, K}, 2.f, 0.f);
+  Tensor b = Sequence(Shape{K, N}, 3.f, 0.f);
+  Tensor c = MultInt8(Quantize(a, p).data, Quantize(b, p).data);
+  EXPECT_EQ(kInt, c.data_type());
+  Tensor expected = Mult(Dequantize(Quantize(a, p)),
+                         Dequantize(Quantize(b, p)));
+  ExpectNear(expected, c.AsType(kFloat32), 0.f);
+}
+
+TEST(OperationQuantization, Dense) {
+  const size_t M = 6, K = 50, N = 19;
+  Tensor x = Sequence(Shape{M, K}, 0.02f, 0.3f);
+  Tensor W = Sequence(Shape{K, N}, 0.01f, -0.1f);
+  Tensor b = Sequence(Shape{N}, 0.1f, 0.f);
+  QuantizedTensor qx = Quantize(x, ChooseQuantParams(-1.f, 1.5f));
+  std::vector<float> lo(N), hi(N);
+  for (size_t j = 0; j < N; j++) {
+    lo[j] = -0.6f - 0.01f * j;
+    hi[j] = 0.4f + 0.02f * j;
+  }
+  // asymmetric per channel weights, to cover all the zero point terms
+  for (bool symmetric : {true, false}) {
+    QuantizedTensor qw =
+        Quantize(W, ChooseQuantParams(lo, hi, 1, symmetric));
+    Tensor expected = Mult(Dequantize(qx), Dequantize(qw));
+    Tensor y = QuantizedDense(qx, qw, Tensor());
+    ExpectNear(expected, y, 1e-4f);
+    AddRow(b, &expected);
+    ExpectNear(expected, QuantizedDense(qx, qw, b), 1e-4f);
+    // and close to the float32 result
+    Tensor ref = Mult(x, W);
+    AddRow(b, &ref);
+    ExpectNear(ref, QuantizedDense(qx, qw, b), 0.2f);
+  }
+}
+
+TEST(OperationQuantization, ConvForward) {
+  const size_t batch = 3, c = 4, h = 7, w = 6, f = 6;
+  Tensor x = Sequence(Shape{batch, c, h, w}, 0.03f, 0.2f);
+  Tensor b = Sequence(Shape{f}, 0.1f, 0.f);
+  QuantizedTensor qx = Quantize(x, ChooseQuantParams(-1.5f, 2.f));
+  Tensor dx = Dequantize(qx);
+  std::vector<float> lo(f), hi(f);
+  for (size_t j = 0; j < f; j++) {
+    lo[j] = -0.4f - 0.1f * j;
+    hi[j] = 0.5f;
+  }
+  struct Case {
+    size_t kernel, stride, pad, group;
+  };
+  // padded and strided, grouped, and pointwise
+  for (const Case &cs :
+       {Case{3, 2, 1, 1}, Case{3, 1, 1, 2}, Case{1, 1, 0, 1}}) {
+    ConvHandle ch(x, {cs.kernel, cs.kernel}, {cs.stride, cs.stride},
+                  {cs.pad, cs.pad}, c, f, true, cs.group);
+    Tensor W = Sequence(Shape{f, c / cs.group, cs.kernel, cs.kernel}, 0.01f,
+                        0.f);
+    for (bool symmetric : {true, false}) {
+      QuantizedTensor qw =
+          Quantize(W, ChooseQuantParams(lo, hi, 0, symmetric));
+      Tensor dw = Dequantize(qw);
+      Tensor expected = CpuConvForward(dx, dw, b, ch);
+      ExpectNear(expected, QuantizedConvForward(qx, qw, b, ch), 1e-4f);
+    }
+  }
+}
+
+TEST(OperationQuantization, Calibrate) {
+  FeedForwardNet net;
+  LayerConf conf;
+  conf.set_type("singa_relu");
+  conf.set_name("relu");
+  const Shape shape{4};
+  net.Add(conf, &shape);
+  std::vector<Tensor> batches{Sequence(Shape{2, 4}, 0.1f, 0.f),
+                              Sequence(Shape{2, 4}, 0.1f, 1.f)};
+  std::vector<RangeObserver> obs = Calibrate(&net, batches);
+  ASSERT_EQ(2u, obs.size());
+  EXPECT_NEAR(-5.f, obs[0].min(), 1e-5f);
+  EXPECT_NEAR(4.4f, obs[0].max(), 1e-5f);
+  EXPECT_EQ(0.f, obs[1].min());
+  EXPECT_EQ(obs[0].max(), obs[1].max());
+  QuantParams p = obs[1].Params();
+  EXPECT_EQ(-128, p.zero_point[0]);
+}
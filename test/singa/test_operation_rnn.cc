@@ -18,6 +18,9 @@
  * under the License.
  *
  *************************************************************/
+#include <cmath>
+#include <functional>
+
 #include "../src/model/operation/rnn.h"
 #include "gtest/gtest.h"
 #include "singa/core/tensor.h"
@@ -139,3 +142,174 @@ TEST(OperationRNNEx, tranining) {
 }
 
 #endif  // USE_CUDNN
+
+namespace {
+std::vector<float> Values(const Tensor &t) {
+  const float *p = t.data<float>();
+  return std::vector<float>(p, p + t.Size());
+}
+
+Tensor RandomTensor(const Shape &shape, std::shared_ptr<Device> dev,
+                    float std) {
+  Tensor t(shape, dev);
+  Gaussian(0.0f, std, &t);
+  return t;
+}
+
+double Dot(const Tensor &a, const Tensor &b) {
+  auto va = Values(a), vb = Values(b);
+  double sum = 0;
+  for (size_t i = 0; i < va.size(); i++) sum += double(va[i]) * vb[i];
+  return sum;
+}
+
+// compare grad with the central differences of loss w.r.t. every element of
+// param
+void CheckGradient(Tensor *param, const Tensor &grad,
+                   const std::function<double()> &loss) {
+  auto v = Values(*param), g = Values(grad);
+  ASSERT_EQ(v.size(), g.size());
+  const float eps = 1e-2f;
+  for (size_t i = 0; i < v.size(); i++) {
+    float orig = v[i];
+    v[i] = orig + eps;
+    param->CopyDataFromHostPtr(v.data(), v.size());
+    double lp = loss();
+    v[i] = orig - eps;
+    param->CopyDataFromHostPtr(v.data(), v.size());
+    double lm = loss();
+    v[i] = orig;
+    param->CopyDataFromHostPtr(v.data(), v.size());
+    EXPECT_NEAR((lp - lm) / (2 * eps), g[i], 2e-3 + 1e-2 * std::fabs(g[i]))
+        << "element " << i;
+  }
+}
+
+// check all gradients of the loss <y, gy> + <hy, ghy> + <cy, gcy>
+void CheckRNNGradients(int mode, int num_layers, int bidirectional,
+                       std::vector<int> lengths) {
+  auto dev = std::make_shared<CppCPU>();
+  dev->SetNumThreads(3);
+  const size_t T = 4, B = lengths.size(), F = 2, H = 3;
+  const size_t D = bidirectional ? 2 : 1;
+  Shape s_s{num_layers * D, B, H};
+
+  Tensor x = RandomTensor(Shape{T, B, F}, dev, 1.0f);
+  CpuRNNHandle h(x, H, mode, num_layers, 1, 0.0f, bidirectional);
+  Tensor W = RandomTensor(Shape{h.weights_size}, dev, 0.5f);
+  Tensor hx = RandomTensor(s_s, dev, 0.5f), cx = RandomTensor(s_s, dev, 0.5f);
+  Tensor gy = RandomTensor(Shape{T, B, D * H}, dev, 1.0f);
+  Tensor ghy = RandomTensor(s_s, dev, 1.0f), gcy = RandomTensor(s_s, dev, 1.0f);
+  Tensor seq_lengths(Shape{B}, dev, kInt);
+  seq_lengths.CopyDataFromHostPtr(lengths.data(), B);
+
+  auto out = CpuRNNForwardTrainingEx(x, hx, cx, W, seq_lengths, h);
+  auto dxs = CpuRNNBackwardxEx(out[0], gy, ghy, gcy, W, hx, cx, seq_lengths, h);
+  Tensor dW = CpuRNNBackwardWEx(x, hx, out[0], seq_lengths, h);
+
+  auto loss = [&]() {
+    auto o = CpuRNNForwardInferenceEx(x, hx, cx, W, seq_lengths, h);
+    return Dot(o[0], gy) + Dot(o[1], ghy) + Dot(o[2], gcy);
+  };
+  CheckGradient(&x, dxs[0], loss);
+  CheckGradient(&hx, dxs[1], loss);
+  if (mode == 2) CheckGradient(&cx, dxs[2], loss);
+  CheckGradient(&W, dW, loss);
+}
+}  // namespace
+
+TEST(CpuOperationRNN, LSTMStep) {
+  auto dev = std::make_shared<CppCPU>();
+  const size_t F = 3, H = 2;
+  Tensor x = RandomTensor(Shape{1, 1, F}, dev, 1.0f);
+  Tensor hx = RandomTensor(Shape{1, 1, H}, dev, 1.0f);
+  Tensor cx = RandomTensor(Shape{1, 1, H}, dev, 1.0f);
+  CpuRNNHandle h(x, H, 2);
+  EXPECT_EQ(4u * (H * F + H * H + 2 * H), h.weights_size);
+  Tensor W = RandomTensor(Shape{h.weights_size}, dev, 1.0f);
+  auto out = CpuRNNForwardInference(x, hx, cx, W, h);
+
+  auto vx = Values(x), vh = Values(hx), vc = Values(cx);
+  std::vector<float> gates[4];
+  for (int k = 0; k < 4; k++) {
+    auto w = Values(CpuRNNGetParamCopy(k, 0, W, false, h));
+    auto r = Values(CpuRNNGetParamCopy(k + 4, 0, W, false, h));
+    auto bw = Values(CpuRNNGetParamCopy(k, 0, W, true, h));
+    auto br = Values(CpuRNNGetParamCopy(k + 4, 0, W, true, h));
+    for (size_t i = 0; i < H; i++) {
+      float a = bw[i] + br[i];
+      for (size_t j = 0; j < F; j++) a += w[i * F + j] * vx[j];
+      for (size_t j = 0; j < H; j++) a += r[i * H + j] * vh[j];
+      gates[k].push_back(k == 2 ? std::tanh(a) : 1.f / (1.f + std::exp(-a)));
+    }
+  }
+  auto y = Values(out[0]), hy = Values(out[1]), cy = Values(out[2]);
+  for (size_t i = 0; i < H; i++) {
+    float c = gates[1][i] * vc[i] + gates[0][i] * gates[2][i];
+    float hn = gates[3][i] * std::tanh(c);
+    EXPECT_NEAR(c, cy[i], 1e-5);
+    EXPECT_NEAR(hn, hy[i], 1e-5);
+    EXPECT_NEAR(hn, y[i], 1e-5);
+  }
+}
+
+TEST(CpuOperationRNN, GradientTanh) { CheckRNNGradients(1, 1, 0, {4, 4, 4}); }
+
+TEST(CpuOperationRNN, GradientLSTM) { CheckRNNGradients(2, 2, 1, {4, 4, 4}); }
+
+TEST(CpuOperationRNN, GradientGRU) { CheckRNNGradients(3, 2, 1, {4, 4, 4}); }
+
+TEST(CpuOperationRNN, GradientVariableLength) {
+  CheckRNNGradients(2, 1, 1, {2, 4, 0});
+  CheckRNNGradients(3, 2, 0, {3, 1, 4});
+}
+
+// a padded batch gives the same results as running each sequence alone
+TEST(CpuOperationRNN, VariableLengthForward) {
+  auto dev = std::make_shared<CppCPU>();
+  dev->SetNumThreads(2);
+  const size_t T = 5, F = 3, H = 4, L = 2, D = 2;
+  std::vector<int> lengths{2, 5, 3};
+  const size_t B = lengths.size();
+  Tensor x = RandomTensor(Shape{T, B, F}, dev, 1.0f);
+  Tensor hx = RandomTensor(Shape{L * D, B, H}, dev, 1.0f);
+  Tensor cx = RandomTensor(Shape{L * D, B, H}, dev, 1.0f);
+  Tensor seq_lengths(Shape{B}, dev, kInt);
+  seq_lengths.CopyDataFromHostPtr(lengths.data(), B);
+  CpuRNNHandle h(x, H, 2, L, 1, 0.0f, 1);
+  Tensor W = RandomTensor(Shape{h.weights_size}, dev, 0.5f);
+  auto out = CpuRNNForwardInferenceEx(x, hx, cx, W, seq_lengths, h);
+  auto y = Values(out[0]), hy = Values(out[1]), cy = Values(out[2]);
+
+  auto vx = Values(x), vh = Values(hx), vc = Values(cx);
+  for (size_t b = 0; b < B; b++) {
+    size_t len = lengths[b];
+    std::vector<float> xb, hb, cb;
+    for (size_t t = 0; t < len; t++)
+      xb.insert(xb.end(), vx.begin() + (t * B + b) * F,
+                vx.begin() + (t * B + b + 1) * F);
+    for (size_t p = 0; p < L * D; p++) {
+      hb.insert(hb.end(), vh.begin() + (p * B + b) * H,
+                vh.begin() + (p * B + b + 1) * H);
+      cb.insert(cb.end(), vc.begin() + (p * B + b) * H,
+                vc.begin() + (p * B + b + 1) * H);
+    }
+    Tensor xs(Shape{len, 1, F}, dev), hs(Shape{L * D, 1, H}, dev),
+        cs(Shape{L * D, 1, H}, dev);
+    xs.CopyDataFromHostPtr(xb.data(), xb.size());
+    hs.CopyDataFromHostPtr(hb.data(), hb.size());
+    cs.CopyDataFromHostPtr(cb.data(), cb.size());
+    CpuRNNHandle hb_handle(xs, H, 2, L, 1, 0.0f, 1);
+    auto ref = CpuRNNForwardInference(xs, hs, cs, W, hb_handle);
+    auto ry = Values(ref[0]), rhy = Values(ref[1]), rcy = Values(ref[2]);
+    for (size_t t = 0; t < T; t++)
+      for (size_t k = 0; k < D * H; k++)
+        EXPECT_NEAR(t < len ? ry[t * D * H + k] : 0.f,
+                    y[(t * B + b) * D * H + k], 1e-5);
+    for (size_t p = 0; p < L * D; p++)
+      for (size_t k = 0; k < H; k++) {
+        EXPECT_NEAR(rhy[p * H + k], hy[(p * B + b) * H + k], 1e-5);
+        EXPECT_NEAR(rcy[p * H + k], cy[(p * B + b) * H + k], 1e-5);
+      }
+  }
+}
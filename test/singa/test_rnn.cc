@@ -0,0 +1,143 @@
+/************************************************************
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ *************************************************************/
+
+#include "../src/model/layer/rnn.h"
+#include "gtest/gtest.h"
+
+using singa::RNN;
+using singa::Shape;
+using singa::Tensor;
+class TestRNN : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    singa::RNNConf *rnnconf = conf.mutable_rnn_conf();
+    rnnconf->set_hidden_size(hidden_size);
+    rnnconf->set_num_stacks(1);
+    rnnconf->set_dropout(0);
+    rnnconf->set_input_mode("linear");
+    rnnconf->set_direction("unidirectional");
+    rnnconf->set_rnn_mode("tanh");
+  }
+  singa::LayerConf conf;
+  size_t hidden_size = 4;
+};
+
+TEST_F(TestRNN, Setup) {
+  RNN rnn;
+  rnn.Setup(Shape{2}, conf);
+  auto weight = rnn.param_values().at(0);
+  EXPECT_EQ(weight.Size(), hidden_size * (2 + hidden_size + 2));
+
+  conf.mutable_rnn_conf()->set_num_stacks(2);
+  conf.mutable_rnn_conf()->set_direction("bidirectional");
+  conf.mutable_rnn_conf()->set_rnn_mode("lstm");
+  RNN birnn;
+  birnn.Setup(Shape{2}, conf);
+  EXPECT_EQ(birnn.param_values().at(0).Size(),
+            2 * 4 * hidden_size * (2 + hidden_size + 2) +
+                2 * 4 * hidden_size * (2 * hidden_size + hidden_size + 2));
+}
+
+TEST_F(TestRNN, Forward) {
+  auto cpu = std::make_shared<singa::CppCPU>();
+  const size_t seqLength = 4, batchsize = 1, dim = 2;
+  const float x[seqLength * batchsize * dim] = {1.0f, 1.0f, 1.0f, 1.0f,
+                                                1.0f, 1.0f, 1.0f, 1.0f};
+
+  vector<Tensor> inputs;
+  for (size_t i = 0; i < seqLength; i++) {
+    Tensor t(Shape{batchsize, dim}, cpu);
+    t.CopyDataFromHostPtr(x + i * t.Size(), t.Size());
+    inputs.push_back(t);
+  }
+
+  singa::Tensor hx;
+  inputs.push_back(hx);
+
+  RNN rnn;
+  rnn.Setup(Shape{dim}, conf);
+  rnn.ToDevice(cpu);
+
+  auto weight = rnn.param_values().at(0);
+  weight.SetValue(0.1f);
+  const float wvalue = 0.1f;
+
+  const auto ret = rnn.Forward(singa::kEval, inputs);
+  EXPECT_EQ(ret.size(), seqLength + 1);
+  vector<float> hxptr(hidden_size, 0.0f);
+  for (size_t i = 0; i < seqLength; i++) {
+    auto yptr = ret[i].data<float>();
+    vector<float> tmp;
+    for (size_t j = 0; j < hidden_size; j++) {
+      float ty = 0;
+      for (size_t k = 0; k < dim; k++) ty += x[i * dim + k] * wvalue;
+      ty += wvalue;
+      for (size_t k = 0; k < hidden_size; k++) ty += hxptr[k] * wvalue;
+      ty += wvalue;
+      ty = tanh(ty);
+      EXPECT_NEAR(ty, yptr[j], 1e-4);
+      tmp.push_back(ty);
+    }
+    std::copy(tmp.begin(), tmp.end(), hxptr.begin());
+  }
+}
+
+// the batch size shrinks over the time steps
+TEST_F(TestRNN, BackwardVariableBatch) {
+  auto cpu = std::make_shared<singa::CppCPU>();
+  conf.mutable_rnn_conf()->set_rnn_mode("lstm");
+  const size_t dim = 3;
+  const vector<size_t> batchsizes{3, 2, 2, 1};
+  RNN rnn;
+  rnn.Setup(Shape{dim}, conf);
+  rnn.ToDevice(cpu);
+  auto weight = rnn.param_values().at(0);
+  Gaussian(0.0f, 0.5f, &weight);
+
+  vector<Tensor> inputs, grads;
+  for (size_t bs : batchsizes) {
+    Tensor t(Shape{bs, dim}, cpu), g(Shape{bs, hidden_size}, cpu);
+    Gaussian(0.0f, 1.0f, &t);
+    g.SetValue(1.0f);
+    inputs.push_back(t);
+    grads.push_back(g);
+  }
+  inputs.push_back(Tensor());
+  inputs.push_back(Tensor());
+  grads.push_back(Tensor());
+  grads.push_back(Tensor());
+
+  auto ret = rnn.Forward(singa::kTrain, inputs);
+  ASSERT_EQ(ret.size(), batchsizes.size() + 2);
+  for (size_t i = 0; i < batchsizes.size(); i++)
+    EXPECT_EQ(batchsizes[i], ret[i].shape(0));
+  // the last sample only has one step, so its final state is y1
+  const float *y1 = ret[0].data<float>(), *hy = ret[4].data<float>();
+  for (size_t j = 0; j < hidden_size; j++)
+    EXPECT_FLOAT_EQ(y1[2 * hidden_size + j], hy[2 * hidden_size + j]);
+
+  auto bret = rnn.Backward(singa::kTrain, grads);
+  ASSERT_EQ(bret.first.size(), batchsizes.size() + 2);
+  for (size_t i = 0; i < batchsizes.size(); i++)
+    EXPECT_EQ(batchsizes[i] * dim, bret.first[i].Size());
+  EXPECT_EQ(weight.Size(), bret.second.at(0).Size());
+  EXPECT_GT(bret.second.at(0).L1(), 0.0f);
+}
@@ -19,7 +19,13 @@
  *
  *************************************************************/
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <thread>
 #include <utility>
 
 #include "gtest/gtest.h"
@@ -139,6 +145,10 @@ class TestGraph : public testing::Test {
 void TestGraph::SetUp() {
   auto cpp_cpu = singa::Platform::GetDefaultDevice();
   devices.push_back(std::make_pair("cpp_cpu", cpp_cpu));
+  // runs independent nodes concurrently
+  auto cpp_threads = std::make_shared<singa::CppCPU>();
+  cpp_threads->SetNumThreads(4);
+  devices.push_back(std::make_pair("cpp_cpu_threads", cpp_threads));
 
 #ifdef USE_CUDA
   auto cuda_gpu = std::make_shared<singa::CudaGPU>();
@@ -345,18 +355,23 @@ TEST_F(TestGraph, BlockTypeParam) {
     graph.AddOperation(op, {in.block(), mid.block()}, {out.block()});
     graph.AddOperation(op, {out.block()}, {mid.block()});
 
+    // the first write of mid waits for the second node reading it
     EXPECT_EQ(3u, nodes.size());
-    EXPECT_EQ(5u, edges.size());
+    EXPECT_EQ(6u, edges.size());
     EXPECT_EQ(3u, blocks.size());
     EXPECT_EQ(1u, leaf_blocks.size());
 
     auto edge2 = edges[1];
     auto edge5 = edges[4];
+    auto edge6 = edges[5];
+    EXPECT_EQ(nodes[1], edge5->src_node());
+    EXPECT_EQ(nodes[2], edge5->dst_node());
+    for (size_t i = 0; i < edges.size(); i++) EXPECT_EQ(int(i), edges[i]->id());
     auto block1 = blocks.find(in.block())->second;
     auto block2 = blocks.find(mid.block())->second;
 
     CheckBlock(block1, 0, in.block(), BlockType::kParam, 3, edge2, NodeVec({}));
-    CheckBlock(block2, 1, mid.block(), BlockType::kParam, 2, edge5,
+    CheckBlock(block2, 1, mid.block(), BlockType::kParam, 2, edge6,
                NodeVec({}));
   }
 }
@@ -758,3 +773,395 @@ TEST_F(TestGraph, AutoRecycle) {
     }
   }
 }
+
+// Independent branches of a cpp device run concurrently. The intermediate
+// blocks are read by two nodes each and must not be freed until both finish.
+TEST(TestGraphConcurrency, Branches) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  Graph graph(dev.get());
+  const int kBranches = 6;
+
+  std::atomic<int> active(0), max_active(0);
+  auto enter = [&active, &max_active]() {
+    int n = ++active, m = max_active.load();
+    while (n > m && !max_active.compare_exchange_weak(m, n)) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    --active;
+  };
+
+  Tensor sum(Shape{1}, dev);
+  {
+    Tensor in(Shape{1}, dev);
+    in.SetValue(1.0f);
+    sum.SetValue(0.0f);
+    std::vector<Tensor> outs;
+    BlockVec out_blocks;
+    for (int i = 0; i < kBranches; i++) {
+      Tensor mid(Shape{1}, dev), out1(Shape{1}, dev), out2(Shape{1}, dev);
+      float x = static_cast<float>(i);
+      graph.AddOperation(
+          [in, mid, x, &enter](Context *ctx) mutable {
+            enter();
+            singa::Add(in, x, &mid);
+          },
+          {in.block()}, {mid.block()});
+      // the slow reader of mid
+      graph.AddOperation(
+          [mid, out1, &enter](Context *ctx) mutable {
+            enter();
+            singa::EltwiseMult(mid, mid, &out1);
+          },
+          {mid.block()}, {out1.block()});
+      graph.AddOperation(
+          [mid, out2](Context *ctx) mutable { out2.CopyData(mid); },
+          {mid.block()}, {out2.block()});
+      outs.push_back(out1);
+      outs.push_back(out2);
+      out_blocks.push_back(out1.block());
+      out_blocks.push_back(out2.block());
+    }
+    graph.AddOperation(
+        [outs, sum](Context *ctx) mutable {
+          for (auto &out : outs) singa::Add(sum, out, &sum);
+        },
+        out_blocks, {sum.block()});
+  }
+
+  for (int iter = 0; iter < 2; iter++) {
+    sum.SetValue(0.0f);
+    graph.RunGraph();
+    // sum of (1 + i)^2 + (1 + i)
+    EXPECT_EQ(91.0f + 21.0f, sum.data<float>()[0]);
+  }
+  EXPECT_GT(max_active.load(), 1);
+  for (auto &it : graph.blocks()) {
+    if (it.second->type() == BlockType::kInter) {
+      EXPECT_FALSE(it.first->initialized());
+    }
+  }
+}
+
+// Nodes using the random generator run one at a time, in program order.
+TEST(TestGraphConcurrency, RandomGenerator) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  Graph graph(dev.get());
+  std::mutex mtx;
+  std::vector<int> order;
+  std::atomic<int> active(0);
+  std::vector<Tensor> outs;
+  for (int i = 0; i < 6; i++) {
+    Tensor out(Shape{1}, dev);
+    outs.push_back(out);
+    graph.AddOperation(
+        [i, &mtx, &order, &active](Context *ctx) {
+          EXPECT_EQ(1, ++active);
+          std::this_thread::sleep_for(std::chrono::milliseconds(5));
+          {
+            std::lock_guard<std::mutex> lock(mtx);
+            order.push_back(i);
+          }
+          --active;
+        },
+        {}, {out.block()}, "Random", true);
+  }
+  graph.RunGraph();
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4, 5}), order);
+}
+
+// The first write of a parameter waits for the nodes reading it, and nodes
+// running at the same time get their own contexts.
+TEST(TestGraphConcurrency, WriteAfterRead) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  Graph graph(dev.get());
+  std::mutex mtx;
+  std::set<Context *> contexts;
+  auto slow = [&mtx, &contexts](Context *ctx) {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      contexts.insert(ctx);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  };
+
+  Tensor param(Shape{1}, dev), out1(Shape{1}, dev), out2(Shape{1}, dev);
+  graph.AddOperation(
+      [param, out1, &slow](Context *ctx) mutable {
+        slow(ctx);
+        out1.CopyData(param);
+      },
+      {param.block()}, {out1.block()});
+  graph.AddOperation(
+      [param, out2, &slow](Context *ctx) mutable {
+        slow(ctx);
+        out2.CopyData(param);
+      },
+      {param.block()}, {out2.block()});
+  // the update reads nothing else, hence it would be ready at once
+  graph.AddOperation(
+      [param](Context *ctx) mutable { singa::Add(param, 1.f, &param); },
+      {param.block()}, {param.block()});
+
+  for (int iter = 0; iter < 3; iter++) {
+    param.SetValue(static_cast<float>(iter));
+    graph.RunGraph();
+    EXPECT_EQ(static_cast<float>(iter), out1.data<float>()[0]);
+    EXPECT_EQ(static_cast<float>(iter), out2.data<float>()[0]);
+    EXPECT_EQ(iter + 1.f, param.data<float>()[0]);
+  }
+  EXPECT_EQ(2u, contexts.size());
+  EXPECT_EQ(1u, contexts.count(dev->context(0)));
+}
+
+// The blocks freed within each iteration are placed in one arena: blocks live
+// at the same time do not overlap, and the graph runs without allocating.
+TEST(TestGraphMemoryPlan, Chain) {
+  auto pool = std::make_shared<singa::CppMemPool>();
+  auto dev = std::make_shared<singa::CppCPU>(pool);
+  dev->SetNumThreads(4);
+  Graph graph(dev.get());
+  graph.EnableMemoryPlan(true);
+  const size_t n = 100, bytes = 448;  // 400 rounded to 64 bytes
+
+  Tensor in(Shape{n}, dev), out(Shape{n}, dev);
+  in.SetValue(1.0f);
+  out.SetValue(0.0f);
+  BlockVec mids;
+  {
+    // out = (((in + 1) * 2 + 1) * 2) + 1
+    Tensor a(Shape{n}, dev), b(Shape{n}, dev), c(Shape{n}, dev),
+        d(Shape{n}, dev);
+    graph.AddOperation(
+        [in, a](Context *ctx) mutable { singa::Add(in, 1.f, &a); },
+        {in.block()}, {a.block()});
+    graph.AddOperation(
+        [a, b](Context *ctx) mutable { singa::EltwiseMult(a, 2.f, &b); },
+        {a.block()}, {b.block()});
+    graph.AddOperation(
+        [b, c](Context *ctx) mutable { singa::Add(b, 1.f, &c); },
+        {b.block()}, {c.block()});
+    graph.AddOperation(
+        [c, d](Context *ctx) mutable { singa::EltwiseMult(c, 2.f, &d); },
+        {c.block()}, {d.block()});
+    graph.AddOperation(
+        [d, out](Context *ctx) mutable { singa::Add(d, 1.f, &out); },
+        {d.block()}, {out.block()});
+    mids = {a.block(), b.block(), c.block(), d.block()};
+  }
+
+  for (bool serial : {false, true}) {
+    for (int iter = 0; iter < 3; iter++) {
+      size_t num_mallocs = pool->num_mallocs();
+      if (serial)
+        graph.RunInSerial();
+      else
+        graph.RunGraph();
+      if (iter > 0) {
+        EXPECT_EQ(num_mallocs, pool->num_mallocs());
+      }
+      const float *dptr = out.data<float>();
+      for (size_t i = 0; i < n; i++) EXPECT_EQ(11.0f, dptr[i]);
+      for (auto blk : mids) EXPECT_FALSE(blk->initialized());
+    }
+
+    // a chain needs two buffers
+    auto &offsets = graph.planned_offsets();
+    EXPECT_EQ(4u, offsets.size());
+    EXPECT_EQ(2 * bytes, graph.planned_peak());
+    for (size_t i = 0; i + 1 < mids.size(); i++)
+      EXPECT_NE(offsets.at(mids[i]), offsets.at(mids[i + 1]));
+    EXPECT_EQ(offsets.at(mids[0]), offsets.at(mids[2]));
+    EXPECT_EQ(offsets.at(mids[1]), offsets.at(mids[3]));
+  }
+
+  graph.EnableMemoryPlan(false);
+  EXPECT_EQ(0u, graph.planned_peak());
+  graph.RunGraph();
+  EXPECT_EQ(11.0f, out.data<float>()[0]);
+}
+
+// Blocks used by the same node or live across branches get disjoint ranges.
+TEST(TestGraphMemoryPlan, Branches) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  Graph graph(dev.get());
+  graph.EnableMemoryPlan(true);
+
+  Tensor in(Shape{16}, dev), out(Shape{16}, dev);
+  in.SetValue(2.0f);
+  out.SetValue(0.0f);
+  std::vector<std::pair<Block *, Block *> > live;
+  {
+    // out = (in + 1) * (in * 3) + (in + 1)
+    Tensor a(Shape{16}, dev), b(Shape{16}, dev), c(Shape{64}, dev);
+    graph.AddOperation(
+        [in, a](Context *ctx) mutable { singa::Add(in, 1.f, &a); },
+        {in.block()}, {a.block()});
+    graph.AddOperation(
+        [in, b](Context *ctx) mutable { singa::EltwiseMult(in, 3.f, &b); },
+        {in.block()}, {b.block()});
+    graph.AddOperation(
+        [a, b, c](Context *ctx) mutable {
+          Tensor ab = a * b;
+          c.CopyDataFromHostPtr(ab.data<float>(), 16);
+        },
+        {a.block(), b.block()}, {c.block()});
+    graph.AddOperation(
+        [a, c, out](Context *ctx) mutable {
+          Tensor c16(Shape{16}, c.device());
+          c16.CopyDataFromHostPtr(c.data<float>(), 16);
+          singa::Add(c16, a, &out);
+        },
+        {a.block(), c.block()}, {out.block()});
+    live = {{a.block(), b.block()}, {a.block(), c.block()},
+            {b.block(), c.block()}};
+  }
+
+  graph.RunGraph();
+  EXPECT_EQ(21.0f, out.data<float>()[0]);
+  EXPECT_EQ(21.0f, out.data<float>()[15]);
+
+  auto &offsets = graph.planned_offsets();
+  EXPECT_EQ(3u, offsets.size());
+  for (auto &it : live) {
+    size_t begin1 = offsets.at(it.first), end1 = begin1 + it.first->size();
+    size_t begin2 = offsets.at(it.second), end2 = begin2 + it.second->size();
+    EXPECT_TRUE(end1 <= begin2 || end2 <= begin1);
+  }
+  EXPECT_EQ(256u + 64u + 64u, graph.planned_peak());
+
+  graph.RunInSerial();
+  EXPECT_EQ(21.0f, out.data<float>()[0]);
+}
+
+// Composite activations buffered from Tensor ops are fused into one node,
+// which gives the same results as the unfused graph.
+TEST(TestGraphFusion, Elu) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  const size_t n = 5000;  // not a multiple of the tile size
+  std::vector<float> x_host(n);
+  for (size_t i = 0; i < n; i++) x_host[i] = (i % 97) * 0.07f - 3.f;
+  Tensor x(Shape{n}, dev), y(Shape{n}, dev);
+  x.CopyDataFromHostPtr(x_host.data(), n);
+
+  dev->EnableGraph(true);
+  {
+    // elu(x) = (exp(x) - 1) * alpha * (x < 0) + x * (x >= 0)
+    Tensor neg = ((singa::Exp(x) - 1.f) * 0.5f) * (x < 0.f);
+    singa::Add(neg, x * (x >= 0.f), &y);
+  }
+  dev->EnableGraph(false);
+
+  dev->RunGraph();
+  auto &fusions = dev->graph()->fusions();
+  ASSERT_EQ(1u, fusions.size());
+  EXPECT_EQ(8u, fusions[0].size());
+  EXPECT_EQ("Add", fusions[0].back()->op_name());
+  std::vector<float> fused(y.data<float>(), y.data<float>() + n);
+  for (size_t i = 0; i < n; i++) {
+    float v = x_host[i];
+    EXPECT_NEAR(v < 0 ? 0.5f * (std::exp(v) - 1.f) : v, fused[i], 1e-6f);
+  }
+  for (auto &it : dev->graph()->blocks()) {
+    if (it.second->type() == BlockType::kInter) {
+      EXPECT_FALSE(it.first->initialized());
+    }
+  }
+
+  dev->EnableFusion(false);
+  y.SetValue(0.f);
+  dev->RunGraph();
+  EXPECT_EQ(0u, dev->graph()->fusions().size());
+  for (size_t i = 0; i < n; i++) EXPECT_EQ(fused[i], y.data<float>()[i]);
+  dev->ResetGraph();
+}
+
+// Outputs read by other nodes or outside the graph, in-place ops and inputs
+// written afterwards stop the fusion.
+TEST(TestGraphFusion, Boundaries) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  Tensor x(Shape{16}, dev), w(Shape{16}, dev), y(Shape{16}, dev),
+      z(Shape{16}, dev), kept;
+  x.SetValue(1.f);
+  w.SetValue(2.f);
+
+  dev->EnableGraph(true);
+  {
+    Tensor a = x + 1.f;  // read by two nodes
+    Tensor b = a * 2.f;
+    Tensor c = b + a;
+    kept = c * 3.f;  // b, c and kept are fused; kept is read outside
+    singa::Add(kept, 1.f, &y);
+    Tensor d = w * 2.f;  // w is written afterwards
+    singa::Add(d, 1.f, &z);
+    singa::Add(w, 1.f, &w);
+  }
+  dev->EnableGraph(false);
+
+  dev->RunGraph();
+  auto &fusions = dev->graph()->fusions();
+  ASSERT_EQ(1u, fusions.size());
+  ASSERT_EQ(3u, fusions[0].size());
+  for (int i = 0; i < 3; i++) EXPECT_EQ(i + 1, fusions[0][i]->id());
+  EXPECT_EQ(19.f, y.data<float>()[0]);
+  EXPECT_EQ(5.f, z.data<float>()[0]);
+  EXPECT_EQ(3.f, w.data<float>()[0]);
+  dev->ResetGraph();
+}
+
+TEST(TestGraphView, SliceRows) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(2);
+  float x[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+  Tensor in(Shape{4, 2}, dev), out(Shape{2, 2}, dev), out2(Shape{2, 2}, dev);
+  in.CopyDataFromHostPtr(x, 8);
+
+  dev->EnableGraph(true);
+  {
+    Tensor y = in * 2.f;
+    Tensor rows = SliceRows(y, 2, 4);
+    rows += 1.f;  // copies the rows from y
+    Tensor first = SliceRows(y, 0, 2);
+    y += 1.f;  // copies the rows of first before changing y
+    singa::Add(rows, first, &out);
+    singa::Add(SliceRows(y, 0, 2), first, &out2);
+  }
+  dev->EnableGraph(false);
+
+  for (int k = 0; k < 3; k++) {
+    dev->RunGraph(k % 2);
+    const float *dptr = out.data<float>(), *dptr2 = out2.data<float>();
+    for (int i = 0; i < 4; i++) {
+      EXPECT_EQ(4.f * i + 9.f, dptr[i]);
+      EXPECT_EQ(4.f * i + 1.f, dptr2[i]);
+    }
+  }
+  dev->ResetGraph();
+}
+
+// The data written into slices and views outside of the graph persists over
+// the runs of the graph.
+TEST(TestGraphView, WrittenViews) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  Tensor x(Shape{4, 2}, dev);
+  x.SetValue(1.f);
+  Tensor s = SliceRows(x, 0, 2), v = x.View(Shape{2, 2}, 4);
+  s.SetValue(3.f);
+  v.SetValue(3.f);
+
+  dev->EnableGraph(true);
+  s += 1.f;
+  v += 1.f;
+  dev->EnableGraph(false);
+  for (int k = 0; k < 3; k++) {
+    dev->RunGraph(k % 2);
+    EXPECT_EQ(4.f + k, s.data<float>()[0]);
+    EXPECT_EQ(4.f + k, v.data<float>()[3]);
+  }
+  // and the parent is unchanged
+  for (int i = 0; i < 8; i++) EXPECT_EQ(1.f, x.data<float>()[i]);
+  dev->ResetGraph();
+}
@@ -0,0 +1,176 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "singa/core/device.h"
+#include "singa/core/sparse_tensor.h"
+using singa::Shape;
+using singa::SparseTensor;
+using singa::Tensor;
+
+namespace {
+// a 5 x 7 matrix with an empty row and an empty column
+Tensor SparseDense() {
+  std::vector<float> v(35, 0.f);
+  v[0 * 7 + 1] = 1.f;
+  v[0 * 7 + 6] = -2.f;
+  v[2 * 7 + 0] = 3.f;
+  v[2 * 7 + 3] = 4.5f;
+  v[3 * 7 + 6] = 5.f;
+  v[4 * 7 + 2] = -6.f;
+  v[4 * 7 + 3] = 7.f;
+  Tensor t(Shape{5, 7});
+  t.CopyDataFromHostPtr(v.data(), v.size());
+  return t;
+}
+
+void ExpectEqual(const Tensor &expected, const Tensor &actual) {
+  ASSERT_EQ(expected.shape(), actual.shape());
+  Tensor e = Contiguous(expected), a = Contiguous(actual);
+  for (size_t i = 0; i < e.Size(); i++)
+    EXPECT_FLOAT_EQ(e.data<float>()[i], a.data<float>()[i]) << i;
+}
+}  // namespace
+
+TEST(SparseTensor, FromDense) {
+  Tensor d = SparseDense();
+  SparseTensor csr = SparseTensor::FromDense(d);
+  EXPECT_EQ(singa::kCSR, csr.format());
+  EXPECT_EQ(7u, csr.nnz());
+  const int offsets[6] = {0, 2, 2, 4, 5, 7};
+  for (size_t r = 0; r < 6; r++)
+    EXPECT_EQ(offsets[r], csr.rows().data<int>()[r]);
+  EXPECT_EQ(3, csr.cols().data<int>()[3]);
+  ExpectEqual(d, csr.ToDense());
+
+  SparseTensor coo = SparseTensor::FromDense(d, singa::kCOO);
+  EXPECT_EQ(7u, coo.rows().Size());
+  EXPECT_EQ(4, coo.rows().data<int>()[6]);
+  ExpectEqual(d, coo.ToDense());
+
+  // from a transposed (strided) tensor
+  Tensor dt = singa::Transpose(d);
+  ExpectEqual(dt, SparseTensor::FromDense(dt).ToDense());
+}
+
+TEST(SparseTensor, COOToCSR) {
+  // unordered, with a duplicated entry
+  const float v[4] = {1.f, 2.f, 3.f, 4.f};
+  const int r[4] = {2, 0, 2, 2}, c[4] = {3, 1, 0, 3};
+  Tensor values(Shape{4}), rows(Shape{4}, singa::kInt),
+      cols(Shape{4}, singa::kInt);
+  values.CopyDataFromHostPtr(v, 4);
+  rows.CopyDataFromHostPtr(r, 4);
+  cols.CopyDataFromHostPtr(c, 4);
+  SparseTensor coo(Shape{3, 4}, singa::kCOO, values, rows, cols);
+  SparseTensor csr = coo.ToCSR();
+  EXPECT_EQ(3u, csr.nnz());
+  const int offsets[4] = {0, 1, 1, 3}, ccols[3] = {1, 0, 3};
+  const float cvalues[3] = {2.f, 3.f, 5.f};
+  for (size_t i = 0; i < 4; i++)
+    EXPECT_EQ(offsets[i], csr.rows().data<int>()[i]);
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_EQ(ccols[i], csr.cols().data<int>()[i]);
+    EXPECT_EQ(cvalues[i], csr.values().data<float>()[i]);
+  }
+  ExpectEqual(coo.ToDense(), csr.ToDense());
+}
+
+TEST(SparseTensor, Transpose) {
+  Tensor d = SparseDense();
+  for (auto format : {singa::kCSR, singa::kCOO}) {
+    SparseTensor t = SparseTensor::FromDense(d, format).Transpose();
+    EXPECT_EQ(format, t.format());
+    EXPECT_EQ(Shape({7, 5}), t.shape());
+    ExpectEqual(singa::Transpose(d), t.ToDense());
+  }
+}
+
+TEST(SparseTensor, Mult) {
+  Tensor d = SparseDense();
+  Tensor B(Shape{7, 3}), v(Shape{7});
+  singa::Uniform(-1.f, 1.f, &B);
+  singa::Uniform(-1.f, 1.f, &v);
+  Tensor dv(Shape{5});
+  Mult(d, v, &dv);
+  // a transposed B
+  Tensor Bt(Shape{3, 7});
+  singa::Uniform(-1.f, 1.f, &Bt);
+  Bt = singa::Transpose(Bt);
+  for (auto format : {singa::kCSR, singa::kCOO}) {
+    SparseTensor A = SparseTensor::FromDense(d, format);
+    ExpectEqual(Mult(d, B), Mult(A, B));
+    ExpectEqual(dv, Mult(A, v));
+    ExpectEqual(Mult(d, Bt), Mult(A, Bt));
+  }
+  // many rows, split across threads
+  Tensor big(Shape{3000, 40});
+  singa::Bernoulli(0.05f, &big);
+  Tensor W(Shape{40, 16});
+  singa::Gaussian(0.f, 1.f, &W);
+  ExpectEqual(Mult(big, W), Mult(SparseTensor::FromDense(big), W));
+}
+
+TEST(SparseTensor, EltwiseMult) {
+  Tensor d = SparseDense();
+  Tensor B(Shape{5, 7});
+  singa::Uniform(-1.f, 1.f, &B);
+  Tensor expected = d * B;
+  for (auto format : {singa::kCSR, singa::kCOO}) {
+    SparseTensor A = SparseTensor::FromDense(d, format);
+    SparseTensor C = EltwiseMult(A, B);
+    EXPECT_EQ(A.nnz(), C.nnz());
+    ExpectEqual(expected, C.ToDense());
+  }
+}
+
+TEST(SparseTensor, CheckIndices) {
+  // forking as the default style does is unsafe with the pool threads
+  ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+  const float v[3] = {1.f, 2.f, 3.f};
+  Tensor values(Shape{3}), rows(Shape{4}, singa::kInt),
+      cols(Shape{3}, singa::kInt);
+  values.CopyDataFromHostPtr(v, 3);
+  const int offsets[4] = {0, 2, 1, 3}, c[3] = {0, 1, 2};
+  rows.CopyDataFromHostPtr(offsets, 4);
+  cols.CopyDataFromHostPtr(c, 3);
+  EXPECT_DEATH(SparseTensor(Shape{3, 3}, singa::kCSR, values, rows, cols),
+               "offsets decrease");
+  const int ok[4] = {0, 1, 1, 3}, bad_cols[3] = {0, 3, 2};
+  rows.CopyDataFromHostPtr(ok, 4);
+  cols.CopyDataFromHostPtr(bad_cols, 3);
+  EXPECT_DEATH(SparseTensor(Shape{3, 3}, singa::kCSR, values, rows, cols),
+               "column 3 of entry 1");
+
+  Tensor coo_rows(Shape{3}, singa::kInt);
+  const int r[3] = {2, -1, 0};
+  coo_rows.CopyDataFromHostPtr(r, 3);
+  cols.CopyDataFromHostPtr(c, 3);
+  EXPECT_DEATH(SparseTensor(Shape{3, 3}, singa::kCOO, values, coo_rows, cols),
+               "row -1 of entry 1");
+
+  // the host reads are not supported in a graph
+  auto dev = std::make_shared<singa::CppCPU>();
+  Tensor d(Shape{2, 2}, dev);
+  d.SetValue(1.f);
+  dev->EnableGraph(true);
+  EXPECT_DEATH(SparseTensor::FromDense(d), "disable the graph");
+  dev->EnableGraph(false);
+}
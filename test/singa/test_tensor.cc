@@ -16,6 +16,11 @@
  * limitations under the License.
  */
 
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "singa/core/tensor.h"
 using singa::Device;
@@ -311,3 +316,135 @@ TEST(TensorClass, Broadcast) {
     EXPECT_EQ(c2[3], 5);
   }
 }
+
+TEST(TensorClass, SliceView) {
+  float x[12];
+  for (int i = 0; i < 12; i++) x[i] = i;
+  Tensor t(Shape{3, 2, 2});
+  t.CopyDataFromHostPtr(x, 12);
+
+  Tensor r = SliceRows(t, 1, 3);
+  EXPECT_TRUE((Shape{2, 2, 2} == r.shape()));
+  EXPECT_EQ(t.block(), r.block()->parent());
+  EXPECT_EQ(t.data<float>() + 4, r.data<float>());
+  Tensor rv = r.View(Shape{2}, 6);
+  EXPECT_EQ(t.data<float>() + 10, rv.data<float>());
+
+  Tensor c = SliceOn(Reshape(t, Shape{1, 3, 4}), 1, 2, 1);
+  EXPECT_TRUE((Shape{1, 1, 4} == c.shape()));
+  EXPECT_EQ(t.data<float>() + 4, c.data<float>());
+
+  // not contiguous, copied
+  Tensor s = SliceOn(t, 1, 2, 1);
+  EXPECT_EQ(nullptr, s.block()->parent());
+  EXPECT_EQ(6.f, s.data<float>()[2]);
+
+  // the first write to the parent copies the views sharing it first
+  t += 1.f;
+  EXPECT_NE(t.data<float>() + 4, r.data<float>());
+  EXPECT_EQ(4.f, r.data<float>()[0]);
+  EXPECT_EQ(4.f, c.data<float>()[0]);
+  EXPECT_EQ(10.f, rv.data<float>()[0]);
+  EXPECT_EQ(5.f, t.data<float>()[4]);
+
+  // and so does the first write to a view
+  Tensor w = t.View(Shape{2, 2}, 4);
+  EXPECT_EQ(t.data<float>() + 4, w.data<float>());
+  w *= 2.f;
+  EXPECT_EQ(10.f, w.data<float>()[0]);
+  EXPECT_EQ(5.f, t.data<float>()[4]);
+  r *= 2.f;
+  EXPECT_EQ(8.f, r.data<float>()[0]);
+  EXPECT_EQ(10.f, rv.data<float>()[0]);
+
+  // the view keeps the parent alive
+  Tensor v = t.View(Shape{2}, 10);
+  t = Tensor();
+  EXPECT_EQ(12.f, v.data<float>()[1]);
+}
+
+TEST(TensorClass, FromExternal) {
+  std::vector<float> buf{1.f, 2.f, 3.f, 4.f};
+  int deleted = 0;
+  {
+    Tensor t = Tensor::FromExternal(buf.data(), Shape{2, 2}, singa::kFloat32,
+                                    [&deleted](void *) { deleted++; });
+    EXPECT_TRUE(t.block()->borrowed());
+    EXPECT_EQ(buf.data(), t.data<float>());
+    Tensor c = t;
+    t += 1.f;
+    EXPECT_EQ(2.f, buf[0]);
+    EXPECT_EQ(5.f, buf[3]);
+    // e.g., by the graph once the block is no longer used
+    t.block()->free_data();
+    EXPECT_EQ(buf.data(), c.data<float>());
+    EXPECT_EQ(0, deleted);
+  }
+  EXPECT_EQ(1, deleted);
+}
+
+TEST(TensorClass, FromMmap) {
+  // a header of 12 bytes followed by the floats
+  const std::string path = "test_tensor_from_mmap.bin";
+  std::vector<float> x(3000);
+  for (size_t i = 0; i < x.size(); i++) x[i] = i * 0.5f;
+  {
+    std::ofstream out(path, std::ios::binary);
+    out.write("singa tensor", 12);
+    out.write(reinterpret_cast<const char *>(x.data()),
+              x.size() * sizeof(float));
+  }
+  // not page aligned
+  Tensor t = Tensor::FromMmap(path, 12 + 1000 * sizeof(float), Shape{20, 100});
+  EXPECT_TRUE(t.block()->borrowed());
+  for (size_t i = 0; i < 2000; i++)
+    EXPECT_EQ(x[1000 + i], t.data<float>()[i]);
+  Tensor y = t * 2.f;
+  EXPECT_EQ(x[2999] * 2, y.data<float>()[1999]);
+
+  // writes are private to the mapping
+  t += 1.f;
+  EXPECT_EQ(x[1000] + 1, t.data<float>()[0]);
+  Tensor u = Tensor::FromMmap(path, 12, Shape{3000});
+  EXPECT_EQ(x[1000], u.data<float>()[1000]);
+  std::remove(path.c_str());
+  EXPECT_EQ(x[2999], u.data<float>()[2999]);
+}
+
+namespace {
+// the available host memory (bytes) on Linux, 0 if unknown
+size_t AvailableMemory() {
+  std::ifstream meminfo("/proc/meminfo");
+  std::string key, unit;
+  size_t kb;
+  while (meminfo >> key >> kb >> unit)
+    if (key == "MemAvailable:") return kb * 1024;
+  return 0;
+}
+}  // namespace
+
+TEST(TensorClass, LargerThan4GB) {
+  // more bytes than int and uint32_t can hold
+  const size_t n = ((size_t(4) << 30) + (size_t(64) << 20)) / sizeof(float);
+  if (AvailableMemory() < n * sizeof(float) + (size_t(256) << 20)) {
+    LOG(WARNING) << "Skip TensorClass.LargerThan4GB: not enough memory";
+    return;
+  }
+  // a device of its own, whose memory pool is released at the end
+  auto dev = std::make_shared<singa::CppCPU>();
+  Tensor t(Shape{n}, dev);
+  EXPECT_EQ(n * sizeof(float), t.block()->size());
+  t.SetValue(1.f);
+  t += 2.f;
+
+  // offsets beyond 4 GB
+  Tensor tail(Shape{4}, dev);
+  CopyDataToFrom(&tail, t, 4, 0, n - 4);
+  for (size_t i = 0; i < 4; i++) EXPECT_EQ(3.f, tail.data<float>()[i]);
+  tail.SetValue(-1.f);
+  CopyDataToFrom(&t, tail, 4, n - 4, 0);
+  EXPECT_EQ(3.f, t.data<float>()[n - 5]);
+  EXPECT_EQ(-1.f, t.data<float>()[n - 1]);
+  Tensor v = t.View(Shape{2}, n - 2);
+  EXPECT_EQ(t.data<float>() + n - 2, v.data<float>());
+}
@@ -17,8 +17,13 @@
  */
 
 #include <array>
+#include <cmath>
+#include <limits>
+#include <vector>
 
+#include "../src/core/tensor/philox.h"
 #include "gtest/gtest.h"
+#include "singa/core/device.h"
 #include "singa/core/tensor.h"
 using singa::Device;
 using singa::Shape;
@@ -76,6 +81,36 @@ TEST_F(TensorMath, ExpStrideCpp) {
   EXPECT_NEAR(exp(dat1[3]), dptr1[4], 1e-5);
 }
 
+TEST_F(TensorMath, MultiThreadEltwiseCpp) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  const size_t m = 300, n = 500;
+  std::vector<float> x(m * n), y(n);
+  for (size_t i = 0; i < x.size(); i++) x[i] = (i % 97) * 0.01f;
+  for (size_t i = 0; i < n; i++) y[i] = i * 0.1f;
+  Tensor t1(Shape{m, n}, dev), t2(Shape{n}, dev);
+  t1.CopyDataFromHostPtr(x.data(), x.size());
+  t2.CopyDataFromHostPtr(y.data(), y.size());
+
+  Tensor p = Exp(t1);
+  const float *dptr = p.data<float>();
+  for (size_t i = 0; i < x.size(); i++) EXPECT_FLOAT_EQ(exp(x[i]), dptr[i]);
+
+  // strided input
+  Tensor q = Exp(Transpose(t1));
+  const float *qptr = q.data<float>();
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < m; j++)
+      EXPECT_FLOAT_EQ(exp(x[j * n + i]), qptr[i * m + j]);
+
+  // broadcasted input
+  Tensor r = t1 + t2;
+  const float *rptr = r.data<float>();
+  for (size_t i = 0; i < m; i++)
+    for (size_t j = 0; j < n; j++)
+      EXPECT_FLOAT_EQ(x[i * n + j] + y[j], rptr[i * n + j]);
+}
+
 TEST_F(TensorMath, LogCpp) {
   Tensor p = Log(a);
   const float *dptr1 = p.data<float>();
@@ -204,6 +239,85 @@ TEST_F(TensorMath, SoftMaxCpp) {
   EXPECT_NEAR(exp(2) / (exp(1) + exp(2)), dptr2[1], 1e-5);
 }
 
+TEST_F(TensorMath, SoftMaxFusedCpp) {
+  // rows of 2 * 1500 elements, i.e., a few chunks of the online softmax
+  const size_t nrow = 20, ncol = 3000;
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  std::vector<float> x(nrow * ncol), dy(nrow * ncol);
+  for (size_t i = 0; i < x.size(); i++) {
+    // the max of a row is in a later chunk than the first one
+    x[i] = (i * 7 % 101) * 0.3f - 20.f + (i % ncol > 2000 ? 60.f : 0.f);
+    dy[i] = (i * 13 % 17) * 0.1f - 0.8f;
+  }
+  Tensor in(Shape{nrow, 2, ncol / 2}, dev), grad(in.shape(), dev);
+  in.CopyDataFromHostPtr(x.data(), x.size());
+  grad.CopyDataFromHostPtr(dy.data(), dy.size());
+
+  Tensor y = SoftMax(in, 1);
+  Tensor logy = LogSoftMax(in, 1);
+  Tensor dx = SoftMaxBackward(grad, 1, y);
+  EXPECT_EQ(in.shape(), y.shape());
+  const float *yptr = y.data<float>(), *lptr = logy.data<float>();
+  const float *dxptr = dx.data<float>();
+  for (size_t r = 0; r < nrow; r++) {
+    const float *xr = x.data() + r * ncol, *dyr = dy.data() + r * ncol;
+    double m = *std::max_element(xr, xr + ncol), s = 0, dot = 0;
+    for (size_t j = 0; j < ncol; j++) s += std::exp(xr[j] - m);
+    for (size_t j = 0; j < ncol; j++)
+      dot += dyr[j] * std::exp(xr[j] - m) / s;
+    for (size_t j = 0; j < ncol; j++) {
+      double p = std::exp(xr[j] - m) / s;
+      size_t k = r * ncol + j;
+      EXPECT_NEAR(p, yptr[k], 1e-6 * p + 1e-12);
+      EXPECT_NEAR(xr[j] - m - std::log(s), lptr[k], 1e-4);
+      EXPECT_NEAR(p * (dyr[j] - dot), dxptr[k], 1e-6 * p + 1e-12);
+    }
+  }
+
+  // log-softmax stays finite where the softmax underflows
+  float z[2] = {0.f, -200.f};
+  Tensor t(Shape{2}, dev);
+  t.CopyDataFromHostPtr(z, 2);
+  EXPECT_EQ(0.f, SoftMax(t).data<float>()[1]);
+  EXPECT_NEAR(-200.f, LogSoftMax(t).data<float>()[1], 1e-4);
+}
+
+TEST_F(TensorMath, SoftMaxMaskedCpp) {
+  // the second chunk of the first row is masked out, the second row is all
+  // masked out
+  const size_t ncol = 2048;
+  const float inf = std::numeric_limits<float>::infinity();
+  std::vector<float> x(2 * ncol, -inf);
+  std::fill(x.begin(), x.begin() + 1024, 0.f);
+  Tensor in(Shape{2, ncol});
+  in.CopyDataFromHostPtr(x.data(), x.size());
+
+  Tensor y = SoftMax(in), logy = LogSoftMax(in);
+  const float *yptr = y.data<float>(), *lptr = logy.data<float>();
+  for (size_t j = 0; j < ncol; j++) {
+    EXPECT_FLOAT_EQ(j < 1024 ? 1.f / 1024 : 0.f, yptr[j]);
+    if (j < 1024)
+      EXPECT_NEAR(-std::log(1024.f), lptr[j], 1e-5);
+    else
+      EXPECT_EQ(-inf, lptr[j]);
+    EXPECT_TRUE(std::isnan(yptr[ncol + j]));
+    EXPECT_TRUE(std::isnan(lptr[ncol + j]));
+  }
+
+  // the fused cross entropy of the first row
+  Tensor row = in.View(Shape{1, ncol});
+  Tensor label(Shape{1}, in.device(), singa::kInt);
+  label.SetValue(3);
+  Tensor lse;
+  Tensor loss = SoftmaxCrossEntropyFwd(row, label, &lse);
+  EXPECT_NEAR(std::log(1024.f), loss.data<float>()[0], 1e-5);
+  EXPECT_NEAR(std::log(1024.f), lse.data<float>()[0], 1e-5);
+  Tensor grad = SoftmaxCrossEntropyBwd(row, label, lse);
+  EXPECT_NEAR(1.f / 1024 - 1.f, grad.data<float>()[3], 1e-6);
+  EXPECT_EQ(0.f, grad.data<float>()[2000]);
+}
+
 #ifdef USE_CUDNN
 TEST_F(TensorMath, SoftMaxOnAxisCUDNN) {
   Tensor in(Shape{2, 2, 2, 2}, std::make_shared<singa::CudaGPU>());
@@ -540,6 +654,318 @@ TEST_F(TensorMath, TransposeIntCpp) {
   EXPECT_EQ(12, dptr[11]);
 }
 
+TEST_F(TensorMath, TransposeTiledCpp) {
+  // (B, H, S, D), not multiples of the tile size
+  const size_t shape[4] = {2, 3, 67, 45};
+  const size_t n = 2 * 3 * 67 * 45;
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  std::vector<float> x(n);
+  for (size_t i = 0; i < n; i++) x[i] = i;
+  Tensor t(Shape{2, 3, 67, 45}, dev);
+  t.CopyDataFromHostPtr(x.data(), n);
+
+  for (auto axes : {vector<size_t>{0, 2, 1, 3}, vector<size_t>{0, 1, 3, 2},
+                    vector<size_t>{3, 2, 1, 0}}) {
+    Tensor y = singa::Transpose(t, axes);
+    y.Contiguous();
+    const float *yptr = y.data<float>();
+    size_t src[4], i = 0;
+    size_t dst[4] = {shape[axes[0]], shape[axes[1]], shape[axes[2]],
+                     shape[axes[3]]};
+    for (size_t a = 0; a < dst[0]; a++)
+      for (size_t b = 0; b < dst[1]; b++)
+        for (size_t c = 0; c < dst[2]; c++)
+          for (size_t d = 0; d < dst[3]; d++, i++) {
+            src[axes[0]] = a, src[axes[1]] = b, src[axes[2]] = c;
+            src[axes[3]] = d;
+            size_t k = ((src[0] * 3 + src[1]) * 67 + src[2]) * 45 + src[3];
+            EXPECT_EQ(x[k], yptr[i]);
+          }
+  }
+}
+
+TEST_F(TensorMath, GEMMBatchedStridedCpp) {
+  // attention scores Q * K^T, with K^T a transposed view and a mask-like
+  // operand broadcast over the batch
+  const size_t b = 2, h = 3, s = 7, d = 5;
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  std::vector<float> q(b * h * s * d), k(b * h * s * d), w(h * d * 4);
+  for (size_t i = 0; i < q.size(); i++) q[i] = (i % 13) * 0.1f - 0.6f;
+  for (size_t i = 0; i < k.size(); i++) k[i] = (i % 9) * 0.2f - 0.8f;
+  for (size_t i = 0; i < w.size(); i++) w[i] = (i % 5) * 0.3f - 0.5f;
+  Tensor Q(Shape{b, h, s, d}, dev), K(Q.shape(), dev), W(Shape{h, d, 4}, dev);
+  Q.CopyDataFromHostPtr(q.data(), q.size());
+  K.CopyDataFromHostPtr(k.data(), k.size());
+  W.CopyDataFromHostPtr(w.data(), w.size());
+
+  dev->EnableGraph(true);
+  Tensor S = Mult(Q, singa::Transpose(K, {0, 1, 3, 2}));
+  Tensor P = Mult(Q, W);
+  dev->EnableGraph(false);
+  // no copies of the transposed or broadcast operands
+  EXPECT_EQ(2u, dev->graph()->nodes().size());
+  dev->RunGraph();
+
+  EXPECT_TRUE((Shape{b, h, s, s} == S.shape()));
+  EXPECT_TRUE((Shape{b, h, s, 4} == P.shape()));
+  const float *sptr = S.data<float>(), *pptr = P.data<float>();
+  for (size_t g = 0; g < b * h; g++)
+    for (size_t i = 0; i < s; i++) {
+      const float *qi = q.data() + (g * s + i) * d;
+      for (size_t j = 0; j < s; j++) {
+        float expected = 0;
+        for (size_t l = 0; l < d; l++)
+          expected += qi[l] * k[(g * s + j) * d + l];
+        EXPECT_NEAR(expected, sptr[(g * s + i) * s + j], 1e-5);
+      }
+      for (size_t j = 0; j < 4; j++) {
+        float expected = 0;
+        for (size_t l = 0; l < d; l++)
+          expected += qi[l] * w[((g % h) * d + l) * 4 + j];
+        EXPECT_NEAR(expected, pptr[(g * s + i) * 4 + j], 1e-5);
+      }
+    }
+
+  // a single large product is split among the threads
+  Tensor A(Shape{1, 300, 200}, dev), B(Shape{1, 200, 100}, dev);
+  Gaussian(0.f, 1.f, &A);
+  Gaussian(0.f, 1.f, &B);
+  Tensor C = Mult(A, B);
+  Tensor C2 = Mult(Reshape(A, Shape{300, 200}), Reshape(B, Shape{200, 100}));
+  const float *cptr = C.data<float>(), *c2ptr = C2.data<float>();
+  for (size_t i = 0; i < C.Size(); i++) EXPECT_NEAR(c2ptr[i], cptr[i], 1e-4);
+}
+
+TEST_F(TensorMath, PhiloxRandomCpp) {
+  // known answers of Philox4x32-10 (Random123)
+  auto r = singa::philox::Generate(0, 0, 0);
+  EXPECT_EQ(0x6627e8d5u, r[0]);
+  EXPECT_EQ(0xe169c58du, r[1]);
+  EXPECT_EQ(0xbc57ac4cu, r[2]);
+  EXPECT_EQ(0x9b00dbd8u, r[3]);
+  r = singa::philox::Generate(~0ull, ~0ull, ~0ull);
+  EXPECT_EQ(0x408f276du, r[0]);
+  EXPECT_EQ(0x41c83b0eu, r[1]);
+  EXPECT_EQ(0xa20bc7c6u, r[2]);
+  EXPECT_EQ(0x6d5451fdu, r[3]);
+
+  // the same seed gives the same values for any number of threads
+  const size_t n = 100003;
+  std::vector<std::vector<float>> out;
+  for (int threads : {1, 3, 4}) {
+    auto dev = std::make_shared<singa::CppCPU>();
+    dev->SetNumThreads(threads);
+    dev->SetRandSeed(7);
+    Tensor g(Shape{n}, dev), u(Shape{n}, dev), m(Shape{n}, dev);
+    Gaussian(1.f, 2.f, &g);
+    Uniform(-1.f, 3.f, &u);
+    Bernoulli(0.3f, &m);
+    std::vector<float> v(g.data<float>(), g.data<float>() + n);
+    v.insert(v.end(), u.data<float>(), u.data<float>() + n);
+    v.insert(v.end(), m.data<float>(), m.data<float>() + n);
+    out.push_back(v);
+  }
+  EXPECT_EQ(out[0], out[1]);
+  EXPECT_EQ(out[0], out[2]);
+
+  double mean = 0, var = 0, umean = 0, p = 0;
+  for (size_t i = 0; i < n; i++) {
+    mean += out[0][i] / n;
+    var += (out[0][i] - 1.) * (out[0][i] - 1.) / n;
+    umean += out[0][n + i] / n;
+    EXPECT_TRUE(out[0][n + i] >= -1.f && out[0][n + i] < 3.f);
+    p += out[0][2 * n + i] / n;
+  }
+  EXPECT_NEAR(1., mean, 0.03);
+  EXPECT_NEAR(4., var, 0.1);
+  EXPECT_NEAR(1., umean, 0.03);
+  EXPECT_NEAR(0.3, p, 0.01);
+  // every call draws a new stream
+  Tensor x(Shape{8}), y(Shape{8});
+  Uniform(0.f, 1.f, &x);
+  Uniform(0.f, 1.f, &y);
+  EXPECT_NE(x.data<float>()[0], y.data<float>()[0]);
+}
+
+TEST_F(TensorMath, ReducedPrecisionCpp) {
+  const size_t m = 9, k = 33, n = 17;
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(2);
+  std::vector<float> x(m * k), w(k * n), b(n);
+  for (size_t i = 0; i < x.size(); i++) x[i] = 0.1f * ((i * 7) % 23) - 1.1f;
+  for (size_t i = 0; i < w.size(); i++) w[i] = 0.03f * ((i * 5) % 19) - 0.3f;
+  for (size_t i = 0; i < b.size(); i++) b[i] = 0.7f * i;
+  Tensor X(Shape{m, k}, dev), W(Shape{k, n}, dev), B(Shape{n}, dev);
+  X.CopyDataFromHostPtr(x.data(), x.size());
+  W.CopyDataFromHostPtr(w.data(), w.size());
+  B.CopyDataFromHostPtr(b.data(), b.size());
+
+  for (auto type : {singa::kFloat16, singa::kBFloat16}) {
+    // the relative precision of the type
+    const float eps = type == singa::kFloat16 ? 1.f / 1024 : 1.f / 128;
+    Tensor x16 = X.AsType(type), w16 = W.AsType(type), b16 = B.AsType(type);
+    EXPECT_EQ(2 * m * k, x16.block()->size());
+    // the results on the 16-bit tensors are those of float32 on the same
+    // (rounded) values, rounded once
+    Tensor xr = x16.AsType(singa::kFloat32), wr = w16.AsType(singa::kFloat32),
+           br = b16.AsType(singa::kFloat32);
+    for (size_t i = 0; i < x.size(); i++)
+      EXPECT_NEAR(x[i], xr.data<float>()[i], eps * std::fabs(x[i]));
+    auto check = [&](const Tensor &expected, const Tensor &t16) {
+      EXPECT_EQ(type, t16.data_type());
+      ASSERT_EQ(expected.shape(), t16.shape());
+      Tensor t = t16.AsType(singa::kFloat32);
+      const float *e = expected.data<float>(), *p = t.data<float>();
+      for (size_t i = 0; i < expected.Size(); i++)
+        EXPECT_NEAR(e[i], p[i], eps * (1e-3f + std::fabs(e[i])));
+    };
+    check(Exp(xr), Exp(x16));
+    check(Tanh(singa::Transpose(xr)), Tanh(singa::Transpose(x16)));
+    check(xr * 3.f, x16 * 3.f);
+    Tensor y16 = Mult(x16, w16);
+    check(Mult(xr, wr), y16);
+    check(y16.AsType(singa::kFloat32) + br, y16 + b16);
+    check(SoftMax(xr), SoftMax(x16));
+    check(ReduceSum(xr, {0}), ReduceSum(x16, {0}));
+    check(SumAll(xr), SumAll(x16));
+    Tensor i32 = ArgMax(xr, 1), i16 = ArgMax(x16, 1);
+    EXPECT_EQ(singa::kInt, i16.data_type());
+    for (size_t i = 0; i < m; i++)
+      EXPECT_EQ(i32.data<int>()[i], i16.data<int>()[i]);
+
+    // several tiles and chunks, with transposed and broadcasted operands
+    Tensor big(Shape{70, 300}, dev), row(Shape{70}, dev);
+    Uniform(-2.f, 2.f, &big);
+    Uniform(-2.f, 2.f, &row);
+    Tensor big16 = big.AsType(type), row16 = row.AsType(type);
+    Tensor bigr = big16.AsType(singa::kFloat32);
+    Tensor rowr = row16.AsType(singa::kFloat32);
+    check(singa::Transpose(bigr) - rowr, singa::Transpose(big16) - row16);
+    check(Sigmoid(singa::Transpose(bigr)), Sigmoid(singa::Transpose(big16)));
+
+    Tensor g(Shape{4096}, dev, type);
+    Gaussian(1.f, 2.f, &g);
+    Tensor mean = SumAll(g) / 4096.f;
+    EXPECT_NEAR(1.f, mean.AsType(singa::kFloat32).data<float>()[0], 0.2f);
+  }
+}
+
+TEST_F(TensorMath, StridedEltwiseCpp) {
+  const size_t n = 300, m = 70;  // a few chunks of kEltwiseGrain
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  std::vector<float> x(n * m), r(m), c(n);
+  for (size_t i = 0; i < x.size(); i++) x[i] = i % 101;
+  for (size_t j = 0; j < m; j++) r[j] = 0.5f * j;
+  for (size_t i = 0; i < n; i++) c[i] = -1.f * i;
+  Tensor tx(Shape{n, m}, dev), tr(Shape{m}, dev), tc(Shape{n, 1}, dev);
+  tx.CopyDataFromHostPtr(x.data(), x.size());
+  tr.CopyDataFromHostPtr(r.data(), m);
+  tc.CopyDataFromHostPtr(c.data(), n);
+
+  Tensor row = tx + tr, col = tx * tc, sq = Square(Broadcast(tc, {n, m}));
+  Tensor xt = Transpose(tx);  // m x n
+  Tensor t = xt - Transpose(row);
+  const float *rptr = row.data<float>(), *cptr = col.data<float>();
+  const float *sptr = sq.data<float>(), *tptr = t.data<float>();
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < m; j++) {
+      EXPECT_EQ(x[i * m + j] + r[j], rptr[i * m + j]);
+      EXPECT_EQ(x[i * m + j] * c[i], cptr[i * m + j]);
+      EXPECT_EQ(c[i] * c[i], sptr[i * m + j]);
+      EXPECT_EQ(-r[j], tptr[j * n + i]);
+    }
+}
+
+TEST_F(TensorMath, ReduceCpp) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  const size_t d0 = 4, d1 = 5, d2 = 6;
+  std::vector<float> x(d0 * d1 * d2);
+  for (size_t i = 0; i < x.size(); i++) x[i] = float((i * 37) % 23) - 11.f;
+  Tensor t(Shape{d0, d1, d2}, dev);
+  t.CopyDataFromHostPtr(x.data(), x.size());
+  auto at = [&](size_t i, size_t j, size_t k) {
+    return x[(i * d1 + j) * d2 + k];
+  };
+
+  Tensor s1 = singa::ReduceSum(t, {1});
+  EXPECT_TRUE((Shape{d0, d2} == s1.shape()));
+  Tensor s02 = singa::ReduceSum(t, {0, -1}, true);
+  EXPECT_TRUE((Shape{1, d1, 1} == s02.shape()));
+  Tensor mx = singa::ReduceMax(t, {2}), am = singa::ArgMax(t, 2);
+  Tensor mn = singa::ReduceMin(t, {0}), an = singa::ArgMin(t, 0);
+  EXPECT_EQ(singa::kInt, am.data_type());
+  // transposed input: (d2, d1, d0)
+  Tensor tt = singa::ReduceMean(singa::Transpose(t), {1});
+  const float *s1p = s1.data<float>(), *s02p = s02.data<float>();
+  const float *mxp = mx.data<float>(), *mnp = mn.data<float>();
+  const int *amp = am.data<int>(), *anp = an.data<int>();
+  const float *ttp = tt.data<float>();
+  for (size_t j = 0; j < d1; j++) {
+    float sum = 0;
+    for (size_t i = 0; i < d0; i++)
+      for (size_t k = 0; k < d2; k++) sum += at(i, j, k);
+    EXPECT_FLOAT_EQ(sum, s02p[j]);
+  }
+  for (size_t i = 0; i < d0; i++)
+    for (size_t k = 0; k < d2; k++) {
+      float sum = 0;
+      for (size_t j = 0; j < d1; j++) sum += at(i, j, k);
+      EXPECT_FLOAT_EQ(sum, s1p[i * d2 + k]);
+      EXPECT_FLOAT_EQ(sum / d1, ttp[k * d0 + i]);
+    }
+  for (size_t i = 0; i < d0; i++)
+    for (size_t j = 0; j < d1; j++) {
+      size_t best = 0;
+      for (size_t k = 1; k < d2; k++)
+        if (at(i, j, k) > at(i, j, best)) best = k;
+      EXPECT_EQ(at(i, j, best), mxp[i * d1 + j]);
+      EXPECT_EQ(int(best), amp[i * d1 + j]);
+    }
+  for (size_t j = 0; j < d1; j++)
+    for (size_t k = 0; k < d2; k++) {
+      size_t best = 0;
+      for (size_t i = 1; i < d0; i++)
+        if (at(i, j, k) < at(best, j, k)) best = i;
+      EXPECT_EQ(at(best, j, k), mnp[j * d2 + k]);
+      EXPECT_EQ(int(best), anp[j * d2 + k]);
+    }
+}
+
+TEST_F(TensorMath, ReduceEmptyCpp) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  Tensor t(Shape{0, 3}, dev);
+  // the sums over an empty axis are 0
+  Tensor s0 = singa::ReduceSum(t, {0});
+  EXPECT_TRUE((Shape{3} == s0.shape()));
+  for (size_t i = 0; i < 3; i++) EXPECT_EQ(0.f, s0.data<float>()[i]);
+  EXPECT_EQ(0.f, singa::ReduceSum(t).data<float>()[0]);
+  // no outputs
+  EXPECT_TRUE((Shape{0} == singa::ReduceSum(t, {1}).shape()));
+  EXPECT_TRUE((Shape{0} == singa::ArgMax(t, 1).shape()));
+
+  ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+  EXPECT_DEATH(singa::ReduceMax(t, {0}), "empty axis");
+}
+
+TEST_F(TensorMath, ReduceSumAccuracyCpp) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  const size_t n = 1 << 22;
+  Tensor t(Shape{n / 2, 2}, dev);
+  t.SetValue(0.1f);
+  // one output reduced by all threads, and outputs along the rows
+  float all = singa::ReduceSum(t).data<float>()[0];
+  EXPECT_NEAR(n * 0.1, all, 1e-6 * n * 0.1);
+  const float *rows = singa::Sum(t, 0).data<float>();
+  EXPECT_NEAR(n * 0.05, rows[0], 1e-6 * n * 0.05);
+  EXPECT_NEAR(n * 0.05, rows[1], 1e-6 * n * 0.05);
+  EXPECT_NEAR(n * 0.1, singa::Sum<float>(t), 1e-6 * n * 0.1);
+}
+
 TEST_F(TensorMath, BroadcastCpp) {
   Tensor x(Shape{1});
   x.SetValue(1.0f);
@@ -661,6 +1087,46 @@ TEST_F(TensorMath, MultCpp) {
   }
 }
 
+TEST_F(TensorMath, MultPackedCpp) {
+  // N is not a multiple of the panel width and M not of the row block
+  const size_t m = 13, k = 70, n = 37;
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  std::vector<float> x(m * k), w(k * n);
+  for (size_t i = 0; i < x.size(); i++) x[i] = (i % 11) * 0.1f - 0.5f;
+  for (size_t i = 0; i < w.size(); i++) w[i] = (i % 7) * 0.2f - 0.6f;
+  Tensor A(Shape{m, k}, dev), B(Shape{k, n}, dev), Bt(Shape{n, k}, dev);
+  A.CopyDataFromHostPtr(x.data(), x.size());
+  B.CopyDataFromHostPtr(w.data(), w.size());
+  Bt.CopyDataFromHostPtr(w.data(), w.size());
+  B.SetConstant();
+  Bt.SetConstant();
+  EXPECT_TRUE(B.constant());
+
+  auto check = [&](const Tensor &C, bool trans, float scale) {
+    const float *cptr = C.data<float>();
+    for (size_t i = 0; i < m; i++)
+      for (size_t j = 0; j < n; j++) {
+        float expected = 0;
+        for (size_t l = 0; l < k; l++)
+          expected += x[i * k + l] * (trans ? w[j * k + l] : w[l * n + j]);
+        EXPECT_NEAR(scale * expected, cptr[i * n + j], 1e-4);
+      }
+  };
+  // the second call uses the cached panels
+  for (int i = 0; i < 2; i++) {
+    check(Mult(A, B), false, 1.f);
+    check(Mult(A, singa::Transpose(Bt)), true, 1.f);
+  }
+  EXPECT_NE(nullptr, B.block()->cache());
+  // writing B drops its packed copy
+  B *= 2.f;
+  EXPECT_EQ(nullptr, B.block()->cache());
+  check(Mult(A, B), false, 2.f);
+  B.SetConstant(false);
+  EXPECT_EQ(nullptr, B.block()->cache());
+}
+
 TEST_F(TensorMath, AddColumnCpp) {
   const float x[3] = {1.0f, 2.0f, 3.0f};
   Tensor t(Shape{3});
@@ -851,6 +1317,35 @@ TEST_F(TensorMath, CopyColumnsCpp) {
 }
 #endif
 
+TEST(TensorMath2D, ConcatSliceColumns) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(4);
+  const size_t nrow = 4096;
+  std::vector<float> x(nrow * 5), y(nrow * 3);
+  for (size_t i = 0; i < x.size(); i++) x[i] = i;
+  for (size_t i = 0; i < y.size(); i++) y[i] = -1.f * i;
+  Tensor a(Shape{nrow, 5}, dev), b(Shape{nrow, 3}, dev), c, s;
+  a.CopyDataFromHostPtr(x.data(), x.size());
+  b.CopyDataFromHostPtr(y.data(), y.size());
+
+  dev->EnableGraph(true);
+  c = singa::ConcatOn(std::vector<Tensor>{a, b}, 1);
+  s = singa::SliceOn(c, 4, 6, 1);
+  dev->EnableGraph(false);
+  // one copy for each input and one for the slice
+  EXPECT_EQ(3u, dev->graph()->nodes().size());
+  dev->RunGraph();
+
+  EXPECT_TRUE((Shape{nrow, 8} == c.shape()));
+  const float *cptr = c.data<float>(), *sptr = s.data<float>();
+  for (size_t i = 0; i < nrow; i++) {
+    for (size_t j = 0; j < 5; j++) EXPECT_EQ(x[i * 5 + j], cptr[i * 8 + j]);
+    for (size_t j = 0; j < 3; j++) EXPECT_EQ(y[i * 3 + j], cptr[i * 8 + 5 + j]);
+    EXPECT_EQ(x[i * 5 + 4], sptr[i * 2]);
+    EXPECT_EQ(y[i * 3], sptr[i * 2 + 1]);
+  }
+}
+
 //////////////////////////////////////////////////////////
 #ifdef USE_CUDA
 TEST_F(TensorMath, L2Cuda) {
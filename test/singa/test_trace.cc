@@ -0,0 +1,112 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "singa/core/device.h"
+#include "singa/core/scheduler.h"
+#include "singa/core/tensor.h"
+#include "singa/utils/trace.h"
+
+using singa::Context;
+using singa::Graph;
+using singa::Shape;
+using singa::Tensor;
+using singa::TraceEvent;
+using singa::TraceRecorder;
+
+TEST(TraceRecorder, Eager) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  Tensor x(Shape{4}, dev), y(Shape{4}, dev);
+  x.SetValue(1.f);
+
+  auto trace = TraceRecorder::Global();
+  trace->Start();
+  singa::Add(x, 1.f, &y);
+  trace->Stop();
+  singa::Add(y, 1.f, &y);
+
+  auto events = trace->events();
+  ASSERT_EQ(1u, events.size());
+  const TraceEvent &e = events[0];
+  EXPECT_EQ("Add", e.name);
+  EXPECT_STREQ("eager", e.category);
+  EXPECT_EQ(-1, e.iteration);
+  EXPECT_EQ(16u, e.read_bytes);
+  EXPECT_EQ(16u, e.write_bytes);
+  EXPECT_LE(0, e.start);
+  EXPECT_LE(e.start, e.end);
+  EXPECT_LT(0, e.tid);
+}
+
+TEST(TraceRecorder, Graph) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  dev->SetNumThreads(2);
+  Graph graph(dev.get());
+  Tensor x(Shape{4}, dev), y(Shape{4}, dev), z(Shape{4}, dev);
+  x.SetValue(1.f);
+  graph.AddOperation(
+      [x, y](Context *ctx) mutable { singa::Add(x, 1.f, &y); }, {x.block()},
+      {y.block()}, "first");
+  graph.AddOperation(
+      [x, z](Context *ctx) mutable { singa::Add(x, 2.f, &z); }, {x.block()},
+      {z.block()}, "second");
+
+  auto trace = TraceRecorder::Global();
+  trace->Start();
+  graph.RunGraph();
+  graph.RunInSerial();
+  trace->Stop();
+
+  // the graph nodes and the eager ops they call
+  size_t nodes = 0;
+  for (auto &e : trace->events()) {
+    if (std::string(e.category) != "graph") continue;
+    EXPECT_EQ(nodes < 2 ? 0 : 1, e.iteration);
+    EXPECT_EQ(e.name == "first" ? 0 : 1, e.node);
+    EXPECT_EQ(16u, e.read_bytes);
+    nodes++;
+  }
+  EXPECT_EQ(4u, nodes);
+  EXPECT_EQ(8u, trace->num_events());
+}
+
+TEST(TraceRecorder, Dump) {
+  auto dev = std::make_shared<singa::CppCPU>();
+  Tensor x(Shape{4}, dev);
+
+  auto trace = TraceRecorder::Global();
+  trace->Start(2);
+  for (int i = 0; i < 3; i++)
+    dev->Exec([](Context *ctx) {}, {}, {x.block()}, "say \"hi\"\n");
+  trace->Stop();
+  EXPECT_EQ(2u, trace->num_events());
+  EXPECT_EQ(1u, trace->num_dropped());
+
+  std::ostringstream os;
+  trace->Dump(os);
+  std::string json = os.str();
+  EXPECT_EQ(0u, json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+  EXPECT_NE(std::string::npos,
+            json.find("\"name\":\"say \\\"hi\\\"\\u000a\""));
+  EXPECT_NE(std::string::npos, json.find("\"ph\":\"X\""));
+  EXPECT_NE(std::string::npos, json.find("\"write_bytes\":16"));
+  EXPECT_EQ(json.rfind("\n]}\n"), json.size() - 4);
+}